@@ -38,17 +38,21 @@
 #include "smsvdp.h"
 #include "smsz80.h"
 #include "rom.h"
+#include "gamedb.h"
+#include "bootcache.h"
+#include "sramfile.h"
+#include "statesave.h"
 #include "colecovision.h"
 #include "colecomem.h"
 #include "cheats.h"
 #include "console.h"
 
 #if MAC_OS_X_VERSION_MIN_REQUIRED < __MAC_10_13
-#include "fmemopen/fmemopen.h"
 #include "fmemopen/open_memstream.h"
 #endif
 
-#define SAMPLERATE 44100
+// The cores all synthesize at SOUND_CORE_RATE; this is what the host gets.
+#define SAMPLERATE 48000
 
 @interface SMSGameCore () <OESMSSystemResponderClient, OEGGSystemResponderClient, OESG1000SystemResponderClient, OEColecoVisionSystemResponderClient>
 {
@@ -56,6 +60,7 @@
     BOOL           paused;
     NSURL         *romFile;
     NSMutableDictionary *cheatList;
+    int            videoSystem;
 }
 @end
 
@@ -72,7 +77,16 @@ console_t *cur_console;
     {
         bufLock = [[NSLock alloc] init];
         cheatList = [[NSMutableDictionary alloc] init];
+        videoSystem = VIDEO_NTSC;
+
+        // Built from gamedb.txt by tools/gamedbc.c as part of the build.
+        NSString *dbPath = [[NSBundle bundleForClass:[self class]] pathForResource:@"gamedb" ofType:@"bin"];
+        if(dbPath == nil || gamedb_open(dbPath.fileSystemRepresentation))
+            NSLog(@"CrabEmu: No game database, using the built-in list");
         ringBuffer = [self ringBufferAtIndex:0];
+
+        // Battery saves live in their files, and get flushed every second.
+        sramfile_set_interval(1000);
     }
     return self;
 }
@@ -81,7 +95,10 @@ console_t *cur_console;
 {
     DLog(@"releasing/deallocating CrabEmu memory");
 
+    statesave_shutdown();
     cur_console->shutdown();
+    sramfile_set_interval(0);
+    gamedb_close();
 }
 
 # pragma mark - Execution
@@ -98,14 +115,33 @@ console_t *cur_console;
         coleco_init(VIDEO_NTSC);
         coleco_mem_load_bios(biosPath.fileSystemRepresentation);
         coleco_mem_load_rom(path.fileSystemRepresentation);
+
+        // The BIOS title screen takes 12 seconds every time, so keep a
+        // snapshot of the machine as it hands over to the cart.
+        NSString *cachePath = [[self supportDirectoryPath] stringByAppendingPathComponent:@"Boot Cache"];
+        if([[NSFileManager defaultManager] createDirectoryAtPath:cachePath withIntermediateDirectories:YES attributes:nil error:nil])
+            bootcache_set_dir(cachePath.fileSystemRepresentation);
     }
     else
     {
-        NSData *dataObj = [NSData dataWithContentsOfFile:[path stringByStandardizingPath]];
-        const void *data = [dataObj bytes];
+        rom_image_t img;
+        gamedb_entry_t ent;
+        const uint8 *data;
         uint16_t offset = 0;
         int region = SMS_REGION_DOMESTIC;
 
+        // Same trimming and padding as the core does, so the checksum and
+        // header offsets line up with what it'll see.
+        memset(&img, 0, sizeof(img));
+        if(rom_image_load(path.fileSystemRepresentation, NULL, ROM_IMAGE_TRIM | ROM_IMAGE_32K, &img) != ROM_LOAD_SUCCESS)
+        {
+            if(error)
+                *error = [NSError errorWithDomain:OEGameCoreErrorDomain code:OEGameCoreCouldNotLoadROMError userInfo:nil];
+            return NO;
+        }
+
+        data = img.data;
+
         // Detect SMS ROM header
         if(memcmp(&data[0x1ff0], "TMR SEGA", 8) == 0)
             offset = 0x1ff0;
@@ -117,7 +153,7 @@ console_t *cur_console;
         if(offset)
         {
             // Set machine region
-            switch (((char *)data)[offset + 0x0f] >> 4)
+            switch (data[offset + 0x0f] >> 4)
             {
                 case 3: // SMS Japan
                     region = SMS_REGION_DOMESTIC;
@@ -138,7 +174,28 @@ console_t *cur_console;
             // No header means Japan region
             region = SMS_REGION_DOMESTIC;
 
-        sms_init(SMS_VIDEO_NTSC, region, 0); // 1 = VDP borders
+        // The game database knows better than the header, and is the only
+        // thing that knows which video system a game is for.
+        videoSystem = SMS_VIDEO_NTSC;
+        if(gamedb_find_rom(img.data, img.size, &ent) == 0)
+        {
+            if(ent.region != REGION_NONE)
+                region = (ent.region & REGION_JAPAN) ? SMS_REGION_DOMESTIC : SMS_REGION_EXPORT;
+            else if(ent.flags & GAMEDB_FM)
+                // Games only look for the FM unit on a Japanese console.
+                region = SMS_REGION_DOMESTIC;
+
+            if(ent.video == VIDEO_PAL)
+                videoSystem = SMS_VIDEO_PAL;
+        }
+
+        rom_image_free(&img);
+
+        sms_init(videoSystem, region, 0); // 1 = VDP borders
+        sms_vdp_set_threaded(1);
+        sms_vdp_set_deferred(1);
+        sms_vdp_set_static_detect(1);
+        sms_fm_set_threaded(1);
         sms_mem_load_rom(path.fileSystemRepresentation, console);
         cur_console->frame(0);
     }
@@ -150,7 +207,9 @@ console_t *cur_console;
         [[NSFileManager defaultManager] createDirectoryAtURL:batterySavesDirectory withIntermediateDirectories:YES attributes:nil error:nil];
         NSURL *saveFile = [batterySavesDirectory URLByAppendingPathComponent:[extensionlessFilename stringByAppendingPathExtension:@"sav"]];
 
-        if([saveFile checkResourceIsReachableAndReturnError:nil] && sms_read_cartram_from_file(saveFile.path.fileSystemRepresentation) == 0)
+        // The core maps the save over the cart's memory, making the file for
+        // carts with a battery if it isn't there yet.
+        if(sms_read_cartram_from_file(saveFile.path.fileSystemRepresentation) == 0)
             NSLog(@"CrabEmu: Loaded sram");
     }
 
@@ -178,6 +237,22 @@ console_t *cur_console;
         NSURL *saveFile = [batterySavesDirectory URLByAppendingPathComponent:[extensionlessFilename stringByAppendingPathExtension:@"sav"]];
 
         cur_console->save_sram(saveFile.path.fileSystemRepresentation);
+
+        uint32 frames, fast;
+        sms_vdp_deferred_stats(&frames, &fast);
+
+        if(frames)
+            NSLog(@"CrabEmu: %u of %u frames (%u%%) drawn in tile order",
+                  (unsigned)fast, (unsigned)frames,
+                  (unsigned)((uint64_t)fast * 100 / frames));
+
+        uint32 lines, skipped;
+        sms_vdp_static_stats(&lines, &skipped);
+
+        if(lines)
+            NSLog(@"CrabEmu: %u of %u lines (%u%%) skipped as static",
+                  (unsigned)skipped, (unsigned)lines,
+                  (unsigned)((uint64_t)skipped * 100 / lines));
     }
 
     [super stopEmulation];
@@ -185,7 +260,7 @@ console_t *cur_console;
 
 - (NSTimeInterval)frameInterval
 {
-    return 60;
+    return videoSystem == VIDEO_PAL ? 50 : 60;
 }
 
 # pragma mark - Video
@@ -241,9 +316,23 @@ console_t *cur_console;
 
 # pragma mark - Save States
 
+static void stateSaved(int rv, void *data)
+{
+    void (^block)(BOOL, NSError *) = (__bridge_transfer void (^)(BOOL, NSError *))data;
+    block(rv == 0, nil);
+}
+
 - (void)saveStateToFileAtPath:(NSString *)fileName completionHandler:(void (^)(BOOL, NSError *))block
 {
-    block(cur_console->save_state([fileName fileSystemRepresentation]) == 0, nil);
+    // Only taking the snapshot happens here; compressing and writing it out
+    // happen on the save state thread, which calls the block when it's done.
+    int (*writeState)(FILE *) = cur_console->console_type == CONSOLE_COLECOVISION ? &coleco_write_state : &sms_write_state;
+    void *data = (__bridge_retained void *)[block copy];
+
+    if(statesave_async([fileName fileSystemRepresentation], writeState, &stateSaved, data)) {
+        block = (__bridge_transfer void (^)(BOOL, NSError *))data;
+        block(NO, nil);
+    }
 }
 
 - (void)loadStateFromFileAtPath:(NSString *)fileName completionHandler:(void (^)(BOOL, NSError *))block
@@ -288,18 +377,15 @@ console_t *cur_console;
 
 - (BOOL)deserializeState:(NSData *)state withError:(NSError **)outError
 {
-    const void *bytes = [state bytes];
+    const uint8 *bytes = (const uint8 *)[state bytes];
     size_t length = [state length];
 
-    FILE *fp = fmemopen((void *)bytes, length, "rb");
-
+    // The blocks are read straight out of the data, without copying it.
     int status;
     if(cur_console->console_type == CONSOLE_COLECOVISION)
-        status = coleco_read_state(fp);
+        status = coleco_read_state_mem(bytes, length);
     else
-        status = sms_read_state(fp);
-
-    fclose(fp);
+        status = sms_read_state_mem(bytes, length);
 
     if(status == 0)
         return YES;
@@ -318,25 +404,36 @@ console_t *cur_console;
  CrabEmu callbacks
  */
 
-void sound_update_buffer(signed short *buf, int length)
+// OpenEmu has its own ring buffer, so a reservation is just a scratch buffer
+// that gets copied into it. The shared code in sound/output.c has already
+// taken the samples to SAMPLERATE by the time they get here.
+static int16 reserveBuf[SOUND_RESERVE_MAX >> 1];
+
+int16 *sound_dev_reserve(int length)
+{
+    return reserveBuf;
+}
+
+void sound_dev_commit(int length)
 {
     //NSLog(@"%s %p", __FUNCTION__, ringBuffer);
-    [ringBuffer write:buf maxLength:length];
+    if(length > 0)
+        [ringBuffer write:reserveBuf maxLength:length];
 }
 
 int sound_init(int channels, int region)
 {
-    return 0;
+    return sound_output_init(channels, SAMPLERATE);
 }
 
 void sound_shutdown(void)
 {
-
+    sound_output_shutdown();
 }
 
 void sound_reset_buffer(void)
 {
-
+    sound_output_reset();
 }
 
 void gui_set_viewport(int w, int h)
@@ -0,0 +1,103 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _arch_dreamcast
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "bootcache.h"
+
+static char cache_dir[BOOTCACHE_PATH_LEN - 64];
+
+int bootcache_set_dir(const char *dir) {
+    size_t len;
+
+    if(!dir) {
+        cache_dir[0] = 0;
+        return 0;
+    }
+
+    /* Leave room for the file name. */
+    if((len = strlen(dir)) >= sizeof(cache_dir))
+        return -1;
+
+    memcpy(cache_dir, dir, len + 1);
+    return 0;
+}
+
+int bootcache_start(bootcache_t *bc, const char *console, uint32 bios_crc,
+                    uint32 cart_crc, uint32 sram_crc, int region,
+                    int (*load)(const char *fn)) {
+    FILE *fp;
+
+    bc->pending = 0;
+    bc->watching = 0;
+    bc->dirty = 0;
+
+    if(!cache_dir[0])
+        return BOOTCACHE_OFF;
+
+    snprintf(bc->path, BOOTCACHE_PATH_LEN,
+             "%s/%s-%08" PRIX32 "-%08" PRIX32 "-%08" PRIX32 "-%02X.boot",
+             cache_dir, console, (uint32_t)bios_crc, (uint32_t)cart_crc,
+             (uint32_t)sram_crc, region & 0xFF);
+
+    /* Only try to load it if it's actually there, since a failed load can
+       leave things half done. */
+    if((fp = fopen(bc->path, "rb"))) {
+        fclose(fp);
+
+        if(!load(bc->path))
+            return BOOTCACHE_RESTORED;
+
+#ifdef DEBUG
+        fprintf(stderr, "bootcache_start: Discarding stale snapshot %s\n",
+                bc->path);
+#endif
+        remove(bc->path);
+        bc->watching = 1;
+        return BOOTCACHE_FAILED;
+    }
+
+    bc->watching = 1;
+    return BOOTCACHE_BOOT;
+}
+
+void bootcache_finish(bootcache_t *bc, int (*save)(const char *fn)) {
+    char tmp[BOOTCACHE_PATH_LEN + 4];
+
+    bc->watching = 0;
+
+    if(bc->dirty)
+        return;
+
+    /* Write it somewhere else first, so nothing ever sees half a snapshot. */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", bc->path);
+
+    if(save(tmp) || rename(tmp, bc->path)) {
+#ifdef DEBUG
+        fprintf(stderr, "bootcache_finish: Couldn't save %s\n", bc->path);
+#endif
+        remove(tmp);
+    }
+}
+
+#endif /* !_arch_dreamcast */
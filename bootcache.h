@@ -0,0 +1,70 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef BOOTCACHE_H
+#define BOOTCACHE_H
+
+#include "CrabEmu.h"
+
+CLINKAGE
+
+/* Boot snapshot cache. Running a BIOS always does the same thing for a given
+   BIOS, cartridge and region, as long as nobody touches the controls, so the
+   first time through a save state is taken once the cartridge has control.
+   Later boots just load that state. The snapshots are ordinary save states,
+   named after the console, the region and the checksums of the BIOS, the
+   cartridge and its save memory (which the save state has a copy of).
+
+   A console using this keeps a bootcache_t around. After a reset it calls
+   bootcache_start() (before running anything), then, if that left watching
+   set, bootcache_finish() at the end of the first frame where the cartridge
+   has taken over. Setting dirty at any point in between keeps the snapshot
+   from being saved, and loading some other state should clear watching. */
+
+#define BOOTCACHE_PATH_LEN  1024
+
+/* bootcache_start() return values. */
+#define BOOTCACHE_OFF       0   /* No cache directory, or nothing to cache */
+#define BOOTCACHE_BOOT      1   /* Not cached yet; boot normally */
+#define BOOTCACHE_RESTORED  2   /* The snapshot was loaded */
+#define BOOTCACHE_FAILED    3   /* Loading it failed part way; reset first */
+
+typedef struct bootcache {
+    int pending;                        /* Reset, but not started yet */
+    int watching;                       /* Booting from scratch */
+    int dirty;                          /* Input during the boot */
+    char path[BOOTCACHE_PATH_LEN];
+} bootcache_t;
+
+#ifndef _arch_dreamcast
+
+/* Turn the cache on by giving a directory for it, which has to exist already.
+   NULL (the default) turns it back off. */
+extern int bootcache_set_dir(const char *dir);
+
+extern int bootcache_start(bootcache_t *bc, const char *console,
+                           uint32 bios_crc, uint32 cart_crc, uint32 sram_crc,
+                           int region, int (*load)(const char *fn));
+extern void bootcache_finish(bootcache_t *bc, int (*save)(const char *fn));
+
+#endif /* !_arch_dreamcast */
+
+ENDCLINK
+
+#endif /* !BOOTCACHE_H */
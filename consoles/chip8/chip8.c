@@ -27,33 +27,17 @@
 #include <inttypes.h>
 #endif
 
-#ifdef _arch_dreamcast
-#include <zlib/zlib.h>
-#include <bzlib/bzlib.h>
-#else
-#ifndef NO_ZLIB
-#include <zlib.h>
-#endif
-
-#ifndef NO_BZ2
-#include <bzlib.h>
-#endif
-#endif
-
 #include "rom.h"
 #include "chip8.h"
 #include "chip8cpu.h"
 #include "sound.h"
 
-#ifndef NO_ZLIB
-#include "unzip.h"
-#endif
-
 /* Forward declaration... */
 chip8_t chip8_cons;
 
 static uint8 *cart_rom;
 static uint32 cart_len;
+static rom_image_t cart_image;
 static uint8 memory[4096];
 static uint32 rom_crc, rom_adler;
 static pixel_t fb[64 * 32];
@@ -156,8 +140,7 @@ static void finalize_load(const char *fn) {
     char *name;
 
     /* Calculate the checksums of the game */
-    rom_adler = rom_adler32(cart_rom, cart_len);
-    rom_crc = rom_crc32(cart_rom, cart_len);
+    rom_checksums(cart_rom, cart_len, &rom_crc, &rom_adler);
 
 #ifdef DEBUG
     printf("Checksums: Adler-32: 0x%08" PRIX32 " CRC32: 0x%08" PRIX32 "\n",
@@ -180,266 +163,25 @@ static void finalize_load(const char *fn) {
     }
 }
 
-#ifndef NO_ZLIB
-static int load_gz_rom(const char *fn) {
-    int len;
-    gzFile fp;
-    void *tmp;
-
-    /* Open up the file in question. */
-    if(!(fp = gzopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    /* Read one chunk of the file at a time, until we have no more left. */
-    cart_rom = (uint8 *)malloc(0x100);
-
-    if(!cart_rom) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Couldn't allocate space!\n");
-#endif
-        gzclose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    cart_len = 0;
-    len = gzread(fp, cart_rom, 0x100);
-
-    while(len != 0 && len != -1) {
-        cart_len += len;
-        tmp = realloc(cart_rom, cart_len + 0x100);
-
-        if(!tmp) {
-#ifdef DEBUG
-            fprintf(stderr, "chip8_mem_load_rom: Couldn't allocate space!\n");
-#endif
-            gzclose(fp);
-            free(cart_rom);
-            cart_rom = NULL;
-            return ROM_LOAD_E_ERRNO;
-        }
-
-        cart_rom = (uint8 *)tmp;
-        memset(cart_rom + cart_len, 0xFF, 0x100);
-        len = gzread(fp, cart_rom + cart_len, 0x100);
-    }
-
-    gzclose(fp);
-    finalize_load(fn);
-
-    return ROM_LOAD_SUCCESS;
-}
-#endif
-
-#ifndef NO_BZ2
-static int load_bz2_rom(const char *fn) {
-    int len;
-    BZFILE *fp;
-    void *tmp;
-
-    /* Open up the file in question. */
-    if(!(fp = BZ2_bzopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    /* Read one chunk of the file at a time, until we have no more left. */
-    if(!(cart_rom = (uint8 *)malloc(0x100))) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Couldn't allocate space!\n");
-#endif
-        BZ2_bzclose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    cart_len = 0;
-    len = BZ2_bzread(fp, cart_rom, 0x100);
-
-    while(len != 0 && len != -1) {
-        cart_len += len;
-        tmp = realloc(cart_rom, cart_len + 0x100);
-
-        if(!tmp) {
-#ifdef DEBUG
-            fprintf(stderr, "chip8_mem_load_rom: Couldn't allocate space!\n");
-#endif
-            BZ2_bzclose(fp);
-            free(cart_rom);
-            cart_rom = NULL;
-            return ROM_LOAD_E_ERRNO;
-        }
-
-        cart_rom = (uint8 *)tmp;
-        memset(cart_rom + cart_len, 0xFF, 0x100);
-        len = BZ2_bzread(fp, cart_rom + cart_len, 0x100);
-    }
-
-    BZ2_bzclose(fp);
-    finalize_load(fn);
-
-    return ROM_LOAD_SUCCESS;
-}
-#endif
-
-#ifndef NO_ZLIB
-static int load_zip_rom(const char *fn) {
-    int found = 0;
-    unzFile fp;
-    unz_file_info inf;
-    char fn2[4096];
-    char *ext;
-    int size;
-
-    /* Open up the file in question. */
-    fp = unzOpen(fn);
-
-    if(!fp) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    if(unzGoToFirstFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Couldn't find file in zip!\n");
-#endif
-        unzClose(fp);
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* Keep looking at files until we find a rom. */
-    while(!found) {
-        if(unzGetCurrentFileInfo(fp, &inf, fn2, 4096, NULL, 0, NULL,
-                                 0) != UNZ_OK) {
-#ifdef DEBUG
-            fprintf(stderr, "chip8_mem_load_rom: Error parsing Zip file!\n");
-#endif
-            unzClose(fp);
-            return ROM_LOAD_E_CORRUPT;
-        }
-
-        /* Check if this file looks like a rom. */
-        ext = strrchr(fn2, '.');
-
-        if(ext) {
-            /* XXXX */
-            if(!strcmp(ext, ".ch8") || !strcmp(ext, ".c8")) {
-                found = 1;
-            }
-        }
-
-        /* If we haven't found a rom yet, move to the next file. */
-        if(!found) {
-            if(unzGoToNextFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-                fprintf(stderr, "chip8_mem_load_rom: End of zip file!\n");
-#endif
-                unzClose(fp);
-                return ROM_LOAD_E_NO_ROM;
-            }
-        }
-    }
-
-    /* If the size isn't a nice even amount, round it. */
-    size = inf.uncompressed_size;
-
-    if(!(cart_rom = (uint8 *)malloc(size))) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Could not load ROM: %s!\n", fn);
-        fprintf(stderr, "Reason: %s\n", strerror(errno));
-#endif
-        unzClose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    /* Attempt to open the file we think is a rom. */
-    if(unzOpenCurrentFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Couldn't open rom from zip!\n");
-#endif
-        unzClose(fp);
-        free(cart_rom);
-        cart_rom = NULL;
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* Attempt to read the file. */
-    if(unzReadCurrentFile(fp, cart_rom, size) < 0) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Couldn't read rom from zip!\n");
-#endif
-        unzCloseCurrentFile(fp);
-        unzClose(fp);
-        free(cart_rom);
-        cart_rom = NULL;
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* We're done with the file, close everything. */
-    unzCloseCurrentFile(fp);
-    unzClose(fp);
-
-    cart_len = size;
-    finalize_load(fn);
-
-    return ROM_LOAD_SUCCESS;
-}
-#endif
-
 int chip8_mem_load_rom(const char *fn) {
-    FILE *fp;
-    int size;
-    char *ext;
+    static const char *const exts[] = { ".ch8", ".c8", NULL };
+    int rv;
 
-    /* If its a compressed format, go onto the handler for it... */
-    ext = strrchr(fn, '.');
-
-    if(ext) {
-#ifndef NO_ZLIB
-        if(!strcmp(ext, ".gz")) {
-            return load_gz_rom(fn);
-        }
-        else if(!strcmp(ext, ".zip")) {
-            return load_zip_rom(fn);
-        }
-#endif
-#ifndef NO_BZ2
-        if(!strcmp(ext, ".bz2")) {
-            return load_bz2_rom(fn);
-        }
-#endif
-    }
-
-    if(!(fp = fopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "chip8_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    /* Determine the size of the file */
-    fseek(fp, 0, SEEK_END);
-    size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    if(!(cart_rom = (uint8 *)malloc(size))) {
+    if((rv = rom_image_load(fn, exts, 0, &cart_image)) != ROM_LOAD_SUCCESS) {
 #ifdef DEBUG
         fprintf(stderr, "chip8_mem_load_rom: Could not load ROM: %s!\n", fn);
-        fprintf(stderr, "Reason: %s\n", strerror(errno));
 #endif
-        return ROM_LOAD_E_ERRNO;
+        return rv;
     }
 
-    fread(cart_rom, size, 1, fp);
-    fclose(fp);
+    /* Everything has to fit between 0x200 and the end of memory. */
+    if(cart_image.size > 0x1000 - 0x200) {
+        rom_image_free(&cart_image);
+        return ROM_LOAD_E_BAD_SZ;
+    }
 
-    cart_len = size;
+    cart_rom = cart_image.data;
+    cart_len = cart_image.size;
     finalize_load(fn);
 
     return ROM_LOAD_SUCCESS;
@@ -453,8 +195,7 @@ static int chip8_mem_init(void) {
 }
 
 static int chip8_mem_shutdown(void) {
-    if(cart_rom)
-        free(cart_rom);
+    rom_image_free(&cart_image);
 
     cart_rom = NULL;
     cart_len = 0;
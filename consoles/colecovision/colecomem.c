@@ -28,19 +28,6 @@
 #include <inttypes.h>
 #endif
 
-#ifdef _arch_dreamcast
-#include <zlib/zlib.h>
-#include <bzlib/bzlib.h>
-#else
-#ifndef NO_ZLIB
-#include <zlib.h>
-#endif
-
-#ifndef NO_BZ2
-#include <bzlib.h>
-#endif
-#endif
-
 #include "colecovision.h"
 #include "colecomem.h"
 #include "sn76489.h"
@@ -49,10 +36,6 @@
 #include "sms.h"
 #include "rom.h"
 
-#ifndef NO_ZLIB
-#include "unzip.h"
-#endif
-
 static uint8 ram[1024];
 static uint8 bios_rom[8192];
 static int bios_loaded = 0;
@@ -63,6 +46,7 @@ static uint8 dummy_areaw[256];
 
 static uint8 *cart_rom = NULL;
 static uint32 cart_len = 0;
+static rom_image_t cart_image;
 static uint8 cont_mode = 0;
 static uint32 rom_crc, rom_adler;
 
@@ -202,8 +186,7 @@ static void finalize_load(const char *fn) {
     uint32 i;
 
     /* Calculate the checksums of the game */
-    rom_adler = rom_adler32(cart_rom, cart_len);
-    rom_crc = rom_crc32(cart_rom, cart_len);
+    rom_checksums(cart_rom, cart_len, &rom_crc, &rom_adler);
 
 #ifdef DEBUG
     printf("Checksums: Adler-32: 0x%08" PRIX32 " CRC32: 0x%08" PRIX32 "\n",
@@ -311,286 +294,36 @@ int coleco_mem_load_bios(const char *fn) {
     return 0;
 }
 
-#ifndef NO_ZLIB
-static int load_gz_rom(const char *fn) {
-    int len;
-    gzFile fp;
-    void *tmp;
-
-    /* Open up the file in question. */
-    if(!(fp = gzopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    /* Read one chunk of the file at a time, until we have no more left. */
-    cart_rom = (uint8 *)malloc(0x100);
-
-    if(!cart_rom) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Couldn't allocate space!\n");
-#endif
-        gzclose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
+uint32 coleco_mem_bios_crc(void) {
+    if(!bios_loaded || !cart_rom)
+        return 0;
 
-    cart_len = 0;
-    len = gzread(fp, cart_rom, 0x100);
-
-    while(len != 0 && len != -1) {
-        cart_len += 0x100;
-        tmp = realloc(cart_rom, cart_len + 0x100);
-
-        if(!tmp) {
-#ifdef DEBUG
-            fprintf(stderr, "coleco_mem_load_rom: Couldn't allocate space!\n");
-#endif
-            gzclose(fp);
-            free(cart_rom);
-            cart_rom = NULL;
-            return ROM_LOAD_E_ERRNO;
-        }
-
-        cart_rom = (uint8 *)tmp;
-        memset(cart_rom + cart_len, 0xFF, 0x100);
-        len = gzread(fp, cart_rom + cart_len, 0x100);
-    }
-
-    gzclose(fp);
-    finalize_load(fn);
-
-    return ROM_LOAD_SUCCESS;
+    return rom_crc32(bios_rom, 8192);
 }
-#endif
-
-#ifndef NO_BZ2
-static int load_bz2_rom(const char *fn) {
-    int len;
-    BZFILE *fp;
-    void *tmp;
-
-    /* Open up the file in question. */
-    if(!(fp = BZ2_bzopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    /* Read one chunk of the file at a time, until we have no more left. */    
-    if(!(cart_rom = (uint8 *)malloc(0x100))) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Couldn't allocate space!\n");
-#endif
-        BZ2_bzclose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    cart_len = 0;
-    len = BZ2_bzread(fp, cart_rom, 0x100);
-
-    while(len != 0 && len != -1) {
-        cart_len += 0x100;
-        tmp = realloc(cart_rom, cart_len + 0x100);
-
-        if(!tmp) {
-#ifdef DEBUG
-            fprintf(stderr, "coleco_mem_load_rom: Couldn't allocate space!\n");
-#endif
-            BZ2_bzclose(fp);
-            free(cart_rom);
-            cart_rom = NULL;
-            return ROM_LOAD_E_ERRNO;
-        }
-
-        cart_rom = (uint8 *)tmp;
-        memset(cart_rom + cart_len, 0xFF, 0x100);
-        len = BZ2_bzread(fp, cart_rom + cart_len, 0x100);
-    }
-
-    BZ2_bzclose(fp);
-    finalize_load(fn);
-
-    return ROM_LOAD_SUCCESS;
-}
-#endif
-
-#ifndef NO_ZLIB
-static int load_zip_rom(const char *fn) {
-    int found = 0;
-    unzFile fp;
-    unz_file_info inf;
-    char fn2[4096];
-    char *ext;
-    int size, realsize;
-
-    /* Open up the file in question. */
-    fp = unzOpen(fn);
-
-    if(!fp) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    if(unzGoToFirstFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Couldn't find file in zip!\n");
-#endif
-        unzClose(fp);
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* Keep looking at files until we find a rom. */
-    while(!found) {
-        if(unzGetCurrentFileInfo(fp, &inf, fn2, 4096, NULL, 0, NULL,
-                                 0) != UNZ_OK) {
-#ifdef DEBUG
-            fprintf(stderr, "coleco_mem_load_rom: Error parsing Zip file!\n");
-#endif
-            unzClose(fp);
-            return ROM_LOAD_E_CORRUPT;
-        }
-
-        /* Check if this file looks like a rom. */
-        ext = strrchr(fn2, '.');
-
-        if(ext) {
-            if(!strcmp(ext, ".col") || !strcmp(ext, ".rom")) {
-                found = 1;
-            }
-        }
-
-        /* If we haven't found a rom yet, move to the next file. */
-        if(!found) {
-            if(unzGoToNextFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-                fprintf(stderr, "coleco_mem_load_rom: End of zip file!\n");
-#endif
-                unzClose(fp);
-                return ROM_LOAD_E_NO_ROM;
-            }
-        }
-    }
-
-    /* If the size isn't a nice even amount, round it. */
-    size = realsize = inf.uncompressed_size;
-
-    if(size & 0xFF)
-        realsize = ((size + 0xFF) & 0xFF00);
-
-    if(!(cart_rom = (uint8 *)malloc(realsize))) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Could not load ROM: %s!\n", fn);
-        fprintf(stderr, "Reason: %s\n", strerror(errno));
-#endif
-        unzClose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    memset(cart_rom, 0xFF, realsize);
-
-    /* Attempt to open the file we think is a rom. */
-    if(unzOpenCurrentFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Couldn't open rom from zip!\n");
-#endif
-        unzClose(fp);
-        free(cart_rom);
-        cart_rom = NULL;
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* Attempt to read the file. */
-    if(unzReadCurrentFile(fp, cart_rom, size) < 0) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Couldn't read rom from zip!\n");
-#endif
-        unzCloseCurrentFile(fp);
-        unzClose(fp);
-        free(cart_rom);
-        cart_rom = NULL;
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* We're done with the file, close everything. */
-    unzCloseCurrentFile(fp);
-    unzClose(fp);
-
-    cart_len = realsize;
-    finalize_load(fn);
-
-    return ROM_LOAD_SUCCESS;
-}
-#endif
 
 int coleco_mem_load_rom(const char *fn) {
-    FILE *fp;
-    int size, realsize;
-    char *ext;
-
-    /* If its a compressed format, go onto the handler for it... */
-    ext = strrchr(fn, '.');
-
-    if(ext) {
-#ifndef NO_ZLIB
-        if(!strcmp(ext, ".gz")) {
-            return load_gz_rom(fn);
-        }
-        else if(!strcmp(ext, ".zip")) {
-            return load_zip_rom(fn);
-        }
-#endif
-#ifndef NO_BZ2
-        if(!strcmp(ext, ".bz2")) {
-            return load_bz2_rom(fn);
-        }
-#endif
-    }
+    static const char *const exts[] = { ".col", ".rom", NULL };
+    int rv;
 
-    if(!(fp = fopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "coleco_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    /* Determine the size of the file */
-    fseek(fp, 0, SEEK_END);
-    realsize = size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    /* If the size isn't a nice even amount, round it. */
-    if(size & 0xFF)
-        realsize = ((size + 0xFF) & 0xFF00);
-
-    if(!(cart_rom = (uint8 *)malloc(realsize))) {
+    if((rv = rom_image_load(fn, exts, ROM_IMAGE_PAD, &cart_image)) !=
+       ROM_LOAD_SUCCESS) {
 #ifdef DEBUG
         fprintf(stderr, "coleco_mem_load_rom: Could not load ROM: %s!\n", fn);
-        fprintf(stderr, "Reason: %s\n", strerror(errno));
 #endif
-        return ROM_LOAD_E_ERRNO;
+        return rv;
     }
 
-    memset(cart_rom, 0xFF, realsize);
-    fread(cart_rom, size, 1, fp);
-    fclose(fp);
-
-    cart_len = realsize;
+    cart_rom = cart_image.data;
+    cart_len = cart_image.size;
     finalize_load(fn);
 
     return ROM_LOAD_SUCCESS;
 }
 
-int coleco_mem_read_context(const uint8 *buf) {
-    uint32 len;
+int coleco_mem_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 1040)
         return -1;
 
@@ -603,17 +336,18 @@ int coleco_mem_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the memory */
     memcpy(ram, buf + 16, 1024);
     return 0;
 }
 
-int coleco_regs_read_context(const uint8 *buf) {
-    uint32 len;
+int coleco_regs_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 20)
         return -1;
 
@@ -626,6 +360,9 @@ int coleco_regs_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     cont_mode = buf[16];
 
@@ -691,12 +428,12 @@ int coleco_mem_write_context(FILE *fp) {
     return 0;
 }
 
-int coleco_game_read_context(const uint8 *buf) {
-    uint32 len, crc;
+int coleco_game_read_context(const uint8 *buf, uint32 len,
+                             int load __UNUSED__) {
+    uint32 crc;
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 24)
         return -1;
 
@@ -763,8 +500,7 @@ int coleco_mem_init(void) {
 }
 
 int coleco_mem_shutdown(void) {
-    if(cart_rom)
-        free(cart_rom);
+    rom_image_free(&cart_image);
 
     cart_rom = NULL;
     cart_len = 0;
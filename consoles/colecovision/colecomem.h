@@ -30,14 +30,17 @@ extern void coleco_port_write(uint16 port, uint8 data);
 extern uint8 coleco_port_read(uint16 port);
 
 extern int coleco_mem_load_bios(const char *fn);
+
+/* CRC32 of the BIOS, or 0 if there's no BIOS or no cartridge to boot. */
+extern uint32 coleco_mem_bios_crc(void);
 extern int coleco_mem_load_rom(const char *fn);
 
-extern int coleco_mem_read_context(const uint8 *buf);
-extern int coleco_regs_read_context(const uint8 *buf);
+extern int coleco_mem_read_context(const uint8 *buf, uint32 len, int load);
+extern int coleco_regs_read_context(const uint8 *buf, uint32 len, int load);
 extern int coleco_mem_write_context(FILE *fp);
 
 extern int coleco_game_write_context(FILE *fp);
-extern int coleco_game_read_context(const uint8 *buf);
+extern int coleco_game_read_context(const uint8 *buf, uint32 len, int load);
 
 extern int coleco_mem_init(void);
 extern int coleco_mem_shutdown(void);
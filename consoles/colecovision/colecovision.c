@@ -40,6 +40,9 @@
 #include "sn76489.h"
 #include "smsz80.h"
 #include "sound.h"
+#include "mixer.h"
+#include "bootcache.h"
+#include "statesave.h"
 
 /* Import some stuff from the SMS emulation. Not exactly the cleanest way to do
    this, but it'll work for now. */
@@ -53,15 +56,12 @@ extern int sms_cycles_to_run;
 extern uint16 coleco_cont_bits[2];
 
 static const float NTSC_Z80_CLOCK = 3579545.0f;
-static const int PSG_DIVISOR = 16;
 static const int NTSC_FPS = 60;
 static const int NTSC_LINES_PER_FRAME = 262;
-static const float NTSC_CLOCKS_PER_SAMPLE = 5.073051303855f;
 
 static const float PAL_Z80_CLOCK = 3546893.0f;
 static const int PAL_FPS = 50;
 static const int PAL_LINES_PER_FRAME = 313;
-static const float PAL_CLOCKS_PER_SAMPLE = 5.02677579365f;
 
 static const int cont_bit_map[12] = {
     0x02, 0x08, 0x03, 0x0D, 0x0C, 0x01, 0x0A, 0x0E, 0x04, 0x06, 0x05, 0x09
@@ -70,11 +70,22 @@ static const int cont_bit_map[12] = {
 static int cycles_run, cycles_to_run, scanline;
 
 #ifndef _arch_dreamcast
+/* Where the cartridge starts. The BIOS is done once the CPU gets here. */
+#define CART_START      0x8000
+
+static bootcache_t boot;
+static int boot_done;
+
 static void coleco_frame(int);
 static void coleco_scanline(void);
 static void coleco_single_step(void);
 static void coleco_finish_frame(void);
 static void coleco_finish_scanline(void);
+static int coleco_cycles_elapsed(void);
+
+/* The PSG is the only chip here, so the mixer only has anything to do if its
+   gain has been changed. */
+static mixer_t coleco_mixer;
 #endif
 static int coleco_current_scanline(void);
 static int coleco_cycles_left(void);
@@ -125,41 +136,52 @@ int coleco_init(int video_system) {
     int region = SMS_REGION_EXPORT;
 
     if(video_system == SMS_VIDEO_NTSC) {
-        tmp = NTSC_Z80_CLOCK / PSG_DIVISOR / NTSC_FPS / NTSC_LINES_PER_FRAME /
-              NTSC_CLOCKS_PER_SAMPLE;
+        tmp = (float)SOUND_CORE_RATE / NTSC_FPS / NTSC_LINES_PER_FRAME;
 
         for(i = 0; i < NTSC_LINES_PER_FRAME; ++i) {
             psg_samples[i] = (uint32) (tmp * (i + 1)) -
                              (uint32) (tmp * i);
         }
 
-        /* We end up generating 734 samples per frame @ 44100 Hz, 60fps, but we
-           need 735. */
-        psg_samples[261] += 1;
+        /* Rounding leaves the frame a sample short at some rates, so the last
+           line takes whatever the others didn't. */
+        psg_samples[NTSC_LINES_PER_FRAME - 1] = SOUND_CORE_RATE / NTSC_FPS -
+            (uint32) (tmp * (NTSC_LINES_PER_FRAME - 1));
 
         region |= SMS_VIDEO_NTSC;
 
-        sn76489_init(&psg, NTSC_Z80_CLOCK, 44100.0f,
+        sn76489_init(&psg, NTSC_Z80_CLOCK, (float)SOUND_CORE_RATE,
                      SN76489_NOISE_BITS_NORMAL, SN76489_NOISE_TAPPED_NORMAL);
     }
     else {
-        tmp = PAL_Z80_CLOCK / PSG_DIVISOR / PAL_FPS / PAL_LINES_PER_FRAME /
-              PAL_CLOCKS_PER_SAMPLE;
+        tmp = (float)SOUND_CORE_RATE / PAL_FPS / PAL_LINES_PER_FRAME;
 
         for(i = 0; i < PAL_LINES_PER_FRAME; ++i) {
             psg_samples[i] = (uint32) (tmp * (i + 1)) -
                              (uint32) (tmp * i);
         }
 
-        /* We need 882 samples per frame @ 44100 Hz, 50fps. */
+        psg_samples[PAL_LINES_PER_FRAME - 1] = SOUND_CORE_RATE / PAL_FPS -
+            (uint32) (tmp * (PAL_LINES_PER_FRAME - 1));
+
         region |= SMS_VIDEO_PAL;
 
-        sn76489_init(&psg, PAL_Z80_CLOCK, 44100.0f,
+        sn76489_init(&psg, PAL_Z80_CLOCK, (float)SOUND_CORE_RATE,
                      SN76489_NOISE_BITS_NORMAL, SN76489_NOISE_TAPPED_NORMAL);
     }
 
     sms_region = region;
 
+#ifndef _arch_dreamcast
+    sn76489_set_logging(&psg, &coleco_cycles_elapsed);
+    sn76489_set_band_limited(&psg, 1);
+
+    mixer_init(&coleco_mixer, 2);
+    mixer_add_stream(&coleco_mixer, MIXER_STEREO);
+
+    boot.pending = 1;
+#endif
+
     gui_set_console((console_t *)&colecovision_cons);
 
     coleco_mem_init();
@@ -177,19 +199,27 @@ int coleco_init(int video_system) {
     return 0;
 }
 
-int coleco_reset(void) {
-    if(!colecovision_cons._base.initialized)
-        return 0;
-
+static void psg_reset(void) {
     if(sms_region & SMS_VIDEO_NTSC)
-        sn76489_reset(&psg, NTSC_Z80_CLOCK, 44100.0f,
+        sn76489_reset(&psg, NTSC_Z80_CLOCK, (float)SOUND_CORE_RATE,
                       SN76489_NOISE_BITS_NORMAL, SN76489_NOISE_TAPPED_NORMAL);
     else
-        sn76489_reset(&psg, PAL_Z80_CLOCK, 44100.0f,
+        sn76489_reset(&psg, PAL_Z80_CLOCK, (float)SOUND_CORE_RATE,
                       SN76489_NOISE_BITS_NORMAL, SN76489_NOISE_TAPPED_NORMAL);
+}
+
+int coleco_reset(void) {
+    if(!colecovision_cons._base.initialized)
+        return 0;
+
+    psg_reset();
 
     sound_reset_buffer();
 
+#ifndef _arch_dreamcast
+    boot.pending = 1;
+#endif
+
     coleco_mem_shutdown();
     coleco_mem_init();
 
@@ -204,6 +234,10 @@ int coleco_soft_reset(void) {
     if(!colecovision_cons._base.initialized)
         return 0;
 
+#ifndef _arch_dreamcast
+    boot.pending = 1;
+#endif
+
     coleco_mem_reset();
 
     sms_z80_reset();
@@ -233,6 +267,11 @@ void coleco_button_pressed(int player, int button) {
     if(button < COLECOVISION_UP || button > COLECOVISION_POUND)
         return;
 
+#ifndef _arch_dreamcast
+    /* The boot isn't the same as it always is anymore. */
+    boot.dirty = 1;
+#endif
+
     switch(button) {
         case COLECOVISION_UP:
             coleco_cont_bits[player - 1] |= (1 << 8);
@@ -308,18 +347,79 @@ void coleco_button_released(int player, int button) {
 }
 
 #ifndef _arch_dreamcast
-static __INLINE__ int update_sound(int16 buf[], int start, int line) {
-    if(sms_psg_enabled)
-        sn76489_execute_samples(&psg, buf + start, psg_samples[line]);
-    else
+static int coleco_cycles_elapsed(void) {
+    return cycles_run + sms_z80_get_cycles();
+}
+
+void coleco_sound_set_gain(float gain, float pan) {
+    mixer_set_gain(&coleco_mixer, 0, gain, pan);
+}
+
+static void apply_gain(int16 *buf, int samples) {
+    mixer_run(&coleco_mixer, buf, &buf, samples >> 1);
+}
+
+/* See the SMS version of these for how the PSG write log gets used. */
+static __INLINE__ int update_sound(int16 buf[], int start, int line,
+                                   int defer) {
+    if(!sms_psg_enabled) {
         memset(buf + start, 0, psg_samples[line] << 2);
 
+        if(psg.cycles)
+            sn76489_flush_log(&psg, cycles_to_run);
+    }
+    else if(!psg.cycles) {
+        sn76489_execute_samples(&psg, buf + start, psg_samples[line]);
+    }
+    else if(!defer) {
+        sn76489_execute_logged(&psg, buf + start, psg_samples[line],
+                               cycles_to_run - SMS_CYCLES_PER_LINE,
+                               cycles_to_run);
+    }
+
     return start + (psg_samples[line] << 1);
 }
 
+static void synth_psg_frame(int16 buf[], int samples, int32 start) {
+    if(!sms_psg_enabled || !psg.cycles)
+        return;
+
+    sn76489_execute_logged(&psg, buf, samples >> 1, start, cycles_to_run);
+}
+
+/* Called before the first frame after a reset, to skip the title screen if
+   it's been shown for this cart before. */
+static void boot_start(void) {
+    uint32 bios, crc, adler;
+
+    boot.pending = 0;
+    boot_done = 0;
+
+    if(!(bios = coleco_mem_bios_crc()))
+        return;
+
+    coleco_get_checksums(&crc, &adler);
+
+    if(bootcache_start(&boot, "coleco", bios, crc, 0, sms_region,
+                       &coleco_load_state) == BOOTCACHE_FAILED) {
+        /* Who knows how far the state got, so start over (see the SMS version
+           of this for why the PSG needs its own reset). */
+        psg_reset();
+        coleco_soft_reset();
+        boot.pending = 0;
+    }
+}
+
 static void coleco_frame(int skip) {
-    int16 buf[882 << 1];
+    int16 *buf;
     int samples = 0, total_lines, line;
+    int32 start = cycles_to_run;
+
+    /* This can load a state, which resets the sound buffer. */
+    if(boot.pending)
+        boot_start();
+
+    buf = sound_reserve((SOUND_FRAME_MAX << 1) * sizeof(int16));
 
     if(sms_region & SMS_VIDEO_NTSC)
         total_lines = NTSC_LINES_PER_FRAME;
@@ -332,19 +432,31 @@ static void coleco_frame(int skip) {
         cycles_run += tms9918a_vdp_execute(line, &sms_z80_nmi, skip);
         cycles_run += sms_z80_run(cycles_to_run - cycles_run);
 
-        samples = update_sound(buf, samples, line);
+        samples = update_sound(buf, samples, line, 1);
+
+        /* The cart calls into the BIOS all the time, so this has to be
+           caught while it's happening, not just at the end of the frame. */
+        if(boot.watching && sms_z80_get_pc() >= CART_START)
+            boot_done = 1;
     }
 
-    sound_update_buffer(buf, samples << 1);
+    synth_psg_frame(buf, samples, start);
+    apply_gain(buf, samples);
+    sound_commit(samples << 1);
 
     /* Reset the state for the next frame. */
+    sn76489_end_frame(&psg, cycles_to_run);
     cycles_run -= cycles_to_run;
     cycles_to_run = 0;
     scanline = 0;
+
+    /* The BIOS is done, so this is what the boot cache gets. */
+    if(boot.watching && boot_done)
+        bootcache_finish(&boot, &coleco_save_state);
 }
 
 static void coleco_scanline(void) {
-    int16 buf[882 << 1];
+    int16 buf[SOUND_FRAME_MAX << 1];
     int total_lines, samples = 0;
 
     cycles_to_run += SMS_CYCLES_PER_LINE;
@@ -353,7 +465,9 @@ static void coleco_scanline(void) {
     cycles_run += sms_vdp_execute(scanline, 0);
     cycles_run += tms9918a_vdp_execute(scanline, &sms_z80_nmi, 0);
 
-    samples = update_sound(buf, 0, scanline);
+    samples = update_sound(buf, 0, scanline, 0);
+
+    apply_gain(buf, samples);
     sound_update_buffer(buf, samples << 1);
 
     /* See if we hit the end of a frame by running this scanline. */
@@ -364,6 +478,7 @@ static void coleco_scanline(void) {
 
     if(++scanline == total_lines) {
         /* Reset the state for the next frame. */
+        sn76489_end_frame(&psg, cycles_to_run);
         cycles_run -= cycles_to_run;
         cycles_to_run = 0;
         scanline = 0;
@@ -371,7 +486,7 @@ static void coleco_scanline(void) {
 }
 
 static void coleco_single_step(void) {
-    int16 buf[882 << 1];
+    int16 buf[SOUND_FRAME_MAX << 1];
     int total_lines, run;
 
     /* If we're at the start of a frame, set things up for the first line. Also,
@@ -390,7 +505,8 @@ static void coleco_single_step(void) {
 
     /* Did we finish a line? */
     if(cycles_run >= cycles_to_run) {
-        run = update_sound(buf, 0, scanline);
+        run = update_sound(buf, 0, scanline, 0);
+        apply_gain(buf, run);
         sound_update_buffer(buf, run << 1);
 
         /* Was it the last line in the frame? */
@@ -401,6 +517,7 @@ static void coleco_single_step(void) {
 
         if(++scanline == total_lines) {
             /* Reset the state for the next frame. */
+            sn76489_end_frame(&psg, cycles_to_run);
             cycles_run -= cycles_to_run;
             cycles_to_run = 0;
             scanline = 0;
@@ -409,8 +526,9 @@ static void coleco_single_step(void) {
 }
 
 static void coleco_finish_frame(void) {
-    int16 buf[882 << 1];
+    int16 *buf = sound_reserve((SOUND_FRAME_MAX << 1) * sizeof(int16));
     int samples = 0, total_lines, line;
+    int32 start = cycles_to_run;
 
     if(sms_region & SMS_VIDEO_NTSC)
         total_lines = NTSC_LINES_PER_FRAME;
@@ -423,19 +541,22 @@ static void coleco_finish_frame(void) {
         cycles_run += tms9918a_vdp_execute(scanline, &sms_z80_nmi, 0);
         cycles_run += sms_z80_run(cycles_to_run - cycles_run);
 
-        samples = update_sound(buf, samples, line);
+        samples = update_sound(buf, samples, line, 1);
     }
 
-    sound_update_buffer(buf, samples << 1);
+    synth_psg_frame(buf, samples, start);
+    apply_gain(buf, samples);
+    sound_commit(samples << 1);
 
     /* Reset the state for the next frame. */
+    sn76489_end_frame(&psg, cycles_to_run);
     cycles_run -= cycles_to_run;
     cycles_to_run = 0;
     scanline = 0;
 }
 
 static void coleco_finish_scanline(void) {
-    int16 buf[882 << 1];
+    int16 buf[SOUND_FRAME_MAX << 1];
     int total_lines, samples = 0;
 
     /* Make sure we have something to do. */
@@ -446,7 +567,9 @@ static void coleco_finish_scanline(void) {
        run. */
     cycles_run += sms_z80_run(cycles_to_run - cycles_run);
 
-    samples = update_sound(buf, 0, scanline);
+    samples = update_sound(buf, 0, scanline, 0);
+
+    apply_gain(buf, samples);
     sound_update_buffer(buf, samples << 1);
 
     /* See if we hit the end of a frame by finishing this line. */
@@ -457,6 +580,7 @@ static void coleco_finish_scanline(void) {
 
     if(++scanline == total_lines) {
         /* Reset the state for the next frame. */
+        sn76489_end_frame(&psg, cycles_to_run);
         cycles_run -= cycles_to_run;
         cycles_to_run = 0;
         scanline = 0;
@@ -479,7 +603,7 @@ int coleco_save_state(const char *filename)
 #endif
 {
     FILE *fp;
-    uint8 data[4];
+    int rv;
 
     if(!colecovision_cons._base.initialized)
     /* This shouldn't happen.... */
@@ -489,62 +613,10 @@ int coleco_save_state(const char *filename)
     if(!fp)
         return -1;
 
-    fprintf(fp, "CrabEmu Save State");
-
-    /* Write save state version */
-    data[0] = 0x00;
-    data[1] = 0x02;
-    fwrite(data, 1, 2, fp);
-
-    /* Write out the Console Metadata block */
-    data[0] = 'C';
-    data[1] = 'O';
-    data[2] = 'N';
-    data[3] = 'S';
-    fwrite(data, 1, 4, fp);             /* Block ID */
-
-    UINT32_TO_BUF(24, data);
-    fwrite(data, 1, 4, fp);             /* Length */
-
-    UINT16_TO_BUF(1, data);
-    fwrite(data, 1, 2, fp);             /* Version */
-    fwrite(data, 1, 2, fp);             /* Flags (Importance = 1) */
-
-    data[0] = data[1] = data[2] = data[3] = 0;
-    fwrite(data, 1, 4, fp);             /* Child pointer */
-    UINT32_TO_BUF(1, data);
-    fwrite(data, 1, 4, fp);             /* Console (1 = ColecoVision) */
-
-    data[0] = 0;                        /* Console sub-type */
-    data[1] = 0;                        /* Region code */
-    data[2] = sms_region >> 4;          /* Video system */
-    data[3] = 0;                        /* Reserved */
-    fwrite(data, 1, 4, fp);
-
-    /* Write each block's state */
-    if(coleco_game_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-    else if(sms_z80_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-    else if(sms_psg_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-    else if(sms_vdp_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-    else if(coleco_mem_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-
+    rv = coleco_write_state(fp);
     fclose(fp);
-    return 0;
+
+    return rv;
 }
 
 #ifdef _arch_dreamcast
@@ -677,13 +749,13 @@ int coleco_save_state(const char *filename) {
 }
 #endif
 
-static int coleco_cons_read_context(const uint8 *buf) {
-    uint32 len, cons;
+static int coleco_cons_read_context(const uint8 *buf, uint32 len,
+                                    int load __UNUSED__) {
+    uint32 cons;
     uint16 ver;
     int vid, region;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 24)
         return -1;
 
@@ -713,115 +785,20 @@ static int coleco_cons_read_context(const uint8 *buf) {
     return 0;
 }
 
-static int coleco_load_state_v2(FILE *fp) {
-    uint8 buf[4];
-    int rv;
-    uint32 fourcc, len;
-    uint16 flags;
-    uint8 *ptr;
-    size_t read;
-
-    for(;;) {
-        rv = 0;
-
-        /* Read in the fourcc */
-        read = fread(buf, 1, 4, fp);
-        if(!read)
-            break;
-        else if(read != 4)
-            return -1;
-
-        BUF_TO_UINT32(buf, fourcc);
-
-        /* Read in the length */
-        if(fread(buf, 1, 4, fp) != 4)
-            return -1;
-
-        BUF_TO_UINT32(buf, len);
-
-        /* Check for a malformed block */
-        if(len < 16)
-            return -1;
-
-        /* Allocate space for the block and read it in. */
-        if(!(ptr = (uint8 *)malloc(len)))
-            return -1;
-        UINT32_TO_BUF(fourcc, ptr);
-        UINT32_TO_BUF(len, ptr + 4);
-
-        if(fread(ptr + 8, 1, len - 8, fp) != len - 8) {
-            free(ptr);
-            return -1;
-        }
-
-        switch(fourcc) {
-            case FOURCC_TO_UINT32('C', 'O', 'N', 'S'):
-                rv = coleco_cons_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('G', 'A', 'M', 'E'):
-                rv = coleco_game_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('Z', '8', '0', '\0'):
-                rv = sms_z80_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('P', 'S', 'G', '\0'):
-                rv = sms_psg_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('9', '9', '1', '8'):
-                rv = sms_vdp_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('D', 'R', 'A', 'M'):
-                rv = coleco_mem_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('C', 'V', 'R', 'G'):
-                rv = coleco_regs_read_context(ptr);
-                break;
-
-            default:
-                /* See if its marked as essential... */
-                BUF_TO_UINT16(ptr + 10, flags);
-                if(flags & 1) {
-                    rv = -1;
-#ifdef DEBUG
-                    printf("Unknown block %c%c%c%c, bailing out!\n", ptr[0],
-                           ptr[1], ptr[2], ptr[3]);
-#endif
-                }
-                else {
-#ifdef DEBUG
-                    printf("Ignoring unknown block %c%c%c%c\n", ptr[0], ptr[1],
-                           ptr[2], ptr[3]);
-#endif
-                }
-        }
-
-        /* Clean up this pass */
-        free(ptr);
-
-        if(rv)
-            return rv;
-    }
-
-    coleco_cont_bits[0] = coleco_cont_bits[1] = 0;
-
-    return 0;
-}
+static const statesave_reader_t coleco_readers[] = {
+    { FOURCC_TO_UINT32('C', 'O', 'N', 'S'), &coleco_cons_read_context },
+    { FOURCC_TO_UINT32('G', 'A', 'M', 'E'), &coleco_game_read_context },
+    { FOURCC_TO_UINT32('Z', '8', '0', '\0'), &sms_z80_read_context },
+    { FOURCC_TO_UINT32('P', 'S', 'G', '\0'), &sms_psg_read_context },
+    { FOURCC_TO_UINT32('9', '9', '1', '8'), &sms_vdp_read_context },
+    { FOURCC_TO_UINT32('D', 'R', 'A', 'M'), &coleco_mem_read_context },
+    { FOURCC_TO_UINT32('C', 'V', 'R', 'G'), &coleco_regs_read_context },
+    { 0, NULL }
+};
 
-#ifdef _arch_dreamcast
-static int coleco_load_state_int(const char *filename)
-#else
-int coleco_load_state(const char *filename)
-#endif
-{
-    char str[19];
-    FILE *fp;
-    char byte;
+#ifndef _arch_dreamcast
+int coleco_load_state(const char *filename) {
+    statesave_buf_t buf;
     int rv;
 
     if(!colecovision_cons._base.initialized) {
@@ -829,41 +806,15 @@ int coleco_load_state(const char *filename)
         return -1;
     }
 
-    fp = fopen(filename, "rb");
-    if(!fp)
+    if(statesave_read(filename, &buf))
         return -1;
 
-    fread(str, 18, 1, fp);
-    str[18] = 0;
-    if(strcmp("CrabEmu Save State", str)) {
-        fclose(fp);
-        return -2;
-    }
-
-    /* Read save state version */
-    fread(&byte, 1, 1, fp);
-    if(byte != 0x00) {
-        fclose(fp);
-        return -2;
-    }
-
-    fread(&byte, 1, 1, fp);
-
-    if(byte != 0x02) {
-        fclose(fp);
-        return -2;
-    }
-
-    rv = coleco_load_state_v2(fp);
-
-    fclose(fp);
-
-    sound_reset_buffer();
+    rv = coleco_read_state_mem(buf.data, buf.len);
+    statesave_release(&buf);
 
     return rv;
 }
-
-#ifdef _arch_dreamcast
+#else
 int coleco_load_state(const char *filename __UNUSED__) {
     vmu_pkg_t pkg;
     uint8 *pkg_out, *raw;
@@ -896,7 +847,7 @@ int coleco_load_state(const char *filename __UNUSED__) {
     real_size = *((uint32 *)pkg.data);
     pkg_size = *(((uint32 *)pkg.data) + 1);
 
-    /* Uncompress the data and write it out to a /ram file */
+    /* Uncompress the data and load it straight out of that buffer */
     if(!(raw = (uint8 *)malloc(real_size))) {
         free(pkg_out);
         return -1;
@@ -905,19 +856,9 @@ int coleco_load_state(const char *filename __UNUSED__) {
     uncompress(raw, &real_size, ((uint8 *)pkg.data) + 8, pkg.data_len - 8);
     free(pkg_out);
 
-    sprintf(savename, "/ram/cs-%08" PRIX32, (uint32_t)crc);
-    if(!(fp = fopen(savename, "wb"))) {
-        free(raw);
-        return -1;
-    }
-
-    fwrite(raw, 1, real_size, fp);
-    fclose(fp);
+    rv = coleco_read_state_mem(raw, real_size);
     free(raw);
 
-    rv = coleco_load_state_int(savename);
-    fs_unlink(savename);
-
     return rv;
 }
 #endif
@@ -985,10 +926,8 @@ int coleco_write_state(FILE *fp)
     return 0;
 }
 
-int coleco_read_state(FILE *fp)
+int coleco_read_state_mem(const uint8 *buf, size_t len)
 {
-    char str[19];
-    char byte;
     int rv;
 
     if(!colecovision_cons._base.initialized) {
@@ -996,29 +935,24 @@ int coleco_read_state(FILE *fp)
         return -1;
     }
 
-    if(!fp)
+    if(!buf)
         return -1;
 
-    fread(str, 18, 1, fp);
-    str[18] = 0;
-    if(strcmp("CrabEmu Save State", str)) {
+    if(statesave_version(buf, len) != 0x02)
         return -2;
-    }
 
-    /* Read save state version */
-    fread(&byte, 1, 1, fp);
-    if(byte != 0x00) {
-        return -2;
-    }
+    rv = statesave_walk(buf + STATESAVE_HEADER_LEN, len - STATESAVE_HEADER_LEN,
+                        coleco_readers);
 
-    fread(&byte, 1, 1, fp);
+    if(!rv) {
+        coleco_cont_bits[0] = coleco_cont_bits[1] = 0;
 
-    if(byte != 0x02) {
-        return -2;
+#ifndef _arch_dreamcast
+        /* Whatever this is, it isn't the BIOS booting the cart any more. */
+        boot.pending = boot.watching = 0;
+#endif
     }
 
-    rv = coleco_load_state_v2(fp);
-
     sound_reset_buffer();
 
     return rv;
@@ -57,7 +57,12 @@ extern int coleco_save_state(const char *fn);
 extern int coleco_load_state(const char *fn);
 
 extern int coleco_write_state(FILE *fp);
-extern int coleco_read_state(FILE *fp);
+extern int coleco_read_state_mem(const uint8 *buf, size_t len);
+
+#ifndef _arch_dreamcast
+/* PSG gain (1.0 is normal) and pan (-1.0 left to 1.0 right). */
+extern void coleco_sound_set_gain(float gain, float pan);
+#endif
 
 /* Console definition. */
 typedef struct crabemu_colecovision {
@@ -38,6 +38,7 @@
 #include "nesapu.h"
 
 #include "sound.h"
+#include "statesave.h"
 
 static const float NTSC_6502_CLOCK = 1789772.5f;
 static const int NTSC_LINES_PER_FRAME = 262;
@@ -192,7 +193,7 @@ void nes_frame(int skip) {
     cycles_to_run += 113;
     cycles_run += Crab6502_execute(&nescpu, cycles_to_run - cycles_run);
 
-    nes_apu_execute(cycles_run);
+    nes_apu_execute(cycles_to_run);
 
     /* Reset the state for the next frame. */
     cycles_run -= cycles_to_run;
@@ -227,7 +228,7 @@ static void nes_scanline(void) {
     else if(scanline == 262) {
         nes_ppu_vblank_out();
         cycles_run += Crab6502_execute(&nescpu, cycles_to_run - cycles_run);
-        nes_apu_execute(cycles_run);
+        nes_apu_execute(cycles_to_run);
 
         /* Reset the state for the next frame. */
         cycles_run -= cycles_to_run;
@@ -288,7 +289,7 @@ line_261:
     cycles_to_run += 113;
     cycles_run += Crab6502_execute(&nescpu, cycles_to_run - cycles_run);
 
-    nes_apu_execute(cycles_run);
+    nes_apu_execute(cycles_to_run);
 
     /* Reset the state for the next frame. */
     cycles_run -= cycles_to_run;
@@ -329,7 +330,7 @@ static void nes_single_step(void) {
             nes_ppu_vblank_out();
         }
         else {
-            nes_apu_execute(cycles_run);
+            nes_apu_execute(cycles_to_run);
 
             cycles_run -= cycles_to_run;
             cycles_to_run = 0;
@@ -372,7 +373,7 @@ static void nes_finish_scanline(void) {
             nes_ppu_vblank_out();
         }
         else {
-            nes_apu_execute(cycles_run);
+            nes_apu_execute(cycles_to_run);
 
             cycles_run -= cycles_to_run;
             cycles_to_run = 0;
@@ -491,12 +492,10 @@ static int nes_6502_write_context(FILE *fp) {
     return 0;
 }
 
-static int nes_6502_read_context(const uint8 *buf) {
-    uint32 len;
+static int nes_6502_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 24)
         return -1;
 
@@ -509,6 +508,9 @@ static int nes_6502_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Read in the data */
     BUF_TO_UINT16(buf + 16, nescpu.pc.w);
     nescpu.a = buf[18];
@@ -594,12 +596,12 @@ int nes_save_state(const char *filename)
     return 0;
 }
 
-static int nes_cons_read_context(const uint8 *buf) {
-    uint32 len, cons;
+static int nes_cons_read_context(const uint8 *buf, uint32 len,
+                                 int load __UNUSED__) {
+    uint32 cons;
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 24)
         return -1;
 
@@ -621,153 +623,45 @@ static int nes_cons_read_context(const uint8 *buf) {
     return 0;
 }
 
-#ifdef _arch_dreamcast
-static int nes_load_state_int(const char *filename)
-#else
-int nes_load_state(const char *filename)
-#endif
-{
-    FILE *fp;
-    char str[19];
-    uint8 byte;
-    uint8 buf[4];
-    int rv;
-    uint32 fourcc, len;
-    uint16 flags;
-    uint8 *ptr;
-    size_t read;
+static const statesave_reader_t nes_readers[] = {
+    { FOURCC_TO_UINT32('C', 'O', 'N', 'S'), &nes_cons_read_context },
+    { FOURCC_TO_UINT32('G', 'A', 'M', 'E'), &nes_game_read_context },
+    { FOURCC_TO_UINT32('6', '5', '0', '2'), &nes_6502_read_context },
+    { FOURCC_TO_UINT32('N', 'A', 'P', 'U'), &nes_apu_read_context },
+    { FOURCC_TO_UINT32('N', 'P', 'P', 'U'), &nes_ppu_read_context },
+    { FOURCC_TO_UINT32('D', 'R', 'A', 'M'), &nes_mem_read_context },
+    { FOURCC_TO_UINT32('M', 'A', 'P', 'R'), &nes_mapper_read_context },
+    { FOURCC_TO_UINT32('N', 'C', 'R', 'M'), &nes_chr_ram_read_context },
+    { FOURCC_TO_UINT32('N', 'S', 'R', 'M'), &nes_sram_read_context },
+    { 0, NULL }
+};
 
+static int nes_read_state_mem(const uint8 *buf, size_t len) {
     if(!nes_cons._base.initialized)
         /* This shouldn't happen.... */
         return -1;
 
-    fp = fopen(filename, "rb");
-    if(!fp)
-        return -1;
-
-    fread(str, 18, 1, fp);
-    str[18] = 0;
-    if(strcmp("CrabEmu Save State", str)) {
-        fclose(fp);
-        return -2;
-    }
-
-    /* Read save state version */
-    fread(&byte, 1, 1, fp);
-    if(byte != 0x00) {
-        fclose(fp);
-        return -2;
-    }
-
-    fread(&byte, 1, 1, fp);
-    if(byte != 0x02) {
-        fclose(fp);
+    if(statesave_version(buf, len) != 0x02)
         return -2;
-    }
-
-    /* Process each chunk */
-    for(;;) {
-        rv = 0;
-
-        /* Read in the fourcc */
-        read = fread(buf, 1, 4, fp);
-        if(!read)
-            break;
-        else if(read != 4)
-            return -1;
-
-        BUF_TO_UINT32(buf, fourcc);
-
-        /* Read in the length */
-        if(fread(buf, 1, 4, fp) != 4)
-            return -1;
-
-        BUF_TO_UINT32(buf, len);
-
-        /* Check for a malformed block */
-        if(len < 16)
-            return -1;
-
-        /* Allocate space for the block and read it in. */
-        if(!(ptr = (uint8 *)malloc(len)))
-            return -1;
-        UINT32_TO_BUF(fourcc, ptr);
-        UINT32_TO_BUF(len, ptr + 4);
 
-        if(fread(ptr + 8, 1, len - 8, fp) != len - 8) {
-            free(ptr);
-            return -1;
-        }
+    return statesave_walk(buf + STATESAVE_HEADER_LEN,
+                          len - STATESAVE_HEADER_LEN, nes_readers);
+}
 
-        switch(fourcc) {
-            case FOURCC_TO_UINT32('C', 'O', 'N', 'S'):
-                rv = nes_cons_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('G', 'A', 'M', 'E'):
-                rv = nes_game_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('6', '5', '0', '2'):
-                rv = nes_6502_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('N', 'A', 'P', 'U'):
-                rv = nes_apu_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('N', 'P', 'P', 'U'):
-                rv = nes_ppu_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('D', 'R', 'A', 'M'):
-                rv = nes_mem_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('M', 'A', 'P', 'R'):
-                rv = nes_mapper_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('N', 'C', 'R', 'M'):
-                rv = nes_chr_ram_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('N', 'S', 'R', 'M'):
-                rv = nes_sram_read_context(ptr);
-                break;
-
-            default:
-                /* See if its marked as essential... */
-                BUF_TO_UINT16(ptr + 10, flags);
-                if(flags & 1) {
-                    rv = -1;
-#ifdef DEBUG
-                    printf("Unknown block %c%c%c%c, bailing out!\n", ptr[0],
-                           ptr[1], ptr[2], ptr[3]);
-#endif
-                }
-                else {
-#ifdef DEBUG
-                    printf("Ignoring unknown block %c%c%c%c\n", ptr[0], ptr[1],
-                           ptr[2], ptr[3]);
-#endif
-                }
-        }
+#ifndef _arch_dreamcast
+int nes_load_state(const char *filename) {
+    statesave_buf_t buf;
+    int rv;
 
-        /* Clean up this pass */
-        free(ptr);
+    if(statesave_read(filename, &buf))
+        return -1;
 
-        if(rv) {
-#ifdef DEBUG
-            printf("Error parsing block %c%c%c%c\n", ptr[0], ptr[1], ptr[2],
-                   ptr[3]);
-#endif
-            return rv;
-        }
-    }
+    rv = nes_read_state_mem(buf.data, buf.len);
+    statesave_release(&buf);
 
-    return 0;
+    return rv;
 }
+#endif
 
 #ifdef _arch_dreamcast
 int nes_save_state(const char *filename) {
@@ -930,7 +824,7 @@ int nes_load_state(const char *filename __UNUSED__) {
     real_size = *((uint32 *)pkg.data);
     pkg_size = *(((uint32 *)pkg.data) + 1);
 
-    /* Uncompress the data and write it out to a /ram file */
+    /* Uncompress the data and load it straight out of that buffer */
     if(!(raw = (uint8 *)malloc(real_size))) {
         free(pkg_out);
         return -1;
@@ -939,19 +833,9 @@ int nes_load_state(const char *filename __UNUSED__) {
     uncompress(raw, &real_size, ((uint8 *)pkg.data) + 8, pkg.data_len - 8);
     free(pkg_out);
 
-    sprintf(savename, "/ram/cs-%08" PRIX32, (uint32_t)crc);
-    if(!(fp = fopen(savename, "wb"))) {
-        free(raw);
-        return -1;
-    }
-
-    fwrite(raw, 1, real_size, fp);
-    fclose(fp);
+    rv = nes_read_state_mem(raw, real_size);
     free(raw);
 
-    rv = nes_load_state_int(savename);
-    fs_unlink(savename);
-
     return rv;
 }
 #endif
@@ -32,13 +32,7 @@
 #include <bzlib/bzlib.h>
 #include "icon.h"
 #else
-#ifndef NO_ZLIB
-#include <zlib.h>
-#endif
-
-#ifndef NO_BZ2
-#include <bzlib.h>
-#endif
+#include <sys/stat.h>
 #endif
 
 #include "nesmem.h"
@@ -46,10 +40,9 @@
 #include "nesapu.h"
 #include "Crab6502.h"
 #include "rom.h"
-
-#ifndef NO_ZLIB
-#include "unzip.h"
-#endif
+#include "gamedb.h"
+#include "sramfile.h"
+#include "console.h"
 
 uint8 nes_ram[2 * 1024];
 uint8 *nes_read_map[256];
@@ -68,11 +61,13 @@ uint8 *nes_chr_rom = NULL;
 uint8 *nes_sram = NULL;
 struct ines nes_cur_hdr;
 uint32 nes_prg_crc = 0, nes_prg_adler = 0;
+static int sram_type = GAMEDB_SRAM_UNKNOWN;
 
 uint16 nes_pad = 0;
 static uint8 pad_latch[2] = { 0xFF, 0xFF };
 
 static uint8 *rom_data = NULL;
+static rom_image_t rom_image;
 
 extern Crab6502_t nescpu;
 
@@ -169,9 +164,9 @@ static nes_mapper_t *find_mapper(int m) {
 static void nes_finalize(const char *fn) {
     char *name;
 
-    /* Calculate the CRC of the PRG */
-    nes_prg_crc = rom_crc32(nes_prg_rom, nes_prg_rom_size);
-    nes_prg_adler = rom_adler32(nes_prg_rom, nes_prg_rom_size);
+    /* Decode the CHR-ROM before the mapper sets up its banks. */
+    nes_ppu_set_chr_rom(nes_chr_rom_size ? nes_chr_rom : NULL,
+                        (uint32)nes_chr_rom_size);
 
     cur_mapper->init();
     Crab6502_set_memread(&nescpu, cur_mapper->read);
@@ -199,6 +194,10 @@ void nes_mem_update_map(void) {
 static int nes_sram_written(void) {
     size_t i;
 
+    /* Some carts have RAM there without a battery to keep it. */
+    if(sram_type == GAMEDB_SRAM_NONE)
+        return 0;
+
     for(i = 0; i < nes_sram_size; ++i) {
         if(nes_sram[i])
             return 1;
@@ -214,6 +213,10 @@ int nes_mem_write_sram(const char *fn) {
     if(!fn)
         return -1;
 
+    /* If it's mapped to that file, it only needs flushing. */
+    if(!sramfile_sync(nes_sram, fn))
+        return 0;
+
     /* Make sure the SRAM has been written to */
     if(!nes_sram_written())
         return 0;
@@ -231,11 +234,22 @@ int nes_mem_write_sram(const char *fn) {
 }
 
 int nes_mem_read_sram(const char *fn) {
+    struct stat st;
     FILE *fp;
+    int exists;
 
     if(!fn)
         return -1;
 
+    exists = !stat(fn, &st);
+
+    /* Map it over the SRAM instead, if that's turned on, so it gets written
+       as the game goes. A cart with a battery gets its file now, if it
+       doesn't have one yet, so that it's kept from the first write on. */
+    if((exists || (nes_cur_hdr.flags[0] & 0x02)) &&
+       !sramfile_map(nes_sram, nes_sram_size, fn))
+        return exists ? 0 : -1;
+
     if(!(fp = fopen(fn, "rb")))
         return -1;
 
@@ -371,6 +385,35 @@ int nes_mem_read_sram(const char *fn __UNUSED__) {
 }
 #endif /* _arch_dreamcast */
 
+static void fix_header(struct ines *hdr) {
+    gamedb_entry_t ent;
+
+    if(gamedb_find(nes_prg_crc, nes_prg_adler, &ent) ||
+       (ent.console && ent.console != CONSOLE_NES))
+        return;
+
+#ifdef DEBUG
+    printf("Game database: %s\n", ent.name);
+#endif
+
+    if(ent.mapper != GAMEDB_NO_MAPPER)
+        nes_mapper = ent.mapper;
+
+    if(ent.flags & GAMEDB_MIRROR_4)
+        hdr->flags[0] = (hdr->flags[0] & ~0x01) | 0x08;
+    else if(ent.flags & GAMEDB_MIRROR_V)
+        hdr->flags[0] = (hdr->flags[0] & ~0x08) | 0x01;
+    else if(ent.flags & GAMEDB_MIRROR_H)
+        hdr->flags[0] &= ~0x09;
+
+    if(ent.sram == GAMEDB_SRAM_BATTERY)
+        hdr->flags[0] |= 0x02;
+    else if(ent.sram == GAMEDB_SRAM_NONE)
+        hdr->flags[0] &= ~0x02;
+
+    sram_type = ent.sram;
+}
+
 static int parse_rom(const char *fn, int size) {
     struct ines hdr;
 
@@ -382,7 +425,7 @@ static int parse_rom(const char *fn, int size) {
 #ifdef DEBUG
         fprintf(stderr, "nes_mem_load_rom: ROM %s not an iNES rom!\n", fn);
 #endif
-        free(rom_data);
+        rom_image_free(&rom_image);
         rom_data = NULL;
 
         return ROM_LOAD_E_NO_ROM;
@@ -403,6 +446,17 @@ static int parse_rom(const char *fn, int size) {
         nes_sram_size = hdr.prg_ram_size ? hdr.prg_ram_size * 8192 : 8192;
     }
 
+    /* Plenty of dumps out there have bad headers, so see if the game database
+       knows better. The checksum is of the PRG alone, so the header doesn't
+       change it. */
+    sram_type = GAMEDB_SRAM_UNKNOWN;
+
+    if(size >= (int)(nes_prg_rom_size + 16)) {
+        rom_checksums(rom_data + 16, (uint32)nes_prg_rom_size, &nes_prg_crc,
+                      &nes_prg_adler);
+        fix_header(&hdr);
+    }
+
 #ifdef DEBUG
     printf("PRG ROM Size: %d, CHR ROM Size: %d, SRAM Size: %d\n",
            (int)nes_prg_rom_size, (int)nes_chr_rom_size, (int)nes_sram_size);
@@ -416,7 +470,7 @@ static int parse_rom(const char *fn, int size) {
         fprintf(stderr, "nes_mem_load_rom: Mapper %d is unsupported!\n",
                 nes_mapper);
 #endif
-        free(rom_data);
+        rom_image_free(&rom_image);
         rom_data = NULL;
 
         return ROM_LOAD_E_UNK_MAPPER;
@@ -427,7 +481,7 @@ static int parse_rom(const char *fn, int size) {
 #ifdef DEBUG
         fprintf(stderr, "nes_mem_load_rom: ROM has an unsupported trainer!\n");
 #endif
-        free(rom_data);
+        rom_image_free(&rom_image);
         rom_data = NULL;
 
         return ROM_LOAD_E_HAS_TRAINER;
@@ -439,7 +493,7 @@ static int parse_rom(const char *fn, int size) {
         fprintf(stderr, "nes_mem_load_rom: ROM is too small (got %d, expected "
                 "%d)\n", size, (int)(nes_prg_rom_size + nes_chr_rom_size + 16));
 #endif
-        free(rom_data);
+        rom_image_free(&rom_image);
         rom_data = NULL;
 
         return ROM_LOAD_E_BAD_SZ;
@@ -450,12 +504,12 @@ static int parse_rom(const char *fn, int size) {
     nes_chr_rom = nes_prg_rom + nes_prg_rom_size;
 
     /* Make space for SRAM and CHR RAM (if needed). */
-    if(!(nes_sram = (uint8 *)malloc(nes_sram_size))) {
+    if(!(nes_sram = (uint8 *)sramfile_alloc(nes_sram_size))) {
 #ifdef DEBUG
         fprintf(stderr, "nes_mem_load_rom: Couldn't allocate SRAM\n");
-        perror("malloc");
+        perror("sramfile_alloc");
 #endif
-        free(rom_data);
+        rom_image_free(&rom_image);
         rom_data = nes_prg_rom = nes_chr_rom = NULL;
 
         return ROM_LOAD_E_ERRNO;
@@ -470,8 +524,8 @@ static int parse_rom(const char *fn, int size) {
             fprintf(stderr, "nes_mem_load_rom: Couldn't allocate CHR RAM\n");
             perror("malloc");
 #endif
-            free(rom_data);
-            free(nes_sram);
+            rom_image_free(&rom_image);
+            sramfile_free(nes_sram, nes_sram_size);
             rom_data = nes_prg_rom = nes_sram = NULL;
 
             return ROM_LOAD_E_ERRNO;
@@ -484,299 +538,29 @@ static int parse_rom(const char *fn, int size) {
     return ROM_LOAD_SUCCESS;
 }
 
-#ifndef NO_ZLIB
-static int load_gz_rom(const char *fn) {
-    int len, size = 0;
-    gzFile fp;
-    void *tmp;
-
-    /* Open up the file in question. */
-    if(!(fp = gzopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    if(!(rom_data = (uint8 *)malloc(0x1000))) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Couldn't allocate space!\n");
-        perror("malloc");
-#endif
-        gzclose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    size = 0;
-    len = gzread(fp, rom_data, 0x1000);
-
-    /* Read in a block of the file at a time... */
-    while(len != 0 && len != -1) {
-        size += len;
-        tmp = realloc(rom_data, size + 0x1000);
-
-        if(!tmp) {
-#ifdef DEBUG
-            fprintf(stderr, "nes_mem_load_rom: Couldn't allocate space!\n");
-            perror("realloc");
-#endif
-            gzclose(fp);
-            free(rom_data);
-            rom_data = NULL;
-
-            return ROM_LOAD_E_ERRNO;
-        }
-
-        rom_data = (uint8 *)tmp;
-        memset(rom_data + size, 0xFF, 0x1000);
-        len = gzread(fp, rom_data + size, 0x1000);
-    }
-
-    /* Truncate to the "correct" length if we can. */
-    if((tmp = realloc(rom_data, size)))
-        rom_data = (uint8 *)tmp;
-
-    /* Close the file, as we're done with it */
-    gzclose(fp);
-
-    /* Parse the file we read in... */
-    return parse_rom(fn, size);
-}
-#endif
-
-#ifndef NO_BZ2
-static int load_bz2_rom(const char *fn) {
-    int len, size = 0;
-    BZFILE *fp;
-    void *tmp;
-
-    /* Open up the file in question. */
-    if(!(fp = BZ2_bzopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    if(!(rom_data = (uint8 *)malloc(0x1000))) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Couldn't allocate space!\n");
-        perror("malloc");
-#endif
-        BZ2_bzclose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    size = 0;
-    len = BZ2_bzread(fp, rom_data, 0x1000);
-
-    /* Read in a block of the file at a time... */
-    while(len != 0 && len != -1) {
-        size += len;
-        tmp = realloc(rom_data, size + 0x1000);
-
-        if(!tmp) {
-#ifdef DEBUG
-            fprintf(stderr, "nes_mem_load_rom: Couldn't allocate space!\n");
-            perror("realloc");
-#endif
-            BZ2_bzclose(fp);
-            free(rom_data);
-            rom_data = NULL;
-
-            return ROM_LOAD_E_ERRNO;
-        }
-
-        rom_data = (uint8 *)tmp;
-        memset(rom_data + size, 0xFF, 0x1000);
-        len = BZ2_bzread(fp, rom_data + size, 0x1000);
-    }
-
-    /* Truncate to the "correct" length if we can. */
-    if((tmp = realloc(rom_data, size)))
-        rom_data = (uint8 *)tmp;
-
-    /* Close the file, as we're done with it */
-    BZ2_bzclose(fp);
-
-    /* Parse the file we read in... */
-    return parse_rom(fn, size);
-}
-#endif
-
-#ifndef NO_ZLIB
-static int load_zip_rom(const char *fn) {
-    unzFile fp;
-    unz_file_info inf;
-    char fn2[4096];
-    char *ext;
-    int found = 0, size;
-
-    /* Open up the zip file in question */
-    if(!(fp = unzOpen(fn))) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    if(unzGoToFirstFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Couldn't find file in zip!\n");
-#endif
-        unzClose(fp);
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* Keep looking at files until we find a rom. */
-    while(!found) {
-        if(unzGetCurrentFileInfo(fp, &inf, fn2, 4096, NULL, 0, NULL,
-                                 0) != UNZ_OK) {
-#ifdef DEBUG
-            fprintf(stderr, "nes_mem_load_rom: Error parsing zip file!\n");
-#endif
-            unzClose(fp);
-            return ROM_LOAD_E_CORRUPT;
-        }
-
-        /* Check if this file looks like a rom. */
-        ext = strrchr(fn2, '.');
-
-        if(ext) {
-            if(!strcmp(ext, ".nes"))
-                found = 1;
-        }
-
-        /* If we haven't found a rom yet, move to the next file. */
-        if(!found) {
-            if(unzGoToNextFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-                fprintf(stderr, "nes_mem_load_rom: End of zip file!\n");
-#endif
-                unzClose(fp);
-                return ROM_LOAD_E_NO_ROM;
-            }
-        }
-    }
-
-    /* Allocate space for the file, and read it in */
-    if(!(rom_data = (uint8 *)malloc(inf.uncompressed_size))) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Couldn't allocate space for ROM!\n");
-        perror("malloc");
-#endif
-        unzClose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    size = inf.uncompressed_size;
-
-    /* Attempt to open the file we think is a rom. */
-    if(unzOpenCurrentFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Couldn't open rom from zip!\n");
-#endif
-        unzClose(fp);
-        free(rom_data);
-        rom_data = NULL;
-
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* Attempt to read the file. */
-    if(unzReadCurrentFile(fp, rom_data, size) < 0) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Couldn't read rom from zip!\n");
-#endif
-        unzCloseCurrentFile(fp);
-        unzClose(fp);
-        free(rom_data);
-        rom_data = NULL;
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* We're done with the file, close everything. */
-    unzCloseCurrentFile(fp);
-    unzClose(fp);
-
-    /* Parse the file we read in... */
-    return parse_rom(fn, size);
-}
-#endif
-
 int nes_mem_load_rom(const char *fn) {
-    char *ext;
-    FILE *fp;
-    int size;
+    static const char *const exts[] = { ".nes", NULL };
+    int rv;
 
-    /* If its a compressed format, go onto their handler... */
-    ext = strrchr(fn, '.');
-
-    if(ext) {
-#ifndef NO_ZLIB
-        if(!strcmp(ext, ".gz")) {
-            return load_gz_rom(fn);
-        }
-        else if(!strcmp(ext, ".zip")) {
-            return load_zip_rom(fn);
-        }
-#endif
-#ifndef NO_BZ2
-        if(!strcmp(ext, ".bz2")) {
-            return load_bz2_rom(fn);
-        }
-#endif
-    }
-
-    if(!(fp = fopen(fn, "rb"))) {
+    if((rv = rom_image_load(fn, exts, 0, &rom_image)) != ROM_LOAD_SUCCESS) {
 #ifdef DEBUG
-        perror("fopen");
-        fprintf(stderr, "nes_mem_load_rom: Could not open ROM: %s!\n", fn);
+        fprintf(stderr, "nes_mem_load_rom: Could not load ROM: %s!\n", fn);
 #endif
-        return ROM_LOAD_E_ERRNO;
+        return rv;
     }
 
-    /* Determine the size of the file */
-    fseek(fp, 0, SEEK_END);
-    size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    if(size < 16) {
+    if(rom_image.size < 16) {
 #ifdef DEBUG
         fprintf(stderr, "nes_mem_load_rom: ROM %s too short!\n", fn);
 #endif
-        fclose(fp);
+        rom_image_free(&rom_image);
         return ROM_LOAD_E_BAD_SZ;
     }
 
-    /* Allocate space for the ROM's data. */
-    if(!(rom_data = (uint8 *)malloc(size))) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Couldn't allocate space for ROM!\n");
-        perror("malloc");
-#endif
-        fclose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    /* Read the file in */
-    if(fread(rom_data, 1, size, fp) != (size_t)size) {
-#ifdef DEBUG
-        fprintf(stderr, "nes_mem_load_rom: Couldn't read ROM file!\n");
-        perror("fread");
-#endif
-        free(rom_data);
-        rom_data = NULL;
-        fclose(fp);
-
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    /* Close the file, as we're done with it */
-    fclose(fp);
+    rom_data = rom_image.data;
 
     /* Parse the file we read in... */
-    return parse_rom(fn, size);
+    return parse_rom(fn, (int)rom_image.size);
 }
 
 int nes_mem_init(void) {
@@ -804,11 +588,13 @@ int nes_mem_init(void) {
 }
 
 int nes_mem_shutdown(void) {
+    nes_ppu_set_chr_rom(NULL, 0);
+
     if(!nes_chr_rom_size)
         free(nes_chr_rom);
 
-    free(nes_sram);
-    free(rom_data);
+    sramfile_free(nes_sram, nes_sram_size);
+    rom_image_free(&rom_image);
 
     nes_prg_rom_size = nes_chr_rom_size = nes_sram_size = 0;
     nes_prg_rom = nes_chr_rom = nes_sram = rom_data = NULL;
@@ -872,12 +658,11 @@ int nes_game_write_context(FILE *fp) {
     return 0;
 }
 
-int nes_game_read_context(const uint8 *buf) {
-    uint32 len, crc;
+int nes_game_read_context(const uint8 *buf, uint32 len, int load __UNUSED__) {
+    uint32 crc;
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 24)
         return -1;
 
@@ -931,8 +716,7 @@ static int nes_chr_ram_write_context(FILE *fp) {
     return 0;
 }
 
-int nes_chr_ram_read_context(const uint8 *buf) {
-    uint32 len;
+int nes_chr_ram_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Make sure we have CHR RAM (not ROM) */
@@ -940,7 +724,6 @@ int nes_chr_ram_read_context(const uint8 *buf) {
         return 0;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 8208)
         return -1;
 
@@ -953,6 +736,9 @@ int nes_chr_ram_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the data */
     memcpy(nes_chr_rom, buf + 16, 8192);
 
@@ -989,8 +775,7 @@ static int nes_sram_write_context(FILE *fp) {
     return 0;
 }
 
-int nes_sram_read_context(const uint8 *buf) {
-    uint32 len;
+int nes_sram_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Make sure we have SRAM */
@@ -998,7 +783,6 @@ int nes_sram_read_context(const uint8 *buf) {
         return 0;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != nes_sram_size + 16)
         return -1;
 
@@ -1011,6 +795,9 @@ int nes_sram_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the data */
     memcpy(nes_sram, buf + 16, nes_sram_size);
 
@@ -1089,12 +876,10 @@ int nes_mem_write_context(FILE *fp) {
     return 0;
 }
 
-int nes_mem_read_context(const uint8 *buf) {
-    uint32 len;
+int nes_mem_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 2064)
         return -1;
 
@@ -1107,19 +892,21 @@ int nes_mem_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the data */
     memcpy(nes_ram, buf + 16, 2048);
 
     return 0;
 }
 
-int nes_mapper_read_context(const uint8 *buf) {
-    uint32 len, ptr, num;
+int nes_mapper_read_context(const uint8 *buf, uint32 len, int load) {
+    uint32 ptr, num;
     uint16 ver;
     uint32 cxt_len = cur_mapper->cxt_len();
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != cxt_len + 20)
         return -1;
 
@@ -1145,6 +932,9 @@ int nes_mapper_read_context(const uint8 *buf) {
     if(num != nes_mapper)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Read in the mapper data, if any */
     if(ptr)
         return cur_mapper->read_cxt(buf + ptr + 16);
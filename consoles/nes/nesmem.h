@@ -86,12 +86,12 @@ extern void nes_mem_writereg(uint16 addr, uint8 val);
 
 /* Save state stuff... */
 extern int nes_game_write_context(FILE *fp);
-extern int nes_game_read_context(const uint8 *buf);
+extern int nes_game_read_context(const uint8 *buf, uint32 len, int load);
 extern int nes_mem_write_context(FILE *fp);
-extern int nes_chr_ram_read_context(const uint8 *buf);
-extern int nes_sram_read_context(const uint8 *buf);
-extern int nes_mem_read_context(const uint8 *buf);
-extern int nes_mapper_read_context(const uint8 *buf);
+extern int nes_chr_ram_read_context(const uint8 *buf, uint32 len, int load);
+extern int nes_sram_read_context(const uint8 *buf, uint32 len, int load);
+extern int nes_mem_read_context(const uint8 *buf, uint32 len, int load);
+extern int nes_mapper_read_context(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
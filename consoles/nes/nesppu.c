@@ -25,10 +25,19 @@
 #include <malloc.h>
 #endif
 
+/* The last step of each line, putting the background and sprites together and
+   looking up the output colour of every pixel, can be done 16 pixels at a time
+   with byte compares and shuffles, like the checksums in rom.c. */
+#if !defined(_arch_dreamcast) && defined(__x86_64__) && defined(__GNUC__) && \
+    !defined(CRABEMU_NO_SSSE3)
+#define LINE_PAL_SSSE3
+#include <immintrin.h>
+#endif
+
 #include "nesppu.h"
 #include "nesmem.h"
-
-static uint16 ppu_lut[256];
+#include "nesppu-tab.h"
+#include "statesave.h"
 
 static uint8 ppu_regs[8];
 static int ppu_addr_latched = 0;
@@ -43,12 +52,42 @@ static uint8 ppu_oam_ram[256];
 static uint8 ppu_bg_pal[16], real_bg_pal[16];
 static uint8 ppu_spr_pal[16], real_spr_pal[16];
 
+/* Output colours for the 32 palette entries, with the emphasis bits applied.
+   Rebuilt only when palette RAM or PPUMASK is written. */
+static pixel_t ppu_line_pal[32];
+static int ppu_line_pal_dirty = 1;
+
+#ifdef LINE_PAL_SSSE3
+/* The same colours split up by byte, so byte k of every colour is in
+   ppu_line_planes[k], for the table lookups. */
+static uint8 ppu_line_planes[sizeof(pixel_t)][32];
+static int line_pal_use_ssse3;
+#endif
+
+/* A sprite line with no sprites on it, for lines that don't draw any. */
+static const uint8 ppu_no_spr[256 + 16];
+
 static uint8 *ppu_map[0x30];
 static uint8 ppu_nametables[4096];
 
 static int ppu_patterns_rom = 0;
 static nes_ppu_pattern_t ppu_patterns[512];
 
+/* Where each group of 16 patterns currently comes from. This normally points
+   into ppu_patterns, but CHR-ROM banks are mapped straight into ppu_chr_store,
+   which holds the whole CHR-ROM pre-decoded. */
+static nes_ppu_pattern_t *ppu_patmap[32];
+static nes_ppu_pattern_t *ppu_chr_store = NULL;
+static const uint8 *ppu_chr_rom = NULL;
+static uint32 ppu_chr_size = 0;
+
+/* Patterns that the old scheme would have had to decode again after a bank
+   switch, used to count how much decoding the store saves. */
+static uint8 ppu_stale[512];
+static uint32 ppu_frames = 0;
+static uint32 ppu_decoded = 0;
+static uint32 ppu_saved = 0;
+
 static pixel_t *ppu_framebuffer;
 static void (*mmc2_cb)(uint16 pn);
 
@@ -65,28 +104,21 @@ struct ppu_spr {
 static int sprs_per_line[240];
 static struct ppu_spr sprs[240][8];
 
-void nes_ppu_update_cache(int pat) {
-    uint8 *bitplane;
+static void ppu_decode_pattern(nes_ppu_pattern_t *p, const uint8 *bitplane) {
     int i, j;
     uint8 pixel;
     uint8 *tex1, *tex2, *tex3, *tex4;
     int tmp[16];
     uint16 lutval;
 
-    if(pat >= 512 || !ppu_patterns[pat].dirty)
-        return;
-
-    /* Determine where we should start converting */
-    bitplane = ppu_map[pat >> 4] + ((pat & 0x0F) << 4);
-
     for(i = 0; i < 16; ++i) {
         tmp[i] = *bitplane++;
     }
 
-    tex1 = ppu_patterns[pat].texture[0] + 7;
-    tex2 = ppu_patterns[pat].texture[1];
-    tex3 = ppu_patterns[pat].texture[2] + 63;
-    tex4 = ppu_patterns[pat].texture[3] + 56;
+    tex1 = p->texture[0] + 7;
+    tex2 = p->texture[1];
+    tex3 = p->texture[2] + 63;
+    tex4 = p->texture[3] + 56;
 
     for(i = 0; i < 8; ++i) {
         /* lutval = 8x2bpp pixels */
@@ -108,14 +140,46 @@ void nes_ppu_update_cache(int pat) {
         tex4 -= 16;
     }
 
-    ppu_patterns[pat].dirty = 0;
+    p->dirty = 0;
+}
+
+void nes_ppu_update_cache(int pat) {
+    nes_ppu_pattern_t *p;
+
+    if(pat >= 512)
+        return;
+
+    p = ppu_patmap[pat >> 4] + (pat & 0x0F);
+
+    if(!p->dirty)
+        return;
+
+    /* Determine where we should start converting */
+    ppu_decode_pattern(p, ppu_map[pat >> 4] + ((pat & 0x0F) << 4));
+    ++ppu_decoded;
+}
+
+/* Look up a pattern for drawing, decoding it first if needed. */
+static __INLINE__ nes_ppu_pattern_t *ppu_pattern(int pn) {
+    nes_ppu_pattern_t *pat = ppu_patmap[pn >> 4] + (pn & 0x0F);
+
+    /* Update the cache if the pattern is marked as dirty */
+    if(pat->dirty) {
+        nes_ppu_update_cache(pn);
+    }
+    else if(ppu_stale[pn]) {
+        ppu_stale[pn] = 0;
+        ++ppu_saved;
+    }
+
+    return pat;
 }
 
 const nes_ppu_pattern_t *nes_ppu_fetch_pattern(int pat) {
     if(pat >= 512)
         return NULL;
 
-    return ppu_patterns + pat;
+    return ppu_pattern(pat);
 }
 
 void nes_ppu_fetch_bg_pal(uint8 pal[16]) {
@@ -144,6 +208,115 @@ void nes_ppu_fetch_spr_pal(uint8 pal[16]) {
     }
 }
 
+static void ppu_update_line_pal(void) {
+    uint8 pal[32];
+    int emph = (ppu_regs[1] & 0xE0) << 1, i;
+
+    nes_ppu_fetch_bg_pal(pal);
+    nes_ppu_fetch_spr_pal(pal + 16);
+
+    for(i = 0; i < 32; ++i) {
+        ppu_line_pal[i] = nes_pal[pal[i] | emph];
+    }
+
+#ifdef LINE_PAL_SSSE3
+    for(i = 0; i < 32; ++i) {
+        uint8 b[sizeof(pixel_t)];
+        size_t k;
+
+        memcpy(b, &ppu_line_pal[i], sizeof(pixel_t));
+
+        for(k = 0; k < sizeof(pixel_t); ++k) {
+            ppu_line_planes[k][i] = b[k];
+        }
+    }
+#endif
+
+    ppu_line_pal_dirty = 0;
+}
+
+#ifdef LINE_PAL_SSSE3
+/* pshufb only looks at the bottom four bits of each index, so each byte gets
+   looked up in both halves of the table and the right one picked after. */
+__attribute__((target("ssse3")))
+static void line_out_ssse3(pixel_t *out, const uint8 *bpal, const uint8 *bgp,
+                           const uint8 *sp, const uint8 *pri) {
+    __m128i lo[sizeof(pixel_t)], hi[sizeof(pixel_t)], p[sizeof(pixel_t)];
+    __m128i idx, sel, b, s, keep, zero = _mm_setzero_si128();
+    __m128i fifteen = _mm_set1_epi8(15);
+#ifdef CRABEMU_32BIT_COLOR
+    __m128i a, c;
+#endif
+    size_t k;
+    int i;
+
+    for(k = 0; k < sizeof(pixel_t); ++k) {
+        lo[k] = _mm_loadu_si128((const __m128i *)ppu_line_planes[k]);
+        hi[k] = _mm_loadu_si128((const __m128i *)(ppu_line_planes[k] + 16));
+    }
+
+    for(i = 0; i < 256; i += 16) {
+        /* The background shows where there's no sprite, or where the sprite
+           is behind a background pixel that isn't transparent. */
+        b = _mm_loadu_si128((const __m128i *)(bgp + i));
+        s = _mm_loadu_si128((const __m128i *)(sp + i));
+        keep = _mm_andnot_si128(_mm_cmpeq_epi8(b, zero),
+                                _mm_loadu_si128((const __m128i *)(pri + i)));
+        keep = _mm_or_si128(keep, _mm_cmpeq_epi8(s, zero));
+        b = _mm_add_epi8(b, _mm_loadu_si128((const __m128i *)(bpal + i)));
+        idx = _mm_or_si128(_mm_and_si128(keep, b), _mm_andnot_si128(keep, s));
+
+        sel = _mm_cmpgt_epi8(idx, fifteen);
+
+        for(k = 0; k < sizeof(pixel_t); ++k) {
+            p[k] = _mm_or_si128(
+                _mm_andnot_si128(sel, _mm_shuffle_epi8(lo[k], idx)),
+                _mm_and_si128(sel, _mm_shuffle_epi8(hi[k], idx)));
+        }
+
+        /* Put the bytes of each colour back together. */
+#ifdef CRABEMU_32BIT_COLOR
+        a = _mm_unpacklo_epi8(p[0], p[1]);
+        c = _mm_unpacklo_epi8(p[2], p[3]);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi16(a, c));
+        _mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(a, c));
+
+        a = _mm_unpackhi_epi8(p[0], p[1]);
+        c = _mm_unpackhi_epi8(p[2], p[3]);
+        _mm_storeu_si128((__m128i *)(out + i + 8), _mm_unpacklo_epi16(a, c));
+        _mm_storeu_si128((__m128i *)(out + i + 12), _mm_unpackhi_epi16(a, c));
+#else
+        _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi8(p[0], p[1]));
+        _mm_storeu_si128((__m128i *)(out + i + 8),
+                         _mm_unpackhi_epi8(p[0], p[1]));
+#endif
+    }
+}
+#endif
+
+/* Put the 256 pixels of a line together and look up the output colour of
+   each. bpal holds the background palette base of each pixel and bgp the
+   background pattern pixels, sp holds the sprite colours (0 where there isn't
+   a sprite) and pri is 0xFF where the sprite goes behind the background. */
+static void ppu_line_out(pixel_t *out, const uint8 *bpal, const uint8 *bgp,
+                         const uint8 *sp, const uint8 *pri) {
+    int i;
+
+#ifdef LINE_PAL_SSSE3
+    if(line_pal_use_ssse3) {
+        line_out_ssse3(out, bpal, bgp, sp, pri);
+        return;
+    }
+#endif
+
+    for(i = 0; i < 256; ++i) {
+        if(sp[i] && !(pri[i] && bgp[i]))
+            out[i] = ppu_line_pal[sp[i]];
+        else
+            out[i] = ppu_line_pal[bpal[i] + bgp[i]];
+    }
+}
+
 void *nes_ppu_framebuffer(void) {
     return ppu_framebuffer;
 }
@@ -172,6 +345,10 @@ void nes_ppu_writereg(int reg, uint8 val) {
             ppu_t = (ppu_t & 0xF3FF) | ((val & 0x03) << 10);
             break;
 
+        case 1:
+            ppu_line_pal_dirty = 1;
+            break;
+
         case 3:
             ppu_oam_addr = val;
             break;
@@ -217,6 +394,7 @@ void nes_ppu_writereg(int reg, uint8 val) {
             /* See where we're writing... */
             if(addr >= 0x3F00) {
                 val &= 0x3F;
+                ppu_line_pal_dirty = 1;
 
                 /* Palette memory */
                 if(addr & 0x0010) {
@@ -259,7 +437,7 @@ void nes_ppu_writereg(int reg, uint8 val) {
             }
             else if(addr < 0x2000 && !ppu_patterns_rom) {
                 ppu_map[addr >> 8][(uint8)addr] = val;
-                ppu_patterns[addr >> 4].dirty = 1;
+                ppu_patmap[addr >> 8][(addr >> 4) & 0x0F].dirty = 1;
             }
             break;
     }
@@ -338,6 +516,7 @@ void nes_ppu_write_oamdma(uint8 val) {
 
 void nes_ppu_vblank_in(void) {
     ppu_regs[2] |= 0x80;
+    ++ppu_frames;
 }
 
 void nes_ppu_vblank_out(void) {
@@ -369,13 +548,35 @@ void nes_ppu_set_tblmirrors(int n1, int n2, int n3, int n4) {
 
 void nes_ppu_set_patterntbl(int tbl, uint8 *ptr, int rom) {
     int i;
+    uint32 off;
 
     for(i = 0; i < 16; ++i) {
         ppu_map[(tbl << 4) + i] = ptr + (i << 8);
     }
 
     ppu_patterns_rom = rom;
+
+    /* If the bank is part of the pre-decoded CHR-ROM, just point at it. */
+    if(rom && ppu_chr_store && ptr >= ppu_chr_rom) {
+        off = (uint32)(ptr - ppu_chr_rom);
+
+        if(off + 0x1000 <= ppu_chr_size && !(off & 0x0F)) {
+            for(i = 0; i < 16; ++i) {
+                ppu_patmap[(tbl << 4) + i] = ppu_chr_store + (off >> 4) +
+                    (i << 4);
+            }
+
+            memset(ppu_stale + (tbl << 8), 1, 256);
+            return;
+        }
+    }
+
+    for(i = 0; i < 16; ++i) {
+        ppu_patmap[(tbl << 4) + i] = ppu_patterns + (tbl << 8) + (i << 4);
+    }
+
     tbl <<= 8;
+    memset(ppu_stale + tbl, 0, 256);
 
     /* Mark all the patterns in that table as dirty */
     for(i = 0; i < 256; ++i) {
@@ -383,6 +584,49 @@ void nes_ppu_set_patterntbl(int tbl, uint8 *ptr, int rom) {
     }
 }
 
+int nes_ppu_set_chr_rom(const uint8 *rom, uint32 size) {
+    uint32 i, count = size >> 4;
+
+    free(ppu_chr_store);
+    ppu_chr_store = NULL;
+    ppu_chr_rom = NULL;
+    ppu_chr_size = 0;
+
+    /* Put everything back to decoding on demand... */
+    for(i = 0; i < 32; ++i) {
+        ppu_patmap[i] = ppu_patterns + (i << 4);
+    }
+
+    memset(ppu_stale, 0, 512);
+
+    if(!rom || size < 0x1000 || size > NES_PPU_CHR_STORE_MAX)
+        return 0;
+
+    if(!(ppu_chr_store = (nes_ppu_pattern_t *)malloc(count *
+                                                     sizeof(nes_ppu_pattern_t)))) {
+#ifdef DEBUG
+        fprintf(stderr, "nes_ppu_set_chr_rom: Couldn't allocate store\n");
+        perror("malloc");
+#endif
+        return -1;
+    }
+
+    for(i = 0; i < count; ++i) {
+        ppu_decode_pattern(ppu_chr_store + i, rom + (i << 4));
+    }
+
+    ppu_chr_rom = rom;
+    ppu_chr_size = size;
+
+    return 0;
+}
+
+void nes_ppu_chr_stats(uint32 *frames, uint32 *decoded, uint32 *saved) {
+    *frames = ppu_frames;
+    *decoded = ppu_decoded;
+    *saved = ppu_saved;
+}
+
 /* Precalculate a whole frame's worth of sprite data. */
 static void ppu_calc_spr(void) {
     int i, j, k, height, pth;
@@ -465,7 +709,7 @@ static void ppu_calc_spr(void) {
                     sprs[j + y][k].spr_num = i;
                     sprs[j + y][k].pattern = pn2;
                     sprs[j + y][k].tex = tex;
-                    sprs[j + y][k].y = j;
+                    sprs[j + y][k].y = j - 8;
                     sprs[j + y][k].x = x;
                     sprs[j + y][k].pal = pal;
                     sprs[j + y][k].bg = bg;
@@ -477,20 +721,23 @@ static void ppu_calc_spr(void) {
     }
 }
 
-#define RENDER_BG_PIXEL() { \
-    pixel = *pixels++; \
-    *bgp++ = pixel; \
-    *px++ = pixel + pal; \
+/* Each tile row comes from its own pattern, so all there is to do here is
+   gather them up, along with the palette base for each pixel. Everything else
+   is done for the whole line at once in ppu_line_out(). */
+#define RENDER_BG_ROW() { \
+    memcpy(bgp, pixels, 8); \
+    memset(bpal, pal, 8); \
+    bgp += 8; \
+    bpal += 8; \
 }
 
-static void ppu_bg_draw(int line __UNUSED__, uint8 *px,
+static void ppu_bg_draw(int line __UNUSED__, uint8 bg_pal[256 + 16],
                         uint8 bg_pixels[256 + 16]) {
     int xc, yc, yf, nt, at;
     int col, pal, pn, pth;
-    uint8 ntb, atb, pixel;
+    uint8 ntb, atb;
     nes_ppu_pattern_t *pat;
-    uint8 *bgp = bg_pixels, *pixels;
-    uint8 *sp = px;
+    uint8 *bgp = bg_pixels, *bpal = bg_pal, *pixels;
 
     /* Which half of the pattern table are we using? */
     pth = (ppu_regs[0] & 0x10) << 4;
@@ -506,7 +753,7 @@ static void ppu_bg_draw(int line __UNUSED__, uint8 *px,
 
     /* Grab the first attribute byte and set up the pointers... */
     atb = ppu_map[at >> 8][(uint8)at];
-    px += 8 - ppu_x;
+    bpal += 8 - ppu_x;
     bgp += 8 - ppu_x;
 
     for(col = 0; col < 33; ++col) {
@@ -514,11 +761,7 @@ static void ppu_bg_draw(int line __UNUSED__, uint8 *px,
            corresponds to. */
         ntb = ppu_map[nt >> 8][(uint8)nt];
         pn = ntb + pth;
-        pat = ppu_patterns + pn;
-
-        /* Update the cache if the pattern is marked as dirty */
-        if(pat->dirty)
-            nes_ppu_update_cache(pn);
+        pat = ppu_pattern(pn);
 
         /* Grab the palette base */
         pal = ((yc & 0x02) << 1) | (xc & 0x02);
@@ -526,14 +769,7 @@ static void ppu_bg_draw(int line __UNUSED__, uint8 *px,
 
         /* Render the pixels! */
         pixels = pat->texture[0] + (yf << 3);
-        RENDER_BG_PIXEL();
-        RENDER_BG_PIXEL();
-        RENDER_BG_PIXEL();
-        RENDER_BG_PIXEL();
-        RENDER_BG_PIXEL();
-        RENDER_BG_PIXEL();
-        RENDER_BG_PIXEL();
-        RENDER_BG_PIXEL();
+        RENDER_BG_ROW();
 
         /* If we've got an MMC2 or an MMC4 and we need to set the latches, do
            so now. */
@@ -566,7 +802,7 @@ static void ppu_bg_draw(int line __UNUSED__, uint8 *px,
         *bgpl++ = 0;
         *bgpl++ = 0;
 
-        bgpl = (uint32 *)(sp + 8);
+        bgpl = (uint32 *)(bg_pal + 8);
         *bgpl++ = 0;
         *bgpl++ = 0;
     }
@@ -605,11 +841,7 @@ static void ppu_bg_skip(int line, uint8 bg_pixels[256 + 16]) {
            corresponds to. */
         ntb = ppu_map[nt >> 8][(uint8)nt];
         pn = ntb + pth;
-        pat = ppu_patterns + pn;
-
-        /* Update the cache if the pattern is marked as dirty */
-        if(pat->dirty)
-            nes_ppu_update_cache(pn);
+        pat = ppu_pattern(pn);
 
         /* "Render" the pixels! */
         pixels = pat->texture[0] + (yf << 3);
@@ -647,136 +879,63 @@ static void ppu_bg_skip(int line, uint8 bg_pixels[256 + 16]) {
     }
 }
 
-#define RENDER_SPR_PIXEL_FG_SPR0() { \
-    pixel = *pixels++; \
-    if(pixel) { \
-        px[x] = pixel + pal; \
-        col_tab[x] = 1; \
-        if(bg_pixels[x]) \
-            ppu_regs[2] |= 0x40; \
-    } \
-    ++x; \
-}
+/* Merge 4 pixels of a sprite's row into the sprite line, under any sprite
+   that's already there. Pattern pixels are 0-3 and the sprite line holds 0 or
+   a colour from 16-31, so looking at the bottom two bits or bit 4 of each byte
+   gives the masks for all 4 pixels at once. pal is the sprite's colour base
+   and bg is all ones if the sprite goes behind the background, both repeated
+   in every byte. Returns the mask of the sprite's own opaque pixels. */
+static __INLINE__ uint32 ppu_spr_merge(uint8 *sp, uint8 *pri,
+                                       const uint8 *pixels, uint32 pal,
+                                       uint32 bg) {
+    uint32 p, s, r, opaque, take;
 
-#define RENDER_SPR_PIXEL_BG_SPR0() { \
-    pixel = *pixels++; \
-    if(pixel) { \
-        col_tab[x] = 1; \
-        if(bg_pixels[x]) { \
-            ppu_regs[2] |= 0x40; \
-        } \
-        else { \
-            px[x] = pixel + pal; \
-        } \
-    } \
-    ++x; \
-}
+    memcpy(&p, pixels, 4);
+    memcpy(&s, sp, 4);
+    memcpy(&r, pri, 4);
 
-#define RENDER_SPR_PIXEL_FG() { \
-    pixel = *pixels++; \
-    if(!col_tab[x] && pixel) { \
-        px[x] = pixel + pal; \
-        col_tab[x] = 1; \
-    } \
-    ++x; \
-}
+    opaque = ((p | (p >> 1)) & 0x01010101) * 0xFF;
+    take = opaque & ~(((s >> 4) & 0x01010101) * 0xFF);
 
-#define RENDER_SPR_PIXEL_BG() { \
-    pixel = *pixels++; \
-    if(!col_tab[x] && pixel) { \
-        col_tab[x] = 1; \
-        if(!bg_pixels[x]) { \
-            px[x] = pixel + pal; \
-        } \
-    } \
-    ++x; \
+    s |= (p + pal) & take;
+    r |= bg & take;
+
+    memcpy(sp, &s, 4);
+    memcpy(pri, &r, 4);
+
+    return opaque;
 }
 
-static void ppu_spr_draw(int line, uint8 *px, uint8 bg_pixels[256 + 16]) {
-    static uint8 col_tab[256 + 16];
-    int i = 0, x, pal, pn;
+/* Build the sprite line: the colour of the first opaque sprite at each pixel,
+   and whether it goes behind the background. */
+static void ppu_spr_draw(int line, uint8 sp[256 + 16], uint8 pri[256 + 16],
+                         uint8 bg_pixels[256 + 16]) {
+    int i, x, pn;
     nes_ppu_pattern_t *pat;
     uint8 *pixels;
-    uint8 pixel;
-
-    /* First of all, clear out our colision table */
-    memset(col_tab, 0, 256 + 16);
+    uint32 pal, bg, opaque[2], b[2];
 
-    /* See if sprite 0 is on this line, since it needs a bit of special handling
-       in how we deal with it. */
-    if(sprs[line][0].spr_num == 0) {
-        i = 1;
-        pn = sprs[line][0].pattern;
-        pat = ppu_patterns + pn;
-
-        /* Update the cache if the pattern is marked as dirty */
-        if(pat->dirty)
-            nes_ppu_update_cache(pn);
-
-        pixels = &pat->texture[sprs[line][0].tex][sprs[line][0].y << 3];
-        x = sprs[line][0].x + 8;
-        pal = sprs[line][0].pal + 16;
-
-        if(sprs[line][0].bg) {
-            RENDER_SPR_PIXEL_BG_SPR0();
-            RENDER_SPR_PIXEL_BG_SPR0();
-            RENDER_SPR_PIXEL_BG_SPR0();
-            RENDER_SPR_PIXEL_BG_SPR0();
-            RENDER_SPR_PIXEL_BG_SPR0();
-            RENDER_SPR_PIXEL_BG_SPR0();
-            RENDER_SPR_PIXEL_BG_SPR0();
-            RENDER_SPR_PIXEL_BG_SPR0();
-        }
-        else {
-            RENDER_SPR_PIXEL_FG_SPR0();
-            RENDER_SPR_PIXEL_FG_SPR0();
-            RENDER_SPR_PIXEL_FG_SPR0();
-            RENDER_SPR_PIXEL_FG_SPR0();
-            RENDER_SPR_PIXEL_FG_SPR0();
-            RENDER_SPR_PIXEL_FG_SPR0();
-            RENDER_SPR_PIXEL_FG_SPR0();
-            RENDER_SPR_PIXEL_FG_SPR0();
-        }
-
-        /* If we've got an MMC2 or an MMC4 and we need to set the latches, do
-           so now. */
-        if(mmc2_cb &&
-           (pn == 0x0FD || pn == 0x0FE || pn == 0x1FD || pn == 0x1FE))
-            mmc2_cb(pn);
-    }
-
-    /* Go through all the sprites on this line. */
-    for(; i < 8 && sprs[line][i].spr_num != 0xFF; ++i) {
+    for(i = 0; i < 8 && sprs[line][i].spr_num != 0xFF; ++i) {
         pn = sprs[line][i].pattern;
-        pat = ppu_patterns + pn;
-
-        /* Update the cache if the pattern is marked as dirty */
-        if(pat->dirty)
-            nes_ppu_update_cache(pn);
+        pat = ppu_pattern(pn);
 
         pixels = &pat->texture[sprs[line][i].tex][sprs[line][i].y << 3];
         x = sprs[line][i].x + 8;
-        pal = sprs[line][i].pal + 16;
-
-        if(sprs[line][i].bg) {
-            RENDER_SPR_PIXEL_BG();
-            RENDER_SPR_PIXEL_BG();
-            RENDER_SPR_PIXEL_BG();
-            RENDER_SPR_PIXEL_BG();
-            RENDER_SPR_PIXEL_BG();
-            RENDER_SPR_PIXEL_BG();
-            RENDER_SPR_PIXEL_BG();
-            RENDER_SPR_PIXEL_BG();
-        }
-        else {
-            RENDER_SPR_PIXEL_FG();
-            RENDER_SPR_PIXEL_FG();
-            RENDER_SPR_PIXEL_FG();
-            RENDER_SPR_PIXEL_FG();
-            RENDER_SPR_PIXEL_FG();
-            RENDER_SPR_PIXEL_FG();
-            RENDER_SPR_PIXEL_FG();
-            RENDER_SPR_PIXEL_FG();
+        pal = (sprs[line][i].pal + 16) * 0x01010101;
+        bg = sprs[line][i].bg ? 0xFFFFFFFF : 0;
+
+        opaque[0] = ppu_spr_merge(sp + x, pri + x, pixels, pal, bg);
+        opaque[1] = ppu_spr_merge(sp + x + 4, pri + x + 4, pixels + 4, pal,
+                                  bg);
+
+        /* Sprite 0 hits wherever it has a pixel over one of the
+           background's. */
+        if(sprs[line][i].spr_num == 0) {
+            memcpy(b, bg_pixels + x, 8);
+
+            if((opaque[0] & (b[0] | (b[0] >> 1)) & 0x01010101) ||
+               (opaque[1] & (b[1] | (b[1] >> 1)) & 0x01010101))
+                ppu_regs[2] |= 0x40;
         }
 
         /* If we've got an MMC2 or an MMC4 and we need to set the latches, do
@@ -808,11 +967,7 @@ static void ppu_spr_skip(int line, uint8 bg_pixels[256 + 16]) {
     if(sprs[line][0].spr_num == 0) {
         i = 1;
         pn = sprs[line][0].pattern;
-        pat = ppu_patterns + pn;
-
-        /* Update the cache if the pattern is marked as dirty */
-        if(pat->dirty)
-            nes_ppu_update_cache(pn);
+        pat = ppu_pattern(pn);
 
         pixels = &pat->texture[sprs[line][0].tex][sprs[line][0].y << 3];
         x = sprs[line][0].x + 8;
@@ -850,10 +1005,11 @@ static void ppu_spr_skip(int line, uint8 bg_pixels[256 + 16]) {
 }
 
 void nes_ppu_execute(int line, int skip) {
-    int bg = ppu_regs[1] & 0x08, spr = ppu_regs[1] & 0x10, i;
+    int bg = ppu_regs[1] & 0x08, spr = ppu_regs[1] & 0x10;
     uint8 bg_pixels[256 + 16];
-    uint8 fb_buf[256 + 16];
-    uint8 *px = fb_buf;
+    uint8 bg_pal[256 + 16];
+    uint8 spr_px[256 + 16], spr_pri[256 + 16];
+    const uint8 *sp = ppu_no_spr, *pri = ppu_no_spr;
     int tmp;
 
     /* Calculate all the sprite data for the frame on the first line */
@@ -864,10 +1020,8 @@ void nes_ppu_execute(int line, int skip) {
        0th color. Sprites might still be enabled, so we still do have to deal
        with the rest of the rendering from here. */
     if(!bg && !skip) {
-        for(i = 0; i < 256 + 16; ++i) {
-            *px++ = 0;
-            bg_pixels[i] = 0;
-        }
+        memset(bg_pal, 0, sizeof(bg_pal));
+        memset(bg_pixels, 0, sizeof(bg_pixels));
     }
 
     if(bg || spr) {
@@ -878,10 +1032,15 @@ void nes_ppu_execute(int line, int skip) {
 
         if(!skip) {
             if(bg)
-                ppu_bg_draw(line, px, bg_pixels);
-
-            if(spr)
-                ppu_spr_draw(line, px, bg_pixels);
+                ppu_bg_draw(line, bg_pal, bg_pixels);
+
+            if(spr && sprs[line][0].spr_num != 0xFF) {
+                memset(spr_px, 0, sizeof(spr_px));
+                memset(spr_pri, 0, sizeof(spr_pri));
+                ppu_spr_draw(line, spr_px, spr_pri, bg_pixels);
+                sp = spr_px;
+                pri = spr_pri;
+            }
         }
         else {
             if(bg)
@@ -921,16 +1080,12 @@ void nes_ppu_execute(int line, int skip) {
 
     /* Copy over the buffer to the actual framebuffer. */
     if(!skip) {
-        uint8 pal[32];
         pixel_t *px2 = ppu_framebuffer + (line << 8);
-        int emph = (ppu_regs[1] & 0xE0) << 1;
 
-        nes_ppu_fetch_bg_pal(pal);
-        nes_ppu_fetch_spr_pal(pal + 16);
+        if(ppu_line_pal_dirty)
+            ppu_update_line_pal();
 
-        for(i = 0; i < 256; ++i) {
-            px2[i] = nes_pal[pal[fb_buf[i + 8]] | emph];
-        }
+        ppu_line_out(px2, bg_pal + 8, bg_pixels + 8, sp + 8, pri + 8);
     }
 }
 
@@ -946,6 +1101,7 @@ int nes_ppu_init(void) {
 
     for(i = 0; i < 0x20; ++i) {
         ppu_map[i] = NULL;
+        ppu_patmap[i] = ppu_patterns + (i << 4);
     }
 
     /* Mark all patterns as dirty */
@@ -976,13 +1132,13 @@ int nes_ppu_init(void) {
     ppu_x = 0;
     ppu_oam_addr = 0;
     ppu_patterns_rom = 0;
+    ppu_line_pal_dirty = 1;
     mmc2_cb = NULL;
 
-    for(i = 0; i < 256; ++i) {
-        ppu_lut[i] = (i & 0x01) | ((i & 0x02) << 1) | ((i & 0x04) << 2) |
-            ((i & 0x08) << 3) | ((i & 0x10) << 4) | ((i & 0x20) << 5) |
-            ((i & 0x40) << 6) | ((i & 0x80) << 7);
-    }
+#ifdef LINE_PAL_SSSE3
+    __builtin_cpu_init();
+    line_pal_use_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
 
 #ifndef _arch_dreamcast
     if(!(ppu_framebuffer = (pixel_t *)malloc(256 * 256 * sizeof(pixel_t))))
@@ -1023,6 +1179,7 @@ int nes_ppu_reset(void) {
     ppu_x = 0;
     ppu_oam_addr = 0;
     ppu_patterns_rom = 0;
+    ppu_line_pal_dirty = 1;
     mmc2_cb = NULL;
 
     memset(ppu_framebuffer, 0, 256 * 256 * sizeof(pixel_t));
@@ -1036,6 +1193,17 @@ void nes_ppu_set_mmc2(void (*cb)(uint16 pn)) {
 }
 
 int nes_ppu_shutdown(void) {
+#ifdef DEBUG
+    if(ppu_frames)
+        fprintf(stderr, "nes_ppu: %u pattern decodes saved by the CHR-ROM "
+                "store over %u frames (%u per frame), %u decoded\n",
+                (unsigned)ppu_saved, (unsigned)ppu_frames,
+                (unsigned)(ppu_saved / ppu_frames), (unsigned)ppu_decoded);
+#endif
+
+    nes_ppu_set_chr_rom(NULL, 0);
+    ppu_frames = ppu_decoded = ppu_saved = 0;
+
 #ifdef _arch_dreamcast
     /* Put the framebuffer back into P1. */
     ppu_framebuffer = (pixel_t *)((uint32)ppu_framebuffer & 0xDFFFFFFF);
@@ -1070,12 +1238,10 @@ static int nes_ppu_write_cram_context(FILE *fp) {
     return 0;
 }
 
-static int nes_ppu_read_cram_context(const uint8 *buf) {
-    uint32 len;
+static int nes_ppu_read_cram_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 48)
         return -1;
 
@@ -1088,6 +1254,9 @@ static int nes_ppu_read_cram_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     memcpy(real_bg_pal, buf + 16, 16);
     memcpy(ppu_bg_pal, buf + 16, 16);
     memcpy(real_spr_pal, buf + 32, 16);
@@ -1119,12 +1288,10 @@ static int nes_ppu_write_oamr_context(FILE *fp) {
     return 0;
 }
 
-static int nes_ppu_read_oamr_context(const uint8 *buf) {
-    uint32 len;
+static int nes_ppu_read_oamr_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 272)
         return -1;
 
@@ -1137,6 +1304,9 @@ static int nes_ppu_read_oamr_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     memcpy(ppu_oam_ram, buf + 16, 256);
     return 0;
 }
@@ -1165,12 +1335,10 @@ static int nes_ppu_write_ntrm_context(FILE *fp) {
     return 0;
 }
 
-static int nes_ppu_read_ntrm_context(const uint8 *buf) {
-    uint32 len;
+static int nes_ppu_read_ntrm_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 4112)
         return -1;
 
@@ -1183,6 +1351,9 @@ static int nes_ppu_read_ntrm_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     memcpy(ppu_nametables, buf + 16, 4096);
     return 0;
 }
@@ -1233,14 +1404,19 @@ int nes_ppu_write_context(FILE *fp) {
     return 0;
 }
 
-int nes_ppu_read_context(const uint8 *buf) {
-    uint32 len, child, clen;
+static const statesave_reader_t ppu_children[] = {
+    { FOURCC_TO_UINT32('O', 'A', 'M', 'R'), &nes_ppu_read_oamr_context },
+    { FOURCC_TO_UINT32('C', 'R', 'A', 'M'), &nes_ppu_read_cram_context },
+    { FOURCC_TO_UINT32('N', 'T', 'R', 'M'), &nes_ppu_read_ntrm_context },
+    { 0, NULL }
+};
+
+int nes_ppu_read_context(const uint8 *buf, uint32 len, int load) {
+    uint32 child;
     uint16 ver;
-    const uint8 *ptr;
     int rv, i;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 4464)
         return -1;
 
@@ -1254,6 +1430,13 @@ int nes_ppu_read_context(const uint8 *buf) {
     if(child != 16)
         return -1;
 
+    /* Make sure the child nodes are sane before loading anything */
+    if(statesave_check(buf + 16 + child, len - 16 - child, ppu_children))
+        return -2;
+
+    if(!load)
+        return 0;
+
     /* Read the PPU state */
     for(i = 0; i < 8; ++i) {
         nes_ppu_writereg(i, buf[16 + i]);
@@ -1266,48 +1449,12 @@ int nes_ppu_read_context(const uint8 *buf) {
     nes_ppu_set_tblmirrors(buf[28], buf[29], buf[30], buf[31]);
     ppu_addr_latched = 0;
 
-    /* Handle child nodes */
-    ptr = buf + 16 + child;
-
-    while(ptr < buf + len) {
-        rv = 0;
-
-        /* Check for a malformed child node */
-        if(ptr + 16 > buf + len)
-            return -2;
-
-        child = FOURCC_TO_UINT32(ptr[0], ptr[1], ptr[2], ptr[3]);
-        BUF_TO_UINT32(ptr + 4, clen);
-
-        /* Make sure the length is sane */
-        if(ptr + clen > buf + len)
-            return -2;
+    /* Load the child nodes */
+    if((rv = statesave_load(buf + 16 + child, len - 16 - child, ppu_children)))
+        return rv;
 
-        switch(child) {
-            case FOURCC_TO_UINT32('O', 'A', 'M', 'R'):
-                rv = nes_ppu_read_oamr_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('C', 'R', 'A', 'M'):
-                rv = nes_ppu_read_cram_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('N', 'T', 'R', 'M'):
-                rv = nes_ppu_read_ntrm_context(ptr);
-                break;
-
-            default:
-                /* See if its marked as essential... */
-                BUF_TO_UINT16(ptr + 10, ver);
-                if(ver & 1)
-                    rv = -1;
-        }
-
-        if(rv)
-            return rv;
-
-        ptr += clen;
-    }
+    /* The palette and PPUMASK have probably changed */
+    ppu_line_pal_dirty = 1;
 
     /* Mark all patterns as dirty */
     for(i = 0; i < 512; ++i) {
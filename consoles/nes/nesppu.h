@@ -55,6 +55,17 @@ extern int nes_ppu_vblnmi_enabled(void);
 extern void nes_ppu_set_tblmirrors(int n1, int n2, int n3, int n4);
 extern void nes_ppu_set_patterntbl(int tbl, uint8 *ptr, int rom);
 
+/* Decode a whole CHR-ROM up front, so that mapping one of its banks with
+   nes_ppu_set_patterntbl() doesn't cause any of its patterns to be decoded
+   again. Pass NULL to drop the store. CHR-ROMs bigger than
+   NES_PPU_CHR_STORE_MAX are decoded on demand, as with CHR-RAM.
+   nes_ppu_chr_stats() reports how many frames have run, how many patterns
+   were decoded on demand, and how many decodes the store saved. */
+#define NES_PPU_CHR_STORE_MAX   (256 * 1024)
+
+extern int nes_ppu_set_chr_rom(const uint8 *rom, uint32 size);
+extern void nes_ppu_chr_stats(uint32 *frames, uint32 *decoded, uint32 *saved);
+
 extern void nes_ppu_execute(int line, int skip);
 extern void nes_ppu_set_mmc2(void (*cb)(uint16 pn));
 
@@ -63,7 +74,7 @@ extern int nes_ppu_reset(void);
 extern int nes_ppu_shutdown(void);
 
 extern int nes_ppu_write_context(FILE *fp);
-extern int nes_ppu_read_context(const uint8 *buf);
+extern int nes_ppu_read_context(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
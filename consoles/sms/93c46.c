@@ -20,8 +20,14 @@
 #include <string.h>
 #include <stdio.h>
 #include "93c46.h"
+#include "sramfile.h"
 
-eeprom93c46_t e93c46;
+/* The contents get pages of their own, so they can be mapped to the save
+   file. */
+static uint16 e93c46_data[SRAMFILE_ROUND(128) / sizeof(uint16)]
+    SRAMFILE_ALIGNED;
+
+eeprom93c46_t e93c46 = { .data = e93c46_data };
 
 void eeprom93c46_init(void) {
     memset(e93c46.data, 0xFF, 64 * sizeof(uint16));
@@ -37,7 +37,7 @@ CLINKAGE
 #define EEPROM93c46_LINE_DATA_OUT 8
 
 typedef struct eeprom93c46_s {
-    uint16 data[64];
+    uint16 *data;                       /* 64 words */
     int mode;
     int bit;
     uint16 data_in;
@@ -230,12 +230,10 @@ int sms_mem_93c46_write_context(FILE *fp) {
     return 0;
 }
 
-int sms_mem_93c46_read_context(const uint8 *buf) {
-    uint32 len;
+int sms_mem_93c46_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 28)
         return -1;
 
@@ -248,6 +246,9 @@ int sms_mem_93c46_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     memcpy(sms_paging_regs, buf + 16, 4);
     e93c46.mode = buf[20];
@@ -261,13 +262,11 @@ int sms_mem_93c46_read_context(const uint8 *buf) {
     return 0;
 }
 
-int sms_mem_93c46_read_mem(const uint8 *buf) {
-    uint32 len;
+int sms_mem_93c46_read_mem(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
     int i;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 144)
         return -1;
 
@@ -280,6 +279,9 @@ int sms_mem_93c46_read_mem(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Read in the data */
     for(i = 0; i < 64; ++i) {
         BUF_TO_UINT16(buf + 16 + (i << 1), e93c46.data[i]);
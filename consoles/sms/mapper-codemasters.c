@@ -204,12 +204,10 @@ int sms_mem_codemasters_write_context(FILE *fp) {
     return 0;
 }
 
-int sms_mem_codemasters_read_context(const uint8 *buf) {
-    uint32 len;
+int sms_mem_codemasters_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 20)
         return -1;
 
@@ -222,17 +220,18 @@ int sms_mem_codemasters_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     memcpy(sms_paging_regs, buf + 16, 4);
     return 0;
 }
 
-int sms_mem_codemasters_read_mem(const uint8 *buf) {
-    uint32 len;
+int sms_mem_codemasters_read_mem(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 8208)
         return -1;
 
@@ -245,6 +244,9 @@ int sms_mem_codemasters_read_mem(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     memcpy(sms_cart_ram, buf + 16, 8192);
     return 0;
 }
@@ -37,8 +37,9 @@ extern void sms_mem_codemasters_mwrite16(uint16 addr,
                                          uint16 data);
 
 extern int sms_mem_codemasters_write_context(FILE *fp);
-extern int sms_mem_codemasters_read_context(const uint8 *buf);
-extern int sms_mem_codemasters_read_mem(const uint8 *buf);
+extern int sms_mem_codemasters_read_context(const uint8 *buf, uint32 len,
+                                            int load);
+extern int sms_mem_codemasters_read_mem(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
@@ -39,7 +39,7 @@ extern void sms_mem_janggun_shutdown(void);
 extern void sms_mem_janggun_reset(void);
 
 extern int sms_mem_janggun_write_context(FILE *fp);
-extern int sms_mem_janggun_read_context(const uint8 *buf);
+extern int sms_mem_janggun_read_context(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
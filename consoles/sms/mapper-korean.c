@@ -116,12 +116,10 @@ int sms_mem_korean_write_context(FILE *fp) {
     return 0;
 }
 
-int sms_mem_korean_read_context(const uint8 *buf) {
-    uint32 len;
+int sms_mem_korean_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 20)
         return -1;
 
@@ -134,6 +132,9 @@ int sms_mem_korean_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     sms_paging_regs[3] = buf[16];
     return 0;
@@ -35,7 +35,7 @@ extern uint16 sms_mem_korean_mread16(uint16 addr);
 extern void sms_mem_korean_mwrite16(uint16 addr, uint16 data);
 
 extern int sms_mem_korean_write_context(FILE *fp);
-extern int sms_mem_korean_read_context(const uint8 *buf);
+extern int sms_mem_korean_read_context(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
@@ -58,7 +58,9 @@ int sms_mem_nomap_write_context(FILE *fp __UNUSED__) {
 }
 
 /* This shouldn't ever get called! */
-int sms_mem_nomap_read_context(const uint8 *buf __UNUSED__) {
+int sms_mem_nomap_read_context(const uint8 *buf __UNUSED__,
+                               uint32 len __UNUSED__,
+                               int load __UNUSED__) {
 #ifdef DEBUG
     fprintf(stderr, "Read context called with invalid mapper!\n");
 #endif
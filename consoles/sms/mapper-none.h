@@ -33,7 +33,7 @@ extern uint16 sms_mem_nomap_mread16(uint16 addr);
 extern void sms_mem_nomap_mwrite16(uint16 addr, uint16 data);
 
 extern int sms_mem_nomap_write_context(FILE *fp);
-extern int sms_mem_nomap_read_context(const uint8 *buf);
+extern int sms_mem_nomap_read_context(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
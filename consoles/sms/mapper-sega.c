@@ -130,12 +130,10 @@ int sms_mem_sega_write_context(FILE *fp) {
     return 0;
 }
 
-int sms_mem_sega_read_context(const uint8 *buf) {
-    uint32 len;
+int sms_mem_sega_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 20)
         return -1;
 
@@ -148,17 +146,18 @@ int sms_mem_sega_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     memcpy(sms_paging_regs, buf + 16, 4);
     return 0;
 }
 
-int sms_mem_sega_read_mem(const uint8 *buf) {
-    uint32 len;
+int sms_mem_sega_read_mem(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len < 16 || len > 0x8010)
         return -1;
 
@@ -171,7 +170,10 @@ int sms_mem_sega_read_mem(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
-    memset(sms_cart_ram, 0, 0x8000);
+    if(!load)
+        return 0;
+
     memcpy(sms_cart_ram, buf + 16, len - 16);
+    memset(sms_cart_ram + len - 16, 0, 0x8000 - (len - 16));
     return 0;
 }
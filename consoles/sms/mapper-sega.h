@@ -33,8 +33,8 @@ extern uint16 sms_mem_sega_mread16(uint16 addr);
 extern void sms_mem_sega_mwrite16(uint16 addr, uint16 data);
 
 extern int sms_mem_sega_write_context(FILE *fp);
-extern int sms_mem_sega_read_context(const uint8 *buf);
-extern int sms_mem_sega_read_mem(const uint8 *buf);
+extern int sms_mem_sega_read_context(const uint8 *buf, uint32 len, int load);
+extern int sms_mem_sega_read_mem(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
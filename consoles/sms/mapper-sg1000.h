@@ -36,7 +36,7 @@ extern uint16 sms_mem_sg_mread16(uint16 addr);
 extern void sms_mem_sg_mwrite16(uint16 addr, uint16 data);
 
 extern int sms_mem_8kb_write_context(FILE *fp);
-extern int sms_mem_8kb_read_mem(const uint8 *buf);
+extern int sms_mem_8kb_read_mem(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
@@ -33,6 +33,8 @@
 #include "smsmem.h"
 #include "mappers.h"
 #include "rom.h"
+#include "gamedb.h"
+#include "console.h"
 
 typedef struct srom_s {
     uint32 adler32;
@@ -40,6 +42,8 @@ typedef struct srom_s {
     uint32 mapper;
 } special_rom_t;
 
+/* These are all in gamedb.txt too. This copy is for when there's no database
+   file to be had. */
 static const int rom_count = 27;
 static special_rom_t romlist[] = {
     { 0xBF3A0EDC, 0x092F29D6, SMS_MAPPER_CASTLE }, /* The Castle - SG-1000 */
@@ -74,10 +78,10 @@ static special_rom_t romlist[] = {
 uint32 sms_find_mapper(const uint8 *rom, uint32 len, uint32 *rcrc,
                        uint32 *radler) {
     uint32 adler, crc;
+    gamedb_entry_t ent;
     int i;
 
-    adler = rom_adler32(rom, len);
-    crc = rom_crc32(rom, len);
+    rom_checksums(rom, len, &crc, &adler);
 
 #ifdef DEBUG
     printf("Checksums: Adler-32: 0x%08" PRIX32 " CRC32: 0x%08" PRIX32 "\n",
@@ -90,6 +94,16 @@ uint32 sms_find_mapper(const uint8 *rom, uint32 len, uint32 *rcrc,
     if(radler)
         *radler = adler;
 
+    /* The game database, if one is loaded, knows about more than the list
+       above does, so it goes first. */
+    if(!gamedb_find(crc, adler, &ent) && ent.console != CONSOLE_NES &&
+       ent.console != CONSOLE_COLECOVISION && ent.console != CONSOLE_CHIP8) {
+        if(ent.mapper != GAMEDB_NO_MAPPER)
+            return ent.mapper;
+        else if(ent.sram == GAMEDB_SRAM_93C46)
+            return SMS_MAPPER_93C46;
+    }
+
     for(i = 0; i < rom_count; ++i) {
 #ifndef NO_ZLIB
         if(romlist[i].adler32 == adler && romlist[i].crc32 == crc) {
@@ -104,3 +118,63 @@ uint32 sms_find_mapper(const uint8 *rom, uint32 len, uint32 *rcrc,
 
     return (uint32)-1;
 }
+
+/* This function is based on code from MEKA, the duty of this function is to
+   try to autodetect what mapper type this cartridge should be using. */
+uint32 sms_guess_mapper(const uint8 *rom, uint32 len) {
+    /* Product codes of games that use the 93c46 serial eeprom. Most of these
+       should be detected by the sms_find_mapper function, but just in case,
+       detect them here as well. */
+    static const uint16 prodcodes[5] = {
+        0x3432, 0x2537, 0x2439, 0x3407, 0x2418
+    };
+    int codemasters, sega, korean, korean_msx, i;
+    const uint8 *ptr;
+    uint16 prodcode;
+
+    if(len > 0x8000) {
+        sega = 0;
+        codemasters = 0;
+        korean = 0;
+        korean_msx = 0;
+        ptr = rom;
+
+        while(ptr < rom + 0x8000) {
+            if((*ptr++) == 0x32) {
+                uint16 value = (*ptr) | ((*(ptr + 1)) << 8);
+
+                ptr += 2;
+
+                if(value == 0xFFFF)
+                    ++sega;
+                else if(value == 0x8000 || value == 0x4000)
+                    ++codemasters;
+                else if(value == 0xA000)
+                    ++korean;
+                else if(value == 0x0002 || value == 0x0003 || value == 0x0004)
+                    ++korean_msx;
+            }
+        }
+
+        if(korean_msx > sega + 2)
+            return SMS_MAPPER_KOREAN_MSX;
+        else if(codemasters > sega + 2)
+            return SMS_MAPPER_CODEMASTERS;
+        else if(korean > sega + 2)
+            return SMS_MAPPER_KOREAN;
+    }
+
+    /* If the cartridge contains less than 32KB of data, there probably isn't
+       even a mapper in it, but just to be safe, in case it has SRAM for some
+       reason, we'll just assume the Sega Mapper. The header is still read from
+       where it would be in a 32KB cartridge, as the caller makes sure that's
+       there to read. */
+    prodcode = rom[0x7FFC] | (rom[0x7FFD] << 8) | ((rom[0x7FFE] & 0xF0) << 12);
+
+    for(i = 0; i < 5; ++i) {
+        if(prodcode == prodcodes[i])
+            return SMS_MAPPER_93C46;
+    }
+
+    return SMS_MAPPER_SEGA;
+}
@@ -30,6 +30,11 @@ CLINKAGE
 extern uint32 sms_find_mapper(const uint8 *rom, uint32 len, uint32 *rcrc,
                               uint32 *radler);
 
+/* Guess the mapper of a cartridge that isn't in the list above by looking at
+   how it writes to the paging registers. rom must have at least 32KB readable,
+   even if len is smaller. */
+extern uint32 sms_guess_mapper(const uint8 *rom, uint32 len);
+
 ENDCLINK
 
 #endif /* !MAPPERS_H */
@@ -33,6 +33,14 @@
 #include "icon.h"
 #endif
 
+#ifndef _arch_dreamcast
+#include <pthread.h>
+#endif
+
+#ifdef __APPLE__
+#include "fmemopen/fmemopen.h"
+#endif
+
 #include "sms.h"
 #include "smsvdp.h"
 #include "smsmem.h"
@@ -41,9 +49,12 @@
 #include "sn76489.h"
 #include "ym2413.h"
 #include "sound.h"
+#include "mixer.h"
 #include "cheats.h"
 #include "sdscterminal.h"
 #include "console.h"
+#include "bootcache.h"
+#include "statesave.h"
 
 uint16 sms_pad = 0xFFFF;
 int sms_psg_enabled = 1;
@@ -52,18 +63,18 @@ sn76489_t psg;
 int sms_region = SMS_REGION_EXPORT;
 YM2413 *sms_fm = NULL;
 
+/* The YM2413 isn't set up until something uses it (see sms_fm_start()). */
+static int fm_clock;
+
 uint32 psg_samples[313];
 
 static const float NTSC_Z80_CLOCK = 3579545.0f;
-static const int PSG_DIVISOR = 16;
 static const int NTSC_FPS = 60;
 static const int NTSC_LINES_PER_FRAME = 262;
-static const float NTSC_CLOCKS_PER_SAMPLE = 5.073051303855f;
 
 static const float PAL_Z80_CLOCK = 3546893.0f;
 static const int PAL_FPS = 50;
 static const int PAL_LINES_PER_FRAME = 313;
-static const float PAL_CLOCKS_PER_SAMPLE = 5.02677579365f;
 
 extern uint8 sms_gg_regs[7];
 extern int sms_bios_active;
@@ -73,11 +84,17 @@ extern uint32 sms_gfxbd_data[2];
 static int cycles_run, cycles_to_run, scanline;
 
 #ifndef _arch_dreamcast
+static bootcache_t boot;
+
 static void sms_frame(int);
 static void sms_scanline(void);
 static void sms_single_step(void);
 static void sms_finish_frame(void);
 static void sms_finish_scanline(void);
+
+/* The PSG and FM outputs go through a mixer, so each can have its own gain and
+   pan, and loud FM can't wrap around. */
+static mixer_t sms_mixer;
 #endif
 static int sms_current_scanline(void);
 static int sms_cycles_left(void);
@@ -128,43 +145,57 @@ int sms_init(int video_system, int region, int borders) {
     float tmp;
 
     if(video_system == SMS_VIDEO_NTSC) {
-        tmp = NTSC_Z80_CLOCK / PSG_DIVISOR / NTSC_FPS / NTSC_LINES_PER_FRAME /
-              NTSC_CLOCKS_PER_SAMPLE;
+        tmp = (float)SOUND_CORE_RATE / NTSC_FPS / NTSC_LINES_PER_FRAME;
 
         for(i = 0; i < NTSC_LINES_PER_FRAME; ++i) {
             psg_samples[i] = (uint32) (tmp * (i + 1)) -
                              (uint32) (tmp * i);
         }
 
-        /* We end up generating 734 samples per frame @ 44100 Hz, 60fps, but we
-           need 735. */
-        psg_samples[261] += 1;
+        /* Rounding leaves the frame a sample short at some rates, so the last
+           line takes whatever the others didn't. */
+        psg_samples[NTSC_LINES_PER_FRAME - 1] = SOUND_CORE_RATE / NTSC_FPS -
+            (uint32) (tmp * (NTSC_LINES_PER_FRAME - 1));
 
         region |= SMS_VIDEO_NTSC;
 
-        sn76489_init(&psg, NTSC_Z80_CLOCK, 44100.0f,
+        sn76489_init(&psg, NTSC_Z80_CLOCK, (float)SOUND_CORE_RATE,
                      SN76489_NOISE_BITS_SMS, SN76489_NOISE_TAPPED_SMS);
-        sms_fm = ym2413_init(NTSC_Z80_CLOCK, 44100);
+        fm_clock = (int)NTSC_Z80_CLOCK;
     }
     else {
-        tmp = PAL_Z80_CLOCK / PSG_DIVISOR / PAL_FPS / PAL_LINES_PER_FRAME /
-             PAL_CLOCKS_PER_SAMPLE;
+        tmp = (float)SOUND_CORE_RATE / PAL_FPS / PAL_LINES_PER_FRAME;
 
         for(i = 0; i < PAL_LINES_PER_FRAME; ++i) {
             psg_samples[i] = (uint32) (tmp * (i + 1)) -
                              (uint32) (tmp * i);
         }
 
-        /* We need 882 samples per frame @ 44100 Hz, 50fps. */
+        psg_samples[PAL_LINES_PER_FRAME - 1] = SOUND_CORE_RATE / PAL_FPS -
+            (uint32) (tmp * (PAL_LINES_PER_FRAME - 1));
+
         region |= SMS_VIDEO_PAL;
 
-        sn76489_init(&psg, PAL_Z80_CLOCK, 44100.0f,
+        sn76489_init(&psg, PAL_Z80_CLOCK, (float)SOUND_CORE_RATE,
                      SN76489_NOISE_BITS_SMS, SN76489_NOISE_TAPPED_SMS);
-        sms_fm = ym2413_init(PAL_Z80_CLOCK, 44100);
+        fm_clock = (int)PAL_Z80_CLOCK;
     }
 
     sms_region = region;
 
+#ifndef _arch_dreamcast
+    /* Stamp PSG writes with their cycle so the frame's output can be
+       synthesized in one go with every write at its exact sample. */
+    sn76489_set_logging(&psg, &sms_cycles_elapsed);
+    sn76489_set_band_limited(&psg, 1);
+
+    mixer_init(&sms_mixer, 2);
+    mixer_add_stream(&sms_mixer, MIXER_STEREO);
+    mixer_add_stream(&sms_mixer, MIXER_SUM);
+
+    boot.pending = 1;
+#endif
+
     gui_set_console((console_t *)&sms_cons);
 
     sms_cheat_init();
@@ -176,7 +207,6 @@ int sms_init(int video_system, int region, int borders) {
     sound_init(2, video_system);
 
     sms_sdsc_reset();
-    ym2413_reset(sms_fm);
     cycles_run = cycles_to_run = scanline = 0;
 
     sms_cons._base.initialized = 1;
@@ -184,20 +214,30 @@ int sms_init(int video_system, int region, int borders) {
     return 0;
 }
 
-int sms_reset(void) {
-    if(sms_cons._base.initialized == 0)
-        return 0;
-
+static void psg_reset(void) {
     if(sms_region & SMS_VIDEO_NTSC) {
-        sn76489_reset(&psg, NTSC_Z80_CLOCK, 44100.0f,
+        sn76489_reset(&psg, NTSC_Z80_CLOCK, (float)SOUND_CORE_RATE,
                       SN76489_NOISE_BITS_SMS, SN76489_NOISE_TAPPED_SMS);
     }
     else {
-        sn76489_reset(&psg, PAL_Z80_CLOCK, 44100.0f,
+        sn76489_reset(&psg, PAL_Z80_CLOCK, (float)SOUND_CORE_RATE,
                       SN76489_NOISE_BITS_SMS, SN76489_NOISE_TAPPED_SMS);
     }
+}
+
+int sms_reset(void) {
+    if(sms_cons._base.initialized == 0)
+        return 0;
 
-    ym2413_reset(sms_fm);
+#ifndef _arch_dreamcast
+    sms_fm_sync();
+    boot.pending = 1;
+#endif
+
+    psg_reset();
+
+    if(sms_fm)
+        ym2413_reset(sms_fm);
 
     sound_reset_buffer();
 
@@ -220,7 +260,13 @@ int sms_soft_reset(void) {
     if(sms_cons._base.initialized == 0)
         return 0;
 
-    ym2413_reset(sms_fm);
+#ifndef _arch_dreamcast
+    sms_fm_sync();
+    boot.pending = 1;
+#endif
+
+    if(sms_fm)
+        ym2413_reset(sms_fm);
 
     sound_reset_buffer();
 
@@ -236,11 +282,16 @@ int sms_soft_reset(void) {
 }
 
 int sms_shutdown(void) {
+#ifndef _arch_dreamcast
+    sms_fm_set_threaded(0);
+#endif
+
     sms_cheat_shutdown();
     sms_mem_shutdown();
     sms_vdp_shutdown();
     sms_z80_shutdown();
     ym2413_shutdown(sms_fm);
+    sms_fm = NULL;
     sound_shutdown();
 
     /* Reset a few things in case we reinit later. */
@@ -252,39 +303,361 @@ int sms_shutdown(void) {
 }
 
 #ifndef _arch_dreamcast
-static __INLINE__ int update_sound(int16 buf[], int start, int line) {
-    int16 fmbuf[16];    /* More than we'll need, but meh. */
-    int16 tmp;
+void sms_sound_set_gain(int chip, float gain, float pan) {
+    if(chip == SMS_SOUND_PSG || chip == SMS_SOUND_FM)
+        mixer_set_gain(&sms_mixer, chip, gain, pan);
+}
+
+/* Mix a stretch of PSG and FM output (fmbuf is NULL if there is none) and send
+   it out. samples counts int16s, as update_sound() does. */
+static void output_sound(int16 *psgbuf, int16 *fmbuf, int samples) {
+    int16 *in[2] = { psgbuf, fmbuf };
+    int16 *out = sound_reserve(samples * sizeof(int16));
+
+    mixer_run(&sms_mixer, out, in, samples >> 1);
+    sound_commit(samples * sizeof(int16));
+}
+
+/* Threaded FM synthesis. When enabled, writes to the YM2413 made while running
+   a whole frame are logged with the Z80 cycle they happened on instead of
+   going to the chip. At the end of the frame the log is handed to the FM
+   thread, which renders the frame's FM output with each write at its sample.
+   The frame's PSG output is held back until then, and mixed with the FM and
+   submitted at the end of the next frame, so the sound ends up one frame
+   late. Only the FM thread touches sms_fm while it is running; anything else
+   that needs the chip has to call sms_fm_sync() first. */
+#define SMS_FM_LOG_SIZE     4096
+
+typedef struct sms_fm_logent_s {
+    int32 cycle;
+    uint8 addr;
+    uint8 data;
+} sms_fm_logent_t;
+
+static struct {
+    int running;
+    int quit;
+    int busy;
+    pthread_t thd;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+
+    /* Set while running a frame, so writes go to the log. */
+    int deferred;
+
+    /* The log being filled by the emulation thread is log[cur], the other
+       one belongs to the FM thread while busy is set. */
+    sms_fm_logent_t log[2][SMS_FM_LOG_SIZE];
+    uint32 log_count[2];
+    int cur;
+
+    /* What the FM thread is to render. */
+    int32 start;
+    int32 end;
+    uint32 samples;
+    int16 fmbuf[SOUND_FRAME_MAX << 1];
+
+    /* PSG output waiting on the FM thread, if pending is set. */
+    int16 psgbuf[SOUND_FRAME_MAX << 1];
+    uint32 pending;
+} fmthd;
+
+static void *fm_thread_proc(void *data __UNUSED__) {
+    sms_fm_logent_t *log;
+    uint32 i, count, pos, next, done;
+    int32 span;
+
+    pthread_mutex_lock(&fmthd.lock);
+
+    for(;;) {
+        while(!fmthd.busy && !fmthd.quit) {
+            pthread_cond_wait(&fmthd.work, &fmthd.lock);
+        }
+
+        if(!fmthd.busy)
+            break;
+
+        log = fmthd.log[fmthd.cur ^ 1];
+        count = fmthd.log_count[fmthd.cur ^ 1];
+        span = fmthd.end - fmthd.start;
+        pthread_mutex_unlock(&fmthd.lock);
+
+        for(i = 0, done = 0; i < count; ++i) {
+            /* Writes that overshot the end of the frame land on its last
+               sample. */
+            if(log[i].cycle <= fmthd.start || span <= 0)
+                next = 0;
+            else if(log[i].cycle >= fmthd.end)
+                next = fmthd.samples;
+            else
+                next = (uint32)(log[i].cycle - fmthd.start) * fmthd.samples /
+                    (uint32)span;
+
+            if(next > done) {
+                ym2413_update(sms_fm, fmthd.fmbuf + (done << 1), next - done);
+                done = next;
+            }
+
+            ym2413_write(sms_fm, log[i].addr, log[i].data);
+        }
+
+        if(done < fmthd.samples) {
+            pos = done << 1;
+            ym2413_update(sms_fm, fmthd.fmbuf + pos, fmthd.samples - done);
+        }
+
+        pthread_mutex_lock(&fmthd.lock);
+        fmthd.busy = 0;
+        pthread_cond_broadcast(&fmthd.done);
+    }
+
+    pthread_mutex_unlock(&fmthd.lock);
+    return NULL;
+}
+
+static void fm_thread_wait(void) {
+    pthread_mutex_lock(&fmthd.lock);
+
+    while(fmthd.busy) {
+        pthread_cond_wait(&fmthd.done, &fmthd.lock);
+    }
+
+    pthread_mutex_unlock(&fmthd.lock);
+}
+
+/* Mix the FM thread's last frame into the held back PSG output and send it
+   out. The FM thread must be idle. */
+static void fm_thread_submit_pending(void) {
+    if(!fmthd.pending)
+        return;
+
+    output_sound(fmthd.psgbuf, fmthd.fmbuf, fmthd.pending << 1);
+    fmthd.pending = 0;
+}
+
+/* Send out the last frame's held back audio, hand this frame's FM writes to
+   the FM thread, and hold on to this frame's PSG output until they're done.
+   samples is the number of int16s in buf, as update_sound() counts them. */
+static void fm_thread_frame(int16 buf[], int samples, int32 start) {
+    fm_thread_wait();
+    fm_thread_submit_pending();
+
+    memcpy(fmthd.psgbuf, buf, samples * sizeof(int16));
+    fmthd.pending = samples >> 1;
+
+    pthread_mutex_lock(&fmthd.lock);
+    fmthd.start = start;
+    fmthd.end = cycles_to_run;
+    fmthd.samples = samples >> 1;
+    fmthd.cur ^= 1;
+    fmthd.log_count[fmthd.cur] = 0;
+    fmthd.busy = 1;
+    pthread_cond_signal(&fmthd.work);
+    pthread_mutex_unlock(&fmthd.lock);
+}
+
+/* Apply whatever is in the log straight to the chip. The FM thread must be
+   idle. */
+static void fm_thread_flush_log(void) {
+    sms_fm_logent_t *log = fmthd.log[fmthd.cur];
     uint32 i;
 
-    if(sms_psg_enabled)
-        sn76489_execute_samples(&psg, buf + start, psg_samples[line]);
-    else
-        memset(buf + start, 0, psg_samples[line] << 2);
+    for(i = 0; i < fmthd.log_count[fmthd.cur]; ++i) {
+        ym2413_write(sms_fm, log[i].addr, log[i].data);
+    }
+
+    fmthd.log_count[fmthd.cur] = 0;
+}
+
+int sms_fm_set_threaded(int enable) {
+    if(enable == fmthd.running)
+        return 0;
 
-    if(sms_ym2413_enabled) {
-        ym2413_update(sms_fm, fmbuf, psg_samples[line]);
+    if(!enable) {
+        sms_fm_sync();
 
-        /* Mix in the FM unit's samples */
-        for(i = 0; i < psg_samples[line]; ++i) {
-            tmp = (fmbuf[i << 1] + fmbuf[(i << 1) + 1]);
-            buf[(i << 1) + start] += tmp;
-            buf[(i << 1) + 1 + start] += tmp;
+        pthread_mutex_lock(&fmthd.lock);
+        fmthd.quit = 1;
+        pthread_cond_signal(&fmthd.work);
+        pthread_mutex_unlock(&fmthd.lock);
+
+        pthread_join(fmthd.thd, NULL);
+
+        pthread_cond_destroy(&fmthd.done);
+        pthread_cond_destroy(&fmthd.work);
+        pthread_mutex_destroy(&fmthd.lock);
+        fmthd.running = 0;
+
+        return 0;
+    }
+
+    fmthd.quit = fmthd.busy = fmthd.deferred = 0;
+    fmthd.cur = 0;
+    fmthd.log_count[0] = fmthd.log_count[1] = 0;
+    fmthd.pending = 0;
+
+    pthread_mutex_init(&fmthd.lock, NULL);
+    pthread_cond_init(&fmthd.work, NULL);
+    pthread_cond_init(&fmthd.done, NULL);
+
+    if(pthread_create(&fmthd.thd, NULL, &fm_thread_proc, NULL)) {
+#ifdef DEBUG
+        fprintf(stderr, "sms_fm_set_threaded: Cannot create thread!\n");
+#endif
+        pthread_cond_destroy(&fmthd.done);
+        pthread_cond_destroy(&fmthd.work);
+        pthread_mutex_destroy(&fmthd.lock);
+        return -1;
+    }
+
+    fmthd.running = 1;
+
+    return 0;
+}
+
+/* Wait for the FM thread, send out any audio it was holding and apply any
+   logged writes, so the chip is up to date and safe to use directly. */
+void sms_fm_sync(void) {
+    if(!fmthd.running)
+        return;
+
+    fm_thread_wait();
+    fm_thread_submit_pending();
+    fm_thread_flush_log();
+}
+#endif /* !_arch_dreamcast */
+
+void sms_fm_write(int a, uint8 data) {
+#ifndef _arch_dreamcast
+    sms_fm_logent_t *ent;
+
+    if(fmthd.deferred) {
+        if(fmthd.log_count[fmthd.cur] < SMS_FM_LOG_SIZE) {
+            ent = &fmthd.log[fmthd.cur][fmthd.log_count[fmthd.cur]++];
+            ent->cycle = sms_cycles_elapsed();
+            ent->addr = (uint8)a;
+            ent->data = data;
+            return;
         }
+
+#ifdef DEBUG
+        fprintf(stderr, "sms_fm_write: write log full, applying now\n");
+#endif
+    }
+
+    /* Something outside of a threaded frame wants the chip. */
+    sms_fm_sync();
+#endif
+
+    if(!sms_fm_start())
+        ym2413_write(sms_fm, a, data);
+}
+
+/* Most games never touch the YM2413, so it's only set up (tables and all) the
+   first time something does. Until then there's no FM output at all. */
+int sms_fm_start(void) {
+    if(sms_fm)
+        return 0;
+
+    if(!(sms_fm = ym2413_init(fm_clock, SOUND_CORE_RATE))) {
+#ifdef DEBUG
+        fprintf(stderr, "sms_fm_start: Cannot allocate YM2413!\n");
+#endif
+        return -1;
+    }
+
+    return 0;
+}
+
+#ifndef _arch_dreamcast
+/* Run the PSG and FM for a line, each into its own buffer. When the PSG write
+   log is in use and defer is set, the PSG part of the line is left for
+   synth_psg_frame() below to do for the whole frame at once. */
+static __INLINE__ int update_sound(int16 psgbuf[], int16 fmbuf[], int start,
+                                   int line, int defer) {
+    if(!sms_psg_enabled) {
+        memset(psgbuf + start, 0, psg_samples[line] << 2);
+
+        if(psg.cycles)
+            sn76489_flush_log(&psg, cycles_to_run);
+    }
+    else if(!psg.cycles) {
+        sn76489_execute_samples(&psg, psgbuf + start, psg_samples[line]);
+    }
+    else if(!defer) {
+        sn76489_execute_logged(&psg, psgbuf + start, psg_samples[line],
+                               cycles_to_run - SMS_CYCLES_PER_LINE,
+                               cycles_to_run);
+    }
+
+    if(sms_ym2413_enabled && !(defer && fmthd.deferred)) {
+        /* Silence until something starts the chip, which might be part way
+           through the frame. */
+        if(sms_fm)
+            ym2413_update(sms_fm, fmbuf + start, psg_samples[line]);
+        else
+            memset(fmbuf + start, 0, psg_samples[line] << 2);
     }
 
     return start + (psg_samples[line] << 1);
 }
 
+/* Called before the first frame after a reset, to skip straight past the BIOS
+   if it's been run for this cart before. */
+static void boot_start(void) {
+    uint32 bios, crc, adler;
+    int rv;
+
+    boot.pending = 0;
+
+    if(!sms_bios_active || !(bios = sms_mem_bios_crc()))
+        return;
+
+    sms_get_checksums(&crc, &adler);
+    rv = bootcache_start(&boot, sms_cons._base.console_type == CONSOLE_GG ?
+                         "gg" : "sms", bios, crc, sms_mem_sram_crc(),
+                         sms_region, &sms_load_state);
+
+    if(rv == BOOTCACHE_FAILED) {
+        /* Who knows how far the state got, so start over. A soft reset leaves
+           the PSG alone, so that needs doing too for the boot to come out the
+           same as it always does. */
+        psg_reset();
+        sms_soft_reset();
+        boot.pending = 0;
+    }
+}
+
+/* Synthesize the PSG output for everything since the start cycle in one go,
+   with each logged write landing on its exact sample. */
+static void synth_psg_frame(int16 buf[], int samples, int32 start) {
+    if(!sms_psg_enabled || !psg.cycles)
+        return;
+
+    sn76489_execute_logged(&psg, buf, samples >> 1, start, cycles_to_run);
+}
+
 static void sms_frame(int skip) {
-    int16 buf[882 << 1];
+    int16 psgbuf[SOUND_FRAME_MAX << 1], fmbuf[SOUND_FRAME_MAX << 1];
     int samples = 0, total_lines, line;
+    int32 start = cycles_to_run;
+
+    if(boot.pending)
+        boot_start();
 
     if(sms_region & SMS_VIDEO_NTSC)
         total_lines = NTSC_LINES_PER_FRAME;
     else
         total_lines = PAL_LINES_PER_FRAME;
 
+    /* FM writes during the frame go to the FM thread, if there is one. The
+       last frame's FM can keep going in the meantime. */
+    if(fmthd.running && sms_ym2413_enabled && sms_fm)
+        fmthd.deferred = 1;
+    else
+        sms_fm_sync();
+
     for(line = 0; line < total_lines; ++line) {
         cycles_to_run += SMS_CYCLES_PER_LINE;
         sms_cheat_frame();
@@ -292,21 +665,43 @@ static void sms_frame(int skip) {
         cycles_run += sms_vdp_execute(line, skip);
         cycles_run += sms_z80_run(cycles_to_run - cycles_run);
 
-        samples = update_sound(buf, samples, line);
+        samples = update_sound(psgbuf, fmbuf, samples, line, 1);
     }
 
-    sound_update_buffer(buf, samples << 1);
+#ifndef _arch_dreamcast
+    /* Make sure the render thread (if any) has caught up. */
+    sms_vdp_sync();
+#endif
+
+    synth_psg_frame(psgbuf, samples, start);
+
+    if(fmthd.deferred) {
+        fmthd.deferred = 0;
+        fm_thread_frame(psgbuf, samples, start);
+    }
+    else {
+        output_sound(psgbuf, sms_ym2413_enabled && sms_fm ? fmbuf : NULL,
+                     samples);
+    }
 
     /* Reset the state for the next frame. */
+    sn76489_end_frame(&psg, cycles_to_run);
     cycles_run -= cycles_to_run;
     cycles_to_run = 0;
     scanline = 0;
+
+    /* The BIOS is done, so this is what the boot cache gets. */
+    if(boot.watching && !sms_bios_active)
+        bootcache_finish(&boot, &sms_save_state);
 }
 
 static void sms_scanline(void) {
-    int16 buf[882 << 1];
+    int16 psgbuf[16], fmbuf[16];    /* More than we'll need, but meh. */
     int total_lines, samples = 0;
 
+    /* Not a whole frame, so the FM is done here as each line ends. */
+    sms_fm_sync();
+
     cycles_to_run += SMS_CYCLES_PER_LINE;
     sms_cheat_frame();
 
@@ -314,8 +709,14 @@ static void sms_scanline(void) {
     cycles_run += sms_vdp_execute(scanline, 0);
     cycles_run += sms_z80_run(cycles_to_run - cycles_run);
 
-    samples = update_sound(buf, 0, scanline);
-    sound_update_buffer(buf, samples << 1);
+    samples = update_sound(psgbuf, fmbuf, 0, scanline, 0);
+    output_sound(psgbuf, sms_ym2413_enabled && sms_fm ? fmbuf : NULL,
+                 samples);
+
+#ifndef _arch_dreamcast
+    /* Make sure the render thread (if any) has caught up. */
+    sms_vdp_sync();
+#endif
 
     /* See if we hit the end of a frame by running this scanline. */
     if(sms_region & SMS_VIDEO_NTSC)
@@ -325,6 +726,7 @@ static void sms_scanline(void) {
 
     if(++scanline == total_lines) {
         /* Reset the state for the next frame. */
+        sn76489_end_frame(&psg, cycles_to_run);
         cycles_run -= cycles_to_run;
         cycles_to_run = 0;
         scanline = 0;
@@ -332,9 +734,12 @@ static void sms_scanline(void) {
 }
 
 static void sms_single_step(void) {
-    int16 buf[882 << 1];
+    int16 psgbuf[16], fmbuf[16];    /* More than we'll need, but meh. */
     int total_lines, run;
 
+    /* Not a whole frame, so the FM is done here as each line ends. */
+    sms_fm_sync();
+
     /* If we're at the start of a frame, set things up for the first line. Also,
        if we finished a line last time (or are starting a new frame), run the
        VDP for the line. */
@@ -350,10 +755,16 @@ static void sms_single_step(void) {
     /* Run our one instruction. */
     cycles_run += sms_z80_run(1);
 
+#ifndef _arch_dreamcast
+    /* Make sure the render thread (if any) has caught up. */
+    sms_vdp_sync();
+#endif
+
     /* Did we finish a line? */
     if(cycles_run >= cycles_to_run) {
-        run = update_sound(buf, 0, scanline);
-        sound_update_buffer(buf, run << 1);
+        run = update_sound(psgbuf, fmbuf, 0, scanline, 0);
+        output_sound(psgbuf, sms_ym2413_enabled && sms_fm ? fmbuf : NULL,
+                     run);
 
         /* Was it the last line in the frame? */
         if(sms_region & SMS_VIDEO_NTSC)
@@ -363,6 +774,7 @@ static void sms_single_step(void) {
 
         if(++scanline == total_lines) {
             /* Reset the state for the next frame. */
+            sn76489_end_frame(&psg, cycles_to_run);
             cycles_run -= cycles_to_run;
             cycles_to_run = 0;
             scanline = 0;
@@ -371,14 +783,22 @@ static void sms_single_step(void) {
 }
 
 static void sms_finish_frame(void) {
-    int16 buf[882 << 1];
+    int16 psgbuf[SOUND_FRAME_MAX << 1], fmbuf[SOUND_FRAME_MAX << 1];
     int samples = 0, total_lines, line;
+    int32 start = cycles_to_run;
 
     if(sms_region & SMS_VIDEO_NTSC)
         total_lines = NTSC_LINES_PER_FRAME;
     else
         total_lines = PAL_LINES_PER_FRAME;
 
+    /* FM writes during the frame go to the FM thread, if there is one. The
+       last frame's FM can keep going in the meantime. */
+    if(fmthd.running && sms_ym2413_enabled && sms_fm)
+        fmthd.deferred = 1;
+    else
+        sms_fm_sync();
+
     for(line = scanline; line < total_lines; ++line) {
         cycles_to_run += SMS_CYCLES_PER_LINE;
         sms_cheat_frame();
@@ -386,21 +806,39 @@ static void sms_finish_frame(void) {
         cycles_run += sms_vdp_execute(line, 0);
         cycles_run += sms_z80_run(cycles_to_run - cycles_run);
 
-        samples = update_sound(buf, samples, line);
+        samples = update_sound(psgbuf, fmbuf, samples, line, 1);
     }
 
-    sound_update_buffer(buf, samples << 1);
+#ifndef _arch_dreamcast
+    /* Make sure the render thread (if any) has caught up. */
+    sms_vdp_sync();
+#endif
+
+    synth_psg_frame(psgbuf, samples, start);
+
+    if(fmthd.deferred) {
+        fmthd.deferred = 0;
+        fm_thread_frame(psgbuf, samples, start);
+    }
+    else {
+        output_sound(psgbuf, sms_ym2413_enabled && sms_fm ? fmbuf : NULL,
+                     samples);
+    }
 
     /* Reset the state for the next frame. */
+    sn76489_end_frame(&psg, cycles_to_run);
     cycles_run -= cycles_to_run;
     cycles_to_run = 0;
     scanline = 0;
 }
 
 static void sms_finish_scanline(void) {
-    int16 buf[882 << 1];
+    int16 psgbuf[16], fmbuf[16];    /* More than we'll need, but meh. */
     int total_lines, samples = 0;
 
+    /* Not a whole frame, so the FM is done here as each line ends. */
+    sms_fm_sync();
+
     /* Make sure we have something to do. */
     if(cycles_run >= cycles_to_run)
         return;
@@ -409,8 +847,14 @@ static void sms_finish_scanline(void) {
        run. */
     cycles_run += sms_z80_run(cycles_to_run - cycles_run);
 
-    samples = update_sound(buf, 0, scanline);
-    sound_update_buffer(buf, samples << 1);
+    samples = update_sound(psgbuf, fmbuf, 0, scanline, 0);
+    output_sound(psgbuf, sms_ym2413_enabled && sms_fm ? fmbuf : NULL,
+                 samples);
+
+#ifndef _arch_dreamcast
+    /* Make sure the render thread (if any) has caught up. */
+    sms_vdp_sync();
+#endif
 
     /* See if we hit the end of a frame by finishing this line. */
     if(sms_region & SMS_VIDEO_NTSC)
@@ -420,6 +864,7 @@ static void sms_finish_scanline(void) {
 
     if(++scanline == total_lines) {
         /* Reset the state for the next frame. */
+        sn76489_end_frame(&psg, cycles_to_run);
         cycles_run -= cycles_to_run;
         cycles_to_run = 0;
         scanline = 0;
@@ -446,6 +891,11 @@ void sms_button_pressed(int player, int button) {
     if(player < 1 || player > 2)
         return;
 
+#ifndef _arch_dreamcast
+    /* The boot isn't the same as it always is anymore. */
+    boot.dirty = 1;
+#endif
+
     if(sms_control_type[player - 1] == SMS_PADTYPE_CONTROL_PAD) {
         if(button < SMS_UP || button > SMS_CONSOLE_RESET || button == SMS_QUIT)
             return;
@@ -623,6 +1073,11 @@ static void sms_psg_read_context_v1(FILE *fp) {
         counter = byte[0] | (byte[1] << 8);
         psg.counter[i] = counter;
     }
+
+#ifndef _arch_dreamcast
+    psg.log_count = 0;
+    psg.bl_resync = 1;
+#endif
 }
 
 int sms_psg_write_context(FILE *fp) {
@@ -630,6 +1085,11 @@ int sms_psg_write_context(FILE *fp) {
     int i;
     uint32 tmp;
 
+#ifndef _arch_dreamcast
+    /* Anything still in the write log belongs in the saved registers. */
+    sn76489_flush_log(&psg, 0x7FFFFFFF);
+#endif
+
     data[0] = 'P';
     data[1] = 'S';
     data[2] = 'G';
@@ -682,13 +1142,12 @@ int sms_psg_write_context(FILE *fp) {
     return 0;
 }
 
-int sms_psg_read_context(const uint8 *buf) {
-    uint32 len, tmp;
+int sms_psg_read_context(const uint8 *buf, uint32 len, int load) {
+    uint32 tmp;
     uint16 ver;
     int i;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 56)
         return -1;
 
@@ -701,6 +1160,9 @@ int sms_psg_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     memcpy(psg.volume, buf + 16, 4);
 
@@ -721,6 +1183,12 @@ int sms_psg_read_context(const uint8 *buf) {
     BUF_TO_UINT16(buf + 50, psg.noise_bits);
     BUF_TO_UINT16(buf + 52, psg.noise_tapped);
 
+#ifndef _arch_dreamcast
+    /* Pending writes were for the state we just replaced. */
+    psg.log_count = 0;
+    psg.bl_resync = 1;
+#endif
+
     return 0;
 }
 
@@ -731,7 +1199,7 @@ int sms_save_state(const char *filename)
 #endif
 {
     FILE *fp;
-    uint8 data[4];
+    int rv;
 
     if(sms_cons._base.initialized == 0)
         /* This shouldn't happen.... */
@@ -745,65 +1213,10 @@ int sms_save_state(const char *filename)
     if(!fp)
         return -1;
 
-    fprintf(fp, "CrabEmu Save State");
-
-    /* Write save state version */
-    data[0] = 0x00;
-    data[1] = 0x02;
-    fwrite(data, 1, 2, fp);
-
-    /* Write out the Console Metadata block */
-    data[0] = 'C';
-    data[1] = 'O';
-    data[2] = 'N';
-    data[3] = 'S';
-    fwrite(data, 1, 4, fp);             /* Block ID */
-
-    UINT32_TO_BUF(24, data);
-    fwrite(data, 1, 4, fp);             /* Length */
-
-    UINT16_TO_BUF(1, data);
-    fwrite(data, 1, 2, fp);             /* Version */
-    fwrite(data, 1, 2, fp);             /* Flags (Importance = 1) */
-
-    data[0] = data[1] = data[2] = data[3] = 0;
-    fwrite(data, 1, 4, fp);             /* Child pointer */
-    fwrite(data, 1, 4, fp);             /* Console (0 = SMS) */
-
-    data[0] = sms_cons._base.console_type;  /* Console sub-type */
-    data[1] = sms_region & 0x0F;            /* Region code */
-    data[2] = sms_region >> 4;              /* Video system */
-    data[3] = 0;                            /* Reserved */
-    fwrite(data, 1, 4, fp);
-
-    /* Write each block's state */
-    if(sms_game_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-    else if(sms_z80_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-    else if(sms_psg_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-    else if(sms_vdp_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-    else if(sms_mem_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-    else if(sms_ym2413_write_context(fp)) {
-        fclose(fp);
-        return -1;
-    }
-
+    rv = sms_write_state(fp);
     fclose(fp);
-    return 0;
+
+    return rv;
 }
 
 #ifdef _arch_dreamcast
@@ -936,13 +1349,13 @@ int sms_save_state(const char *filename) {
 }
 #endif
 
-static int sms_cons_read_context(const uint8 *buf) {
-    uint32 len, cons;
+static int sms_cons_read_context(const uint8 *buf, uint32 len,
+                                 int load __UNUSED__) {
+    uint32 cons;
     uint16 ver;
     int vid, region;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 24)
         return -1;
 
@@ -972,184 +1385,39 @@ static int sms_cons_read_context(const uint8 *buf) {
     return 0;
 }
 
-static int sms_load_state_v2(FILE *fp) {
-    uint8 buf[4];
-    int rv;
-    uint32 fourcc, len;
-    uint16 flags;
-    uint8 *ptr;
-    size_t read;
-
-    for(;;) {
-        rv = 0;
-
-        /* Read in the fourcc */
-        read = fread(buf, 1, 4, fp);
-        if(!read)
-            break;
-        else if(read != 4)
-            return -1;
-
-        BUF_TO_UINT32(buf, fourcc);
-
-        /* Read in the length */
-        if(fread(buf, 1, 4, fp) != 4)
-            return -1;
-
-        BUF_TO_UINT32(buf, len);
-
-        /* Check for a malformed block */
-        if(len < 16)
-            return -1;
-
-        /* Allocate space for the block and read it in. */
-        if(!(ptr = (uint8 *)malloc(len)))
-            return -1;
-        UINT32_TO_BUF(fourcc, ptr);
-        UINT32_TO_BUF(len, ptr + 4);
-
-        if(fread(ptr + 8, 1, len - 8, fp) != len - 8) {
-            free(ptr);
-            return -1;
-        }
-
-        switch(fourcc) {
-            case FOURCC_TO_UINT32('C', 'O', 'N', 'S'):
-                rv = sms_cons_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('G', 'A', 'M', 'E'):
-                rv = sms_game_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('Z', '8', '0', '\0'):
-                rv = sms_z80_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('P', 'S', 'G', '\0'):
-                rv = sms_psg_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('9', '9', '1', '8'):
-                rv = sms_vdp_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('D', 'R', 'A', 'M'):
-                rv = sms_mem_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('G', 'G', 'R', 'G'):
-                rv = sms_ggregs_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('S', 'M', 'S', 'R'):
-                rv = sms_regs_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('M', 'A', 'P', 'R'):
-                rv = sms_mapper_read_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('2', '4', '1', '3'):
-                rv = sms_ym2413_read_context(ptr);
-                break;
-
-            default:
-                /* See if its marked as essential... */
-                BUF_TO_UINT16(ptr + 10, flags);
-                if(flags & 1) {
-                    rv = -1;
-#ifdef DEBUG
-                    printf("Unknown block %c%c%c%c, bailing out!\n", ptr[0],
-                           ptr[1], ptr[2], ptr[3]);
-#endif
-                }
-                else {
-#ifdef DEBUG
-                    printf("Ignoring unknown block %c%c%c%c\n", ptr[0], ptr[1],
-                           ptr[2], ptr[3]);
-#endif
-                }
-        }
-
-        /* Clean up this pass */
-        free(ptr);
-
-        if(rv)
-            return rv;
-    }
-
-    sms_pad = 0xFFFF;
-
-    return 0;
-}
+static const statesave_reader_t sms_readers[] = {
+    { FOURCC_TO_UINT32('C', 'O', 'N', 'S'), &sms_cons_read_context },
+    { FOURCC_TO_UINT32('G', 'A', 'M', 'E'), &sms_game_read_context },
+    { FOURCC_TO_UINT32('Z', '8', '0', '\0'), &sms_z80_read_context },
+    { FOURCC_TO_UINT32('P', 'S', 'G', '\0'), &sms_psg_read_context },
+    { FOURCC_TO_UINT32('9', '9', '1', '8'), &sms_vdp_read_context },
+    { FOURCC_TO_UINT32('D', 'R', 'A', 'M'), &sms_mem_read_context },
+    { FOURCC_TO_UINT32('G', 'G', 'R', 'G'), &sms_ggregs_read_context },
+    { FOURCC_TO_UINT32('S', 'M', 'S', 'R'), &sms_regs_read_context },
+    { FOURCC_TO_UINT32('M', 'A', 'P', 'R'), &sms_mapper_read_context },
+    { FOURCC_TO_UINT32('2', '4', '1', '3'), &sms_ym2413_read_context },
+    { 0, NULL }
+};
 
-#ifdef _arch_dreamcast
-static int sms_load_state_int(const char *filename)
-#else
-int sms_load_state(const char *filename)
-#endif
-{
-    char str[19];
-    FILE *fp;
-    char byte;
+#ifndef _arch_dreamcast
+int sms_load_state(const char *filename) {
+    statesave_buf_t buf;
+    int rv;
 
     if(sms_cons._base.initialized == 0) {
         /* This shouldn't happen.... */
         return -1;
     }
 
-    fp = fopen(filename, "rb");
-    if(!fp)
+    if(statesave_read(filename, &buf))
         return -1;
 
-    fread(str, 18, 1, fp);
-    str[18] = 0;
-    if(strcmp("CrabEmu Save State", str)) {
-        fclose(fp);
-        return -2;
-    }
-
-    /* Read save state version */
-    fread(&byte, 1, 1, fp);
-    if(byte != 0x00) {
-        fclose(fp);
-        return -2;
-    }
-
-    fread(&byte, 1, 1, fp);
-
-    if(byte == 0x01) {
-        /* Read in the current Z80 context */
-        sms_z80_read_context_v1(fp);
-
-        /* Next, read the current VDP state */
-        sms_vdp_read_context_v1(fp);
-
-        /* Now, read the current PSG state */
-        sms_psg_read_context_v1(fp);
+    rv = sms_read_state_mem(buf.data, buf.len);
+    statesave_release(&buf);
 
-        /* Finally, read the current memory contents from the file */
-        sms_mem_read_context_v1(fp);
-    }
-    else if(byte == 0x02) {
-        if(sms_load_state_v2(fp))
-            return -1;
-    }
-    else {
-        /* Unknown version... */
-        fclose(fp);
-        return -2;
-    }
-
-    fclose(fp);
-
-    sound_reset_buffer();
-
-    return 0;
+    return rv;
 }
-
-#ifdef _arch_dreamcast
+#else
 int sms_load_state(const char *filename __UNUSED__) {
     vmu_pkg_t pkg;
     uint8 *pkg_out, *raw;
@@ -1182,7 +1450,7 @@ int sms_load_state(const char *filename __UNUSED__) {
     real_size = *((uint32 *)pkg.data);
     pkg_size = *(((uint32 *)pkg.data) + 1);
 
-    /* Uncompress the data and write it out to a /ram file */
+    /* Uncompress the data and load it straight out of that buffer */
     if(!(raw = (uint8 *)malloc(real_size))) {
         free(pkg_out);
         return -1;
@@ -1191,19 +1459,9 @@ int sms_load_state(const char *filename __UNUSED__) {
     uncompress(raw, &real_size, ((uint8 *)pkg.data) + 8, pkg.data_len - 8);
     free(pkg_out);
 
-    sprintf(savename, "/ram/cs-%08" PRIX32, (uint32_t)crc);
-    if(!(fp = fopen(savename, "wb"))) {
-        free(raw);
-        return -1;
-    }
-
-    fwrite(raw, 1, real_size, fp);
-    fclose(fp);
+    rv = sms_read_state_mem(raw, real_size);
     free(raw);
 
-    rv = sms_load_state_int(savename);
-    fs_unlink(savename);
-
     return rv;
 }
 #endif
@@ -1256,87 +1514,96 @@ int sms_write_state(FILE *fp)
 
     /* Write each block's state */
     if(sms_game_write_context(fp)) {
-        fclose(fp);
         return -1;
     }
     else if(sms_z80_write_context(fp)) {
-        fclose(fp);
         return -1;
     }
     else if(sms_psg_write_context(fp)) {
-        fclose(fp);
         return -1;
     }
     else if(sms_vdp_write_context(fp)) {
-        fclose(fp);
         return -1;
     }
     else if(sms_mem_write_context(fp)) {
-        fclose(fp);
         return -1;
     }
     else if(sms_ym2413_write_context(fp)) {
-        fclose(fp);
         return -1;
     }
 
-    fclose(fp);
     return 0;
 }
 
-int sms_read_state(FILE *fp)
+int sms_read_state_mem(const uint8 *buf, size_t len)
 {
-    char str[19];
-    char byte;
+    FILE *fp;
 
     if(sms_cons._base.initialized == 0) {
         /* This shouldn't happen.... */
         return -1;
     }
 
-    if(!fp)
+    if(!buf)
         return -1;
 
-    fread(str, 18, 1, fp);
-    str[18] = 0;
-    if(strcmp("CrabEmu Save State", str)) {
-        fclose(fp);
-        return -2;
-    }
+    switch(statesave_version(buf, len)) {
+        case 0x01:
+            /* Version 1 states are one flat dump, rather than blocks, and are
+               still read as a stream. */
+            fp = fmemopen((void *)(buf + STATESAVE_HEADER_LEN),
+                          len - STATESAVE_HEADER_LEN, "rb");
+            if(!fp)
+                return -1;
 
-    /* Read save state version */
-    fread(&byte, 1, 1, fp);
-    if(byte != 0x00) {
-        fclose(fp);
-        return -2;
-    }
+#ifndef _arch_dreamcast
+            /* Finish off the FM thread's frame, which belongs to the timeline
+               we're about to leave. */
+            sms_fm_sync();
+#endif
 
-    fread(&byte, 1, 1, fp);
-
-    if(byte == 0x01) {
-        /* Read in the current Z80 context */
-        sms_z80_read_context_v1(fp);
-        
-        /* Next, read the current VDP state */
-        sms_vdp_read_context_v1(fp);
-        
-        /* Now, read the current PSG state */
-        sms_psg_read_context_v1(fp);
-        
-        /* Finally, read the current memory contents from the file */
-        sms_mem_read_context_v1(fp);
-    }
-    else if(byte == 0x02) {
-        if(sms_load_state_v2(fp))
-            return -1;
-    }
-    else {
-        /* Unknown version... */
-        fclose(fp);
-        return -2;
+            /* Read in the current Z80 context */
+            sms_z80_read_context_v1(fp);
+
+            /* Next, read the current VDP state */
+            sms_vdp_read_context_v1(fp);
+
+            /* Now, read the current PSG state */
+            sms_psg_read_context_v1(fp);
+
+            /* Finally, read the current memory contents from the file */
+            sms_mem_read_context_v1(fp);
+
+            fclose(fp);
+            break;
+
+        case 0x02:
+            if(statesave_check(buf + STATESAVE_HEADER_LEN,
+                               len - STATESAVE_HEADER_LEN, sms_readers))
+                return -1;
+
+#ifndef _arch_dreamcast
+            /* As above. This has to happen whether or not the state has a
+               YM2413 block. */
+            sms_fm_sync();
+#endif
+
+            if(statesave_load(buf + STATESAVE_HEADER_LEN,
+                              len - STATESAVE_HEADER_LEN, sms_readers))
+                return -1;
+
+            sms_pad = 0xFFFF;
+            break;
+
+        default:
+            /* Not a save state, or an unknown version... */
+            return -2;
     }
 
-    fclose(fp);
+#ifndef _arch_dreamcast
+    /* Whatever this is, it isn't the BIOS booting the cart any more. */
+    boot.pending = boot.watching = 0;
+#endif
 
     sound_reset_buffer();
 
@@ -38,14 +38,28 @@ extern void sms_button_released(int player, int button);
 extern void sms_set_console(int console);
 extern int sms_cycles_elapsed(void);
 
+extern void sms_fm_write(int a, uint8 data);
+extern int sms_fm_start(void);
+
+#ifndef _arch_dreamcast
+extern int sms_fm_set_threaded(int enable);
+extern void sms_fm_sync(void);
+
+/* Per-chip gain (1.0 is normal) and pan (-1.0 left to 1.0 right). */
+#define SMS_SOUND_PSG   0
+#define SMS_SOUND_FM    1
+
+extern void sms_sound_set_gain(int chip, float gain, float pan);
+#endif
+
 extern int sms_psg_write_context(FILE *fp);
-extern int sms_psg_read_context(const uint8 *buf);
+extern int sms_psg_read_context(const uint8 *buf, uint32 len, int load);
 
 extern int sms_save_state(const char *filename);
 extern int sms_load_state(const char *filename);
 
 extern int sms_write_state(FILE *fp);
-extern int sms_read_state(FILE *fp);
+extern int sms_read_state_mem(const uint8 *buf, size_t len);
 
 /* Old button defines. These define the raw bits used for the data. */
 #define SMS_PAD1_UP     0x0001
@@ -39,10 +39,10 @@
 #include "mapper-none.h"
 #include "mapper-janggun.h"
 #include "sdscterminal.h"
-
-#ifndef NO_ZLIB
-#include "unzip.h"
-#endif
+#include "rom.h"
+#include "gamedb.h"
+#include "sramfile.h"
+#include "statesave.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -50,6 +50,10 @@
 #include <assert.h>
 #include <stdint.h>
 
+#ifndef _arch_dreamcast
+#include <sys/stat.h>
+#endif
+
 #ifdef _arch_dreamcast
 #include <inttypes.h>
 #include <kos/fs.h>
@@ -59,14 +63,6 @@
 #include <zlib/zlib.h>
 #include <bzlib/bzlib.h>
 #include "icon.h"
-#else
-#ifndef NO_ZLIB
-#include <zlib.h>
-#endif
-
-#ifndef NO_BZ2
-#include <bzlib.h>
-#endif
 #endif
 
 static uint8 ram[8 * 1024];
@@ -74,6 +70,7 @@ static uint8 ram[8 * 1024];
 static uint8 *sms_bios_rom = NULL;
 static uint32 sms_bios_len;
 static int cartram_enabled = 0;
+static int cartram_type = GAMEDB_SRAM_UNKNOWN;
 
 static uint32 mapper;
 
@@ -89,6 +86,7 @@ uint8 *sms_rom_page0;
 uint8 *sms_rom_page1;
 uint8 *sms_rom_page2;
 uint8 *sms_cart_rom = NULL;
+static rom_image_t cart_image;
 uint32 sms_cart_len;
 uint8 *gg_bios_rom = NULL;
 uint32 gg_bios_len;
@@ -102,7 +100,7 @@ uint8 *sms_read_map[256];
 uint8 *sms_write_map[256];
 uint8 sms_dummy_arear[256];
 uint8 sms_dummy_areaw[256];
-uint8 sms_cart_ram[0x8000];
+uint8 sms_cart_ram[0x8000] SRAMFILE_ALIGNED;
 int sms_bios_active = 0;
 int sms_control_type[2] = { SMS_PADTYPE_CONTROL_PAD, SMS_PADTYPE_CONTROL_PAD };
 static uint8 sms_fm_detect = 0;
@@ -116,8 +114,10 @@ typedef void (*remap_page_func)();
 remap_page_func sms_mem_remap_page[4];
 
 static int (*sms_map_write_cxt)(FILE *fp) = sms_mem_nomap_write_context;
-static int (*sms_map_read_cxt)(const uint8 *buf) = sms_mem_nomap_read_context;
-static int (*sms_map_read_mem)(const uint8 *buf) = sms_mem_nomap_read_context;
+static int (*sms_map_read_cxt)(const uint8 *buf, uint32 len, int load) =
+    sms_mem_nomap_read_context;
+static int (*sms_map_read_mem)(const uint8 *buf, uint32 len, int load) =
+    sms_mem_nomap_read_context;
 
 static void remap_page0_unmapped() {
     int i;
@@ -396,53 +396,6 @@ static void reorganize_pages() {
     }
 }
 
-/* This function is based on code from MEKA, the duty of this function is to
-   try to autodetect what mapper type this cartridge should be using. */
-static void setup_mapper() {
-    int codemasters, sega, korean, korean_msx;
-    uint8 *ptr;
-
-    if(sms_cart_len <= 0x8000) {
-        /* The cartridge contains less than 32KB of data, so there probably
-           isn't even a mapper in it, but just to be safe, in case it has
-           SRAM for some reason, we'll just assume the Sega Mapper. */
-        mapper = SMS_MAPPER_SEGA;
-        return;
-    }
-
-    sega = 0;
-    codemasters = 0;
-    korean = 0;
-    korean_msx = 0;
-    ptr = sms_cart_rom;
-
-    while(ptr < sms_cart_rom + 0x8000) {
-        if((*ptr++) == 0x32) {
-            uint16 value = (*ptr) | ((*(ptr + 1)) << 8);
-
-            ptr += 2;
-
-            if(value == 0xFFFF)
-                ++sega;
-            else if(value == 0x8000 || value == 0x4000)
-                ++codemasters;
-            else if(value == 0xA000)
-                ++korean;
-            else if(value == 0x0002 || value == 0x0003 || value == 0x0004)
-                ++korean_msx;
-        }
-    }
-
-    if(korean_msx > sega + 2)
-        mapper = SMS_MAPPER_KOREAN_MSX;
-    else if(codemasters > sega + 2)
-        mapper = SMS_MAPPER_CODEMASTERS;
-    else if(korean > sega + 2)
-        mapper = SMS_MAPPER_KOREAN;
-    else
-        mapper = SMS_MAPPER_SEGA;
-}
-
 void sms_mem_handle_memctl(uint8 data) {
     if(sms_memctl == data)
         return;
@@ -702,13 +655,13 @@ void sms_port_write(uint16 port, uint8 data) {
             if(port == 0xF0) {
                 sms_ym2413_regs[0x40] = data;
                 //YM2413Write(0, 0, data);
-                ym2413_write(sms_fm, 0, data);
+                sms_fm_write(0, data);
                 sms_ym2413_in_use = 1;
             }
             else if(port == 0xF1) {
                 sms_ym2413_regs[sms_ym2413_regs[0x40]] = data;
                 //YM2413Write(0, 1, data);
-                ym2413_write(sms_fm, 1, data);
+                sms_fm_write(1, data);
                 sms_ym2413_in_use = 1;
             }
             else if(port == 0xF2) {
@@ -770,7 +723,45 @@ uint8 sms_port_read(uint16 port) {
     }
 }
 
+/* Put the cart RAM and EEPROM back in ordinary memory, if they're mapped to a
+   save file, before anything else gets put in them. */
+static void sram_unmap(void) {
 #ifndef _arch_dreamcast
+    sramfile_unmap(sms_cart_ram);
+    sramfile_unmap(e93c46.data);
+#endif
+}
+
+#ifndef _arch_dreamcast
+
+/* Map the save file over the EEPROM or cart RAM, if that's turned on, so it
+   gets written as the game goes. A file that isn't there yet only gets made
+   for carts that are known to have a battery. Returns 0 if an existing file
+   was mapped, 1 if a new one was, or -1 if it should be read as usual. */
+static int map_cartram(const char *fn) {
+    struct stat st;
+    int exists = !stat(fn, &st);
+
+    if(mapper == SMS_MAPPER_93C46) {
+        if(exists)
+            eeprom93c46_init();
+
+        if(sramfile_map(e93c46.data, 128, fn))
+            return -1;
+    }
+    else {
+        if(!exists && cartram_type != GAMEDB_SRAM_BATTERY)
+            return -1;
+
+        if(sramfile_map(sms_cart_ram, 0x8000, fn))
+            return -1;
+
+        if(exists)
+            cartram_enabled = 1;
+    }
+
+    return exists ? 0 : 1;
+}
 
 int sms_write_cartram_to_file(const char *fn) {
     FILE *fp;
@@ -778,6 +769,11 @@ int sms_write_cartram_to_file(const char *fn) {
     if(fn == NULL)
         return -1;
 
+    /* If it's mapped to that file, it only needs flushing. */
+    if(!sramfile_sync(mapper == SMS_MAPPER_93C46 ? (void *)e93c46.data :
+                      (void *)sms_cart_ram, fn))
+        return 0;
+
     if(mapper == SMS_MAPPER_93C46) {
         fp = fopen(fn, "wb");
 
@@ -788,7 +784,7 @@ int sms_write_cartram_to_file(const char *fn) {
         fclose(fp);
     }
     else {
-        if(!cartram_enabled)
+        if(!cartram_enabled || cartram_type == GAMEDB_SRAM_NONE)
             return 0;
 
         fp = fopen(fn, "wb");
@@ -804,10 +800,14 @@ int sms_write_cartram_to_file(const char *fn) {
 
 int sms_read_cartram_from_file(const char *fn) {
     FILE * fp;
+    int rv;
 
     if(fn == NULL)
         return -1;
 
+    if((rv = map_cartram(fn)) >= 0)
+        return rv ? -1 : 0;
+
     fp = fopen(fn, "rb");
 
     if(fp != NULL) {
@@ -840,7 +840,8 @@ int sms_write_cartram_to_file(const char *fn) {
     int rv = 0, blocks_freed = 0;
     file_t f;
 
-    if(!cartram_enabled && mapper != SMS_MAPPER_93C46)
+    if(mapper != SMS_MAPPER_93C46 &&
+       (!cartram_enabled || cartram_type == GAMEDB_SRAM_NONE))
         return 0;
 
     /* Make sure there's a VMU in port A1. */
@@ -1030,6 +1031,67 @@ int sms_mem_load_bios(const char *fn) {
     return 0;
 }
 
+uint32 sms_mem_bios_crc(void) {
+    if(!sms_cart_rom)
+        return 0;
+
+    if(sms_cons._base.console_type == CONSOLE_SMS && sms_bios_rom)
+        return rom_crc32(sms_bios_rom, sms_bios_len);
+    else if(sms_cons._base.console_type == CONSOLE_GG && gg_bios_rom)
+        return rom_crc32(gg_bios_rom, gg_bios_len);
+
+    return 0;
+}
+
+uint32 sms_mem_sram_crc(void) {
+    uint32 crc = rom_crc32(sms_cart_ram, 0x8000);
+
+    if(mapper == SMS_MAPPER_93C46)
+        crc ^= rom_crc32((uint8 *)e93c46.data, 128);
+
+    return crc;
+}
+
+/* Apply whatever the game database has to say about the cart beyond which
+   mapper it uses (sms_find_mapper() already took care of that). */
+static void apply_gamedb(void) {
+    gamedb_entry_t ent;
+
+    cartram_type = GAMEDB_SRAM_UNKNOWN;
+
+    if(gamedb_find(rom_crc, rom_adler, &ent)) {
+        sms_z80_set_idle_pcs(NULL);
+        return;
+    }
+
+#ifdef DEBUG
+    printf("Game database: %s\n", ent.name);
+#endif
+
+    cartram_type = ent.sram;
+    sms_z80_set_idle_pcs(ent.idle_pc);
+
+    if(ent.region != REGION_NONE) {
+        sms_region &= ~0x0F;
+
+        if(ent.region & REGION_JAPAN) {
+            sms_region |= SMS_REGION_DOMESTIC;
+            sms_gg_regs[0] &= ~0x40;
+        }
+        else {
+            sms_region |= SMS_REGION_EXPORT;
+            sms_gg_regs[0] |= 0x40;
+        }
+    }
+
+#ifdef DEBUG
+    /* The timing's already been set up by the time we get here, so picking the
+       right video system is up to whoever called sms_init(). */
+    if(ent.video && !(sms_region & ent.video))
+        printf("Game database says this cart wants the other video system\n");
+#endif
+}
+
 static void finalize_load(const char *fn) {
     char *name;
     int i;
@@ -1041,30 +1103,16 @@ static void finalize_load(const char *fn) {
         mapper = SMS_MAPPER_SEGA;
 
         if(sms_cons._base.console_type != CONSOLE_SG1000) {
-            setup_mapper();
+            mapper = sms_guess_mapper(sms_cart_rom, sms_cart_len);
 
             if(mapper == SMS_MAPPER_SEGA) {
-                /* Check if this game uses the 93c46 serial eeprom, and if so
-                   enable it. Most of these should be detected by the
-                   sms_find_mapper function, but just in case, detect them
-                   here as well. */
-                const uint16 prodcodes[5] = {
-                    0x3432, 0x2537, 0x2439, 0x3407, 0x2418
-                };
+                /* Check if its Pop Breaker, which apparently doesn't like
+                   running on a non-japanese Game Gear */
                 const uint16 popbreaker = 0x2017;
                 uint16 prodcode = sms_cart_rom[0x7FFC] |
                     (sms_cart_rom[0x7FFD] << 8) |
                     ((sms_cart_rom[0x7FFE] & 0xF0) << 12);
 
-                for(i = 0; i < 5; ++i) {
-                    if(prodcode == prodcodes[i]) {
-                        mapper = SMS_MAPPER_93C46;
-                        break;
-                    }
-                }
-
-                /* While we're at it, check if its Pop Breaker, which apparently
-                   doesn't like running on a non-japanese Game Gear */
                 if(prodcode == popbreaker) {
                     sms_gg_regs[0] = 0x80;
                 }
@@ -1076,6 +1124,8 @@ static void finalize_load(const char *fn) {
     printf("Detected Mapper %d\n", mapper);
 #endif
 
+    apply_gamedb();
+
     if((sms_cons._base.console_type == CONSOLE_SG1000 ||
         sms_cons._base.console_type == CONSOLE_SC3000) &&
        mapper != SMS_MAPPER_TW_MSX_TYPE_B) {
@@ -1284,11 +1334,13 @@ static void finalize_load(const char *fn) {
 
 int sms_mem_run_bios(int console) {
     /* Clear cartram, although it shouldn't be relevant... */
+    sram_unmap();
     memset(sms_cart_ram, 0, 0x8000);
     cartram_enabled = 0;
 
     sms_set_console(console);
 
+    rom_image_free(&cart_image);
     sms_cart_rom = NULL;
     sms_cart_len = 0;
 
@@ -1308,310 +1360,36 @@ int sms_mem_run_bios(int console) {
     return 0;
 }
 
-#ifndef NO_ZLIB
-static int load_gz_rom(const char *fn) {
-    int len;
-    gzFile fp;
-    void *tmp;
-
-    /* Open up the file in question. */
-    if(!(fp = gzopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    /* Read one chunk of the file at a time, until we have no more left. */
-    sms_cart_rom = (uint8 *)malloc(0x1000);
-
-    if(!sms_cart_rom) {
-#ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Couldn't allocate space!\n");
-#endif
-        gzclose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    sms_cart_len = 0;
-    len = gzread(fp, sms_cart_rom, 0x1000);
-
-    while(len != 0 && len != -1) {
-        sms_cart_len += len;
-        tmp = realloc(sms_cart_rom, sms_cart_len + 0x1000);
-
-        if(!tmp) {
-#ifdef DEBUG
-            fprintf(stderr, "sms_mem_load_rom: Couldn't allocate space!\n");
-#endif
-            gzclose(fp);
-            free(sms_cart_rom);
-            sms_cart_rom = NULL;
-            return ROM_LOAD_E_ERRNO;
-        }
-
-        sms_cart_rom = (uint8 *)tmp;
-        memset(sms_cart_rom + sms_cart_len, 0xFF, 0x1000);
-        len = gzread(fp, sms_cart_rom + sms_cart_len, 0x1000);
-    }
-
-    gzclose(fp);
-
-    /* Remove any SMD headers. */
-    if((sms_cart_len % 0x4000) == 512) {
-        /* SMD header present, skip it */
-        memmove(sms_cart_rom, sms_cart_rom + 512, sms_cart_len - 512);
-        sms_cart_len -= 512;
-    }
-
-    finalize_load(fn);
-
-    return ROM_LOAD_SUCCESS;
-}
-#endif
-
-#ifndef NO_BZ2
-static int load_bz2_rom(const char *fn) {
-    int len;
-    BZFILE *fp;
-    void *tmp;
-
-    /* Open up the file in question. */
-    if(!(fp = BZ2_bzopen(fn, "rb"))) {
-#ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    /* Read one chunk of the file at a time, until we have no more left. */
-    sms_cart_rom = (uint8 *)malloc(0x1000);
-
-    if(!sms_cart_rom) {
-#ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Couldn't allocate space!\n");
-#endif
-        BZ2_bzclose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    sms_cart_len = 0;
-    len = BZ2_bzread(fp, sms_cart_rom, 0x1000);
-
-    while(len != 0 && len != -1) {
-        sms_cart_len += len;
-        tmp = realloc(sms_cart_rom, sms_cart_len + 0x1000);
-
-        if(!tmp) {
-#ifdef DEBUG
-            fprintf(stderr, "sms_mem_load_rom: Couldn't allocate space!\n");
-#endif
-            BZ2_bzclose(fp);
-            free(sms_cart_rom);
-            sms_cart_rom = NULL;
-            return ROM_LOAD_E_ERRNO;
-        }
-
-        sms_cart_rom = (uint8 *)tmp;
-        memset(sms_cart_rom + sms_cart_len, 0xFF, 0x1000);
-        len = BZ2_bzread(fp, sms_cart_rom + sms_cart_len, 0x1000);
-    }
-
-    BZ2_bzclose(fp);
-
-    /* Remove any SMD headers. */
-    if((sms_cart_len % 0x4000) == 512) {
-        /* SMD header present, skip it */
-        memmove(sms_cart_rom, sms_cart_rom + 512, sms_cart_len - 512);
-        sms_cart_len -= 512;
-    }
-
-    finalize_load(fn);
-
-    return ROM_LOAD_SUCCESS;
-}
-#endif
-
-#ifndef NO_ZLIB
-static int load_zip_rom(const char *fn) {
-    int console = 0;
-    unzFile fp;
-    unz_file_info inf;
-    char fn2[4096];
-    char *ext;
-
-    /* Open up the file in question. */
-    fp = unzOpen(fn);
-
-    if(!fp) {
-#ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Could not open ROM: %s!\n", fn);
-#endif
-        return ROM_LOAD_E_OPEN;
-    }
-
-    if(unzGoToFirstFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Couldn't find file in zip!\n");
-#endif
-        unzClose(fp);
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* Keep looking at files until we find a rom. */
-    while(console == 0) {
-        if(unzGetCurrentFileInfo(fp, &inf, fn2, 4096, NULL, 0, NULL,
-                                 0) != UNZ_OK) {
-#ifdef DEBUG
-            fprintf(stderr, "sms_mem_load_rom: Error parsing Zip file!\n");
-#endif
-            unzClose(fp);
-            return ROM_LOAD_E_CORRUPT;
-        }
-
-        /* Check if this file looks like a rom. */
-        ext = strrchr(fn2, '.');
-
-        if(ext) {
-            if(!strcmp(ext, ".gg")) {
-                /* GameGear rom */
-                console = CONSOLE_GG;
-            }
-            else if(!strcmp(ext, ".sc")) {
-                /* SC-3000 rom */
-                console = CONSOLE_SC3000;
-            }
-            else if(!strcmp(ext, ".sg")) {
-                /* SG-1000 rom */
-                console = CONSOLE_SG1000;
-            }
-            else if(!strcmp(ext, ".sms") || !strcmp(ext, ".bin")) {
-                /* Master system rom, hopefully */
-                console = CONSOLE_SMS;
-            }
-        }
-
-        /* If we haven't found a rom yet, move to the next file. */
-        if(console == 0) {
-            if(unzGoToNextFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-                fprintf(stderr, "sms_mem_load_rom: End of zip file!\n");
-#endif
-                unzClose(fp);
-                return ROM_LOAD_E_NO_ROM;
-            }
-        }
-    }
-
-    /* At this point, we must have what we believe to be a rom found. */
-    sms_set_console(console);
-
-    /* Read a chunk of the file, until we have no more left. */
-    sms_cart_rom = (uint8 *)malloc(inf.uncompressed_size);
-
-    if(!sms_cart_rom) {
-#ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Couldn't allocate space!\n");
-#endif
-        unzClose(fp);
-        return ROM_LOAD_E_ERRNO;
-    }
-
-    sms_cart_len = inf.uncompressed_size;
-
-    /* Attempt to open the file we think is a rom. */
-    if(unzOpenCurrentFile(fp) != UNZ_OK) {
-#ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Couldn't open rom from zip!\n");
-#endif
-        unzClose(fp);
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* Attempt to read the file. */
-    if(unzReadCurrentFile(fp, sms_cart_rom, sms_cart_len) < 0) {
-#ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Couldn't read rom from zip!\n");
-#endif
-        unzCloseCurrentFile(fp);
-        unzClose(fp);
-        return ROM_LOAD_E_CORRUPT;
-    }
-
-    /* We're done with the file, close everything. */
-    unzCloseCurrentFile(fp);
-    unzClose(fp);
-
-    /* Remove any SMD headers. */
-    if((sms_cart_len % 0x4000) == 512) {
-        /* SMD header present, skip it */
-        memmove(sms_cart_rom, sms_cart_rom + 512, sms_cart_len - 512);
-        sms_cart_len -= 512;
-    }
-
-    finalize_load(fn);
-
-    return ROM_LOAD_SUCCESS;
-}
-#endif
-
 int sms_mem_load_rom(const char *fn, int console) {
-    FILE *fp;
-    int size;
-    char *ext;
+    static const char *const exts[] = { ".gg", ".sc", ".sg", ".sms", ".bin",
+                                        NULL };
+    int rv;
 
+    sram_unmap();
     memset(sms_cart_ram, 0, 0x8000);
     cartram_enabled = 0;
 
     sms_set_console(console);
 
-    /* If its a compressed format, go onto their handler... */
-    ext = strrchr(fn, '.');
-
-    if(ext) {
-#ifndef NO_ZLIB
-        if(!strcmp(ext, ".gz")) {
-            return load_gz_rom(fn);
-        }
-        else if(!strcmp(ext, ".zip")) {
-            return load_zip_rom(fn);
-        }
-#endif
-#ifndef NO_BZ2
-        if(!strcmp(ext, ".bz2")) {
-            return load_bz2_rom(fn);
-        }
-#endif
-    }
+    rom_image_free(&cart_image);
+    sms_cart_rom = NULL;
+    sms_cart_len = 0;
 
-    if(!(fp = fopen(fn, "rb"))) {
+    if((rv = rom_image_load(fn, exts, ROM_IMAGE_TRIM | ROM_IMAGE_32K,
+                            &cart_image)) != ROM_LOAD_SUCCESS) {
 #ifdef DEBUG
-        fprintf(stderr, "sms_mem_load_rom: Could not open ROM: %s!\n", fn);
+        fprintf(stderr, "sms_mem_load_rom: Could not load ROM: %s!\n", fn);
 #endif
-        return ROM_LOAD_E_ERRNO;
+        return rv;
     }
 
-    /* Determine the size of the file */
-    fseek(fp, 0, SEEK_END);
-    size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    /* If the ROM came out of a zip file, the name inside tells us what it's
+       for better than whatever we were told. */
+    if(cart_image.console > 0)
+        sms_set_console(cart_image.console);
 
-    /* Determine if header/footer info is present */
-    if((size % 0x4000) == 512) {
-        /* SMD header present, skip it */
-        fseek(fp, 512, SEEK_SET);
-        size -= 512;
-    }
-    else if((size % 0x4000) == 64) {
-        /* Footer present, truncate it */
-        size -= 64;
-    }
-
-    sms_cart_rom = (uint8 *)malloc(size);
-    fread(sms_cart_rom, size, 1, fp);
-    fclose(fp);
-
-    sms_cart_len = size;
+    sms_cart_rom = cart_image.data;
+    sms_cart_len = cart_image.size;
 
     finalize_load(fn);
 
@@ -1656,13 +1434,11 @@ int sms_ym2413_write_context(FILE *fp) {
     return 0;
 }
 
-int sms_ym2413_read_context(const uint8 *buf) {
-    uint32 len;
+int sms_ym2413_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
     int i;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 84)
         return -1;
 
@@ -1675,9 +1451,21 @@ int sms_ym2413_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     memcpy(sms_ym2413_regs, buf + 16, 65);
 
+#ifndef _arch_dreamcast
+    /* The FM thread can't be using the chip while we do this. */
+    sms_fm_sync();
+#endif
+
+    /* The block is only there if the chip was in use, so start it up. */
+    if(sms_fm_start())
+        return -1;
+
     /* This is based on how SMS Plus handles things... */
     ym2413_write(sms_fm, 0, 0x0E);
     ym2413_write(sms_fm, 1, sms_ym2413_regs[0x0E]);
@@ -1895,12 +1683,11 @@ int sms_game_write_context(FILE *fp) {
     return 0;
 }
 
-int sms_game_read_context(const uint8 *buf) {
-    uint32 len, crc;
+int sms_game_read_context(const uint8 *buf, uint32 len, int load __UNUSED__) {
+    uint32 crc;
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 24)
         return -1;
 
@@ -1925,12 +1712,10 @@ int sms_game_read_context(const uint8 *buf) {
     return 0;
 }
 
-int sms_mem_read_context(const uint8 *buf) {
-    uint32 len;
+int sms_mem_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     switch(sms_cons._base.console_type) {
         case CONSOLE_SMS:
         case CONSOLE_GG:
@@ -1957,17 +1742,18 @@ int sms_mem_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the memory */
     memcpy(ram, buf + 16, len - 16);
     return 0;
 }
 
-int sms_regs_read_context(const uint8 *buf) {
-    uint32 len;
+int sms_regs_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 20)
         return -1;
 
@@ -1980,6 +1766,9 @@ int sms_regs_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     sms_mem_handle_ioctl(buf[16]);
     sms_mem_handle_memctl(buf[17]);
@@ -1988,12 +1777,10 @@ int sms_regs_read_context(const uint8 *buf) {
     return 0;
 }
 
-int sms_ggregs_read_context(const uint8 *buf) {
-    uint32 len;
+int sms_ggregs_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 24)
         return -1;
 
@@ -2006,19 +1793,25 @@ int sms_ggregs_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     memcpy(sms_gg_regs, buf + 16, 7);
     return 0;
 }
 
-int sms_mapper_read_context(const uint8 *buf) {
-    uint32 len, rd_mapper, child, clen;
+int sms_mapper_read_context(const uint8 *buf, uint32 len, int load) {
+    uint32 rd_mapper, child;
     uint16 ver;
-    const uint8 *ptr;
     int rv;
+    statesave_reader_t children[] = {
+        { FOURCC_TO_UINT32('M', 'P', 'P', 'R'), sms_map_read_cxt },
+        { FOURCC_TO_UINT32('M', 'P', 'R', 'M'), sms_map_read_mem },
+        { 0, NULL }
+    };
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len < 20)
         return -1;
 
@@ -2037,44 +1830,16 @@ int sms_mapper_read_context(const uint8 *buf) {
     if(mapper != rd_mapper)
         return -1;
 
-    /* Handle child nodes */
-    ptr = buf + 16 + child;
-
-    while(ptr < buf + len) {
-        rv = 0;
-
-        /* Check for a malformed child node */
-        if(ptr + 16 > buf + len)
-            return -2;
-
-        child = FOURCC_TO_UINT32(ptr[0], ptr[1], ptr[2], ptr[3]);
-        BUF_TO_UINT32(ptr + 4, clen);
-
-        /* Make sure the length is sane */
-        if(ptr + clen > buf + len)
-            return -2;
-
-        switch(child) {
-            case FOURCC_TO_UINT32('M', 'P', 'P', 'R'):
-                rv = sms_map_read_cxt(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('M', 'P', 'R', 'M'):
-                rv = sms_map_read_mem(ptr);
-                break;
-
-            default:
-                /* See if its marked as essential... */
-                BUF_TO_UINT16(ptr + 10, ver);
-                if(ver & 1)
-                    rv = -1;
-        }
+    /* Make sure the child nodes are sane before loading anything */
+    if(statesave_check(buf + 16 + child, len - 16 - child, children))
+        return -2;
 
-        if(rv)
-            return rv;
+    if(!load)
+        return 0;
 
-        ptr += clen;
-    }
+    /* Load the child nodes */
+    if((rv = statesave_load(buf + 16 + child, len - 16 - child, children)))
+        return rv;
 
     reorganize_pages();
 
@@ -2156,9 +1921,9 @@ int sms_mem_init(void) {
 
 int sms_mem_shutdown(void) {
     sms_mem_janggun_shutdown();
+    sram_unmap();
 
-    if(sms_cart_rom != NULL)
-        free(sms_cart_rom);
+    rom_image_free(&cart_image);
 
     if(sms_bios_rom != NULL)
         free(sms_bios_rom);
@@ -73,22 +73,29 @@ extern int sms_write_cartram_to_file(const char *fn);
 extern int sms_read_cartram_from_file(const char *fn);
 
 extern int sms_ym2413_write_context(FILE *fp);
-extern int sms_ym2413_read_context(const uint8 *buf);
+extern int sms_ym2413_read_context(const uint8 *buf, uint32 len, int load);
 extern int sms_mem_write_context(FILE *fp);
-extern int sms_mem_read_context(const uint8 *buf);
-extern int sms_regs_read_context(const uint8 *buf);
-extern int sms_ggregs_read_context(const uint8 *buf);
-extern int sms_mapper_read_context(const uint8 *buf);
-extern int sms_mapper_pg_read_context(const uint8 *buf);
-extern int sms_mapper_mem_read_context(const uint8 *buf);
-
-extern int sms_game_read_context(const uint8 *buf);
+extern int sms_mem_read_context(const uint8 *buf, uint32 len, int load);
+extern int sms_regs_read_context(const uint8 *buf, uint32 len, int load);
+extern int sms_ggregs_read_context(const uint8 *buf, uint32 len, int load);
+extern int sms_mapper_read_context(const uint8 *buf, uint32 len, int load);
+extern int sms_mapper_pg_read_context(const uint8 *buf, uint32 len, int load);
+extern int sms_mapper_mem_read_context(const uint8 *buf, uint32 len, int load);
+
+extern int sms_game_read_context(const uint8 *buf, uint32 len, int load);
 extern int sms_game_write_context(FILE *fp);
 
 extern void sms_mem_read_context_v1(FILE *fp);
 
 extern void sms_get_checksums(uint32 *crc, uint32 *adler);
 
+/* CRC32 of the BIOS that boots the cartridge, or 0 if there's either no BIOS
+   for this console or no cartridge for it to boot. */
+extern uint32 sms_mem_bios_crc(void);
+
+/* CRC32 of the cartridge's save memory (battery backed RAM or EEPROM). */
+extern uint32 sms_mem_sram_crc(void);
+
 ENDCLINK
 
 #endif /* !SMSMEM_H */
@@ -22,16 +22,19 @@
 #include "tms9918a.h"
 #include "smsz80.h"
 #include "smsvcnt.h"
+#include "smsvdp-tab.h"
+#include "statesave.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 #ifdef _arch_dreamcast
 #include <malloc.h>
+#else
+#include <pthread.h>
 #endif
 
 sms_vdp_t smsvdp;
-static uint32 lut[256];
 
 /* Size of the top border for each video mode, in scanlines. */
 static const int top_border[6] = { 27, 11, 0, 54, 38, 30 };
@@ -40,51 +43,51 @@ static const int kyoukai1[] = { 216, 232, 240, 240, 256, 264 };
 static const int kyoukai2[] = { 235, 251, 262, 259, 275, 283 };
 
 #ifdef CRABEMU_32BIT_COLOR
-static void update_local_pal_sms(int num) {
+static void update_local_pal_sms(sms_vdp_t *vdp, int num) {
     /* Calculate the RGB888 color from the BGR222 color */
-    smsvdp.pal[num] = ((smsvdp.cram[num] & 0x03) << 22) |
-                      ((smsvdp.cram[num] & 0x0C) << 12) |
-                      ((smsvdp.cram[num] & 0x30) << 2) |
-                      (0xFF000000);
+    vdp->pal[num] = ((vdp->cram[num] & 0x03) << 22) |
+                    ((vdp->cram[num] & 0x0C) << 12) |
+                    ((vdp->cram[num] & 0x30) << 2) |
+                    (0xFF000000);
 }
 
-static void update_local_pal_gg(int num) {
+static void update_local_pal_gg(sms_vdp_t *vdp, int num) {
     /* Calculate the RGB888 color from the BGR444 color */
-    smsvdp.pal[num >> 1] = ((smsvdp.cram[num] & 0x0F) << 20) |
-                           ((smsvdp.cram[num] & 0xF0) << 8) |
-                           ((smsvdp.cram[num + 1] & 0x0F) << 4) |
-                           (0xFF000000);
+    vdp->pal[num >> 1] = ((vdp->cram[num] & 0x0F) << 20) |
+                         ((vdp->cram[num] & 0xF0) << 8) |
+                         ((vdp->cram[num + 1] & 0x0F) << 4) |
+                         (0xFF000000);
 }
 #else
-static void update_local_pal_sms(int num) {
+static void update_local_pal_sms(sms_vdp_t *vdp, int num) {
     /* Calculate the RGB555 color from the BGR222 color */
-    smsvdp.pal[num] = ((smsvdp.cram[num] & 0x03) << 13) |
-                      ((smsvdp.cram[num] & 0x0C) << 6) |
-                      ((smsvdp.cram[num] & 0x30) >> 1);
+    vdp->pal[num] = ((vdp->cram[num] & 0x03) << 13) |
+                    ((vdp->cram[num] & 0x0C) << 6) |
+                    ((vdp->cram[num] & 0x30) >> 1);
 }
 
-static void update_local_pal_gg(int num) {
+static void update_local_pal_gg(sms_vdp_t *vdp, int num) {
     /* Calculate the RGB555 color from the BGR444 color */
-    smsvdp.pal[num >> 1] = ((smsvdp.cram[num] & 0x0F) << 11) |
-                           ((smsvdp.cram[num] & 0xF0) << 2) |
-                           ((smsvdp.cram[num + 1] & 0x0F) << 1);
+    vdp->pal[num >> 1] = ((vdp->cram[num] & 0x0F) << 11) |
+                         ((vdp->cram[num] & 0xF0) << 2) |
+                         ((vdp->cram[num + 1] & 0x0F) << 1);
 }
 #endif
 
-static __INLINE__ void readjust_name_table() {
-    if(smsvdp.lines == 192) {
-        smsvdp.name_table = smsvdp.vram + ((smsvdp.regs[2] & 0x0E) << 10);
+static __INLINE__ void readjust_name_table(sms_vdp_t *vdp) {
+    if(vdp->lines == 192) {
+        vdp->name_table = vdp->vram + ((vdp->regs[2] & 0x0E) << 10);
     }
     else {
-        smsvdp.name_table = smsvdp.vram + ((smsvdp.regs[2] & 0x0C) << 10) +
-            0x700;
+        vdp->name_table = vdp->vram + ((vdp->regs[2] & 0x0C) << 10) + 0x700;
     }
 }
 
-typedef void (*smsvdp_draw_func)(int line, pixel_t *px);
+typedef void (*smsvdp_draw_func)(sms_vdp_t *vdp, int line, pixel_t *px);
 typedef void (*smsvdp_skip_func)(int line);
 
-static void dummy_draw(int line __UNUSED__, pixel_t *px __UNUSED__) {
+static void dummy_draw(sms_vdp_t *vdp __UNUSED__, int line __UNUSED__,
+                       pixel_t *px __UNUSED__) {
 }
 
 static void dummy_skip(int line __UNUSED__) {
@@ -96,7 +99,7 @@ static smsvdp_skip_func spr_skip = &dummy_skip;
 
 static const uint8 *vcnt_tab = vcnt_ntsc_192;
 
-void sms_vdp_update_cache(int pat) {
+static void update_cache(sms_vdp_t *vdp, int pat) {
     uint8 *bitplane;
     int i, j;
     uint8 pixel;
@@ -104,15 +107,15 @@ void sms_vdp_update_cache(int pat) {
     int tmp1, tmp2, tmp3, tmp4;
     uint32 lutval;
 
-    if(pat >= 512 || !smsvdp.pattern[pat].dirty)
+    if(pat >= 512 || !vdp->pattern[pat].dirty)
         return;
 
     /* Determine where we should start converting from and to... */
-    bitplane = smsvdp.vram + (pat << 5);
-    tex1 = smsvdp.pattern[pat].texture[0] + 7;
-    tex2 = smsvdp.pattern[pat].texture[1];
-    tex3 = smsvdp.pattern[pat].texture[2] + 63;
-    tex4 = smsvdp.pattern[pat].texture[3] + 56;
+    bitplane = vdp->vram + (pat << 5);
+    tex1 = vdp->pattern[pat].texture[0] + 7;
+    tex2 = vdp->pattern[pat].texture[1];
+    tex3 = vdp->pattern[pat].texture[2] + 63;
+    tex4 = vdp->pattern[pat].texture[3] + 56;
     
     for(i = 0; i < 8; ++i) {
         tmp1 = *bitplane++;
@@ -140,148 +143,160 @@ void sms_vdp_update_cache(int pat) {
         tex4 -= 16;
     }
 
-    smsvdp.pattern[pat].dirty = 0;
+    vdp->pattern[pat].dirty = 0;
+    ++vdp->plane.pattern_gen[pat];
 }
 
-#define DRAW_PIXEL_HIGH() { \
-    entry = (*pixels++) + pal; \
-    *px++ = smsvdp.pal[entry]; \
-    *current_alpha++ = (entry & 0x0F); \
+void sms_vdp_update_cache(int pat) {
+    update_cache(&smsvdp, pat);
+}
+
+/* Bring one row of the background plane up to date, redrawing only the tiles
+   whose name table entry or pattern changed since they were last drawn. */
+static void update_plane_row(sms_vdp_t *vdp, int row) {
+    sms_vdp_plane_t *plane = &vdp->plane;
+    uint16 *name_table_short = &((uint16 *)vdp->name_table)[row << 5];
+    int col, tile, tilenum, i, j;
+    uint8 *pixels, *dst, ext;
+
+    for(col = 0; col < 32; ++col) {
+        tile = name_table_short[col];
+#ifdef __BIG_ENDIAN__
+        tile = ((tile & 0xFF) << 8) | ((tile >> 8) & 0xFF);
+#endif
+        tilenum = tile & 0x1FF;
+
+        /* Check if the pattern is dirtied, if so, clean it up */
+        if(vdp->pattern[tilenum].dirty)
+            update_cache(vdp, tilenum);
+
+        if(plane->valid[row][col] && plane->tile[row][col] == tile &&
+           plane->tile_gen[row][col] == plane->pattern_gen[tilenum])
+            continue;
+
+        /* Palette select goes in bit 4, priority in bit 5 */
+        pixels = vdp->pattern[tilenum].texture[(tile >> 9) & 0x03];
+        ext = ((tile & 0x800) >> 7) | ((tile & 0x1000) >> 7);
+        dst = &plane->pixels[row << 3][col << 3];
+
+        for(i = 0; i < 8; ++i, dst += 256) {
+            for(j = 0; j < 8; ++j) {
+                dst[j] = *pixels++ | ext;
+            }
+        }
+
+        plane->tile[row][col] = (uint16)tile;
+        plane->tile_gen[row][col] = plane->pattern_gen[tilenum];
+        plane->valid[row][col] = 1;
+    }
 }
 
-#define DRAW_PIXEL_LOW() { \
-    entry = (*pixels++) + pal; \
-    *px++ = smsvdp.pal[entry]; \
-    *current_alpha++ = 0; \
+#define DRAW_PLANE_PIXEL(src) { \
+    entry = src[(x + base) & 0xFF]; \
+    px[x] = vdp->pal[entry & 0x1F]; \
+    vdp->alpha[x] = (entry & 0x20) ? (entry & 0x0F) : 0; \
 }
 
-static void sms_vdp_m4_draw_bg(int line, pixel_t *px) {
-    int row, col, tile, tilenum, tmp;
+static void sms_vdp_m4_draw_bg(sms_vdp_t *vdp, int line, pixel_t *px) {
+    int row, tmp, x, end, base, lock;
     int rendercol, renderrow, xoff, yoff;
-    uint8 *pixels;
-    int entry, pal, attrib;
-    uint16 *name_table_short;
-    uint8 *current_alpha;
+    uint8 *src, *lsrc;
+    int entry;
 
     row = line >> 3;
 
     /* Figure out what column/row to render first */
-    if(row < 2 && smsvdp.regs[0] & 0x40) {
+    if(row < 2 && vdp->regs[0] & 0x40) {
         /* Do not scroll the top two rows, if requested. */
         rendercol = 0;
         xoff = 0;
     }
     else {
-        rendercol = smsvdp.xscroll_coarse;
-        xoff = smsvdp.xscroll_fine;
+        rendercol = vdp->xscroll_coarse;
+        xoff = vdp->xscroll_fine;
     }
 
-    if(smsvdp.lines == 192) {
-        tmp = line + smsvdp.regs[9];
+    if(vdp->lines == 192) {
+        tmp = line + vdp->regs[9];
 
         if(tmp > 223)
             tmp -= 224;
     }
     else {
-        tmp = (line + smsvdp.regs[9]) & 0xFF;
+        tmp = (line + vdp->regs[9]) & 0xFF;
     }
 
-    yoff = smsvdp.yscroll_fine;
+    yoff = vdp->yscroll_fine;
 
     renderrow = (tmp >> 3);
+    update_plane_row(vdp, renderrow);
+    src = vdp->plane.pixels[(renderrow << 3) | ((line + yoff) & 0x07)];
 
-    name_table_short = &((uint16 *)smsvdp.name_table)[renderrow << 5];
-    px += xoff;
-    current_alpha = smsvdp.alpha + xoff;
+    /* Disable vertical scrolling for the last few columns. Those are the
+       ones that end up from 192 + xoff onwards, plus whatever part of the last
+       column wraps back around to the left edge. */
+    lock = vdp->regs[0] & 0x80;
+    end = 256;
+    lsrc = src;
 
-    /* Render each pixel of background data for this line */
-    for(col = 0; col < 32; ++col) {
-        if(col == 24 && smsvdp.regs[0] & 0x80) {
-            /* Disable vertical scrolling for the last few columns */
-            renderrow = line >> 3;
-            yoff = 0;
-            name_table_short = &((uint16 *)smsvdp.name_table)[renderrow << 5];
-        }
+    if(lock) {
+        end = 192 + xoff;
 
-        /* Get the tile that we're rendering */
-        tile = name_table_short[rendercol];
-#ifdef __BIG_ENDIAN__
-        tile = ((tile & 0xFF) << 8) | ((tile >> 8) & 0xFF);
-#endif
-        tilenum = tile & 0x1FF;
+        if(row != renderrow)
+            update_plane_row(vdp, row);
 
-        /* Check if the pattern is dirtied, if so, clean it up */
-        if(smsvdp.pattern[tilenum].dirty)
-            sms_vdp_update_cache(tilenum);
-
-        attrib = (tile >> 9) & 0x03;
-
-        /* Find the texture */
-        pixels = &smsvdp.pattern[tilenum].texture[attrib]
-            [((line + yoff) & 0x07) << 3];
-
-        pal = (tile & 0x800) >> 7;
-
-        /* Draw the pixels */
-        if(tile & 0x1000) {
-            DRAW_PIXEL_HIGH();
-            DRAW_PIXEL_HIGH();
-            DRAW_PIXEL_HIGH();
-            DRAW_PIXEL_HIGH();
-            DRAW_PIXEL_HIGH();
-            DRAW_PIXEL_HIGH();
-            DRAW_PIXEL_HIGH();
-            DRAW_PIXEL_HIGH();
-        }
-        else {
-            DRAW_PIXEL_LOW();
-            DRAW_PIXEL_LOW();
-            DRAW_PIXEL_LOW();
-            DRAW_PIXEL_LOW();
-            DRAW_PIXEL_LOW();
-            DRAW_PIXEL_LOW();
-            DRAW_PIXEL_LOW();
-            DRAW_PIXEL_LOW();
-        }
+        lsrc = vdp->plane.pixels[line];
+    }
+
+    /* Screen pixel x comes from plane pixel x + base of the selected row */
+    base = (rendercol << 3) - xoff;
+
+    for(x = xoff; x < end; ++x) {
+        DRAW_PLANE_PIXEL(src);
+    }
+
+    for(; x < 256; ++x) {
+        DRAW_PLANE_PIXEL(lsrc);
+    }
 
-        rendercol = (rendercol + 1) & 0x1F;
+    for(x = 0; x < xoff; ++x) {
+        DRAW_PLANE_PIXEL(lsrc);
     }
 }
 
-#undef DRAW_PIXEL_HIGH
-#undef DRAW_PIXEL_LOW
+#undef DRAW_PLANE_PIXEL
 
-static void sms_vdp_m4_draw_spr(int line, pixel_t *px) {
-    uint8 *sat = smsvdp.sat;
+static void sms_vdp_m4_draw_spr(sms_vdp_t *vdp, int line, pixel_t *px) {
+    uint8 *sat = vdp->sat;
     uint8 *pix;
     static uint8 col_tab[256];
     int height, i, n = 0, j, x, y, num, half, ds = 0, tiled = 0, ls = 0;
-    pixel_t *pal = (smsvdp.pal + 0x10);
+    pixel_t *pal = (vdp->pal + 0x10);
     pixel_t *current_pixel;
 
     /* First of all, clear out our colision table */
-    memset(col_tab, 0, 0xFF);
+    memset(col_tab, 0, 256);
 
     /* Normal sprites are 8 pixels high, so start with that */
     height = 8;
 
     /* If bit 1 of register 1 is set, then the height is 16 */
-    if(smsvdp.regs[1] & 0x02) {
+    if(vdp->regs[1] & 0x02) {
         tiled = 1;
         height = 16;
     }
 
     /* If bit 0 of register 1 is set, sprites have their pixels doubled */
-    if(smsvdp.regs[1] & 0x01) {
+    if(vdp->regs[1] & 0x01) {
         ds = 1;
         height <<= 1;
     }
 
     /* If bit 3 of register 0 is set, shift sprites left 8 pixels */
-    ls = smsvdp.regs[0] & 0x08;
+    ls = vdp->regs[0] & 0x08;
 
     /* Which half of the pattern table are we getting the patterns from? */
-    half = (smsvdp.regs[6] & 0x04) << 6;
+    half = (vdp->regs[6] & 0x04) << 6;
 
     /* Parse the table */
     for(i = 0; i < 64; ++i) {
@@ -313,15 +328,15 @@ static void sms_vdp_m4_draw_spr(int line, pixel_t *px) {
 
                 /* Set our pixel pointer up */
                 if(((line - y) >> ds) > 7) {
-                    if(smsvdp.pattern[num + 1].dirty)
-                        sms_vdp_update_cache(num + 1);
-                    pix = &smsvdp.pattern[num + 1].texture[0][(((line - y) >>
+                    if(vdp->pattern[num + 1].dirty)
+                        update_cache(vdp, num + 1);
+                    pix = &vdp->pattern[num + 1].texture[0][(((line - y) >>
                                                                 ds) - 8) << 3];
                 }
                 else {
-                    if(smsvdp.pattern[num].dirty)
-                        sms_vdp_update_cache(num);
-                    pix = &smsvdp.pattern[num].texture[0][((line - y) >> ds) <<
+                    if(vdp->pattern[num].dirty)
+                        update_cache(vdp, num);
+                    pix = &vdp->pattern[num].texture[0][((line - y) >> ds) <<
                                                           3];
                 }
 
@@ -338,13 +353,13 @@ static void sms_vdp_m4_draw_spr(int line, pixel_t *px) {
                     if(pix[j]) {
                         /* Check for collision, set the flag if there is one */
                         if(col_tab[x]) {
-                            smsvdp.status |= 0x20;
+                            vdp->status |= 0x20;
                             goto doublesize;
                         }
 
                         /* Make sure not to tromp on a high-priority background
                            tile */
-                        if(smsvdp.alpha[x])
+                        if(vdp->alpha[x])
                             goto doublesize;
 
                         /* Actually draw the pixel */
@@ -352,19 +367,19 @@ static void sms_vdp_m4_draw_spr(int line, pixel_t *px) {
                         col_tab[x] = 1;
 
 doublesize:
-                        if(ds) {
+                        if(ds && x < 255) {
                             ++current_pixel;
 
                             /* Check for collision, set the flag if there is
                                one */
                             if(col_tab[++x]) {
-                                smsvdp.status |= 0x20;
+                                vdp->status |= 0x20;
                                 continue;
                             }
 
                             /* Make sure not to tromp on a high-priority
                                background tile */
-                            if(smsvdp.alpha[x])
+                            if(vdp->alpha[x])
                                 continue;
 
                             /* Actually draw the pixel */
@@ -378,7 +393,7 @@ doublesize:
             else {
                 /* Too many sprites on this line, set the flag, and stop
                    rendering */
-                smsvdp.status |= 0x40;
+                vdp->status |= 0x40;
                 break;
             }
         }
@@ -397,7 +412,7 @@ static void sms_vdp_m4_skip_spr(int line) {
         return;
 
     /* First of all, clear out our colision table */
-    memset(col_tab, 0, 0xFF);
+    memset(col_tab, 0, 256);
 
     /* Normal sprites are 8 pixels high, so start with that */
     height = 8;
@@ -428,6 +443,10 @@ static void sms_vdp_m4_skip_spr(int line) {
 
         y = sat[i] + 1;
 
+        /* sat[i] = 255 implies that the sprite should start on line 0. */
+        if(y == 256)
+            y = 0;
+
         /* Check the position of this sprite */
         if(line >= y && line <= y + height - 1) {
             /* If its on this line, make sure that we haven't already rendered
@@ -471,7 +490,7 @@ static void sms_vdp_m4_skip_spr(int line) {
                         if(col_tab[x]++)
                             smsvdp.status |= 0x20;
 
-                        if(ds) {
+                        if(ds && x < 255) {
                             /* Check for collision, set the flag if there is
                                one */
                             if(col_tab[++x]++)
@@ -491,29 +510,58 @@ static void sms_vdp_m4_skip_spr(int line) {
     }
 }
 
-uint32 sms_vdp_execute(int line, int skip) {
+#ifndef _arch_dreamcast
+/* Figure out which lines outside of the active display draw the bottom border
+   (those before bb) and the top border (those at or after tb). */
+static void border_lines(sms_vdp_t *vdp, int *bb, int *tb) {
+    int idx = (vdp->vidmode == SMS_VIDEO_NTSC) ? 0 : 3;
+
+    switch(vdp->lines) {
+        case 192:
+            break;
+
+        case 224:
+            idx += 1;
+            break;
+
+        case 240:
+            idx += 2;
+            break;
+
+        default:
+            *bb = 0;
+            *tb = 512;
+            return;
+    }
+
+    *bb = kyoukai1[idx];
+    *tb = kyoukai2[idx];
+}
+#endif /* !_arch_dreamcast */
+
+static void render_line(sms_vdp_t *vdp, int line, int skip,
+                        smsvdp_draw_func bg, smsvdp_draw_func spr) {
     int i;
-    uint32 cycles = 0;
 
     /* Draw only if the display is enabled */
-    if(smsvdp.regs[1] & 0x40 && line < smsvdp.lines) {
+    if(vdp->regs[1] & 0x40 && line < vdp->lines) {
         if(!skip) {
             pixel_t *px;
 
 #ifndef _arch_dreamcast
-            if(smsvdp.borders)
-                px = (smsvdp.framebuffer_base) + (line << smsvdp.fb_x);
+            if(vdp->borders)
+                px = (vdp->framebuffer_base) + (line << vdp->fb_x);
             else
 #endif /* !_arch_dreamcast */
-                px = (smsvdp.framebuffer) + (line << smsvdp.fb_x);
+                px = (vdp->framebuffer) + (line << vdp->fb_x);
 
 #ifndef _arch_dreamcast
             /* Fill in the left border, if we're bothering to emulate them.
                This will also, conveniently, reposition the px pointer to beyond
                the border for us. */
-            if(smsvdp.borders) {
-                int tmp = (smsvdp.regs[7] & 0x0F) | 0x10;
-                pixel_t col = smsvdp.pal[tmp];
+            if(vdp->borders) {
+                int tmp = (vdp->regs[7] & 0x0F) | 0x10;
+                pixel_t col = vdp->pal[tmp];
 
                 /* The left border is 13 pixels in size. */
                 *px++ = col;    /* 1 */
@@ -532,13 +580,13 @@ uint32 sms_vdp_execute(int line, int skip) {
             }
 #endif /* !_arch_dreamcast */
 
-            bg_draw(line, px);
-            spr_draw(line, px);
+            bg(vdp, line, px);
+            spr(vdp, line, px);
 
             /* Determine if we should mask column 0, and if so, do it */
-            if(smsvdp.regs[0] & 0x20 && !skip) {
-                int tmp = (smsvdp.regs[7] & 0x0F) | 0x10;
-                pixel_t col = smsvdp.pal[tmp];
+            if(vdp->regs[0] & 0x20 && !skip) {
+                int tmp = (vdp->regs[7] & 0x0F) | 0x10;
+                pixel_t col = vdp->pal[tmp];
 
                 /* Each column is 8 pixels. Mask all 8 of them */
                 *px++ = col;    /* 1 */
@@ -553,10 +601,10 @@ uint32 sms_vdp_execute(int line, int skip) {
 
 #ifndef _arch_dreamcast
             /* Fill in the right border, if we're bothering to emulate them. */
-            if(smsvdp.borders) {
-                int tmp = (smsvdp.regs[7] & 0x0F) | 0x10;
-                pixel_t col = smsvdp.pal[tmp];
-                px = (smsvdp.framebuffer_base) + (line << smsvdp.fb_x) + 256 +
+            if(vdp->borders) {
+                int tmp = (vdp->regs[7] & 0x0F) | 0x10;
+                pixel_t col = vdp->pal[tmp];
+                px = (vdp->framebuffer_base) + (line << vdp->fb_x) + 256 +
                     13;
 
                 /* The right border is 15 pixels in size. */
@@ -585,18 +633,18 @@ uint32 sms_vdp_execute(int line, int skip) {
             spr_skip(line);
         }
     }
-    else if(line < smsvdp.lines && !skip) {
+    else if(line < vdp->lines && !skip) {
         pixel_t *px;
 #ifndef _arch_dreamcast
-        if(smsvdp.borders)
-            px = (smsvdp.framebuffer_base) + (line << smsvdp.fb_x);
+        if(vdp->borders)
+            px = (vdp->framebuffer_base) + (line << vdp->fb_x);
         else
 #endif /* !_arch_dreamcast */
-            px = (smsvdp.framebuffer) + (line << smsvdp.fb_x);
+            px = (vdp->framebuffer) + (line << vdp->fb_x);
 
         /* Blank the whole scanline. */
-        int tmp = (smsvdp.regs[7] & 0x0F) | 0x10;
-        pixel_t col = smsvdp.pal[tmp];
+        int tmp = (vdp->regs[7] & 0x0F) | 0x10;
+        pixel_t col = vdp->pal[tmp];
 
         for(i = 0; i < 256; ++i) {
             *px++ = col;
@@ -604,7 +652,7 @@ uint32 sms_vdp_execute(int line, int skip) {
 
 #ifndef _arch_dreamcast
         /* Blank the rest of the scanline as well. */
-        if(smsvdp.borders) {
+        if(vdp->borders) {
             for(i = 0; i < 28; ++i) {
                 *px++ = col;
             }
@@ -614,67 +662,867 @@ uint32 sms_vdp_execute(int line, int skip) {
 #ifndef _arch_dreamcast
     /* If we're emulating borders, then we might have work to do outside the
        active display period. */
-    else if(smsvdp.borders) {
-        int bb = 0, tb = 512;
-
-        if(smsvdp.vidmode == SMS_VIDEO_NTSC) {
-            switch(smsvdp.lines) {
-                case 192:
-                    bb = kyoukai1[0];
-                    tb = kyoukai2[0];
-                    break;
+    else if(vdp->borders) {
+        int bb, tb;
 
-                case 224:
-                    bb = kyoukai1[1];
-                    tb = kyoukai2[1];
-                    break;
+        border_lines(vdp, &bb, &tb);
 
-                case 240:
-                    bb = kyoukai1[2];
-                    tb = kyoukai2[2];
-                    break;
+        if(line < bb) {
+            pixel_t *px = (vdp->framebuffer_base) + (line << vdp->fb_x);
+            int tmp = (vdp->regs[7] & 0x0F) | 0x10;
+            pixel_t col = vdp->pal[tmp];
+
+            for(i = 0; i < 284; ++i) {
+                *px++ = col;
+            }
+        }
+        else if(line >= tb) {
+            pixel_t *px = (vdp->framebuffer) + ((line - tb) << vdp->fb_x);
+            int tmp = (vdp->regs[7] & 0x0F) | 0x10;
+            pixel_t col = vdp->pal[tmp];
+
+            for(i = 0; i < 284; ++i) {
+                *px++ = col;
             }
         }
+    }
+#endif /* !_arch_dreamcast */
+}
+
+#ifndef _arch_dreamcast
+/* Static line detection. When enabled, everything that goes into drawing a
+   line (the registers, palette, the name table rows and pattern rows the
+   background uses, and the sprites on the line) is hashed as the line goes
+   by. If the hash matches the one from the last time the line was drawn into
+   the same framebuffer, that framebuffer already holds the right thing, and
+   the line is left alone (the sprite flags still get worked out). Frontends
+   like OpenEmu can hand over a different buffer from one frame to the next,
+   so hashes are kept for a few framebuffers at once. Lines in the TMS9918
+   modes are always drawn. */
+#define SMS_VDP_HASH_LINES      313
+#define SMS_VDP_HASH_BUFS       3
+
+#define HASH_INIT               0x9747B28C
+
+static struct {
+    int enabled;
+
+    /* The framebuffer each set of hashes is for, and the frame it was last
+       drawn to on. */
+    pixel_t *fb[SMS_VDP_HASH_BUFS];
+    uint32 used[SMS_VDP_HASH_BUFS];
+    uint32 frame;
+    int cur;
+
+    /* Input hashes for each line, as of the last time it was drawn into that
+       framebuffer. A hash of 0 never matches anything. */
+    uint32 hash[SMS_VDP_HASH_BUFS][SMS_VDP_HASH_LINES];
+
+    /* Which lines need to be drawn this frame. */
+    uint8 draw[SMS_VDP_HASH_LINES];
+
+    /* Statistics: lines seen, and those that were skipped. */
+    uint32 lines;
+    uint32 skipped;
+} sld;
+
+/* One round of MurmurHash3, a word at a time. */
+static __INLINE__ uint32 hash_word(uint32 h, uint32 w) {
+    w *= 0xCC9E2D51;
+    w = (w << 15) | (w >> 17);
+    w *= 0x1B873593;
+
+    h ^= w;
+    h = (h << 13) | (h >> 19);
+    return h * 5 + 0xE6546B64;
+}
+
+static __INLINE__ uint32 hash_words(uint32 h, const void *buf, int len) {
+    const uint8 *ptr = (const uint8 *)buf;
+    uint32 w;
+
+    for(; len >= 4; len -= 4, ptr += 4) {
+        memcpy(&w, ptr, 4);
+        h = hash_word(h, w);
+    }
+
+    return h;
+}
+
+/* Hash a row of the name table, along with the row of each pattern that will
+   be drawn from it. */
+static uint32 hash_name_row(sms_vdp_t *vdp, uint32 h, int row, int prow) {
+    uint16 *name_table_short = &((uint16 *)vdp->name_table)[row << 5];
+    uint32 w;
+    int i, tile;
+
+    h = hash_words(h, name_table_short, 64);
+
+    for(i = 0; i < 32; ++i) {
+        tile = name_table_short[i];
+#ifdef __BIG_ENDIAN__
+        tile = ((tile & 0xFF) << 8) | ((tile >> 8) & 0xFF);
+#endif
+        memcpy(&w, vdp->vram + ((tile & 0x1FF) << 5) +
+               (((tile & 0x400) ? 7 - prow : prow) << 2), 4);
+        h = hash_word(h, w);
+    }
+
+    return h;
+}
+
+/* Hash the sprites that get drawn on the given line, in the order they'd be
+   drawn in. This mirrors the logic of sms_vdp_m4_draw_spr(). */
+static uint32 hash_sprites(sms_vdp_t *vdp, uint32 h, int line) {
+    uint8 *sat = vdp->sat;
+    int height = 8, i, n = 0, y, num, row, ds = 0, tiled = 0, half;
+    uint32 w;
+
+    if(vdp->regs[1] & 0x02) {
+        tiled = 1;
+        height = 16;
+    }
+
+    if(vdp->regs[1] & 0x01) {
+        ds = 1;
+        height <<= 1;
+    }
+
+    half = (vdp->regs[6] & 0x04) << 6;
+
+    for(i = 0; i < 64 && n < 8; ++i) {
+        if(sat[i] == 0xD0)
+            break;
+
+        y = sat[i] + 1;
+
+        if(y == 256)
+            y = 0;
+
+        if(line >= y && line <= y + height - 1) {
+            num = sat[(i << 1) | 0x81] + half;
+
+            if(tiled)
+                num &= 0x1FE;
+
+            row = (line - y) >> ds;
+
+            if(row > 7) {
+                ++num;
+                row -= 8;
+            }
+
+            memcpy(&w, vdp->vram + (num << 5) + (row << 2), 4);
+            h = hash_word(h, sat[(i << 1) | 0x80]);
+            h = hash_word(h, w);
+            ++n;
+        }
+    }
+
+    return h;
+}
+
+/* Hash the inputs to a line. Returns 0 for lines that aren't tracked. */
+static uint32 line_hash(sms_vdp_t *vdp, int line) {
+    uint32 h = HASH_INIT;
+    int tmp;
+
+    h = hash_word(h, (uint32)(vdp->framebuffer_base - vdp->framebuffer));
+    h = hash_word(h, (uint32)(vdp->lines | (vdp->vidmode << 9) |
+                              (vdp->borders << 10)));
+
+    /* Blanked lines and borders only depend on the backdrop colour. */
+    if(line >= vdp->lines || !(vdp->regs[1] & 0x40)) {
+        h = hash_word(h, vdp->regs[1] & 0x40);
+        h = hash_word(h, vdp->pal[(vdp->regs[7] & 0x0F) | 0x10]);
+        return h ? h : 1;
+    }
+
+    if(bg_draw != sms_vdp_m4_draw_bg)
+        return 0;
+
+    /* Register 10 is the line counter, which doesn't affect drawing. */
+    h = hash_words(h, vdp->regs, 8);
+    h = hash_word(h, vdp->regs[8] | (vdp->regs[9] << 8));
+    h = hash_words(h, vdp->pal, sizeof(pixel_t) * 32);
+
+    tmp = line + vdp->regs[9];
+
+    if(vdp->lines == 192) {
+        if(tmp > 223)
+            tmp -= 224;
+    }
+    else {
+        tmp &= 0xFF;
+    }
+
+    h = hash_name_row(vdp, h, tmp >> 3, (line + vdp->yscroll_fine) & 0x07);
+
+    /* The right side columns might be locked in place vertically. */
+    if(vdp->regs[0] & 0x80)
+        h = hash_name_row(vdp, h, line >> 3, line & 0x07);
+
+    h = hash_sprites(vdp, h, line);
+
+    return h ? h : 1;
+}
+
+/* Find the hashes for the framebuffer being drawn to, taking over the set
+   that's gone the longest without being used if it's one we haven't seen. */
+static void static_select(void) {
+    int i, old = 0;
+
+    for(i = 0; i < SMS_VDP_HASH_BUFS; ++i) {
+        if(sld.fb[i] == smsvdp.framebuffer) {
+            sld.cur = i;
+            return;
+        }
+
+        if(sld.used[i] < sld.used[old])
+            old = i;
+    }
+
+    sld.fb[old] = smsvdp.framebuffer;
+    memset(sld.hash[old], 0, sizeof(sld.hash[old]));
+    sld.cur = old;
+}
+
+/* Forget everything, so every line gets drawn again. */
+static void static_reset(void) {
+    memset(sld.fb, 0, sizeof(sld.fb));
+    memset(sld.used, 0, sizeof(sld.used));
+    memset(sld.hash, 0, sizeof(sld.hash));
+    sld.frame = 0;
+    sld.cur = 0;
+}
+
+/* Work out whether a line has to be drawn this frame. */
+static int static_check(int line) {
+    uint32 h;
+
+    if(sld.fb[sld.cur] != smsvdp.framebuffer)
+        static_select();
+
+    if(line == 0)
+        sld.used[sld.cur] = ++sld.frame;
+
+    if(line >= SMS_VDP_HASH_LINES)
+        return 1;
+
+    h = line_hash(&smsvdp, line);
+    ++sld.lines;
+
+    if(h && h == sld.hash[sld.cur][line]) {
+        ++sld.skipped;
+        sld.draw[line] = 0;
+        return 0;
+    }
+
+    sld.hash[sld.cur][line] = h;
+    sld.draw[line] = 1;
+    return 1;
+}
+
+/* Whether a line held back by the deferred renderer still has to be drawn. */
+static __INLINE__ int static_changed(int line) {
+    return !sld.enabled || sld.draw[line];
+}
+
+int sms_vdp_set_static_detect(int enable) {
+    static_reset();
+    sld.enabled = enable;
+    return 0;
+}
+
+void sms_vdp_static_stats(uint32 *lines, uint32 *skipped) {
+    *lines = sld.lines;
+    *skipped = sld.skipped;
+}
+#endif /* !_arch_dreamcast */
+
+#ifndef _arch_dreamcast
+/* Deferred rendering. Most frames don't touch the VDP at all during the active
+   display period, so when this is enabled, drawing of the active lines is put
+   off until the end of the frame. If nothing gets written to VRAM, CRAM, or the
+   registers in the meantime, the background for the whole frame is drawn in
+   tile order, with each pattern looked up once per tile row instead of once
+   per line. If something does get written, the lines held back so far are
+   drawn normally before the write goes through, and the rest of the frame is
+   drawn line by line as usual.
+
+   This works along with threaded rendering (below), rather than instead of
+   it: held back lines are handed to the render thread, either as one record
+   for the whole frame to be drawn in tile order once the active display is
+   over, or line by line when something gets written first. */
+#define SMS_VDP_DEFER_LINES     240
+
+static struct {
+    int enabled;
+
+    /* Number of lines at the top of the frame that haven't been drawn yet. */
+    int pending;
+
+    /* Statistics: frames seen, and those drawn in tile order. */
+    uint32 frames;
+    uint32 fast;
+
+    /* Background priority data for each line, saved off by the tile order
+       renderer for use when drawing sprites. */
+    uint8 alpha[SMS_VDP_DEFER_LINES][256];
+} dfr;
+
+static int sms_vdp_m4_frame_row(sms_vdp_t *vdp, int line) {
+    int tmp;
+
+    if(vdp->lines == 192) {
+        tmp = line + vdp->regs[9];
+
+        if(tmp > 223)
+            tmp -= 224;
+    }
+    else {
+        tmp = (line + vdp->regs[9]) & 0xFF;
+    }
+
+    return tmp >> 3;
+}
+
+/* Draw the mode 4 background for lines 0 through count - 1 in tile order. The
+   output is exactly what sms_vdp_m4_draw_bg() would give line by line. */
+static void sms_vdp_m4_draw_frame(sms_vdp_t *vdp, int count) {
+    int line, end, l, col, first, last, scrolled;
+    int row, rendercol, xoff, yoff, tile, tilenum, attrib, tmp, i, x;
+    int locked, pal;
+    uint16 *name_table_short;
+    uint8 *pixels, *alpha;
+    pixel_t *base, *px;
+    uint8 *tex;
+
+    base = vdp->framebuffer;
+
+    if(vdp->borders)
+        base = vdp->framebuffer_base + 13;
+
+    /* The columns that ignore vertical scrolling get a pass of their own. */
+    for(scrolled = 1; scrolled >= 0; --scrolled) {
+        if(scrolled) {
+            first = 0;
+            last = (vdp->regs[0] & 0x80) ? 24 : 32;
+            yoff = vdp->yscroll_fine;
+        }
+        else if(vdp->regs[0] & 0x80) {
+            first = 24;
+            last = 32;
+            yoff = 0;
+        }
         else {
-            switch(smsvdp.lines) {
-                case 192:
-                    bb = kyoukai1[3];
-                    tb = kyoukai2[3];
-                    break;
+            break;
+        }
 
-                case 224:
-                    bb = kyoukai1[4];
-                    tb = kyoukai2[4];
-                    break;
+        for(line = 0; line < count; line = end) {
+            row = scrolled ? sms_vdp_m4_frame_row(vdp, line) : line >> 3;
+            locked = (line >> 3) < 2 && (vdp->regs[0] & 0x40);
+
+            /* Find all the lines that come from this row of the name table. */
+            for(end = line + 1; end < count && end - line < 8; ++end) {
+                tmp = scrolled ? sms_vdp_m4_frame_row(vdp, end) : end >> 3;
 
-                case 240:
-                    bb = kyoukai1[5];
-                    tb = kyoukai2[5];
+                if(tmp != row ||
+                   locked != ((end >> 3) < 2 && (vdp->regs[0] & 0x40)))
                     break;
             }
+
+            if(locked) {
+                rendercol = 0;
+                xoff = 0;
+            }
+            else {
+                rendercol = vdp->xscroll_coarse;
+                xoff = vdp->xscroll_fine;
+            }
+
+            name_table_short = &((uint16 *)vdp->name_table)[row << 5];
+
+            for(col = first; col < last; ++col) {
+                tile = name_table_short[(rendercol + col) & 0x1F];
+#ifdef __BIG_ENDIAN__
+                tile = ((tile & 0xFF) << 8) | ((tile >> 8) & 0xFF);
+#endif
+                tilenum = tile & 0x1FF;
+
+                if(vdp->pattern[tilenum].dirty)
+                    update_cache(vdp, tilenum);
+
+                attrib = (tile >> 9) & 0x03;
+                tex = vdp->pattern[tilenum].texture[attrib];
+                pal = (tile & 0x800) >> 7;
+
+                x = xoff + (col << 3);
+
+                /* Draw this tile's 8 pixel wide slice of each line. Only the
+                   last column can wrap around the edge. */
+                for(l = line; l < end; ++l) {
+                    pixels = tex + (((l + yoff) & 0x07) << 3);
+                    px = base + (l << vdp->fb_x);
+                    alpha = dfr.alpha[l];
+
+                    if(x <= 248) {
+                        for(i = 0; i < 8; ++i) {
+                            px[x + i] = vdp->pal[pixels[i] + pal];
+                        }
+
+                        if(tile & 0x1000)
+                            memcpy(alpha + x, pixels, 8);
+                        else
+                            memset(alpha + x, 0, 8);
+                    }
+                    else {
+                        for(i = 0; i < 8; ++i) {
+                            px[(x + i) & 0xFF] = vdp->pal[pixels[i] + pal];
+                            alpha[(x + i) & 0xFF] =
+                                (tile & 0x1000) ? pixels[i] : 0;
+                        }
+                    }
+                }
+            }
         }
+    }
+}
 
-        if(line < bb) {
-            pixel_t *px = (smsvdp.framebuffer_base) + (line << smsvdp.fb_x);
-            int tmp = (smsvdp.regs[7] & 0x0F) | 0x10;
-            pixel_t col = smsvdp.pal[tmp];
+/* Stand-in for the background drawing function once the tile order renderer
+   has drawn the background. All that's left to do is load up the priority data
+   for the sprites. */
+static void sms_vdp_m4_frame_bg(sms_vdp_t *vdp, int line,
+                                pixel_t *px __UNUSED__) {
+    memcpy(vdp->alpha, dfr.alpha[line], 256);
+}
 
-            for(i = 0; i < 284; ++i) {
-                *px++ = col;
+/* Threaded rendering. When enabled, the emulation thread doesn't draw anything
+   itself. Instead, it records the register state of the VDP at the start of
+   each line, along with a log of every VRAM and CRAM write made since the line
+   before. The render thread replays that log into its own copy of the VDP
+   (rvdp) and draws the line from there, trailing behind the emulation thread
+   by at most SMS_VDP_THREAD_LINES lines. */
+#define SMS_VDP_THREAD_LINES    32
+#define SMS_VDP_THREAD_WRITES   8192
+
+#define SMS_VDP_LOG_VRAM        0
+#define SMS_VDP_LOG_CRAM        1
+
+typedef struct smsvdp_logent_s {
+    uint16 addr;
+    uint8 data;
+    uint8 type;
+} smsvdp_logent_t;
+
+typedef struct smsvdp_linerec_s {
+    int line;
+    int lines;
+    int vidmode;
+    uint8 regs[16];
+    pixel_t *framebuffer;
+    pixel_t *framebuffer_base;
+    smsvdp_draw_func bg;
+    smsvdp_draw_func spr;
+    uint32 log_end;
+
+    /* If not 0, draw lines 0 through frame - 1 in tile order, instead of just
+       the one line. */
+    int frame;
+} smsvdp_linerec_t;
+
+static struct {
+    int running;
+    int quit;
+    pthread_t thd;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+
+    /* Line records, indexed modulo SMS_VDP_THREAD_LINES. Only touched while
+       holding the lock. */
+    smsvdp_linerec_t recs[SMS_VDP_THREAD_LINES];
+    uint32 head;
+    uint32 tail;
+
+    /* Write log, indexed modulo SMS_VDP_THREAD_WRITES. log_head and log_seen
+       belong to the emulation thread, log_done is updated under the lock by
+       the render thread once it has replayed a line's writes. */
+    smsvdp_logent_t log[SMS_VDP_THREAD_WRITES];
+    uint32 log_head;
+    uint32 log_seen;
+    uint32 log_done;
+} rthd;
+
+/* The render thread's copy of the VDP. */
+static sms_vdp_t rvdp;
+
+static void render_thread_replay(uint32 end) {
+    smsvdp_logent_t *ent;
+    uint32 i;
+
+    for(i = rthd.log_done; i != end; ++i) {
+        ent = &rthd.log[i % SMS_VDP_THREAD_WRITES];
+
+        if(ent->type == SMS_VDP_LOG_VRAM) {
+            rvdp.vram[ent->addr] = ent->data;
+            rvdp.pattern[ent->addr >> 5].dirty = 1;
+            tms9918a_vram_written(&rvdp, ent->addr);
+        }
+        else {
+            rvdp.cram[ent->addr] = ent->data;
+
+            if(sms_cons._base.console_type != CONSOLE_GG)
+                update_local_pal_sms(&rvdp, ent->addr);
+            else
+                update_local_pal_gg(&rvdp, ent->addr & 0x3E);
+        }
+    }
+}
+
+static void *render_thread_proc(void *data __UNUSED__) {
+    smsvdp_linerec_t *rec;
+    int tmp;
+
+    pthread_mutex_lock(&rthd.lock);
+
+    for(;;) {
+        while(rthd.head == rthd.tail && !rthd.quit) {
+            pthread_cond_wait(&rthd.work, &rthd.lock);
+        }
+
+        if(rthd.head == rthd.tail)
+            break;
+
+        rec = &rthd.recs[rthd.tail % SMS_VDP_THREAD_LINES];
+        pthread_mutex_unlock(&rthd.lock);
+
+        render_thread_replay(rec->log_end);
+
+        /* A line of -1 just flushes the write log. */
+        if(rec->line >= 0) {
+            memcpy(rvdp.regs, rec->regs, 16);
+            rvdp.lines = rec->lines;
+            rvdp.vidmode = rec->vidmode;
+            rvdp.framebuffer = rec->framebuffer;
+            rvdp.framebuffer_base = rec->framebuffer_base;
+
+            readjust_name_table(&rvdp);
+            rvdp.sat = rvdp.vram + ((rvdp.regs[5] & 0x7E) << 7);
+            tmp = (rvdp.regs[8] & 0xF8) >> 3;
+            rvdp.xscroll_coarse = (32 - tmp) & 0x1F;
+            rvdp.xscroll_fine = rvdp.regs[8] & 0x07;
+            rvdp.yscroll_fine = rvdp.regs[9] & 0x07;
+
+            if(rec->frame) {
+                sms_vdp_m4_draw_frame(&rvdp, rec->frame);
+
+                for(tmp = 0; tmp < rec->frame; ++tmp) {
+                    render_line(&rvdp, tmp, 0, sms_vdp_m4_frame_bg, rec->spr);
+                }
+            }
+            else {
+                render_line(&rvdp, rec->line, 0, rec->bg, rec->spr);
             }
         }
-        else if(line >= tb) {
-            pixel_t *px = (smsvdp.framebuffer) + ((line - tb) << smsvdp.fb_x);
-            int tmp = (smsvdp.regs[7] & 0x0F) | 0x10;
-            pixel_t col = smsvdp.pal[tmp];
 
-            for(i = 0; i < 284; ++i) {
-                *px++ = col;
+        pthread_mutex_lock(&rthd.lock);
+        rthd.log_done = rec->log_end;
+        ++rthd.tail;
+        pthread_cond_broadcast(&rthd.done);
+    }
+
+    pthread_mutex_unlock(&rthd.lock);
+    return NULL;
+}
+
+static void render_thread_queue(int line, int frame) {
+    smsvdp_linerec_t *rec;
+
+    pthread_mutex_lock(&rthd.lock);
+
+    /* Don't let the render thread fall too far behind. */
+    while(rthd.head - rthd.tail >= SMS_VDP_THREAD_LINES) {
+        pthread_cond_wait(&rthd.done, &rthd.lock);
+    }
+
+    rthd.log_seen = rthd.log_done;
+
+    rec = &rthd.recs[rthd.head % SMS_VDP_THREAD_LINES];
+    rec->line = line;
+    rec->frame = frame;
+    rec->log_end = rthd.log_head;
+
+    if(line >= 0) {
+        memcpy(rec->regs, smsvdp.regs, 16);
+        rec->lines = smsvdp.lines;
+        rec->vidmode = smsvdp.vidmode;
+        rec->framebuffer = smsvdp.framebuffer;
+        rec->framebuffer_base = smsvdp.framebuffer_base;
+        rec->bg = bg_draw;
+        rec->spr = spr_draw;
+    }
+
+    ++rthd.head;
+    pthread_cond_signal(&rthd.work);
+    pthread_mutex_unlock(&rthd.lock);
+}
+
+static void render_thread_log(int type, uint16 addr, uint8 data) {
+    smsvdp_logent_t *ent;
+
+    /* If the log is full, push out what we have so far and wait for the render
+       thread to get through it. */
+    if(rthd.log_head - rthd.log_seen >= SMS_VDP_THREAD_WRITES) {
+        render_thread_queue(-1, 0);
+        sms_vdp_sync();
+    }
+
+    ent = &rthd.log[rthd.log_head % SMS_VDP_THREAD_WRITES];
+    ent->addr = addr;
+    ent->data = data;
+    ent->type = (uint8)type;
+    ++rthd.log_head;
+}
+
+/* Bring the render thread's copy of the VDP in line with the real one. This is
+   needed any time the VDP state is changed other than through the ports. */
+static void render_thread_resync(void) {
+    int i;
+
+    if(!rthd.running)
+        return;
+
+    sms_vdp_sync();
+
+    memcpy(rvdp.vram, smsvdp.vram, 0x4000);
+    memcpy(rvdp.cram, smsvdp.cram, 64);
+    memcpy(rvdp.pal, smsvdp.pal, sizeof(pixel_t) * 32);
+    rvdp.borders = smsvdp.borders;
+    rvdp.fb_x = smsvdp.fb_x;
+    rvdp.fb_y = smsvdp.fb_y;
+    rvdp.machine = smsvdp.machine;
+
+    for(i = 0; i < 512; ++i) {
+        rvdp.pattern[i].dirty = 1;
+    }
+
+    tms9918a_cache_reset(&rvdp);
+}
+
+static void deferred_draw(int fast) {
+    uint8 status = smsvdp.status;
+    int i;
+
+    /* If static line detection is on, see if any of the lines changed. */
+    if(sld.enabled) {
+        for(i = 0; i < dfr.pending && !sld.draw[i]; ++i) {
+        }
+
+        if(i == dfr.pending) {
+            if(fast)
+                ++dfr.fast;
+
+            dfr.pending = 0;
+            return;
+        }
+    }
+
+    if(rthd.running) {
+        if(fast) {
+            render_thread_queue(0, dfr.pending);
+            ++dfr.fast;
+        }
+        else {
+            for(i = 0; i < dfr.pending; ++i) {
+                if(static_changed(i))
+                    render_thread_queue(i, 0);
             }
         }
+
+        dfr.pending = 0;
+        return;
+    }
+
+    /* The sprite flags were already worked out when the lines went by, so
+       don't let them get set again here. */
+    if(fast) {
+        sms_vdp_m4_draw_frame(&smsvdp, dfr.pending);
+
+        for(i = 0; i < dfr.pending; ++i) {
+            render_line(&smsvdp, i, 0, sms_vdp_m4_frame_bg, spr_draw);
+        }
+
+        ++dfr.fast;
+    }
+    else {
+        for(i = 0; i < dfr.pending; ++i) {
+            if(static_changed(i))
+                render_line(&smsvdp, i, 0, bg_draw, spr_draw);
+        }
     }
+
+    smsvdp.status = status;
+    dfr.pending = 0;
+}
+
+/* Called before anything that affects rendering changes. */
+static __INLINE__ void deferred_flush(void) {
+    if(dfr.pending)
+        deferred_draw(0);
+}
+
+int sms_vdp_set_threaded(int enable) {
+    if(enable == rthd.running)
+        return 0;
+
+    /* Lines held back so far go to whoever was drawing them. */
+    deferred_flush();
+
+    if(!enable) {
+        pthread_mutex_lock(&rthd.lock);
+        rthd.quit = 1;
+        pthread_cond_signal(&rthd.work);
+        pthread_mutex_unlock(&rthd.lock);
+
+        pthread_join(rthd.thd, NULL);
+
+        pthread_cond_destroy(&rthd.done);
+        pthread_cond_destroy(&rthd.work);
+        pthread_mutex_destroy(&rthd.lock);
+
+        free(rvdp.vram);
+        free(rvdp.cram);
+        free(rvdp.pal);
+        rthd.running = 0;
+
+        return 0;
+    }
+
+    rvdp.vram = (uint8 *)malloc(0x4000);
+    rvdp.cram = (uint8 *)malloc(64);
+    rvdp.pal = (pixel_t *)malloc(sizeof(pixel_t) * 32);
+
+    if(!rvdp.vram || !rvdp.cram || !rvdp.pal) {
+#ifdef DEBUG
+        fprintf(stderr, "sms_vdp_set_threaded: Out of memory!\n");
+#endif
+        free(rvdp.vram);
+        free(rvdp.cram);
+        free(rvdp.pal);
+        return -1;
+    }
+
+    rthd.head = rthd.tail = 0;
+    rthd.log_head = rthd.log_seen = rthd.log_done = 0;
+    rthd.quit = 0;
+
+    pthread_mutex_init(&rthd.lock, NULL);
+    pthread_cond_init(&rthd.work, NULL);
+    pthread_cond_init(&rthd.done, NULL);
+
+    if(pthread_create(&rthd.thd, NULL, &render_thread_proc, NULL)) {
+#ifdef DEBUG
+        fprintf(stderr, "sms_vdp_set_threaded: Cannot create thread!\n");
+#endif
+        pthread_cond_destroy(&rthd.done);
+        pthread_cond_destroy(&rthd.work);
+        pthread_mutex_destroy(&rthd.lock);
+        free(rvdp.vram);
+        free(rvdp.cram);
+        free(rvdp.pal);
+        return -1;
+    }
+
+    rthd.running = 1;
+    render_thread_resync();
+
+    return 0;
+}
+
+/* Work out whether to hold back the given line, drawing the held back lines
+   once the active display is over. Returns nonzero if the line was held. */
+static int deferred_hold(int line) {
+    /* Start holding back lines at the top of each frame, if there's a mode 4
+       display to draw. */
+    if(line == 0) {
+        ++dfr.frames;
+
+        if(smsvdp.regs[1] & 0x40 && bg_draw == sms_vdp_m4_draw_bg &&
+           smsvdp.lines <= SMS_VDP_DEFER_LINES)
+            dfr.pending = 1;
+    }
+    else if(dfr.pending && line < smsvdp.lines) {
+        dfr.pending = line + 1;
+    }
+    else if(dfr.pending) {
+        /* Nothing changed during the active display, draw it all now. */
+        deferred_draw(1);
+    }
+
+    return dfr.pending;
+}
+
+int sms_vdp_set_deferred(int enable) {
+    deferred_flush();
+    dfr.enabled = enable;
+    return 0;
+}
+
+void sms_vdp_deferred_stats(uint32 *frames, uint32 *fast) {
+    *frames = dfr.frames;
+    *fast = dfr.fast;
+}
+
+void sms_vdp_sync(void) {
+    /* Draw anything that's been held back this frame. */
+    deferred_flush();
+
+    if(!rthd.running)
+        return;
+
+    pthread_mutex_lock(&rthd.lock);
+
+    while(rthd.head != rthd.tail) {
+        pthread_cond_wait(&rthd.done, &rthd.lock);
+    }
+
+    rthd.log_seen = rthd.log_done;
+    pthread_mutex_unlock(&rthd.lock);
+}
 #endif /* !_arch_dreamcast */
 
+uint32 sms_vdp_execute(int line, int skip) {
+    uint32 cycles = 0;
+
+#ifndef _arch_dreamcast
+    int draw = 1;
+
+    if(sld.enabled && !skip)
+        draw = static_check(line);
+
+    if(dfr.enabled && !skip && deferred_hold(line)) {
+        /* Held back until the end of the active display. */
+        spr_skip(line);
+    }
+    else if(rthd.running && !skip) {
+        /* Hand the line off to the render thread. The sprite flags are visible
+           to the CPU, so they still have to be worked out here. */
+        if(draw)
+            render_thread_queue(line, 0);
+
+        if(smsvdp.regs[1] & 0x40 && line < smsvdp.lines)
+            spr_skip(line);
+    }
+    else if(!draw) {
+        /* Nothing's changed on this line since it was last drawn. */
+        if(smsvdp.regs[1] & 0x40 && line < smsvdp.lines)
+            spr_skip(line);
+    }
+    else
+#endif /* !_arch_dreamcast */
+        render_line(&smsvdp, line, skip, bg_draw, spr_draw);
+
     if(line <= smsvdp.lines) {
         if(smsvdp.linecnt == 0) {
             /* The Register 10 line count will underflow, interrupt if
@@ -736,8 +1584,8 @@ uint32 tms9918a_vdp_execute(int line, void (*irqfunc)(), int skip) {
                 px = (smsvdp.framebuffer) + (line << smsvdp.fb_x);
 
 
-            bg_draw(line, px);
-            spr_draw(line, px);
+            bg_draw(&smsvdp, line, px);
+            spr_draw(&smsvdp, line, px);
         }
         else {
             /* Backgrounds can't actually affect anything status-wise, so there
@@ -785,23 +1633,53 @@ void sms_vdp_data_write(uint8 data) {
         case 0x01:
         case 0x02:
             if(smsvdp.vram[smsvdp.addr] != data) {
+#ifndef _arch_dreamcast
+                deferred_flush();
+#endif
                 smsvdp.vram[smsvdp.addr] = data;
                 smsvdp.pattern[smsvdp.addr >> 5].dirty = 1;
+                tms9918a_vram_written(&smsvdp, smsvdp.addr);
+
+#ifndef _arch_dreamcast
+                if(rthd.running)
+                    render_thread_log(SMS_VDP_LOG_VRAM, smsvdp.addr, data);
+#endif
             }
             break;
         case 0x03:
             if(sms_cons._base.console_type != CONSOLE_GG) {
+#ifndef _arch_dreamcast
+                deferred_flush();
+#endif
                 smsvdp.cram[smsvdp.addr & 0x1F] = data;
-                update_local_pal_sms(smsvdp.addr & 0x1F);
+                update_local_pal_sms(&smsvdp, smsvdp.addr & 0x1F);
+
+#ifndef _arch_dreamcast
+                if(rthd.running)
+                    render_thread_log(SMS_VDP_LOG_CRAM, smsvdp.addr & 0x1F,
+                                      data);
+#endif
             }
             else {
                 if(!(smsvdp.addr & 0x01)) {
                     smsvdp.pal_latch = data;
                 }
                 else {
+#ifndef _arch_dreamcast
+                    deferred_flush();
+#endif
                     smsvdp.cram[smsvdp.addr & 0x3E] = smsvdp.pal_latch;
                     smsvdp.cram[smsvdp.addr & 0x3F] = data;
-                    update_local_pal_gg(smsvdp.addr & 0x3E);
+                    update_local_pal_gg(&smsvdp, smsvdp.addr & 0x3E);
+
+#ifndef _arch_dreamcast
+                    if(rthd.running) {
+                        render_thread_log(SMS_VDP_LOG_CRAM, smsvdp.addr & 0x3E,
+                                          smsvdp.pal_latch);
+                        render_thread_log(SMS_VDP_LOG_CRAM, smsvdp.addr & 0x3F,
+                                          data);
+                    }
+#endif
                 }
             }
             break;
@@ -812,6 +1690,11 @@ void sms_vdp_data_write(uint8 data) {
 }
 
 static void sms_vdp_reg_write(int reg, uint8 data) {
+#ifndef _arch_dreamcast
+    if(smsvdp.regs[reg] != data)
+        deferred_flush();
+#endif
+
     smsvdp.regs[reg] = data;
 
     if(reg == 0) {
@@ -840,7 +1723,7 @@ static void sms_vdp_reg_write(int reg, uint8 data) {
         }
     }
     else if(reg == 2) {
-        readjust_name_table();
+        readjust_name_table(&smsvdp);
     }
     else if(reg == 5) {
         smsvdp.sat = smsvdp.vram + ((smsvdp.regs[5] & 0x7E) << 7);
@@ -1016,6 +1899,8 @@ int sms_vdp_init(int mode, int borders) {
            overwritten before they're used, anyway */
     }
 
+    tms9918a_cache_reset(&smsvdp);
+
     /* Allocate memory */
     smsvdp.cram = (uint8 *)malloc(64);
 
@@ -1085,13 +1970,7 @@ int sms_vdp_init(int mode, int borders) {
 
     sms_vdp_set_vidmode(mode, SMS_VDP_MACHINE_SMS2);
 
-    for(i = 0; i < 256; ++i) {
-        lut[i] = (i & 0x01) | ((i & 0x02) << 3) | ((i & 0x04) << 6) |
-            ((i & 0x08) << 9) | ((i & 0x10) << 12) | ((i & 0x20) << 15) |
-            ((i & 0x40) << 18) | ((i & 0x80) << 21);
-    }
-
-    readjust_name_table();
+    readjust_name_table(&smsvdp);
     smsvdp.sat = smsvdp.vram + ((smsvdp.regs[5] & 0x7E) << 7);
 
     return 0;
@@ -1135,12 +2014,20 @@ int sms_vdp_reset(void) {
            overwritten before they're used, anyway */
     }
 
+    tms9918a_cache_reset(&smsvdp);
+
     memset(smsvdp.vram, 0, 0x4000);
     memset(smsvdp.cram, 0, 64);
     memset(smsvdp.pal, 0, sizeof(pixel_t) * 32);
 
     sms_vdp_set_vidmode(smsvdp.vidmode, smsvdp.machine);
 
+#ifndef _arch_dreamcast
+    dfr.pending = 0;
+    static_reset();
+    render_thread_resync();
+#endif
+
     return 0;
 }
 
@@ -1148,6 +2035,13 @@ int sms_vdp_shutdown(void) {
 #ifdef _arch_dreamcast
     /* Put the framebuffer back into P1. */
     smsvdp.framebuffer = (pixel_t *)((uint32)smsvdp.framebuffer & 0xDFFFFFFF);
+#else
+    sms_vdp_set_threaded(0);
+
+    dfr.enabled = dfr.pending = 0;
+    dfr.frames = dfr.fast = 0;
+    sld.enabled = 0;
+    sld.lines = sld.skipped = 0;
 #endif
 
     /* Free all RAM used */
@@ -1407,7 +2301,7 @@ void sms_vdp_set_vidmode(int mode, int machine) {
     }
 
     if(oldlines != smsvdp.lines) {
-        readjust_name_table();
+        readjust_name_table(&smsvdp);
     }
 }
 
@@ -1434,12 +2328,10 @@ static int sms_vdp_write_vram_context(FILE *fp) {
     return 0;
 }
 
-static int sms_vdp_read_vram_context(const uint8 *buf) {
-    uint32 len;
+static int sms_vdp_read_vram_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 0x4010)
         return -1;
 
@@ -1452,7 +2344,9 @@ static int sms_vdp_read_vram_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
-    memset(smsvdp.vram, 0, 0x4000);
+    if(!load)
+        return 0;
+
     memcpy(smsvdp.vram, buf + 16, 0x4000);
     return 0;
 }
@@ -1484,12 +2378,10 @@ static int sms_vdp_write_cram_context(FILE *fp) {
     return 0;
 }
 
-static int sms_vdp_read_cram_context(const uint8 *buf) {
-    uint32 len;
+static int sms_vdp_read_cram_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 80)
         return -1;
 
@@ -1502,7 +2394,9 @@ static int sms_vdp_read_cram_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
-    memset(smsvdp.cram, 0, 64);
+    if(!load)
+        return 0;
+
     memcpy(smsvdp.cram, buf + 16, 64);
     return 0;
 }
@@ -1561,14 +2455,18 @@ int sms_vdp_write_context(FILE *fp) {
     return 0;
 }
 
-int sms_vdp_read_context(const uint8 *buf) {
-    uint32 len, child, clen;
+static const statesave_reader_t vdp_children[] = {
+    { FOURCC_TO_UINT32('V', 'R', 'A', 'M'), &sms_vdp_read_vram_context },
+    { FOURCC_TO_UINT32('C', 'R', 'A', 'M'), &sms_vdp_read_cram_context },
+    { 0, NULL }
+};
+
+int sms_vdp_read_context(const uint8 *buf, uint32 len, int load) {
+    uint32 child;
     uint16 ver;
-    const uint8 *ptr;
     int rv, i, tmp;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len < 48)
         return -1;
 
@@ -1582,6 +2480,13 @@ int sms_vdp_read_context(const uint8 *buf) {
     if(child != 32)
         return -1;
 
+    /* Make sure the child nodes are sane before loading anything */
+    if(statesave_check(buf + 16 + child, len - 16 - child, vdp_children))
+        return -2;
+
+    if(!load)
+        return 0;
+
     /* Read the VDP state */
     for(i = 0; i < 16; ++i) {
         smsvdp.regs[i] = buf[16 + i];
@@ -1597,53 +2502,18 @@ int sms_vdp_read_context(const uint8 *buf) {
     smsvdp.hcnt = buf[40];
     BUF_TO_UINT32(buf + 44, smsvdp.flags);
 
-    /* Handle child nodes */
-    ptr = buf + 16 + child;
-
-    while(ptr < buf + len) {
-        rv = 0;
-
-        /* Check for a malformed child node */
-        if(ptr + 16 > buf + len)
-            return -2;
-
-        child = FOURCC_TO_UINT32(ptr[0], ptr[1], ptr[2], ptr[3]);
-        BUF_TO_UINT32(ptr + 4, clen);
-
-        /* Make sure the length is sane */
-        if(ptr + clen > buf + len)
-            return -2;
-
-        switch(child) {
-            case FOURCC_TO_UINT32('V', 'R', 'A', 'M'):
-                rv = sms_vdp_read_vram_context(ptr);
-                break;
-
-            case FOURCC_TO_UINT32('C', 'R', 'A', 'M'):
-                rv = sms_vdp_read_cram_context(ptr);
-                break;
-
-            default:
-                /* See if its marked as essential... */
-                BUF_TO_UINT16(ptr + 10, ver);
-                if(ver & 1)
-                    rv = -1;
-        }
-
-        if(rv)
-            return rv;
-
-        ptr += clen;
-    }
+    /* Load the child nodes */
+    if((rv = statesave_load(buf + 16 + child, len - 16 - child, vdp_children)))
+        return rv;
 
     if(sms_cons._base.console_type != CONSOLE_GG) {
         for(i = 0; i < 0x20; ++i) {
-            update_local_pal_sms(i);
+            update_local_pal_sms(&smsvdp, i);
         }
     }
     else {
         for(i = 0; i < 0x40; i += 2) {
-            update_local_pal_gg(i);
+            update_local_pal_gg(&smsvdp, i);
         }
     }
 
@@ -1655,7 +2525,7 @@ int sms_vdp_read_context(const uint8 *buf) {
     smsvdp.xscroll_fine = smsvdp.regs[8] & 0x07;
     smsvdp.yscroll_fine = smsvdp.regs[9] & 0x07;
     sms_vdp_set_vidmode(smsvdp.vidmode, smsvdp.machine);
-    readjust_name_table();
+    readjust_name_table(&smsvdp);
 
     /* Assert the irq line if we need to. */
     if((smsvdp.status & 0x80) && (smsvdp.regs[1] & 0x20)) {
@@ -1669,6 +2539,14 @@ int sms_vdp_read_context(const uint8 *buf) {
            overwritten before they're used, anyway */
     }
 
+    tms9918a_cache_reset(&smsvdp);
+
+#ifndef _arch_dreamcast
+    dfr.pending = 0;
+    static_reset();
+    render_thread_resync();
+#endif
+
     return 0;
 }
 
@@ -1701,14 +2579,22 @@ void sms_vdp_read_context_v1(FILE *fp) {
            overwritten before they're used, anyway */
     }
 
+    tms9918a_cache_reset(&smsvdp);
+
     if(sms_cons._base.console_type != CONSOLE_GG) {
         for(i = 0; i < 0x20; ++i) {
-            update_local_pal_sms(i);
+            update_local_pal_sms(&smsvdp, i);
         }
     }
     else {
         for(i = 0; i < 0x40; i += 2) {
-            update_local_pal_gg(i);
+            update_local_pal_gg(&smsvdp, i);
         }
     }
+
+#ifndef _arch_dreamcast
+    dfr.pending = 0;
+    static_reset();
+    render_thread_resync();
+#endif
 }
@@ -34,6 +34,42 @@ typedef struct smspat_s {
     uint8 dirty;
 } sms_vdp_pattern_t;
 
+/* Cached mode 4 background plane. Each byte holds the palette index of a pixel
+   in bits 0-4 and the priority flag in bit 5, so palette changes don't need to
+   invalidate anything. A tile is redrawn when its name table entry changes, or
+   when its pattern is reconverted (tracked by pattern_gen). */
+typedef struct sms_vdp_plane_s {
+    uint8 pixels[256][256];
+    uint16 tile[32][32];
+    uint32 tile_gen[32][32];
+    uint8 valid[32][32];
+    uint32 pattern_gen[512];
+} sms_vdp_plane_t;
+
+/* Pattern cache for the TMS9918 modes. Each entry holds the 8 rows of a
+   pattern, expanded to one colour number per pixel (0 meaning the backdrop
+   colour shows through). Sprites are looked up through per-line lists. */
+typedef struct sms_vdp_tms_cache_s {
+    /* Mode and table layout the cache was built for */
+    int mode;
+    int pg;
+    int ct;
+    int mask;
+    int mask2;
+
+    /* Expanded patterns (768 in mode 2, 256 otherwise) */
+    uint8 rows[768][8][8];
+    uint8 dirty[768];
+
+    /* Sprites on each line, rebuilt when the Y positions change */
+    int sat;
+    int spr_size;
+    uint8 spr_dirty;
+    uint8 spr[192][4];
+    uint8 spr_count[192];
+    uint8 spr_end[192];
+} sms_vdp_tms_cache_t;
+
 typedef struct smsvdp_s {
     /* Command Word - written to the control port
        Consists of a 2-bit code and a 14-bit address */
@@ -112,6 +148,12 @@ typedef struct smsvdp_s {
     int borders;
     int fb_x;
     int fb_y;
+
+    /* Mode 4 background plane cache */
+    sms_vdp_plane_t plane;
+
+    /* Pattern cache for the TMS9918 modes */
+    sms_vdp_tms_cache_t tms;
 } sms_vdp_t;
 
 #define SMS_VDP_FLAG_BYTES_WRITTEN  0x00000001
@@ -143,13 +185,36 @@ extern int sms_vdp_init(int mode, int borders);
 extern int sms_vdp_reset(void);
 extern int sms_vdp_shutdown(void);
 
+#ifndef _arch_dreamcast
+/* Threaded rendering: draw lines on a second thread, trailing the emulation by
+   a few lines. sms_vdp_sync() waits for all queued lines to be drawn, and must
+   be called before the framebuffer is used. */
+extern int sms_vdp_set_threaded(int enable);
+extern void sms_vdp_sync(void);
+
+/* Deferred rendering: hold back drawing until the end of the active display,
+   and draw the whole frame in tile order if the VDP wasn't touched in the
+   meantime. With threaded rendering on as well, the held back lines are drawn
+   on the render thread. sms_vdp_deferred_stats() reports how many frames were
+   drawn, and how many of those took the tile order path. */
+extern int sms_vdp_set_deferred(int enable);
+extern void sms_vdp_deferred_stats(uint32 *frames, uint32 *fast);
+
+/* Static line detection: skip drawing lines whose inputs hash the same as the
+   last time they were drawn into the same framebuffer. Works along with both
+   of the above. sms_vdp_static_stats() reports how many lines were looked at,
+   and how many of those were skipped. */
+extern int sms_vdp_set_static_detect(int enable);
+extern void sms_vdp_static_stats(uint32 *lines, uint32 *skipped);
+#endif
+
 #define SMS_VDP_MACHINE_SMS1     1
 #define SMS_VDP_MACHINE_SMS2     2
 #define SMS_VDP_MACHINE_TMS9918A 3
 extern void sms_vdp_set_vidmode(int mode, int machine);
 
 extern int sms_vdp_write_context(FILE *fp);
-extern int sms_vdp_read_context(const uint8 *buf);
+extern int sms_vdp_read_context(const uint8 *buf, uint32 len, int load);
 extern void sms_vdp_read_context_v1(FILE *fp);
 
 extern sms_vdp_t smsvdp;
@@ -278,7 +278,8 @@ void sms_z80_read_context_v1(FILE *fp __UNUSED__) {
     /* XXXX */
 }
 
-int sms_z80_read_context(const uint8 *buf __UNUSED__) {
+int sms_z80_read_context(const uint8 *buf __UNUSED__, uint32 len __UNUSED__,
+                         int load __UNUSED__) {
     /* XXXX */
     return -1;
 }
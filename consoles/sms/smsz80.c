@@ -23,6 +23,7 @@
 #include "CrabZ80.h"
 
 CrabZ80_t *cpuz80 = NULL;
+static uint16 idle_pcs[SMS_Z80_IDLE_PCS];
 
 int sms_z80_init(void) {
     cpuz80 = (CrabZ80_t *)malloc(sizeof(CrabZ80_t));
@@ -101,7 +102,38 @@ void sms_z80_set_mwrite16(void (*mwrite)(uint16, uint16)) {
     CrabZ80_set_memwrite16(cpuz80, mwrite);
 }
 
+void sms_z80_set_idle_pcs(const uint16 pcs[SMS_Z80_IDLE_PCS]) {
+    int i;
+
+    for(i = 0; i < SMS_Z80_IDLE_PCS; ++i) {
+        idle_pcs[i] = pcs ? pcs[i] : 0;
+    }
+}
+
+/* Is the CPU sitting at the top of a loop that does nothing but wait for an
+   interrupt that isn't coming this time around? */
+static int sms_z80_idle(void) {
+    uint16 pc = cpuz80->pc.w;
+    int i;
+
+    if(!idle_pcs[0] || cpuz80->ei || (cpuz80->irq_pending & 2) ||
+       ((cpuz80->irq_pending & 1) && cpuz80->iff1))
+        return 0;
+
+    for(i = 0; i < SMS_Z80_IDLE_PCS && idle_pcs[i]; ++i) {
+        if(idle_pcs[i] == pc)
+            return 1;
+    }
+
+    return 0;
+}
+
 uint32 sms_z80_run(uint32 cycles) {
+    /* The VDP only raises interrupts between runs, and the loop only looks at
+       RAM, so nothing it could see will change before we're called again. */
+    if(sms_z80_idle())
+        return cycles;
+
     return CrabZ80_execute(cpuz80, cycles);
 }
 
@@ -288,12 +320,10 @@ int sms_z80_write_context(FILE *fp) {
     return 0;
 }
 
-int sms_z80_read_context(const uint8 *buf) {
-    uint32 len;
+int sms_z80_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 52)
         return -1;
 
@@ -306,6 +336,9 @@ int sms_z80_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     cpuz80->af.b.l = buf[16];
     cpuz80->af.b.h = buf[17];
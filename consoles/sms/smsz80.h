@@ -28,6 +28,12 @@ CLINKAGE
 
 extern void sms_z80_reset(void);
 extern uint32 sms_z80_run(uint32 cycles);
+
+/* PCs of loops that only spin on RAM waiting for an interrupt. When the CPU is
+   at one of them with no interrupt pending, sms_z80_run() skips ahead rather
+   than running the loop. Zeros (or NULL) for none. */
+#define SMS_Z80_IDLE_PCS 2
+extern void sms_z80_set_idle_pcs(const uint16 pcs[SMS_Z80_IDLE_PCS]);
 extern void sms_z80_assert_irq(void);
 extern void sms_z80_clear_irq(void);
 extern void sms_z80_nmi(void);
@@ -72,7 +78,7 @@ extern uint16 sms_z80_read_reg(int reg);
 extern void sms_z80_write_reg(int reg, uint16 value);
 
 extern int sms_z80_write_context(FILE *fp);
-extern int sms_z80_read_context(const uint8 *buf);
+extern int sms_z80_read_context(const uint8 *buf, uint32 len, int load);
 extern void sms_z80_read_context_v1(FILE *fp);
 
 ENDCLINK
@@ -158,12 +158,10 @@ int terebi_write_context(FILE *fp) {
     return 0;
 }
 
-int terebi_read_context(const uint8 *buf) {
-    uint32 len;
+int terebi_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 20)
         return -1;
 
@@ -176,6 +174,9 @@ int terebi_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Copy in the registers */
     terebi_flags = buf[16] ? TEREBI_OEKAKI_AXIS_Y : 0;
     return 0;
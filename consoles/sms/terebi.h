@@ -38,7 +38,7 @@ extern void terebi_mwrite16(uint16 addr, uint16 data);
 extern void terebi_update(int x, int y, int pressed);
 
 extern int terebi_write_context(FILE *fp);
-extern int terebi_read_context(const uint8 *buf);
+extern int terebi_read_context(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
@@ -29,253 +29,257 @@
     *_tmp = color; \
 }
 
-#define DRAW_BACKGROUND(pixel) { \
-    DRAW_COLOR(bg, line, (i << 3) + pixel); \
+/* Pattern cache for modes 0, 1 and 2. Rather than pulling apart the pattern
+   and colour bytes for every pixel of every line, each pattern is expanded
+   once into colour numbers, and only redone when the VRAM behind it changes
+   (or the tables move). Mode 3 doesn't have any pattern bits to decode, so it
+   doesn't use the cache. */
+#define TMS_CACHE_NONE  -1
+
+#define TMS_SPR_FIFTH   0x40
+#define TMS_SPR_END     0x80
+
+void tms9918a_cache_reset(sms_vdp_t *vdp) {
+    vdp->tms.mode = TMS_CACHE_NONE;
+    vdp->tms.sat = -1;
 }
 
-#define DRAW_FOREGROUND(pixel) { \
-    DRAW_COLOR(fg, line, (i << 3) + pixel); \
-}
+/* Make sure the cache is set up for the given mode and the current table
+   addresses. If anything has moved, everything has to be redone. */
+static void tms_cache_layout(sms_vdp_t *vdp, int mode) {
+    int pg, ct = 0, mask = 0xFF, mask2 = 0;
 
-void tms9918a_m0_draw_bg(int line, pixel_t *px) {
-    pixel_t bg, fg;
-    uint8 *name_table;
-    uint8 *pattern_gen;
-    uint8 *color_table;
-    uint8 pixels, pattern, color;
-    int i, row;
+    if(mode == 2) {
+        pg = (vdp->regs[4] & 0x04) << 11;
+        ct = (vdp->regs[3] & 0x80) << 6;
+        mask = ((vdp->regs[4] & 0x03) << 8) | 0xFF;
+        mask2 = ((vdp->regs[3] & 0x7F) << 3) | 0x07;
+    }
+    else {
+        pg = (vdp->regs[4] & 0x07) << 11;
 
-    name_table = &smsvdp.vram[(smsvdp.regs[2] & 0x0F) << 10];
-    pattern_gen = &smsvdp.vram[(smsvdp.regs[4] & 0x07) << 11];
-    color_table = &smsvdp.vram[smsvdp.regs[3] << 6];
+        if(mode == 0)
+            ct = vdp->regs[3] << 6;
+    }
 
-    row = line >> 3;
+    if(vdp->tms.mode == mode && vdp->tms.pg == pg && vdp->tms.ct == ct &&
+       vdp->tms.mask == mask && vdp->tms.mask2 == mask2)
+        return;
 
-    for(i = 0; i < 32; ++i) {
-        pattern = name_table[(row << 5) + i];
-        pixels = *(pattern_gen + (pattern << 3) + (line & 0x07));
-        color = *(color_table + (pattern >> 3));
+    vdp->tms.mode = mode;
+    vdp->tms.pg = pg;
+    vdp->tms.ct = ct;
+    vdp->tms.mask = mask;
+    vdp->tms.mask2 = mask2;
+    memset(vdp->tms.dirty, 1, 768);
+}
 
-        if(color & 0x0F)
-            bg = tms9918_pal[color & 0x0F];
-        else
-            bg = tms9918_pal[smsvdp.regs[7] & 0x0F];
+static void tms_cache_update(sms_vdp_t *vdp, int pat) {
+    uint8 *pixels, *color, *tex;
+    int r, j, fg, bg;
 
-        if(color >> 4)
-            fg = tms9918_pal[color >> 4];
-        else
-            fg = tms9918_pal[smsvdp.regs[7] & 0x0F];
+    if(vdp->tms.mode == 2) {
+        pixels = vdp->vram + vdp->tms.pg + ((pat & vdp->tms.mask) << 3);
+        color = vdp->vram + vdp->tms.ct + ((pat & vdp->tms.mask2) << 3);
+    }
+    else {
+        pixels = vdp->vram + vdp->tms.pg + (pat << 3);
+        color = vdp->vram + vdp->tms.ct + (pat >> 3);
+    }
 
-        if(pixels & 0x80)
-            DRAW_FOREGROUND(0)
-        else
-            DRAW_BACKGROUND(0)
+    for(r = 0; r < 8; ++r) {
+        tex = vdp->tms.rows[pat][r];
 
-        if(pixels & 0x40)
-            DRAW_FOREGROUND(1)
-        else
-            DRAW_BACKGROUND(1)
+        if(vdp->tms.mode == 1) {
+            /* Text mode only has 6 pixels, which are either on or off. */
+            for(j = 0; j < 6; ++j) {
+                tex[j] = (pixels[r] >> (7 - j)) & 0x01;
+            }
+        }
+        else {
+            /* Mode 2 has a colour byte per row, mode 0 one per 8 patterns. */
+            fg = (vdp->tms.mode == 2) ? color[r] : color[0];
+            bg = fg & 0x0F;
+            fg >>= 4;
 
-        if(pixels & 0x20)
-            DRAW_FOREGROUND(2)
-        else
-            DRAW_BACKGROUND(2)
+            for(j = 0; j < 8; ++j) {
+                tex[j] = (pixels[r] & (0x80 >> j)) ? fg : bg;
+            }
+        }
+    }
 
-        if(pixels & 0x10)
-            DRAW_FOREGROUND(3)
-        else
-            DRAW_BACKGROUND(3)
+    vdp->tms.dirty[pat] = 0;
+}
 
-        if(pixels & 0x08)
-            DRAW_FOREGROUND(4)
-        else
-            DRAW_BACKGROUND(4)
+/* Mark every pattern whose number, masked with mask, matches num. The patterns
+   that match are num with any combination of the masked off bits set. */
+static void tms_cache_dirty_masked(sms_vdp_t *vdp, int num, int mask) {
+    int free = ~mask & 0x3FF, s = free;
 
-        if(pixels & 0x04)
-            DRAW_FOREGROUND(5)
-        else
-            DRAW_BACKGROUND(5)
+    if(num & free)
+        return;
 
-        if(pixels & 0x02)
-            DRAW_FOREGROUND(6)
-        else
-            DRAW_BACKGROUND(6)
+    for(;;) {
+        if((num | s) < 768)
+            vdp->tms.dirty[num | s] = 1;
 
-        if(pixels & 0x01)
-            DRAW_FOREGROUND(7)
-        else
-            DRAW_BACKGROUND(7)
+        if(!s)
+            break;
+
+        s = (s - 1) & free;
     }
 }
 
-#undef DRAW_BACKGROUND
-#undef DRAW_FOREGROUND
-
-#define DRAW_BACKDROP(pixel) { \
-    DRAW_COLOR(bd, line, (i * 6) + pixel + 8); \
-}
+/* Called whenever a byte of VRAM changes. */
+void tms9918a_vram_written(sms_vdp_t *vdp, int addr) {
+    int off;
 
-#define DRAW_TEXT(pixel) { \
-    DRAW_COLOR(tc, line, (i * 6) + pixel + 8); \
-}
+    if(vdp->tms.mode != TMS_CACHE_NONE) {
+        off = addr - vdp->tms.pg;
 
-void tms9918a_m1_draw_bg(int line, pixel_t *px) {
-    pixel_t tc, bd;
-    uint8 *name_table;
-    uint8 *pattern_gen;
-    uint8 pixels;
-    int i, row;
+        if(vdp->tms.mode == 2) {
+            if(off >= 0 && off < 0x1800)
+                tms_cache_dirty_masked(vdp, off >> 3, vdp->tms.mask);
 
-    bd = tms9918_pal[smsvdp.regs[7] & 0x0F];
-    tc = tms9918_pal[(smsvdp.regs[7] >> 4) & 0x0F];
+            off = addr - vdp->tms.ct;
 
-    name_table = &smsvdp.vram[(smsvdp.regs[2] & 0x0F) << 10];
-    pattern_gen = &smsvdp.vram[(smsvdp.regs[4] & 0x07) << 11];
+            if(off >= 0 && off < 0x1800)
+                tms_cache_dirty_masked(vdp, off >> 3, vdp->tms.mask2);
+        }
+        else {
+            if(off >= 0 && off < 0x800)
+                vdp->tms.dirty[off >> 3] = 1;
 
-    row = line >> 3;
+            off = addr - vdp->tms.ct;
 
-    for(i = 0; i < 8; ++i) {
-        DRAW_COLOR(bd, line, i);
-        DRAW_COLOR(bd, line, i + 248);
+            if(vdp->tms.mode == 0 && off >= 0 && off < 32)
+                memset(&vdp->tms.dirty[off << 3], 1, 8);
+        }
     }
 
-    for(i = 0; i < 40; ++i) {
-        pixels = *(pattern_gen + (name_table[row * 40 + i] << 3) +
-                   (line & 0x07));
+    /* Only the Y positions matter for working out what's on each line. */
+    off = addr - vdp->tms.sat;
 
-        if(pixels & 0x80)
-            DRAW_TEXT(0)
-        else
-            DRAW_BACKDROP(0)
+    if(off >= 0 && off < 128 && !(off & 0x03))
+        vdp->tms.spr_dirty = 1;
+}
 
-        if(pixels & 0x40)
-            DRAW_TEXT(1)
-        else
-            DRAW_BACKDROP(1)
+#define DRAW_PATTERN() { \
+    *px++ = pal[tex[0]]; \
+    *px++ = pal[tex[1]]; \
+    *px++ = pal[tex[2]]; \
+    *px++ = pal[tex[3]]; \
+    *px++ = pal[tex[4]]; \
+    *px++ = pal[tex[5]]; \
+    *px++ = pal[tex[6]]; \
+    *px++ = pal[tex[7]]; \
+}
 
-        if(pixels & 0x20)
-            DRAW_TEXT(2)
-        else
-            DRAW_BACKDROP(2)
+/* Set up the colours to use for a line. Colour 0 is transparent, so it shows
+   the backdrop colour instead. */
+static __INLINE__ void tms_line_pal(sms_vdp_t *vdp, pixel_t pal[16]) {
+    memcpy(pal, tms9918_pal, sizeof(pixel_t) * 16);
+    pal[0] = tms9918_pal[vdp->regs[7] & 0x0F];
+}
 
-        if(pixels & 0x10)
-            DRAW_TEXT(3)
-        else
-            DRAW_BACKDROP(3)
+void tms9918a_m0_draw_bg(sms_vdp_t *vdp, int line, pixel_t *px) {
+    pixel_t pal[16];
+    uint8 *name_table;
+    uint8 *tex;
+    int i, pattern;
 
-        if(pixels & 0x08)
-            DRAW_TEXT(4)
-        else
-            DRAW_BACKDROP(4)
+    tms_cache_layout(vdp, 0);
+    tms_line_pal(vdp, pal);
 
-        if(pixels & 0x04)
-            DRAW_TEXT(5)
-        else
-            DRAW_BACKDROP(5)
-    }
-}
+    name_table = &vdp->vram[((vdp->regs[2] & 0x0F) << 10) + ((line >> 3) << 5)];
 
-#undef DRAW_BACKDROP
-#undef DRAW_TEXT
+    for(i = 0; i < 32; ++i) {
+        pattern = name_table[i];
 
-#define DRAW_BACKGROUND(pixel) { \
-    DRAW_COLOR(bg, line, (i << 3) + pixel); \
-}
+        if(vdp->tms.dirty[pattern])
+            tms_cache_update(vdp, pattern);
 
-#define DRAW_FOREGROUND(pixel) { \
-    DRAW_COLOR(fg, line, (i << 3) + pixel); \
+        tex = vdp->tms.rows[pattern][line & 0x07];
+        DRAW_PATTERN();
+    }
 }
 
-void tms9918a_m2_draw_bg(int line, pixel_t *px) {
-    pixel_t bg, fg;
+void tms9918a_m1_draw_bg(sms_vdp_t *vdp, int line, pixel_t *px) {
+    pixel_t pal[2];
     uint8 *name_table;
-    uint8 *pattern_gen;
-    uint8 *color_table;
-    uint8 pixels, color;
-    int pattern;
-    int i, row, mask, mask2;
+    uint8 *tex;
+    int i, pattern;
 
-    row = line >> 3;    
-    mask = ((smsvdp.regs[4] & 0x03) << 8) | 0xFF;
-    mask2 = ((smsvdp.regs[3] & 0x7F) << 3) | 0x07;
+    tms_cache_layout(vdp, 1);
 
-    name_table = &smsvdp.vram[(smsvdp.regs[2] & 0x0F) << 10];
-    pattern_gen = &smsvdp.vram[(smsvdp.regs[4] & 0x04) << 11];
-    color_table = &smsvdp.vram[(smsvdp.regs[3] & 0x80) << 6];
+    pal[0] = tms9918_pal[vdp->regs[7] & 0x0F];
+    pal[1] = tms9918_pal[(vdp->regs[7] >> 4) & 0x0F];
 
-    for(i = 0; i < 32; ++i) {
-        pattern = name_table[(row << 5) + i] + ((row & 0x18) << 5);
-        pixels = *(pattern_gen + ((pattern & mask) << 3) + (line & 0x07));
-        color = *(color_table + ((pattern & mask2) << 3) + (line & 0x07));
+    name_table = &vdp->vram[((vdp->regs[2] & 0x0F) << 10) + (line >> 3) * 40];
 
-        if(color & 0x0F)
-            bg = tms9918_pal[color & 0x0F];
-        else
-            bg = tms9918_pal[smsvdp.regs[7] & 0x0F];
+    for(i = 0; i < 8; ++i) {
+        px[i] = pal[0];
+        px[i + 248] = pal[0];
+    }
 
-        if(color >> 4)
-            fg = tms9918_pal[color >> 4];
-        else
-            fg = tms9918_pal[smsvdp.regs[7] & 0x0F];
+    px += 8;
 
-        if(pixels & 0x80)
-            DRAW_FOREGROUND(0)
-        else
-            DRAW_BACKGROUND(0)
+    for(i = 0; i < 40; ++i) {
+        pattern = name_table[i];
+
+        if(vdp->tms.dirty[pattern])
+            tms_cache_update(vdp, pattern);
+
+        tex = vdp->tms.rows[pattern][line & 0x07];
+        *px++ = pal[tex[0]];
+        *px++ = pal[tex[1]];
+        *px++ = pal[tex[2]];
+        *px++ = pal[tex[3]];
+        *px++ = pal[tex[4]];
+        *px++ = pal[tex[5]];
+    }
+}
 
-        if(pixels & 0x40)
-            DRAW_FOREGROUND(1)
-        else
-            DRAW_BACKGROUND(1)
+void tms9918a_m2_draw_bg(sms_vdp_t *vdp, int line, pixel_t *px) {
+    pixel_t pal[16];
+    uint8 *name_table;
+    uint8 *tex;
+    int i, pattern, bank;
 
-        if(pixels & 0x20)
-            DRAW_FOREGROUND(2)
-        else
-            DRAW_BACKGROUND(2)
+    tms_cache_layout(vdp, 2);
+    tms_line_pal(vdp, pal);
 
-        if(pixels & 0x10)
-            DRAW_FOREGROUND(3)
-        else
-            DRAW_BACKGROUND(3)
+    name_table = &vdp->vram[((vdp->regs[2] & 0x0F) << 10) + ((line >> 3) << 5)];
 
-        if(pixels & 0x08)
-            DRAW_FOREGROUND(4)
-        else
-            DRAW_BACKGROUND(4)
+    /* Each third of the screen has its own set of 256 patterns. */
+    bank = (line & 0xC0) << 2;
 
-        if(pixels & 0x04)
-            DRAW_FOREGROUND(5)
-        else
-            DRAW_BACKGROUND(5)
+    for(i = 0; i < 32; ++i) {
+        pattern = name_table[i] + bank;
 
-        if(pixels & 0x02)
-            DRAW_FOREGROUND(6)
-        else
-            DRAW_BACKGROUND(6)
+        if(vdp->tms.dirty[pattern])
+            tms_cache_update(vdp, pattern);
 
-        if(pixels & 0x01)
-            DRAW_FOREGROUND(7)
-        else
-            DRAW_BACKGROUND(7)
+        tex = vdp->tms.rows[pattern][line & 0x07];
+        DRAW_PATTERN();
     }
 }
 
-#undef DRAW_BACKGROUND
-#undef DRAW_FOREGROUND
+#undef DRAW_PATTERN
 
 #define DRAW_PIXEL(pixel) { \
     DRAW_COLOR(c, line, (i << 3) + pixel); \
 }
 
-void tms9918a_m3_draw_bg(int line, pixel_t *px) {
+void tms9918a_m3_draw_bg(sms_vdp_t *vdp, int line, pixel_t *px) {
     uint8 *name_table;
     uint8 *pattern_gen;
     int row, i;
     uint8 pattern, color;
     pixel_t c;
 
-    name_table = &smsvdp.vram[(smsvdp.regs[2] & 0x0F) << 10];
-    pattern_gen = &smsvdp.vram[(smsvdp.regs[4] & 0x07) << 11];
+    name_table = &vdp->vram[(vdp->regs[2] & 0x0F) << 10];
+    pattern_gen = &vdp->vram[(vdp->regs[4] & 0x07) << 11];
 
     row = line >> 3;
 
@@ -290,7 +294,7 @@ void tms9918a_m3_draw_bg(int line, pixel_t *px) {
         if(color & 0x0F)
             c = tms9918_pal[color & 0x0F];
         else
-            c = tms9918_pal[smsvdp.regs[7] & 0x0F];
+            c = tms9918_pal[vdp->regs[7] & 0x0F];
 
         DRAW_PIXEL(0)
         DRAW_PIXEL(1)
@@ -300,7 +304,7 @@ void tms9918a_m3_draw_bg(int line, pixel_t *px) {
         if(color >> 4)
             c = tms9918_pal[color & 0x0F];
         else
-            c = tms9918_pal[smsvdp.regs[7] & 0x0F];
+            c = tms9918_pal[vdp->regs[7] & 0x0F];
 
         DRAW_PIXEL(4)
         DRAW_PIXEL(5)
@@ -313,11 +317,11 @@ void tms9918a_m3_draw_bg(int line, pixel_t *px) {
 
 #define CHECK_PIXEL(i) { \
     if(col_tab[(i << size_shift)]++) \
-        smsvdp.status |= 0x20; \
+        vdp->status |= 0x20; \
 \
     if(size_shift) { \
         if(col_tab[(i << 1) + 1]++) \
-            smsvdp.status |= 0x20; \
+            vdp->status |= 0x20; \
     } \
 }
 
@@ -326,7 +330,7 @@ void tms9918a_m3_draw_bg(int line, pixel_t *px) {
         DRAW_COLOR(c, line, (i << size_shift) + x); \
     } \
     else { \
-        smsvdp.status |= 0x20; \
+        vdp->status |= 0x20; \
     } \
 \
     if(size_shift) { \
@@ -334,47 +338,96 @@ void tms9918a_m3_draw_bg(int line, pixel_t *px) {
             DRAW_COLOR(c, line, (i << 1) + x + 1); \
         } \
         else { \
-            smsvdp.status |= 0x20; \
+            vdp->status |= 0x20; \
         } \
     } \
 }
 
-void tms9918a_m023_draw_spr(int line, pixel_t *px) {
+/* Work out which sprites are on each line. This follows the same rules the
+   sprite drawing code used to apply line by line: sprites are taken in order
+   until the end of list marker, and the fifth one on a line stops things. */
+static void tms_spr_update(sms_vdp_t *vdp) {
+    uint8 *sat;
+    int sat_addr, size, height, i, y, l, end;
+
+    sat_addr = (vdp->regs[5] & 0x7F) << 7;
+    size = vdp->regs[1] & 0x03;
+
+    if(!vdp->tms.spr_dirty && vdp->tms.sat == sat_addr &&
+       vdp->tms.spr_size == size)
+        return;
+
+    vdp->tms.sat = sat_addr;
+    vdp->tms.spr_size = size;
+    vdp->tms.spr_dirty = 0;
+
+    sat = vdp->vram + sat_addr;
+    height = ((size & 0x02) ? 16 : 8) << (size & 0x01);
+
+    memset(vdp->tms.spr_count, 0, 192);
+    memset(vdp->tms.spr_end, 32, 192);
+
+    for(i = 0; i < 32; ++i) {
+        y = sat[i << 2] + 1;
+
+        if(y == 0xD1) {
+            /* End of list marker, for any lines that haven't hit 5 yet */
+            for(l = 0; l < 192; ++l) {
+                if(!(vdp->tms.spr_end[l] & TMS_SPR_FIFTH))
+                    vdp->tms.spr_end[l] = TMS_SPR_END | i;
+            }
+
+            break;
+        }
+
+        end = y + height;
+
+        if(end > 192)
+            end = 192;
+
+        for(l = y; l < end; ++l) {
+            if(vdp->tms.spr_end[l] & TMS_SPR_FIFTH)
+                continue;
+
+            if(vdp->tms.spr_count[l] == 4)
+                vdp->tms.spr_end[l] = TMS_SPR_FIFTH | i;
+            else
+                vdp->tms.spr[l][vdp->tms.spr_count[l]++] = (uint8)i;
+        }
+    }
+}
+
+void tms9918a_m023_draw_spr(sms_vdp_t *vdp, int line, pixel_t *px) {
     uint8 *sat, *sprite_gen;
     int i, pattern_size, size_shift, tmp, pixels, pixels2 = 0;
-    int count = 0, x, y = 0, pattern, color;
+    int k, x, y, pattern, color, end;
     pixel_t c;
     static uint8 col_tab[256];
 
+    if(line >= 192)
+        return;
+
     /* First of all, clear out our colision table */
     memset(col_tab, 0, 256);
 
-    sat = &smsvdp.vram[(smsvdp.regs[5] & 0x7F) << 7];
-    sprite_gen = &smsvdp.vram[(smsvdp.regs[6] & 0x07) << 11];
+    tms_spr_update(vdp);
+
+    sat = &vdp->vram[(vdp->regs[5] & 0x7F) << 7];
+    sprite_gen = &vdp->vram[(vdp->regs[6] & 0x07) << 11];
 
-    if(smsvdp.regs[1] & 0x01)
+    if(vdp->regs[1] & 0x01)
         size_shift = 1;
     else
         size_shift = 0;
 
-    if(smsvdp.regs[1] & 0x02)
+    if(vdp->regs[1] & 0x02)
         pattern_size = 16;
     else
         pattern_size = 8;
 
-    for(i = 0; i < 32 && count < 5; ++i) {
+    for(k = 0; k < vdp->tms.spr_count[line]; ++k) {
+        i = vdp->tms.spr[line][k];
         y = sat[i << 2] + 1;
-
-        if(y == 0xD1)
-            /* End of list marker */
-            break;
-        else if(line < y)
-            continue;
-        else if(y + (pattern_size << size_shift) - 1 < line)
-            continue;
-        else if(++count == 5)
-            break;
-
         x = sat[(i << 2) + 1];
         pattern = sat[(i << 2) + 2];
         color = sat[(i << 2) + 3];
@@ -550,45 +603,48 @@ void tms9918a_m023_draw_spr(int line, pixel_t *px) {
         }
     }
 
-    if(!(smsvdp.status & 0x40)) {
-        if(count == 5) {
+    if(!(vdp->status & 0x40)) {
+        end = vdp->tms.spr_end[line];
+
+        if(end & TMS_SPR_FIFTH) {
             /* Set the 5 sprites flag and the fifth sprite bits */
-            smsvdp.status |= 0x40 | ((i - 1) & 0x1F);
+            vdp->status |= 0x40 | (((end & 0x3F) - 1) & 0x1F);
         }
-        else if(y == 0xD1) {
+        else if(end & TMS_SPR_END) {
             /* Set the fifth sprite bits to the last sprite displayed */
-            smsvdp.status |= (i & 0x1F);
+            vdp->status |= (end & 0x1F);
         }
         else {
             /* Otherwise, set the fifth sprite bits to the last sprite */
-            smsvdp.status |= 0x1F;
+            vdp->status |= 0x1F;
         }
     }
 }
 
 void tms9918a_m023_skip_spr(int line) {
     static uint8 col_tab[256];
+    sms_vdp_t *vdp = &smsvdp;
     uint8 *sat, *sprite_gen;
     int i, pattern_size, size_shift, tmp, pixels, pixels2 = 0;
     int count = 0, x, y = 0, pattern, color;
 
     /* See if all the flags we can affect are already set. If so, we don't need
        to go any further. */
-    if((smsvdp.status & 0x60) == 0x60)
+    if((vdp->status & 0x60) == 0x60)
         return;
 
     /* First of all, clear out our colision table */
     memset(col_tab, 0, 256);
 
-    sat = &smsvdp.vram[(smsvdp.regs[5] & 0x7F) << 7];
-    sprite_gen = &smsvdp.vram[(smsvdp.regs[6] & 0x07) << 11];
+    sat = &vdp->vram[(vdp->regs[5] & 0x7F) << 7];
+    sprite_gen = &vdp->vram[(vdp->regs[6] & 0x07) << 11];
 
-    if(smsvdp.regs[1] & 0x01)
+    if(vdp->regs[1] & 0x01)
         size_shift = 1;
     else
         size_shift = 0;
 
-    if(smsvdp.regs[1] & 0x02)
+    if(vdp->regs[1] & 0x02)
         pattern_size = 16;
     else
         pattern_size = 8;
@@ -700,19 +756,19 @@ void tms9918a_m023_skip_spr(int line) {
         continue;
     }
 
-    if(!(smsvdp.status & 0x40)) {
+    if(!(vdp->status & 0x40)) {
         if(count == 5) {
             /* Set the 5 sprites flag and the fifth sprite bits */
-            smsvdp.status |= 0x40 | ((i - 1) & 0x1F);
+            vdp->status |= 0x40 | ((i - 1) & 0x1F);
         }
         else if(y == 0xD1) {
             /* Set the fifth sprite bits to the last sprite displayed */
-            smsvdp.status &= 0xE0;
-            smsvdp.status |= (i & 0x1F);
+            vdp->status &= 0xE0;
+            vdp->status |= (i & 0x1F);
         }
         else {
             /* Otherwise, set the fifth sprite bits to the last sprite */
-            smsvdp.status |= 0x1F;
+            vdp->status |= 0x1F;
         }
     }
 }
@@ -725,7 +781,10 @@ void tms9918a_vdp_data_write(uint8 data) {
     smsvdp.read_buf = data;
 	
     /* Write the byte to the RAM */
-    smsvdp.vram[smsvdp.addr] = data;
+    if(smsvdp.vram[smsvdp.addr] != data) {
+        smsvdp.vram[smsvdp.addr] = data;
+        tms9918a_vram_written(&smsvdp, smsvdp.addr);
+    }
 
     /* Update the address register, and wrap, if needed */
     smsvdp.addr = (smsvdp.addr + 1) & 0x3FFF;
@@ -67,13 +67,16 @@ static const pixel_t tms9918_pal[16] = {
 };
 #endif
 
-extern void tms9918a_m0_draw_bg(int line, pixel_t *px);
-extern void tms9918a_m1_draw_bg(int line, pixel_t *px);
-extern void tms9918a_m2_draw_bg(int line, pixel_t *px);
-extern void tms9918a_m3_draw_bg(int line, pixel_t *px);
-extern void tms9918a_m023_draw_spr(int line, pixel_t *px);
+extern void tms9918a_m0_draw_bg(sms_vdp_t *vdp, int line, pixel_t *px);
+extern void tms9918a_m1_draw_bg(sms_vdp_t *vdp, int line, pixel_t *px);
+extern void tms9918a_m2_draw_bg(sms_vdp_t *vdp, int line, pixel_t *px);
+extern void tms9918a_m3_draw_bg(sms_vdp_t *vdp, int line, pixel_t *px);
+extern void tms9918a_m023_draw_spr(sms_vdp_t *vdp, int line, pixel_t *px);
 extern void tms9918a_m023_skip_spr(int line);
 
+extern void tms9918a_cache_reset(sms_vdp_t *vdp);
+extern void tms9918a_vram_written(sms_vdp_t *vdp, int addr);
+
 extern void tms9918a_vdp_data_write(uint8 data);
 extern void tms9918a_vdp_ctl_write(uint8 data);
 extern uint8 tms9918a_vdp_data_read(void);
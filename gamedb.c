@@ -0,0 +1,224 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _arch_dreamcast
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "gamedb.h"
+#include "rom.h"
+
+#define GAMEDB_MAGIC    (FOURCC_TO_UINT32('C', 'R', 'D', 'B'))
+
+static struct {
+    uint8 *base;
+    size_t len;
+    int mapped;
+
+    uint32 count;
+    uint32 buckets;
+    uint32 rec_len;
+    const uint8 *disp;
+    const uint8 *recs;
+    const char *strs;
+    uint32 strs_len;
+} db;
+
+uint32 gamedb_hash(uint32 crc, uint32 seed) {
+    uint32 h = crc ^ (seed * 0x9E3779B9);
+
+    /* MurmurHash3's finalizer. CRCs are pretty well mixed already, but not
+       against each other for every seed. */
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+void gamedb_close(void) {
+#ifndef _arch_dreamcast
+    if(db.mapped)
+        munmap(db.base, db.len);
+    else
+#endif
+        free(db.base);
+
+    memset(&db, 0, sizeof(db));
+}
+
+/* Make sure the header describes something that actually fits in the file. */
+static int check_header(const uint8 *buf, size_t len) {
+    uint32 magic, disp_off, recs_off, strs_off;
+    uint16 ver, rec_len;
+
+    if(len < GAMEDB_HDR_LEN)
+        return -1;
+
+    BUF_TO_UINT32(buf, magic);
+    BUF_TO_UINT16(buf + 4, ver);
+    BUF_TO_UINT16(buf + 6, rec_len);
+
+    if(magic != GAMEDB_MAGIC || ver != GAMEDB_VERSION ||
+       rec_len < GAMEDB_REC_LEN)
+        return -1;
+
+    BUF_TO_UINT32(buf + 8, db.count);
+    BUF_TO_UINT32(buf + 12, db.buckets);
+    BUF_TO_UINT32(buf + 16, disp_off);
+    BUF_TO_UINT32(buf + 20, recs_off);
+    BUF_TO_UINT32(buf + 24, strs_off);
+    BUF_TO_UINT32(buf + 28, db.strs_len);
+
+    if(db.count && !db.buckets)
+        return -1;
+
+    if((uint64_t)disp_off + (uint64_t)db.buckets * 2 > len ||
+       (uint64_t)recs_off + (uint64_t)db.count * rec_len > len ||
+       (uint64_t)strs_off + db.strs_len > len)
+        return -1;
+
+    /* Titles are looked up by offset, so the last one has to be terminated for
+       that to be safe. */
+    if(db.strs_len && buf[strs_off + db.strs_len - 1] != 0)
+        return -1;
+
+    db.rec_len = rec_len;
+    db.disp = buf + disp_off;
+    db.recs = buf + recs_off;
+    db.strs = (const char *)buf + strs_off;
+
+    return 0;
+}
+
+int gamedb_open(const char *fn) {
+    FILE *fp;
+    long size;
+
+    gamedb_close();
+
+    if(!(fp = fopen(fn, "rb"))) {
+#ifdef DEBUG
+        fprintf(stderr, "gamedb_open: Couldn't open %s\n", fn);
+#endif
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if(size < GAMEDB_HDR_LEN) {
+        fclose(fp);
+        return -1;
+    }
+
+    db.len = (size_t)size;
+
+#ifndef _arch_dreamcast
+    /* Nothing in here is ever written, and most of it is never even looked at
+       for any one run, so let the pager deal with it. */
+    db.base = (uint8 *)mmap(NULL, db.len, PROT_READ, MAP_PRIVATE, fileno(fp),
+                            0);
+
+    if(db.base != (uint8 *)MAP_FAILED) {
+        db.mapped = 1;
+    }
+    else
+#endif
+    {
+        db.base = NULL;
+
+        if(!(db.base = (uint8 *)malloc(db.len)) ||
+           fread(db.base, 1, db.len, fp) != db.len) {
+            fclose(fp);
+            gamedb_close();
+            return -1;
+        }
+    }
+
+    fclose(fp);
+
+    if(check_header(db.base, db.len)) {
+#ifdef DEBUG
+        fprintf(stderr, "gamedb_open: %s isn't a valid game database\n", fn);
+#endif
+        gamedb_close();
+        return -1;
+    }
+
+    return 0;
+}
+
+int gamedb_find(uint32 crc, uint32 adler, gamedb_entry_t *ent) {
+    const uint8 *rec;
+    uint32 tmp, name;
+    uint16 disp;
+    int i;
+
+    if(!db.count)
+        return -1;
+
+    BUF_TO_UINT16(db.disp + (gamedb_hash(crc, 0) % db.buckets) * 2, disp);
+    rec = db.recs + (gamedb_hash(crc, disp + 1) % db.count) * db.rec_len;
+
+    /* The hash puts every CRC somewhere, so make sure it's the right one. */
+    BUF_TO_UINT32(rec, tmp);
+    if(tmp != crc)
+        return -1;
+
+    BUF_TO_UINT32(rec + 4, tmp);
+    if(tmp && tmp != adler)
+        return -1;
+
+    ent->crc32 = crc;
+    ent->adler32 = tmp;
+    ent->console = rec[8];
+    ent->region = rec[9];
+    ent->video = rec[10];
+    ent->sram = rec[11];
+    BUF_TO_UINT16(rec + 12, ent->mapper);
+    BUF_TO_UINT16(rec + 14, ent->flags);
+
+    for(i = 0; i < GAMEDB_IDLE_PCS; ++i) {
+        BUF_TO_UINT16(rec + 16 + i * 2, ent->idle_pc[i]);
+    }
+
+    BUF_TO_UINT32(rec + 20, name);
+    ent->name = name < db.strs_len ? db.strs + name : "";
+
+    return 0;
+}
+
+int gamedb_find_rom(const uint8 *data, uint32 len, gamedb_entry_t *ent) {
+    uint32 crc, adler;
+
+    if(!db.count)
+        return -1;
+
+    rom_checksums(data, len, &crc, &adler);
+    return gamedb_find(crc, adler, ent);
+}
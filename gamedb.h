@@ -0,0 +1,109 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef GAMEDB_H
+#define GAMEDB_H
+
+#include "CrabEmu.h"
+
+CLINKAGE
+
+/* File format, all little endian:
+     32 byte header:
+        0   "CRDB"
+        4   uint16 version (GAMEDB_VERSION)
+        6   uint16 size of each record (at least GAMEDB_REC_LEN)
+        8   uint32 number of records
+        12  uint32 number of hash buckets
+        16  uint32 offset of the displacement table (uint16 per bucket)
+        20  uint32 offset of the records
+        24  uint32 offset of the string table
+        28  uint32 length of the string table
+     Record:
+        0   uint32 CRC32
+        4   uint32 Adler-32, or 0 if the CRC32 is enough to go by
+        8   uint8 console, region, video, sram
+        12  uint16 mapper, flags
+        16  uint16 idle loop PCs (GAMEDB_IDLE_PCS of them)
+        20  uint32 offset of the title in the string table
+        24  reserved (zero)
+   The records are laid out by a minimal perfect hash of the CRC32: bucket b is
+   gamedb_hash(crc, 0) % buckets, and the record is at index
+   gamedb_hash(crc, disp[b] + 1) % records. tools/gamedbc.c builds these from
+   the text source in gamedb.txt. */
+#define GAMEDB_VERSION      1
+#define GAMEDB_HDR_LEN      32
+#define GAMEDB_REC_LEN      32
+#define GAMEDB_IDLE_PCS     2
+
+/* No mapper override; use whatever the ROM header or detection says. */
+#define GAMEDB_NO_MAPPER    0xFFFF
+
+/* Types of save memory on the cartridge. */
+#define GAMEDB_SRAM_UNKNOWN 0
+#define GAMEDB_SRAM_NONE    1       /* Any cart RAM is not battery backed */
+#define GAMEDB_SRAM_BATTERY 2
+#define GAMEDB_SRAM_93C46   3
+
+/* Flags */
+#define GAMEDB_FM           0x0001  /* Uses the YM2413 if it finds one */
+#define GAMEDB_MIRROR_H     0x0002  /* NES: horizontal mirroring */
+#define GAMEDB_MIRROR_V     0x0004  /* NES: vertical mirroring */
+#define GAMEDB_MIRROR_4     0x0008  /* NES: four screen VRAM */
+
+typedef struct gamedb_entry {
+    uint32 crc32;
+    uint32 adler32;
+
+    uint8 console;                      /* CONSOLE_*, or 0 if not known */
+    uint8 region;                       /* REGION_*, or REGION_NONE */
+    uint8 video;                        /* VIDEO_NTSC/VIDEO_PAL, or 0 */
+    uint8 sram;                         /* GAMEDB_SRAM_* */
+
+    uint16 mapper;                      /* Console's mapper numbering */
+    uint16 flags;
+
+    /* Where the game spins waiting on an interrupt, polling nothing but RAM.
+       Zero for unused slots. */
+    uint16 idle_pc[GAMEDB_IDLE_PCS];
+
+    /* Points into the database itself, so only good until gamedb_close(). */
+    const char *name;
+} gamedb_entry_t;
+
+/* Map in a database built by tools/gamedbc.c, replacing any already open.
+   Returns 0 on success, -1 on failure (in which case no database is open). */
+extern int gamedb_open(const char *fn);
+extern void gamedb_close(void);
+
+/* Look up a ROM by its checksums. If the record has an Adler-32, the one given
+   must match it too. Returns 0 and fills in ent if the ROM is in the database,
+   -1 if it isn't (or there's no database open). Safe to call from several
+   threads at once, as long as nobody is opening or closing the database. */
+extern int gamedb_find(uint32 crc, uint32 adler, gamedb_entry_t *ent);
+
+/* Checksum the given ROM data and look it up. */
+extern int gamedb_find_rom(const uint8 *data, uint32 len, gamedb_entry_t *ent);
+
+/* The hash the database is laid out by, for gamedbc. */
+extern uint32 gamedb_hash(uint32 crc, uint32 seed);
+
+ENDCLINK
+
+#endif /* !GAMEDB_H */
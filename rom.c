@@ -21,6 +21,13 @@
 #include <string.h>
 #include <stdlib.h>
 
+#ifndef _arch_dreamcast
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #ifdef _arch_dreamcast
 #include <zlib/zlib.h>
 #include <bzlib/bzlib.h>
@@ -75,28 +82,28 @@ static int guess_on_ext(const char *fn, int chop) {
     if(!ext)
         rv = -1;
     else if(!strcasecmp(ext, ".sms"))
-        return CONSOLE_SMS;
+        rv = CONSOLE_SMS;
     else if(!strcasecmp(ext, ".gg"))
-        return CONSOLE_GG;
+        rv = CONSOLE_GG;
     else if(!strcasecmp(ext, ".sc"))
-        return CONSOLE_SC3000;
+        rv = CONSOLE_SC3000;
     else if(!strcasecmp(ext, ".sg"))
-        return CONSOLE_SG1000;
+        rv = CONSOLE_SG1000;
     else if(!strcasecmp(ext, ".rom") || !strcasecmp(ext, ".col"))
-        return CONSOLE_COLECOVISION;
+        rv = CONSOLE_COLECOVISION;
     else if(!strcasecmp(ext, ".nes"))
-        return CONSOLE_NES;
+        rv = CONSOLE_NES;
     else if(!strcasecmp(ext, ".ch8") || !strcasecmp(ext, ".c8"))
-        return CONSOLE_CHIP8;
+        rv = CONSOLE_CHIP8;
 #ifndef NO_ZLIB
     else if(!strcasecmp(ext, ".gz"))
-        return TYPE_GZIP;
+        rv = TYPE_GZIP;
     else if(!strcasecmp(ext, ".zip"))
-        return TYPE_ZIP;
+        rv = TYPE_ZIP;
 #endif
 #ifndef NO_BZ2
     else if(!strcasecmp(ext, ".bz2"))
-        return TYPE_BZIP2;
+        rv = TYPE_BZIP2;
 #endif
 
     if(fn2)
@@ -208,20 +215,97 @@ static int detect_gz(const char *fn) {
 }
 #endif
 
+/* How much of the start of a ROM to look at for detecting what it is for. This
+   covers a Sega header at 0x7FF0, even behind a 512 byte SMD header. */
+#define SNIFF_LEN   (0x8000 + 512)
+
+/* Figure out the console from the first bit of a ROM, falling back to guess
+   (from the filename) if there's nothing to go on. SG-1000, SC-3000 and Chip-8
+   ROMs don't have anything to identify them by, so those always come from the
+   name. */
+static int sniff_console(const uint8 *buf, uint32 len, int guess) {
+    static const uint32 offs[3] = { 0x7FF0, 0x3FF0, 0x1FF0 };
+    uint32 off;
+    int i, j;
+
+    if(guess < -1)
+        guess = -1;
+
+    if(len >= 4 && buf[0] == 'N' && buf[1] == 'E' && buf[2] == 'S' &&
+       buf[3] == 0x1A)
+        return CONSOLE_NES;
+
+    for(i = 0; i < 3; ++i) {
+        for(j = 0; j < 2; ++j) {
+            off = offs[i] + (j ? 512 : 0);
+
+            if(len < off + 16 || memcmp(buf + off, "TMR SEGA", 8))
+                continue;
+
+            /* Game Gear games can run in SMS mode, so if the name already
+               says which of the two it is, go with that. */
+            if(guess == CONSOLE_SMS || guess == CONSOLE_GG)
+                return guess;
+
+            /* Otherwise, the region code will have to do. */
+            switch(buf[off + 15] >> 4) {
+                case 5:
+                case 6:
+                case 7:
+                    return CONSOLE_GG;
+
+                default:
+                    return CONSOLE_SMS;
+            }
+        }
+    }
+
+    if(len >= 2 && ((buf[0] == 0xAA && buf[1] == 0x55) ||
+                    (buf[0] == 0x55 && buf[1] == 0xAA)))
+        return CONSOLE_COLECOVISION;
+
+    return guess;
+}
+
 #ifndef NO_BZ2
-static int detect_bz2(const char *fn) {
-    /* We really don't have a choice here... Guess based on the extension before
-       .bz2. */
-    return guess_on_ext(fn, 1);
+static int sniff_bz2(const char *fn, uint8 *buf) {
+    BZFILE *fp;
+    int len;
+
+    if(!(fp = BZ2_bzopen(fn, "rb")))
+        return -2;
+
+    len = BZ2_bzread(fp, buf, SNIFF_LEN);
+    BZ2_bzclose(fp);
+
+    /* There's no name stored in the file, so go with what's before .bz2. */
+    return sniff_console(buf, len > 0 ? (uint32)len : 0, guess_on_ext(fn, 1));
 }
 #endif
 
 #ifndef NO_ZLIB
-static int detect_zip(const char *fn) {
-    int console = 0;
+static int sniff_gz(const char *fn, uint8 *buf) {
+    gzFile fp;
+    int len, guess;
+
+    if((guess = detect_gz(fn)) == -2)
+        return -2;
+
+    if(!(fp = gzopen(fn, "rb")))
+        return -2;
+
+    /* This only inflates as much as is asked for. */
+    len = gzread(fp, buf, SNIFF_LEN);
+    gzclose(fp);
+
+    return sniff_console(buf, len > 0 ? (uint32)len : 0, guess);
+}
+
+static int sniff_zip(const char *fn, uint8 *buf) {
     unzFile fp;
     unz_file_info inf;
     char fn2[4096];
+    int guess = -1, len;
 
     /* Open up the file in question. */
     if(!(fp = unzOpen(fn))) {
@@ -239,8 +323,9 @@ static int detect_zip(const char *fn) {
         return -2;
     }
 
-    /* Keep looking at files until we find a rom. */
-    while(console <= 0) {
+    /* Look through the directory for something named like a rom. This doesn't
+       have to decompress anything. */
+    while(guess <= 0) {
         if(unzGetCurrentFileInfo(fp, &inf, fn2, 4096, NULL, 0, NULL,
                                  0) != UNZ_OK) {
 #ifdef DEBUG
@@ -250,66 +335,686 @@ static int detect_zip(const char *fn) {
             return -2;
         }
 
-        /* Check if this file looks like a rom. */
-        console = guess_on_ext(fn2, 0);
+        guess = guess_on_ext(fn2, 0);
 
-        /* If we haven't found a rom yet, move to the next file. */
-        if(console <= 0) {
-            if(unzGoToNextFile(fp) != UNZ_OK) {
+        if(guess <= 0 && unzGoToNextFile(fp) != UNZ_OK) {
 #ifdef DEBUG
-                fprintf(stderr, "rom_detect_console: End of zip file!\n");
+            fprintf(stderr, "rom_detect_console: End of zip file!\n");
 #endif
-                unzClose(fp);
-                return -2;
-            }
+            unzClose(fp);
+            return -2;
         }
     }
 
-    /* If we get here, we have our console. Return it! */
-    return console;
+    /* Then read just the start of it to check the name against. */
+    if(unzOpenCurrentFile(fp) != UNZ_OK) {
+        unzClose(fp);
+        return guess;
+    }
+
+    len = unzReadCurrentFile(fp, buf, SNIFF_LEN);
+    unzCloseCurrentFile(fp);
+    unzClose(fp);
+
+    return sniff_console(buf, len > 0 ? (uint32)len : 0, guess);
 }
 #endif
 
 int rom_detect_console(const char *fn) {
+    FILE *fp;
+    uint8 *buf;
+    size_t len;
     int rv;
 
-    rv = guess_on_ext(fn, 0);
-    switch(rv) {
+    if(!(buf = (uint8 *)malloc(SNIFF_LEN)))
+        return guess_on_ext(fn, 0);
+
+    if(!(fp = fopen(fn, "rb"))) {
+        free(buf);
+        return -2;
+    }
+
+    len = fread(buf, 1, SNIFF_LEN, fp);
+    fclose(fp);
+
+    /* Go by what's in the file rather than its name, as rom_image_load()
+       does, then look at the start of whatever's inside. */
 #ifndef NO_ZLIB
-        case TYPE_GZIP:
-            return detect_gz(fn);
+    if(len >= 2 && buf[0] == 0x1F && buf[1] == 0x8B)
+        rv = sniff_gz(fn, buf);
+    else if(len >= 4 && buf[0] == 'P' && buf[1] == 'K' && buf[2] == 0x03 &&
+            buf[3] == 0x04)
+        rv = sniff_zip(fn, buf);
+    else
+#endif
+#ifndef NO_BZ2
+    if(len >= 3 && buf[0] == 'B' && buf[1] == 'Z' && buf[2] == 'h')
+        rv = sniff_bz2(fn, buf);
+    else
+#endif
+        rv = sniff_console(buf, (uint32)len, guess_on_ext(fn, 0));
+
+    free(buf);
+    return rv;
+}
+
+/* Allocate the buffer for an image that's expected to be size bytes long,
+   with room for any padding that was asked for. */
+static int alloc_image(rom_image_t *img, uint32 size, int flags) {
+    size_t len = size;
+
+    if(flags & ROM_IMAGE_PAD)
+        len = (len + 0xFF) & ~(size_t)0xFF;
+
+    /* Leave room for a header to be trimmed off the front, if needed. */
+    if((flags & ROM_IMAGE_32K) && len < 0x8000 + 512)
+        len = 0x8000 + 512;
+
+    if(!len)
+        len = 0x100;
+
+    if(!(img->base = malloc(len)))
+        return ROM_LOAD_E_ERRNO;
+
+    img->base_len = len;
+    img->data = (uint8 *)img->base;
+    img->size = 0;
+
+    return ROM_LOAD_SUCCESS;
+}
+
+#if !defined(NO_ZLIB) || !defined(NO_BZ2)
+static int grow_image(rom_image_t *img) {
+    size_t len = img->base_len << 1;
+    void *tmp;
+
+    if(!(tmp = realloc(img->base, len)))
+        return ROM_LOAD_E_ERRNO;
+
+    img->base = tmp;
+    img->base_len = len;
+    img->data = (uint8 *)tmp;
+
+    return ROM_LOAD_SUCCESS;
+}
+
+/* Decompress straight into the image buffer, sized from the hint. If the hint
+   was short, the buffer gets doubled until everything fits. */
+static int stream_image(void *fp, int (*rd)(void *, void *, int),
+                        uint32 hint, int flags, rom_image_t *img) {
+    uint8 probe;
+    int len, rv;
+
+    if((rv = alloc_image(img, hint, flags)))
+        return rv;
+
+    for(;;) {
+        if(img->size == img->base_len) {
+            /* See if there's actually anything more before growing. */
+            if((len = rd(fp, &probe, 1)) <= 0)
+                break;
+
+            if((rv = grow_image(img)))
+                return rv;
+
+            img->data[img->size++] = probe;
+        }
+
+        len = rd(fp, img->data + img->size,
+                 (int)(img->base_len - img->size));
+
+        if(len <= 0)
+            break;
 
-        case TYPE_ZIP:
-            return detect_zip(fn);
+        img->size += len;
+    }
+
+    return len < 0 ? ROM_LOAD_E_CORRUPT : ROM_LOAD_SUCCESS;
+}
 #endif
 
-#ifndef NO_BZ2
-        case TYPE_BZIP2:
-            return detect_bz2(fn);
+#ifndef NO_ZLIB
+/* Deflate can't do much better than 1032:1, and no ROM for anything here is
+   anywhere near 16MB. */
+#define GZ_RATIO_MAX    1032
+#define GZ_HINT_MAX     (16 * 1024 * 1024)
+
+static int gz_read(void *fp, void *buf, int len) {
+    return gzread((gzFile)fp, buf, (unsigned)len);
+}
+
+static int load_gz_image(const char *fn, FILE *fp, int flags,
+                         rom_image_t *img) {
+    uint8 buf[4];
+    uint32 hint = 0;
+    long clen;
+    gzFile gz;
+    int rv;
+
+    /* The uncompressed size is in the last four bytes of the file. That's
+       straight from the file, so don't allocate more than the rest of it
+       could inflate to or than any ROM needs; if it really is bigger than
+       that, grow_image() takes care of it. */
+    if(!fseek(fp, -4, SEEK_END) && fread(buf, 1, 4, fp) == 4) {
+        hint = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+        clen = ftell(fp);
+
+        if(clen > 0 && (uint64_t)hint > (uint64_t)clen * GZ_RATIO_MAX)
+            hint = (uint32)((uint64_t)clen * GZ_RATIO_MAX);
+
+        if(hint > GZ_HINT_MAX)
+            hint = GZ_HINT_MAX;
+    }
+
+    fclose(fp);
+
+    if(!(gz = gzopen(fn, "rb"))) {
+#ifdef DEBUG
+        fprintf(stderr, "rom_image_load: Could not open ROM: %s!\n", fn);
+#endif
+        return ROM_LOAD_E_OPEN;
+    }
+
+    rv = stream_image(gz, &gz_read, hint, flags, img);
+    gzclose(gz);
+
+    return rv;
+}
 #endif
 
-        default:
-            return rv;
+#ifndef NO_BZ2
+static int bz_read(void *fp, void *buf, int len) {
+    return BZ2_bzread((BZFILE *)fp, buf, len);
+}
+
+static int load_bz2_image(const char *fn, FILE *fp, int flags,
+                          rom_image_t *img) {
+    uint32 hint;
+    BZFILE *bz;
+    int rv;
+
+    /* bzip2 doesn't record the uncompressed size, but ROMs don't tend to
+       compress much better than 4:1. */
+    fseek(fp, 0, SEEK_END);
+    hint = (uint32)ftell(fp) << 2;
+    fclose(fp);
+
+    if(!(bz = BZ2_bzopen(fn, "rb"))) {
+#ifdef DEBUG
+        fprintf(stderr, "rom_image_load: Could not open ROM: %s!\n", fn);
+#endif
+        return ROM_LOAD_E_OPEN;
     }
+
+    rv = stream_image(bz, &bz_read, hint, flags, img);
+    BZ2_bzclose(bz);
+
+    return rv;
 }
+#endif
 
-uint32 rom_crc32(const uint8 *data, int size) {
+#ifndef NO_ZLIB
+static int zip_name_matches(const char *name, const char *const exts[]) {
+    const char *ext = strrchr(name, '.');
     int i;
-    uint32 rv = 0xFFFFFFFF;
 
-    for(i = 0; i < size; ++i) {
-        rv ^= data[i];
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
+    if(!ext)
+        return 0;
+
+    if(!exts)
+        return guess_on_ext(name, 0) >= 0;
+
+    for(i = 0; exts[i]; ++i) {
+        if(!strcmp(ext, exts[i]))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int load_zip_image(const char *fn, const char *const exts[], int flags,
+                          rom_image_t *img) {
+    unzFile fp;
+    unz_file_info inf;
+    char fn2[4096];
+    int rv;
+
+    if(!(fp = unzOpen(fn))) {
+#ifdef DEBUG
+        fprintf(stderr, "rom_image_load: Could not open ROM: %s!\n", fn);
+#endif
+        return ROM_LOAD_E_OPEN;
+    }
+
+    if(unzGoToFirstFile(fp) != UNZ_OK) {
+#ifdef DEBUG
+        fprintf(stderr, "rom_image_load: Couldn't find file in zip!\n");
+#endif
+        unzClose(fp);
+        return ROM_LOAD_E_CORRUPT;
+    }
+
+    /* Keep looking at files until we find a rom. */
+    for(;;) {
+        if(unzGetCurrentFileInfo(fp, &inf, fn2, 4096, NULL, 0, NULL,
+                                 0) != UNZ_OK) {
+#ifdef DEBUG
+            fprintf(stderr, "rom_image_load: Error parsing zip file!\n");
+#endif
+            unzClose(fp);
+            return ROM_LOAD_E_CORRUPT;
+        }
+
+        if(zip_name_matches(fn2, exts))
+            break;
+
+        if(unzGoToNextFile(fp) != UNZ_OK) {
+#ifdef DEBUG
+            fprintf(stderr, "rom_image_load: End of zip file!\n");
+#endif
+            unzClose(fp);
+            return ROM_LOAD_E_NO_ROM;
+        }
+    }
+
+    img->console = guess_on_ext(fn2, 0);
+
+    /* The directory entry has the size, so this is the only allocation. */
+    if((rv = alloc_image(img, (uint32)inf.uncompressed_size, flags))) {
+        unzClose(fp);
+        return rv;
+    }
+
+    if(unzOpenCurrentFile(fp) != UNZ_OK) {
+#ifdef DEBUG
+        fprintf(stderr, "rom_image_load: Couldn't open rom from zip!\n");
+#endif
+        unzClose(fp);
+        return ROM_LOAD_E_CORRUPT;
+    }
+
+    if(unzReadCurrentFile(fp, img->data, inf.uncompressed_size) !=
+       (int)inf.uncompressed_size) {
+#ifdef DEBUG
+        fprintf(stderr, "rom_image_load: Couldn't read rom from zip!\n");
+#endif
+        unzCloseCurrentFile(fp);
+        unzClose(fp);
+        return ROM_LOAD_E_CORRUPT;
+    }
+
+    unzCloseCurrentFile(fp);
+    unzClose(fp);
+
+    img->size = (uint32)inf.uncompressed_size;
+
+    return ROM_LOAD_SUCCESS;
+}
+#endif
+
+static int load_raw_image(FILE *fp, int flags, rom_image_t *img) {
+    long size;
+    int rv;
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if(size <= 0) {
+        fclose(fp);
+        return ROM_LOAD_E_BAD_SZ;
+    }
+
+#ifndef _arch_dreamcast
+    /* Map the file instead of reading it in, unless it needs padding that the
+       mapping can't provide. Small SMS/SG-1000 carts get read past their end,
+       so those have to stay in a real buffer too. */
+    if((!(flags & ROM_IMAGE_PAD) || !(size & 0xFF)) &&
+       (!(flags & ROM_IMAGE_32K) || size >= 0x8000)) {
+        void *ptr = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE,
+                         fileno(fp), 0);
+
+        if(ptr != MAP_FAILED) {
+            fclose(fp);
+            img->base = ptr;
+            img->base_len = (size_t)size;
+            img->data = (uint8 *)ptr;
+            img->size = (uint32)size;
+            img->mapped = 1;
+            return ROM_LOAD_SUCCESS;
+        }
+    }
+#endif
+
+    if((rv = alloc_image(img, (uint32)size, flags))) {
+        fclose(fp);
+        return rv;
+    }
+
+    if(fread(img->data, 1, (size_t)size, fp) != (size_t)size) {
+        fclose(fp);
+        return ROM_LOAD_E_ERRNO;
+    }
+
+    fclose(fp);
+    img->size = (uint32)size;
+
+    return ROM_LOAD_SUCCESS;
+}
+
+int rom_image_load(const char *fn, const char *const exts[], int flags,
+                   rom_image_t *img) {
+    FILE *fp;
+    uint8 magic[4] = { 0, 0, 0, 0 };
+    uint32 len;
+    int rv;
+
+    memset(img, 0, sizeof(rom_image_t));
+    img->console = -1;
+
+    if(!(fp = fopen(fn, "rb"))) {
+#ifdef DEBUG
+        fprintf(stderr, "rom_image_load: Could not open ROM: %s!\n", fn);
+#endif
+        return ROM_LOAD_E_ERRNO;
+    }
+
+    if(fread(magic, 1, 4, fp) != 4)
+        magic[0] = magic[1] = magic[2] = magic[3] = 0;
+
+#ifndef NO_ZLIB
+    if(magic[0] == 0x1F && magic[1] == 0x8B)
+        rv = load_gz_image(fn, fp, flags, img);
+    else if(magic[0] == 'P' && magic[1] == 'K' && magic[2] == 0x03 &&
+            magic[3] == 0x04) {
+        fclose(fp);
+        rv = load_zip_image(fn, exts, flags, img);
+    }
+    else
+#endif
+#ifndef NO_BZ2
+    if(magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h')
+        rv = load_bz2_image(fn, fp, flags, img);
+    else
+#endif
+        rv = load_raw_image(fp, flags, img);
+
+    if(rv != ROM_LOAD_SUCCESS) {
+        rom_image_free(img);
+        return rv;
+    }
+
+    if(!img->size) {
+        rom_image_free(img);
+        return ROM_LOAD_E_BAD_SZ;
+    }
+
+    if(flags & ROM_IMAGE_TRIM) {
+        if((img->size % 0x4000) == 512) {
+            /* SMD header present, skip it */
+            img->data += 512;
+            img->size -= 512;
+        }
+        else if((img->size % 0x4000) == 64) {
+            /* Footer present, truncate it */
+            img->size -= 64;
+        }
+    }
+
+    /* Fill whatever's left of the buffer like an empty bus would. Anything
+       that's still mapped here doesn't need padding. */
+    if(!img->mapped) {
+        len = (uint32)((uint8 *)img->base + img->base_len -
+                       (img->data + img->size));
+        memset(img->data + img->size, 0xFF, len);
+
+        if(flags & ROM_IMAGE_PAD)
+            img->size = (img->size + 0xFF) & ~0xFF;
     }
 
-    return ~rv;
+    return ROM_LOAD_SUCCESS;
+}
+
+void rom_image_free(rom_image_t *img) {
+#ifndef _arch_dreamcast
+    if(img->mapped)
+        munmap(img->base, img->base_len);
+    else
+#endif
+        free(img->base);
+
+    img->base = NULL;
+    img->data = NULL;
+    img->base_len = 0;
+    img->size = 0;
+    img->mapped = 0;
+}
+
+/* CRC32 uses the same polynomial as zlib (reflected 0xEDB88320). It's done
+   eight bytes at a time with the slicing-by-8 tables, or with carry-less
+   multiplication where the CPU has it. */
+#if !defined(_arch_dreamcast) && defined(__x86_64__) && defined(__GNUC__) && \
+    !defined(CRABEMU_NO_PCLMUL)
+#define CRC_PCLMUL
+#include <immintrin.h>
+#endif
+
+/* Size of the pieces the combined checksum works through, so that Adler-32
+   sees each piece while it's still in the cache from the CRC. */
+#define CHECKSUM_CHUNK  4096
+
+static uint32 crc_tab[8][256];
+
+#ifdef CRC_PCLMUL
+static int crc_use_pclmul;
+static int adler_use_ssse3;
+#endif
+
+static void checksum_init_tables(void) {
+    uint32 c;
+    int i, j;
+
+    for(i = 0; i < 256; ++i) {
+        c = (uint32)i;
+
+        for(j = 0; j < 8; ++j) {
+            c = (0xEDB88320 & (-(c & 1))) ^ (c >> 1);
+        }
+
+        crc_tab[0][i] = c;
+    }
+
+    for(i = 0; i < 256; ++i) {
+        c = crc_tab[0][i];
+
+        for(j = 1; j < 8; ++j) {
+            c = crc_tab[0][c & 0xFF] ^ (c >> 8);
+            crc_tab[j][i] = c;
+        }
+    }
+
+#ifdef CRC_PCLMUL
+    __builtin_cpu_init();
+    crc_use_pclmul = __builtin_cpu_supports("pclmul") &&
+        __builtin_cpu_supports("sse4.1");
+    adler_use_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#ifndef _arch_dreamcast
+#include <pthread.h>
+
+static pthread_once_t checksum_once = PTHREAD_ONCE_INIT;
+
+/* The ROM indexer checksums from a bunch of threads at once. */
+static void checksum_init(void) {
+    pthread_once(&checksum_once, &checksum_init_tables);
+}
+#else
+static void checksum_init(void) {
+    static int ready = 0;
+
+    if(!ready) {
+        checksum_init_tables();
+        ready = 1;
+    }
+}
+#endif
+
+/* Takes and returns the running (inverted) value. */
+static uint32 crc_slice8(uint32 c, const uint8 *buf, uint32 len) {
+    uint32 lo, hi;
+
+    while(len && ((uintptr_t)buf & 7)) {
+        c = crc_tab[0][(c ^ *buf++) & 0xFF] ^ (c >> 8);
+        --len;
+    }
+
+    while(len >= 8) {
+        /* Put together byte by byte, so this is the same on any endianness. */
+        lo = c ^ (buf[0] | (buf[1] << 8) | (buf[2] << 16) |
+                  ((uint32)buf[3] << 24));
+        hi = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32)buf[7] << 24);
+
+        c = crc_tab[7][lo & 0xFF] ^ crc_tab[6][(lo >> 8) & 0xFF] ^
+            crc_tab[5][(lo >> 16) & 0xFF] ^ crc_tab[4][lo >> 24] ^
+            crc_tab[3][hi & 0xFF] ^ crc_tab[2][(hi >> 8) & 0xFF] ^
+            crc_tab[1][(hi >> 16) & 0xFF] ^ crc_tab[0][hi >> 24];
+
+        buf += 8;
+        len -= 8;
+    }
+
+    while(len--) {
+        c = crc_tab[0][(c ^ *buf++) & 0xFF] ^ (c >> 8);
+    }
+
+    return c;
+}
+
+#ifdef CRC_PCLMUL
+/* Folds four 128-bit lanes at a time, then reduces them down to 32 bits with
+   a Barrett reduction. This is the method from Intel's "Fast CRC Computation
+   for Generic Polynomials Using PCLMULQDQ Instruction" paper. len must be at
+   least 64 and a multiple of 16. Takes and returns the running value. */
+__attribute__((target("pclmul,sse4.1")))
+static uint32 crc_pclmul(uint32 c, const uint8 *buf, uint32 len) {
+    static const uint64_t k1k2[2] = { 0x0154442BD4ULL, 0x01C6E41596ULL };
+    static const uint64_t k3k4[2] = { 0x01751997D0ULL, 0x00CCAA009EULL };
+    static const uint64_t k5k0[2] = { 0x0163CD6124ULL, 0x0000000000ULL };
+    static const uint64_t poly[2] = { 0x01DB710641ULL, 0x01F7011641ULL };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)c));
+    x0 = _mm_loadu_si128((const __m128i *)k1k2);
+
+    buf += 64;
+    len -= 64;
+
+    while(len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /* Fold the four lanes into one. */
+    x0 = _mm_loadu_si128((const __m128i *)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Then anything that's left, 16 bytes at a time. */
+    while(len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /* 128 bits down to 64... */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* ...and Barrett reduce to 32. */
+    x0 = _mm_loadu_si128((const __m128i *)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+static uint32 crc_update(uint32 c, const uint8 *buf, uint32 len) {
+#ifdef CRC_PCLMUL
+    uint32 bulk;
+
+    if(crc_use_pclmul && len >= 64) {
+        bulk = len & ~15;
+        c = crc_pclmul(c, buf, bulk);
+        buf += bulk;
+        len -= bulk;
+    }
+#endif
+
+    return crc_slice8(c, buf, len);
+}
+
+uint32 rom_crc32(const uint8 *data, int size) {
+    checksum_init();
+
+    if(size <= 0)
+        return 0;
+
+    return ~crc_update(0xFFFFFFFF, data, (uint32)size);
 }
 
 /* Public-domain adler32 checksum. Borrowed from stb-2.23, which has the
@@ -327,14 +1032,85 @@ uint32 rom_crc32(const uint8 *data, int size) {
    Documentation: http://nothings.org/stb/stb_h.html
    Unit tests:    http://nothings.org/stb/stb.c
 */
-#include <stdint.h>
-
 #define STB_ADLER32_SEED   1
+#define ADLER_MOD           65521
+
+#ifdef CRC_PCLMUL
+/* 32 bytes at a time: s1 picks up the plain sum of each block, and s2 the sum
+   weighted 32 down to 1, plus 32 times whatever s1 was going into the block.
+   Does as many whole blocks as it can, and leaves the rest. */
+__attribute__((target("ssse3")))
+static uint32 adler_ssse3(uint32 *a1, uint32 *a2, const uint8 *buf,
+                          uint32 len) {
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                       24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+                                       8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i v_ps, v_s1, v_s2, b1, b2;
+    uint32 s1 = *a1, s2 = *a2;
+    uint32 blocks = len >> 5, n, done = blocks << 5;
+
+    while(blocks) {
+        /* Same limit as the scalar version, so nothing can overflow. */
+        n = blocks < 5552 / 32 ? blocks : 5552 / 32;
+        blocks -= n;
+
+        v_ps = _mm_set_epi32(0, 0, 0, (int)(s1 * n));
+        v_s2 = _mm_set_epi32(0, 0, 0, (int)s2);
+        v_s1 = zero;
+
+        do {
+            b1 = _mm_loadu_si128((const __m128i *)buf);
+            b2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b1, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+                                     _mm_maddubs_epi16(b1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b2, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+                                     _mm_maddubs_epi16(b2, tap2), ones));
+
+            buf += 32;
+        } while(--n);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, 0xB1));
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, 0x4E));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, 0xB1));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, 0x4E));
+
+        s1 = (s1 + (uint32)_mm_cvtsi128_si32(v_s1)) % ADLER_MOD;
+        s2 = (uint32)_mm_cvtsi128_si32(v_s2) % ADLER_MOD;
+    }
 
-uint32 rom_adler32(const uint8 *buffer, uint32 buflen) {
-    const unsigned long ADLER_MOD = 65521;
-    unsigned long s1 = STB_ADLER32_SEED & 0xffff, s2 = STB_ADLER32_SEED >> 16;
-    unsigned long blocklen, i;
+    *a1 = s1;
+    *a2 = s2;
+
+    return done;
+}
+#endif
+
+/* Both sums must already be reduced, and they come back that way. */
+static void adler_update(uint32 *a1, uint32 *a2, const uint8 *buffer,
+                         uint32 buflen) {
+    uint32 s1, s2;
+    uint32 blocklen, i;
+
+#ifdef CRC_PCLMUL
+    if(adler_use_ssse3) {
+        i = adler_ssse3(a1, a2, buffer, buflen);
+        buffer += i;
+        buflen -= i;
+    }
+#endif
+
+    s1 = *a1;
+    s2 = *a2;
 
     blocklen = buflen % 5552;
     while (buflen) {
@@ -359,5 +1135,40 @@ uint32 rom_adler32(const uint8 *buffer, uint32 buflen) {
         blocklen = 5552;
     }
 
+    *a1 = s1;
+    *a2 = s2;
+}
+
+uint32 rom_adler32(const uint8 *buffer, uint32 buflen) {
+    uint32 s1 = STB_ADLER32_SEED & 0xffff, s2 = STB_ADLER32_SEED >> 16;
+
+    checksum_init();
+    adler_update(&s1, &s2, buffer, buflen);
     return (s2 << 16) + s1;
 }
+
+void rom_checksums(const uint8 *data, uint32 len, uint32 *crc,
+                   uint32 *adler) {
+    uint32 c = 0xFFFFFFFF, chunk;
+    uint32 s1 = STB_ADLER32_SEED & 0xffff, s2 = STB_ADLER32_SEED >> 16;
+
+    checksum_init();
+
+    /* Splitting Adler-32 up like this doesn't change the result, as
+       adler_update() always leaves its sums reduced. */
+    while(len) {
+        chunk = len < CHECKSUM_CHUNK ? len : CHECKSUM_CHUNK;
+
+        c = crc_update(c, data, chunk);
+        adler_update(&s1, &s2, data, chunk);
+
+        data += chunk;
+        len -= chunk;
+    }
+
+    if(crc)
+        *crc = ~c;
+
+    if(adler)
+        *adler = (s2 << 16) + s1;
+}
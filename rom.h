@@ -24,10 +24,47 @@
 
 CLINKAGE
 
+/* A ROM image as loaded by rom_image_load(). data may point into a read-only
+   mapping of the file rather than an allocation (and may not be at the start
+   of either), so it must only be let go of with rom_image_free(). */
+typedef struct rom_image {
+    uint8 *data;
+    uint32 size;
+
+    /* Console guessed from the name of the file pulled out of a zip archive,
+       or -1 if there was no such name to go on. */
+    int console;
+
+    void *base;
+    size_t base_len;
+    int mapped;
+} rom_image_t;
+
+/* Flags for rom_image_load(). ROM_IMAGE_TRIM drops a 512 byte SMD header or
+   a 64 byte footer, going by the size of the image. ROM_IMAGE_PAD rounds the
+   size up to a multiple of 256 bytes, filling the rest with 0xFF.
+   ROM_IMAGE_32K makes sure at least 32KiB past data can be read, even if the
+   image itself is smaller. */
+#define ROM_IMAGE_TRIM      0x01
+#define ROM_IMAGE_PAD       0x02
+#define ROM_IMAGE_32K       0x04
+
+/* Load a ROM, whether it's a plain image or is in a gzip, bzip2 or zip file
+   (told apart by their contents, not the name). For zip files, the first file
+   in the archive with one of the extensions in the NULL-terminated exts list
+   is used. Returns one of the ROM_LOAD_* codes. */
+extern int rom_image_load(const char *fn, const char *const exts[], int flags,
+                          rom_image_t *img);
+extern void rom_image_free(rom_image_t *img);
+
 extern int rom_detect_console(const char *fn);
 extern uint32 rom_crc32(const uint8 *data, int size);
 extern uint32 rom_adler32(const uint8 *buffer, uint32 buflen);
 
+/* Both of the above in one pass over the data. Either pointer may be NULL. */
+extern void rom_checksums(const uint8 *data, uint32 len, uint32 *crc,
+                          uint32 *adler);
+
 ENDCLINK
 
 #endif /* !ROM_H */
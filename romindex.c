@@ -0,0 +1,566 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "romindex.h"
+#include "rom.h"
+#include "console.h"
+#include "smsmem.h"
+#include "mappers.h"
+
+/* On-disk format: a 16 byte file header, then each entry as a fixed 48 byte
+   record followed by its path (without a terminator). Everything is little
+   endian. */
+#define INDEX_MAGIC     (FOURCC_TO_UINT32('C', 'R', 'I', 'X'))
+#define INDEX_VERSION   1
+#define INDEX_HDR_LEN   16
+#define INDEX_REC_LEN   48
+
+typedef struct scan_ctx {
+    romindex_entry_t *entries;
+    uint32 *jobs;
+    uint32 njobs;
+    uint32 next;
+} scan_ctx_t;
+
+typedef struct file_list {
+    romindex_entry_t *entries;
+    uint32 count;
+    uint32 alloc;
+} file_list_t;
+
+static int entry_cmp(const void *a, const void *b) {
+    return strcmp(((const romindex_entry_t *)a)->path,
+                  ((const romindex_entry_t *)b)->path);
+}
+
+const romindex_entry_t *romindex_find(const romindex_t *idx,
+                                      const char *path) {
+    romindex_entry_t key;
+
+    if(!idx->count)
+        return NULL;
+
+    key.path = (char *)path;
+    return (const romindex_entry_t *)bsearch(&key, idx->entries, idx->count,
+                                             sizeof(romindex_entry_t),
+                                             &entry_cmp);
+}
+
+void romindex_free(romindex_t *idx) {
+    uint32 i;
+
+    for(i = 0; i < idx->count; ++i) {
+        free(idx->entries[i].path);
+    }
+
+    free(idx->entries);
+    memset(idx, 0, sizeof(romindex_t));
+}
+
+static void index_sega(romindex_entry_t *ent, const rom_image_t *img) {
+    static const uint32 offs[3] = { 0x7FF0, 0x3FF0, 0x1FF0 };
+    int i;
+
+    /* The loader does the same as this, so the mapper ends up the same. */
+    ent->mapper = sms_find_mapper(img->data, img->size, &ent->crc32,
+                                  &ent->adler32);
+
+    if(ent->mapper == (uint32)-1) {
+        if(ent->console == CONSOLE_SG1000)
+            ent->mapper = SMS_MAPPER_SEGA;
+        else
+            ent->mapper = sms_guess_mapper(img->data, img->size);
+    }
+
+    for(i = 0; i < 3; ++i) {
+        if(img->size >= offs[i] + 16 &&
+           !memcmp(img->data + offs[i], "TMR SEGA", 8)) {
+            memcpy(ent->header, img->data + offs[i], 16);
+            ent->region = ent->header[15] >> 4;
+            break;
+        }
+    }
+}
+
+static void index_nes(romindex_entry_t *ent, const rom_image_t *img) {
+    const uint8 *hdr = img->data;
+    uint32 prg;
+
+    if(img->size < 16 || hdr[0] != 'N' || hdr[1] != 'E' || hdr[2] != 'S' ||
+       hdr[3] != 0x1A) {
+        ent->console = -1;
+        return;
+    }
+
+    memcpy(ent->header, hdr, 16);
+    ent->region = hdr[9] & 0x01;
+
+    /* Same as nesmem.c: junk in the reserved bytes means only the low nibble
+       of the mapper number can be trusted. */
+    if(hdr[15] || hdr[14] || hdr[13] || hdr[12])
+        ent->mapper = hdr[6] >> 4;
+    else
+        ent->mapper = (hdr[6] >> 4) | (hdr[7] & 0xF0);
+
+    prg = hdr[4] * 16384;
+
+    if(prg > img->size - 16)
+        prg = img->size - 16;
+
+    rom_checksums(hdr + 16, prg, &ent->crc32, &ent->adler32);
+}
+
+static void index_file(romindex_entry_t *ent) {
+    rom_image_t img;
+    int flags = 0;
+
+    ent->crc32 = ent->adler32 = 0;
+    ent->mapper = (uint32)-1;
+    ent->region = 0;
+    memset(ent->header, 0, 16);
+
+    /* This only ever reads the start of the file. */
+    ent->console = rom_detect_console(ent->path);
+
+    switch(ent->console) {
+        case CONSOLE_SMS:
+        case CONSOLE_GG:
+        case CONSOLE_SG1000:
+        case CONSOLE_SC3000:
+            flags = ROM_IMAGE_TRIM | ROM_IMAGE_32K;
+            break;
+
+        case CONSOLE_COLECOVISION:
+            flags = ROM_IMAGE_PAD;
+            break;
+
+        case CONSOLE_NES:
+        case CONSOLE_CHIP8:
+            break;
+
+        default:
+            ent->console = -1;
+            return;
+    }
+
+    /* With no list of extensions, this takes the same file out of a zip
+       archive that rom_detect_console() looked at. */
+    if(rom_image_load(ent->path, NULL, flags, &img) != ROM_LOAD_SUCCESS) {
+        ent->console = -1;
+        return;
+    }
+
+    if(ent->console == CONSOLE_NES) {
+        index_nes(ent, &img);
+    }
+    else if(flags & ROM_IMAGE_TRIM) {
+        index_sega(ent, &img);
+    }
+    else {
+        rom_checksums(img.data, img.size, &ent->crc32, &ent->adler32);
+    }
+
+    rom_image_free(&img);
+}
+
+static void *scan_thread(void *ptr) {
+    scan_ctx_t *ctx = (scan_ctx_t *)ptr;
+    uint32 job;
+
+    for(;;) {
+        job = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED);
+
+        if(job >= ctx->njobs)
+            break;
+
+        index_file(&ctx->entries[ctx->jobs[job]]);
+    }
+
+    return NULL;
+}
+
+static int add_file(file_list_t *list, char *path, const struct stat *st) {
+    romindex_entry_t *tmp;
+    uint32 len;
+
+    if(list->count == list->alloc) {
+        len = list->alloc ? list->alloc << 1 : 256;
+
+        if(!(tmp = (romindex_entry_t *)realloc(list->entries,
+                                               len * sizeof(romindex_entry_t))))
+            return -1;
+
+        list->entries = tmp;
+        list->alloc = len;
+    }
+
+    memset(&list->entries[list->count], 0, sizeof(romindex_entry_t));
+    list->entries[list->count].path = path;
+    list->entries[list->count].size = (uint64_t)st->st_size;
+    list->entries[list->count].mtime = (int64_t)st->st_mtime;
+    ++list->count;
+
+    return 0;
+}
+
+static int walk_dir(file_list_t *list, const char *dir) {
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    size_t dlen = strlen(dir), len;
+    char *path;
+    int rv = 0;
+
+    if(!(d = opendir(dir)))
+        return -1;
+
+    while(!rv && (de = readdir(d))) {
+        /* Skip hidden files, as well as . and .. */
+        if(de->d_name[0] == '.')
+            continue;
+
+        len = dlen + strlen(de->d_name) + 2;
+
+        if(!(path = (char *)malloc(len))) {
+            rv = -1;
+            break;
+        }
+
+        snprintf(path, len, "%s/%s", dir, de->d_name);
+
+        /* Don't follow symlinks to directories, so there's no way to end up
+           going around in circles. */
+        if(lstat(path, &st) || (S_ISLNK(st.st_mode) &&
+                                (stat(path, &st) || !S_ISREG(st.st_mode)))) {
+            free(path);
+            continue;
+        }
+
+        if(S_ISDIR(st.st_mode)) {
+            walk_dir(list, path);
+            free(path);
+        }
+        else if(S_ISREG(st.st_mode)) {
+            if(add_file(list, path, &st)) {
+                free(path);
+                rv = -1;
+            }
+        }
+        else {
+            free(path);
+        }
+    }
+
+    closedir(d);
+    return rv;
+}
+
+/* Whether path is dir or somewhere underneath it. */
+static int in_dir(const char *path, const char *dir, size_t dlen) {
+    return !strncmp(path, dir, dlen) && (path[dlen] == '/' || !path[dlen]);
+}
+
+static void free_list(file_list_t *list) {
+    uint32 i;
+
+    for(i = 0; i < list->count; ++i) {
+        free(list->entries[i].path);
+    }
+
+    free(list->entries);
+}
+
+int romindex_scan(romindex_t *idx, const char *dir, int threads) {
+    file_list_t list = { NULL, 0, 0 };
+    scan_ctx_t ctx;
+    pthread_t *thds = NULL;
+    const romindex_entry_t *old;
+    romindex_entry_t *ent, *tmp;
+    char *root;
+    size_t dlen;
+    uint32 i;
+    int j, started = 0, rv;
+
+    /* Trailing slashes would throw off the paths, as well as in_dir(). */
+    dlen = strlen(dir);
+
+    while(dlen > 1 && dir[dlen - 1] == '/') {
+        --dlen;
+    }
+
+    if(!(root = (char *)malloc(dlen + 1)))
+        return -1;
+
+    memcpy(root, dir, dlen);
+    root[dlen] = 0;
+    rv = walk_dir(&list, root);
+    free(root);
+
+    /* Make room for everything that'll be kept from the old index up front, so
+       nothing can fail once the work has been done. */
+    if(!rv && idx->count) {
+        if(!(tmp = (romindex_entry_t *)realloc(list.entries,
+                                               (list.count + idx->count) *
+                                               sizeof(romindex_entry_t))))
+            rv = -1;
+        else
+            list.entries = tmp;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    if(!rv && list.count &&
+       !(ctx.jobs = (uint32 *)malloc(list.count * sizeof(uint32))))
+        rv = -1;
+
+    if(rv) {
+        free_list(&list);
+        return -1;
+    }
+
+    ctx.entries = list.entries;
+
+    /* Anything that looks the same as last time doesn't need to be read. */
+    idx->reused = 0;
+
+    for(i = 0; i < list.count; ++i) {
+        ent = &list.entries[i];
+        old = romindex_find(idx, ent->path);
+
+        if(old && old->size == ent->size && old->mtime == ent->mtime) {
+            ent->console = old->console;
+            ent->crc32 = old->crc32;
+            ent->adler32 = old->adler32;
+            ent->mapper = old->mapper;
+            ent->region = old->region;
+            memcpy(ent->header, old->header, 16);
+            ++idx->reused;
+        }
+        else {
+            ctx.jobs[ctx.njobs++] = i;
+        }
+    }
+
+    idx->scanned = ctx.njobs;
+
+    if(threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    if((uint32)threads > ctx.njobs)
+        threads = (int)ctx.njobs;
+
+    if(threads > 1 &&
+       (thds = (pthread_t *)malloc(sizeof(pthread_t) * (threads - 1)))) {
+        for(j = 0; j < threads - 1; ++j) {
+            if(pthread_create(&thds[j], NULL, &scan_thread, &ctx))
+                break;
+
+            ++started;
+        }
+    }
+
+    /* This thread pitches in too, and finishes up on its own if no others
+       could be started. */
+    scan_thread(&ctx);
+
+    for(j = 0; j < started; ++j) {
+        pthread_join(thds[j], NULL);
+    }
+
+    free(thds);
+    free(ctx.jobs);
+
+    /* Keep whatever was indexed from outside of this tree. */
+    for(i = 0; i < idx->count; ++i) {
+        ent = &idx->entries[i];
+
+        if(in_dir(ent->path, dir, dlen))
+            free(ent->path);
+        else
+            list.entries[list.count++] = *ent;
+    }
+
+    free(idx->entries);
+    idx->entries = list.entries;
+    idx->count = list.count;
+    qsort(idx->entries, idx->count, sizeof(romindex_entry_t), &entry_cmp);
+
+    return 0;
+}
+
+int romindex_save(const romindex_t *idx, const char *fn) {
+    FILE *fp;
+    uint8 rec[INDEX_REC_LEN];
+    const romindex_entry_t *ent;
+    char *tmpfn;
+    size_t len = strlen(fn) + 5, plen;
+    uint32 i;
+    int rv = 0;
+
+    /* Write to the side and move it into place, so a reader never sees half
+       of an index. */
+    if(!(tmpfn = (char *)malloc(len)))
+        return -1;
+
+    snprintf(tmpfn, len, "%s.tmp", fn);
+
+    if(!(fp = fopen(tmpfn, "wb"))) {
+        free(tmpfn);
+        return -1;
+    }
+
+    memset(rec, 0, INDEX_HDR_LEN);
+    UINT32_TO_BUF(INDEX_MAGIC, rec);
+    UINT16_TO_BUF(INDEX_VERSION, rec + 4);
+    UINT32_TO_BUF(idx->count, rec + 8);
+
+    if(fwrite(rec, 1, INDEX_HDR_LEN, fp) != INDEX_HDR_LEN)
+        rv = -1;
+
+    for(i = 0; i < idx->count && !rv; ++i) {
+        ent = &idx->entries[i];
+        plen = strlen(ent->path);
+
+        if(plen > 0xFFFF)
+            plen = 0xFFFF;
+
+        UINT32_TO_BUF((uint32)ent->size, rec);
+        UINT32_TO_BUF((uint32)(ent->size >> 32), rec + 4);
+        UINT32_TO_BUF((uint32)ent->mtime, rec + 8);
+        UINT32_TO_BUF((uint32)((uint64_t)ent->mtime >> 32), rec + 12);
+        UINT32_TO_BUF(ent->crc32, rec + 16);
+        UINT32_TO_BUF(ent->adler32, rec + 20);
+        UINT32_TO_BUF(ent->mapper, rec + 24);
+        rec[28] = (uint8)(int8)ent->console;
+        rec[29] = ent->region;
+        UINT16_TO_BUF((uint16)plen, rec + 30);
+        memcpy(rec + 32, ent->header, 16);
+
+        if(fwrite(rec, 1, INDEX_REC_LEN, fp) != INDEX_REC_LEN ||
+           fwrite(ent->path, 1, plen, fp) != plen)
+            rv = -1;
+    }
+
+    if(fclose(fp))
+        rv = -1;
+
+    if(!rv && rename(tmpfn, fn))
+        rv = -1;
+
+    if(rv)
+        remove(tmpfn);
+
+    free(tmpfn);
+    return rv;
+}
+
+int romindex_load(romindex_t *idx, const char *fn) {
+    FILE *fp;
+    uint8 *buf = NULL, *ptr, *end;
+    romindex_entry_t *ent;
+    long len;
+    uint32 magic, count, lo, hi, i;
+    uint16 ver, plen;
+
+    memset(idx, 0, sizeof(romindex_t));
+
+    if(!(fp = fopen(fn, "rb")))
+        return -1;
+
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if(len < INDEX_HDR_LEN || !(buf = (uint8 *)malloc(len)) ||
+       fread(buf, 1, len, fp) != (size_t)len) {
+        free(buf);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+
+    BUF_TO_UINT32(buf, magic);
+    BUF_TO_UINT16(buf + 4, ver);
+    BUF_TO_UINT32(buf + 8, count);
+
+    if(magic != INDEX_MAGIC || ver != INDEX_VERSION ||
+       count > (uint32)(len / INDEX_REC_LEN))
+        goto err;
+
+    if(count && !(idx->entries = (romindex_entry_t *)
+                  calloc(count, sizeof(romindex_entry_t))))
+        goto err;
+
+    ptr = buf + INDEX_HDR_LEN;
+    end = buf + len;
+
+    for(i = 0; i < count; ++i) {
+        if(end - ptr < INDEX_REC_LEN)
+            goto err;
+
+        BUF_TO_UINT16(ptr + 30, plen);
+
+        if(end - ptr - INDEX_REC_LEN < plen)
+            goto err;
+
+        ent = &idx->entries[i];
+
+        if(!(ent->path = (char *)malloc(plen + 1)))
+            goto err;
+
+        memcpy(ent->path, ptr + INDEX_REC_LEN, plen);
+        ent->path[plen] = 0;
+        ++idx->count;
+
+        BUF_TO_UINT32(ptr, lo);
+        BUF_TO_UINT32(ptr + 4, hi);
+        ent->size = ((uint64_t)hi << 32) | lo;
+        BUF_TO_UINT32(ptr + 8, lo);
+        BUF_TO_UINT32(ptr + 12, hi);
+        ent->mtime = (int64_t)(((uint64_t)hi << 32) | lo);
+        BUF_TO_UINT32(ptr + 16, ent->crc32);
+        BUF_TO_UINT32(ptr + 20, ent->adler32);
+        BUF_TO_UINT32(ptr + 24, ent->mapper);
+        ent->console = (int8)ptr[28];
+        ent->region = ptr[29];
+        memcpy(ent->header, ptr + 32, 16);
+
+        ptr += INDEX_REC_LEN + plen;
+    }
+
+    free(buf);
+
+    /* Should already be in order, but don't count on it. */
+    qsort(idx->entries, idx->count, sizeof(romindex_entry_t), &entry_cmp);
+    return 0;
+
+err:
+    free(buf);
+    romindex_free(idx);
+    return -1;
+}
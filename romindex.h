@@ -0,0 +1,81 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ROMINDEX_H
+#define ROMINDEX_H
+
+#include "CrabEmu.h"
+
+CLINKAGE
+
+/* What's known about one file in a ROM library. The checksums are over the
+   same bytes the console's own loader checksums (so the PRG for NES games,
+   and the image without any SMD header for Sega games), and so can be used
+   to look things up the same way. */
+typedef struct romindex_entry {
+    char *path;
+    uint64_t size;
+    int64_t mtime;
+
+    /* CONSOLE_* value, or -1 for files that aren't a ROM for anything we
+       know about. Those are kept too, so they don't get looked at again. */
+    int console;
+
+    uint32 crc32;
+    uint32 adler32;
+
+    /* SMS_MAPPER_* value for Sega consoles, the iNES mapper number for NES
+       games, or (uint32)-1 if there's no such thing. */
+    uint32 mapper;
+
+    /* Region code from the Sega header, or the TV system bit from the iNES
+       header. The header itself is kept as is, or is all zero if there wasn't
+       one. */
+    uint8 region;
+    uint8 header[16];
+} romindex_entry_t;
+
+typedef struct romindex {
+    romindex_entry_t *entries;          /* Sorted by path */
+    uint32 count;
+
+    /* How many files the last romindex_scan() had to look at, and how many it
+       was able to take from what was already in the index. */
+    uint32 scanned;
+    uint32 reused;
+} romindex_t;
+
+/* Read an index written by romindex_save(). On failure (including the file not
+   existing), the index is left empty and -1 is returned. */
+extern int romindex_load(romindex_t *idx, const char *fn);
+extern int romindex_save(const romindex_t *idx, const char *fn);
+
+/* Walk the directory tree at dir, updating the index to match it. Only files
+   whose size or modification time differ from what's in the index get read.
+   Entries for files outside of dir are left alone. threads <= 0 means one per
+   CPU. */
+extern int romindex_scan(romindex_t *idx, const char *dir, int threads);
+
+extern const romindex_entry_t *romindex_find(const romindex_t *idx,
+                                             const char *path);
+extern void romindex_free(romindex_t *idx);
+
+ENDCLINK
+
+#endif /* !ROMINDEX_H */
@@ -0,0 +1,118 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2 
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audioring.h"
+
+/* Each side publishes its counter with a release store and reads the other
+   side's with an acquire load, so the samples are visible before the count
+   that covers them. */
+#define LOAD_ACQ(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define LOAD_OWN(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+
+int audioring_init(audioring_t *ring, uint32 size, uint32 slack) {
+    if(!size || (size & (size - 1)) || slack > size) {
+#ifdef DEBUG
+        fprintf(stderr, "audioring_init: bad size %u\n", (unsigned)size);
+#endif
+        return -1;
+    }
+
+    ring->buf = (int16 *)calloc(size + slack, sizeof(int16));
+    if(!ring->buf) {
+#ifdef DEBUG
+        fprintf(stderr, "audioring_init: out of memory\n");
+#endif
+        return -1;
+    }
+
+    ring->size = size;
+    ring->slack = slack;
+    ring->head = ring->tail = 0;
+
+    return 0;
+}
+
+void audioring_destroy(audioring_t *ring) {
+    free(ring->buf);
+    ring->buf = NULL;
+    ring->size = ring->slack = 0;
+}
+
+uint32 audioring_used(audioring_t *ring) {
+    return LOAD_ACQ(&ring->head) - LOAD_ACQ(&ring->tail);
+}
+
+int16 *audioring_reserve(audioring_t *ring, uint32 count) {
+    uint32 head = LOAD_OWN(&ring->head);
+
+    if(count > ring->slack ||
+       head - LOAD_ACQ(&ring->tail) + count > ring->size)
+        return NULL;
+
+    return ring->buf + (head & (ring->size - 1));
+}
+
+void audioring_commit(audioring_t *ring, uint32 count) {
+    uint32 head = LOAD_OWN(&ring->head);
+    uint32 pos = head & (ring->size - 1);
+
+    /* Move anything written past the end back around to the start. */
+    if(pos + count > ring->size)
+        memcpy(ring->buf, ring->buf + ring->size,
+               (pos + count - ring->size) * sizeof(int16));
+
+    STORE_REL(&ring->head, head + count);
+}
+
+uint32 audioring_read(audioring_t *ring, int16 *out, uint32 count) {
+    uint32 tail = LOAD_OWN(&ring->tail);
+    uint32 avail = LOAD_ACQ(&ring->head) - tail;
+    uint32 pos = tail & (ring->size - 1), first;
+
+    if(count > avail)
+        count = avail;
+
+    first = ring->size - pos;
+    if(first >= count) {
+        memcpy(out, ring->buf + pos, count * sizeof(int16));
+    }
+    else {
+        memcpy(out, ring->buf + pos, first * sizeof(int16));
+        memcpy(out + first, ring->buf, (count - first) * sizeof(int16));
+    }
+
+    STORE_REL(&ring->tail, tail + count);
+    return count;
+}
+
+uint32 audioring_skip(audioring_t *ring, uint32 count) {
+    uint32 tail = LOAD_OWN(&ring->tail);
+    uint32 avail = LOAD_ACQ(&ring->head) - tail;
+
+    if(count > avail)
+        count = avail;
+
+    STORE_REL(&ring->tail, tail + count);
+    return count;
+}
@@ -0,0 +1,65 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2 
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef AUDIORING_H
+#define AUDIORING_H
+
+#include "CrabEmu.h"
+
+CLINKAGE
+
+/* Single-producer, single-consumer ring of int16 samples. The emulation
+   thread is the only one that may reserve/commit, and the audio callback the
+   only one that may read/skip, and neither side takes a lock.
+
+   The buffer has some slack past its end so that every reservation is
+   contiguous. Whatever lands in the slack gets copied to the start of the
+   buffer on commit. */
+typedef struct audioring_struct {
+    int16 *buf;
+    uint32 size;
+    uint32 slack;
+
+    /* Running sample counts. head only ever changes on the producer side, and
+       tail only on the consumer side. */
+    uint32 head;
+    uint32 tail;
+} audioring_t;
+
+/* size must be a power of two. slack is the largest single reservation. */
+int audioring_init(audioring_t *ring, uint32 size, uint32 slack);
+void audioring_destroy(audioring_t *ring);
+
+/* Samples that have been committed but not read. Safe from either side. */
+uint32 audioring_used(audioring_t *ring);
+
+/* Producer side. Returns room for count samples, or NULL if the consumer
+   hasn't made that much space yet. Commit may be for fewer samples than were
+   reserved. */
+int16 *audioring_reserve(audioring_t *ring, uint32 count);
+void audioring_commit(audioring_t *ring, uint32 count);
+
+/* Consumer side. Read copies out up to count samples and returns how many it
+   got. Skip drops up to count samples. */
+uint32 audioring_read(audioring_t *ring, int16 *out, uint32 count);
+uint32 audioring_skip(audioring_t *ring, uint32 count);
+
+ENDCLINK
+
+#endif /* !AUDIORING_H */
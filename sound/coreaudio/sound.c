@@ -28,10 +28,13 @@
 
 #include "CrabEmu.h"
 #include "sound.h"
+#include "audioring.h"
 
 #define FRAMES_TO_BUFFER    4
 #define FRAME_LOW_HALF      (FRAMES_TO_BUFFER / 2)
-#define SAMPLE_RATE         44100
+
+/* Used if the device won't say what rate it runs at. */
+#define DEFAULT_RATE        48000
 
 #ifndef __MAC_OS_X_VERSION_10_6
 #define __MAC_OS_X_VERSION_10_6 1060
@@ -49,88 +52,81 @@ typedef AudioComponentDescription ComponentDescription;
 
 #define UNUSED __UNUSED__
 
-static const UInt32 NTSC_SAMPLES_PER_FRAME = 735;  /* SAMPLE_RATE / 60 */
-static const UInt32 PAL_SAMPLES_PER_FRAME = 882;   /* SAMPLE_RATE / 50 */
-
 static AudioUnit outputAU;
-static unsigned char *buffer;
-static UInt32 buffer_size;
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static UInt32 read_pos, write_pos;
+static audioring_t ring;
 static int paused = 0;
 static semaphore_t sem;
 static UInt32 samples_consumed = 0, samples_per_frame;
 static int initted = 0;
 
+/* What sound_reserve() handed out, and where samples go when the ring is
+   full. */
+static int16 *reserved;
+static int16 overflow[SOUND_RESERVE_MAX >> 1];
+
+/* The callback plays silence until the ring holds FRAME_LOW_HALF frames, so
+   there's a cushion against the emulation thread running late. primed is only
+   touched by the callback. */
+static int primed = 0;
+
+/* Set by sound_reset_buffer() to have the callback drop everything committed
+   before flush_to. */
+static int flush_req = 0;
+static uint32 flush_to;
+
 static OSStatus sound_callback(void *inRefCon UNUSED,
                                AudioUnitRenderActionFlags *ioActionFlags UNUSED,
                                const AudioTimeStamp *inTimeStamp UNUSED,
                                UInt32 inBusNumber UNUSED,
                                UInt32 inNumFrames UNUSED,
                                AudioBufferList *ioData) {
-    UInt32 len = ioData->mBuffers[0].mDataByteSize, len2;
-    void *ptr = ioData->mBuffers[0].mData;
-
-    pthread_mutex_lock(&mutex);
+    UInt32 len = ioData->mBuffers[0].mDataByteSize >> 1, got = 0;
+    int16 *ptr = (int16 *)ioData->mBuffers[0].mData;
 
-    if(paused) {
-        memset(ptr, 0, len);
-    }
-    else if((read_pos + len > write_pos && write_pos > read_pos)) {
-        memset(ptr, 0, len);
-        samples_consumed += len / 2;
+    if(__atomic_load_n(&flush_req, __ATOMIC_ACQUIRE)) {
+        audioring_skip(&ring, flush_to - ring.tail);
+        primed = 0;
+        __atomic_store_n(&flush_req, 0, __ATOMIC_RELEASE);
     }
-    else {
-        samples_consumed += len / 2;
-
-        if(read_pos + len > buffer_size) {
-            len2 = buffer_size - read_pos;
-            len -= len2;
-
-            memcpy(ptr, buffer + read_pos, len2);
-            memcpy(ptr + len2, buffer, len);
-            read_pos = len;
-        }
-        else {
-            memcpy(ptr, buffer + read_pos, len);
-            read_pos += len;
-
-            if(read_pos == buffer_size)
-                read_pos = 0;
-        }
+
+    if(!primed &&
+       audioring_used(&ring) >= samples_per_frame * FRAME_LOW_HALF)
+        primed = 1;
+
+    if(!paused) {
+        if(primed)
+            got = audioring_read(&ring, ptr, len);
+
+        samples_consumed += len;
     }
 
+    /* Whatever we didn't have gets silence. */
+    if(got < len)
+        memset(ptr + got, 0, (len - got) << 1);
+
     /* See if we need to increment our semaphore */
     while(samples_consumed > samples_per_frame) {
         semaphore_signal(sem);
         samples_consumed -= samples_per_frame;
     }
 
-    pthread_mutex_unlock(&mutex);
-
     return noErr;
 }
 
-void sound_update_buffer(signed short *buf, int length) {
-    pthread_mutex_lock(&mutex);
-
-    if(write_pos + length > buffer_size) {
-        int l1, l2;
+int16 *sound_dev_reserve(int length) {
+    reserved = initted ? audioring_reserve(&ring, length >> 1) : NULL;
 
-        l1 = buffer_size - write_pos;
-        l2 = length - l1;
+    if(!reserved)
+        return overflow;
 
-        memcpy(buffer + write_pos, buf, l1);
-        memcpy(buffer, ((unsigned char *)buf) + l1, l2);
+    return reserved;
+}
 
-        write_pos = l2;
-    }
-    else {
-        memcpy(buffer + write_pos, buf, length);
-        write_pos += length;
-    }
+void sound_dev_commit(int length) {
+    if(reserved)
+        audioring_commit(&ring, length >> 1);
 
-    pthread_mutex_unlock(&mutex);
+    reserved = NULL;
 }
 
 int sound_init(int channels, int region) {
@@ -140,24 +136,11 @@ int sound_init(int channels, int region) {
     Component comp;
     AURenderCallbackStruct callback;
     UInt32 bufsz;
-    int rv = 0;
+    int rv = 0, rate;
 
     if(initted)
         return 0;
 
-    /* Figure out how big our internal buffer will be */
-    if(region == VIDEO_NTSC)
-        samples_per_frame = NTSC_SAMPLES_PER_FRAME * channels;
-    else
-        samples_per_frame = PAL_SAMPLES_PER_FRAME * channels;
-
-    buffer_size = samples_per_frame * FRAMES_TO_BUFFER * 2;
-
-    /* Allocate our buffer */
-    buffer = calloc(buffer_size, 1);
-    read_pos = 0;
-    write_pos = samples_per_frame * FRAME_LOW_HALF * 2;
-
     /* Find the default audio output unit */
     desc.componentType = kAudioUnitType_Output;
     desc.componentSubType = kAudioUnitSubType_DefaultOutput;
@@ -180,12 +163,47 @@ int sound_init(int channels, int region) {
         goto err1;
     }
 
-    /* Set up the AudioStreamBasicDescription - 16-bit Stereo PCM @ 44100Hz */
+    /* Feed the device at the rate it already runs at, so the samples only get
+       resampled once, by us, rather than again by the system. */
+    bufsz = sizeof(basic_desc);
+    error = AudioUnitGetProperty(outputAU, kAudioUnitProperty_StreamFormat,
+                                 kAudioUnitScope_Output, 0, &basic_desc,
+                                 &bufsz);
+
+    if(error != noErr || basic_desc.mSampleRate < 8000.0)
+        rate = DEFAULT_RATE;
+    else
+        rate = (int)basic_desc.mSampleRate;
+
+    if(sound_output_init(channels, rate)) {
+        rv = -12;
+        goto err2;
+    }
+
+    /* Figure out how big our internal buffer will be */
+    if(region == VIDEO_NTSC)
+        samples_per_frame = (rate / 60) * channels;
+    else
+        samples_per_frame = (rate / 50) * channels;
+
+    /* Set up the ring, with enough slack for the biggest reservation. */
+    bufsz = SOUND_RESERVE_MAX >> 1;
+    while(bufsz < samples_per_frame * FRAMES_TO_BUFFER)
+        bufsz <<= 1;
+
+    if(audioring_init(&ring, bufsz, SOUND_RESERVE_MAX >> 1)) {
+        rv = -11;
+        goto err2;
+    }
+
+    primed = flush_req = 0;
+
+    /* Set up the AudioStreamBasicDescription - 16-bit PCM at that rate */
     basic_desc.mFormatID = kAudioFormatLinearPCM;
     basic_desc.mFormatFlags = kLinearPCMFormatFlagIsPacked | 
         kLinearPCMFormatFlagIsSignedInteger | kAudioFormatFlagsNativeEndian;
     basic_desc.mChannelsPerFrame = channels;
-    basic_desc.mSampleRate = SAMPLE_RATE;
+    basic_desc.mSampleRate = rate;
     basic_desc.mBitsPerChannel = 16;
     basic_desc.mFramesPerPacket = 1;
     basic_desc.mBytesPerFrame = 2 * channels;
@@ -198,7 +216,7 @@ int sound_init(int channels, int region) {
 
     if(error != noErr) {
         rv = -3;
-        goto err2;
+        goto err3;
     }
 
     /* Set the callback for getting sound data. */
@@ -211,7 +229,7 @@ int sound_init(int channels, int region) {
 
     if(error != noErr) {
         rv = -4;
-        goto err2;
+        goto err3;
     }
 
     bufsz = 512;
@@ -222,7 +240,7 @@ int sound_init(int channels, int region) {
 
     if(error != noErr) {
         rv = -7;
-        goto err3;
+        goto err4;
     }
 
     /* Initialize the Audio Unit for our use now that its set up. */
@@ -230,14 +248,14 @@ int sound_init(int channels, int region) {
 
     if(error != noErr) {
         rv = -8;
-        goto err3;
+        goto err4;
     }
 
     /* Create the semaphore */
     if(semaphore_create(mach_task_self(), &sem, SYNC_POLICY_FIFO,
                         FRAME_LOW_HALF)) {
         rv = -10;
-        goto err4;
+        goto err5;
     }
 
     /* Pause the audio output... */
@@ -248,7 +266,7 @@ int sound_init(int channels, int region) {
 
     if(error != noErr) {
         rv = -9;
-        goto err5;
+        goto err6;
     }
 
     initted = 1;
@@ -257,13 +275,13 @@ int sound_init(int channels, int region) {
 
     /* Error conditions. Errors cause cascading deinitialization, so hence this
        chain of labels. */
-err5:
+err6:
     semaphore_destroy(mach_task_self(), sem);
 
-err4:
+err5:
     AudioUnitUninitialize(outputAU);
 
-err3:
+err4:
     callback.inputProc = NULL;
     callback.inputProcRefCon = NULL;
 
@@ -271,7 +289,11 @@ err3:
                          kAudioUnitScope_Input, 0, &callback,
                          sizeof(callback));
 
+err3:
+    audioring_destroy(&ring);
+
 err2:
+    sound_output_shutdown();
     CloseComponent(outputAU);
 
 err1:
@@ -304,8 +326,8 @@ void sound_shutdown(void) {
     /* Clean up the semaphore */
     semaphore_destroy(mach_task_self(), sem);
 
-    free(buffer);
-    buffer = NULL;
+    audioring_destroy(&ring);
+    sound_output_shutdown();
 
     initted = 0;
 }
@@ -314,9 +336,11 @@ void sound_reset_buffer(void) {
     if(!initted)
         return;
 
-    read_pos = 0;
-    write_pos = samples_per_frame * FRAME_LOW_HALF * 2;
-    memset(buffer, 0, buffer_size);
+    sound_output_reset();
+
+    /* The callback owns the read side, so ask it to drop what's there. */
+    flush_to = ring.head;
+    __atomic_store_n(&flush_req, 1, __ATOMIC_RELEASE);
 }
 
 void sound_pause() {
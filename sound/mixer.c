@@ -0,0 +1,278 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2 
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <string.h>
+
+#include "mixer.h"
+
+/* Adding each stream in and clamping the result can be done 4 frames at a time
+   with SSE4.1, where the CPU has it. */
+#if !defined(_arch_dreamcast) && defined(__x86_64__) && defined(__GNUC__) && \
+    !defined(CRABEMU_NO_SSE41)
+#define MIXER_SSE41
+#include <immintrin.h>
+
+static int use_sse41;
+#endif
+
+/* Frames mixed at a time. The accumulators for a chunk stay in cache while
+   each stream is added in. */
+#define MIXER_CHUNK         256
+#define GAIN_SHIFT          12
+
+void mixer_init(mixer_t *mix, int channels) {
+    memset(mix, 0, sizeof(mixer_t));
+    mix->channels = channels;
+
+#ifdef MIXER_SSE41
+    __builtin_cpu_init();
+    use_sse41 = __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+int mixer_add_stream(mixer_t *mix, int type) {
+    mixer_stream_t *s;
+
+    if(mix->count == MIXER_MAX_STREAMS)
+        return -1;
+
+    s = &mix->stream[mix->count];
+    s->type = type;
+    s->gain[0] = s->gain[1] = MIXER_UNITY;
+
+    return mix->count++;
+}
+
+void mixer_set_gain(mixer_t *mix, int stream, float gain, float pan) {
+    mixer_stream_t *s = &mix->stream[stream];
+
+    if(gain < 0.0f)
+        gain = 0.0f;
+    else if(gain > 4.0f)
+        gain = 4.0f;
+
+    if(pan < -1.0f)
+        pan = -1.0f;
+    else if(pan > 1.0f)
+        pan = 1.0f;
+
+    /* Balance style panning: the center leaves both sides alone. */
+    s->gain[0] = (int32)(gain * (pan > 0.0f ? 1.0f - pan : 1.0f) *
+                         MIXER_UNITY + 0.5f);
+    s->gain[1] = (int32)(gain * (pan < 0.0f ? 1.0f + pan : 1.0f) *
+                         MIXER_UNITY + 0.5f);
+}
+
+static void add_stereo(int32 *acc, const mixer_stream_t *s, const int16 *in,
+                       int n) {
+    int32 gl = s->gain[0], gr = s->gain[1];
+    int i;
+
+    switch(s->type) {
+        case MIXER_MONO:
+            for(i = 0; i < n; ++i) {
+                acc[i << 1] += (in[i] * gl) >> GAIN_SHIFT;
+                acc[(i << 1) + 1] += (in[i] * gr) >> GAIN_SHIFT;
+            }
+            break;
+
+        case MIXER_STEREO:
+            for(i = 0; i < n; ++i) {
+                acc[i << 1] += (in[i << 1] * gl) >> GAIN_SHIFT;
+                acc[(i << 1) + 1] += (in[(i << 1) + 1] * gr) >> GAIN_SHIFT;
+            }
+            break;
+
+        case MIXER_SUM:
+            for(i = 0; i < n; ++i) {
+                int32 x = in[i << 1] + in[(i << 1) + 1];
+                acc[i << 1] += (x * gl) >> GAIN_SHIFT;
+                acc[(i << 1) + 1] += (x * gr) >> GAIN_SHIFT;
+            }
+            break;
+    }
+}
+
+static void add_mono(int32 *acc, const mixer_stream_t *s, const int16 *in,
+                     int n) {
+    int32 g = s->gain[0];
+    int i;
+
+    switch(s->type) {
+        case MIXER_MONO:
+            for(i = 0; i < n; ++i) {
+                acc[i] += (in[i] * g) >> GAIN_SHIFT;
+            }
+            break;
+
+        case MIXER_STEREO:
+            for(i = 0; i < n; ++i) {
+                acc[i] += ((in[i << 1] + in[(i << 1) + 1]) * g) >>
+                    (GAIN_SHIFT + 1);
+            }
+            break;
+
+        case MIXER_SUM:
+            for(i = 0; i < n; ++i) {
+                acc[i] += ((in[i << 1] + in[(i << 1) + 1]) * g) >> GAIN_SHIFT;
+            }
+            break;
+    }
+}
+
+#ifdef MIXER_SSE41
+/* Add the first n frames of a stream in, n being a multiple of 4. Two
+   channels that are played as one are summed with pmaddwd. Returns the number
+   of frames done. */
+__attribute__((target("sse4.1")))
+static int add_sse41(int32 *acc, const mixer_stream_t *s, const int16 *in,
+                     int n, int ch) {
+    __m128i g, x, v, lo, hi, a, ones = _mm_set1_epi16(1);
+    int i, shift = GAIN_SHIFT;
+
+    if(ch == 2)
+        g = _mm_setr_epi32(s->gain[0], s->gain[1], s->gain[0], s->gain[1]);
+    else
+        g = _mm_set1_epi32(s->gain[0]);
+
+    if(ch == 1 && s->type == MIXER_STEREO)
+        shift = GAIN_SHIFT + 1;
+
+    for(i = 0; i < n; i += 4) {
+        /* Get the four frames as 32-bit samples. */
+        if(s->type == MIXER_MONO) {
+            x = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(in + i)));
+        }
+        else {
+            v = _mm_loadu_si128((const __m128i *)(in + (i << 1)));
+
+            if(ch == 2 && s->type == MIXER_STEREO) {
+                lo = _mm_cvtepi16_epi32(v);
+                hi = _mm_cvtepi16_epi32(_mm_srli_si128(v, 8));
+                a = _mm_loadu_si128((const __m128i *)(acc + (i << 1)));
+                a = _mm_add_epi32(a, _mm_srai_epi32(_mm_mullo_epi32(lo, g),
+                                                    shift));
+                _mm_storeu_si128((__m128i *)(acc + (i << 1)), a);
+                a = _mm_loadu_si128((const __m128i *)(acc + (i << 1) + 4));
+                a = _mm_add_epi32(a, _mm_srai_epi32(_mm_mullo_epi32(hi, g),
+                                                    shift));
+                _mm_storeu_si128((__m128i *)(acc + (i << 1) + 4), a);
+                continue;
+            }
+
+            x = _mm_madd_epi16(v, ones);
+        }
+
+        if(ch == 2) {
+            lo = _mm_unpacklo_epi32(x, x);
+            hi = _mm_unpackhi_epi32(x, x);
+            a = _mm_loadu_si128((const __m128i *)(acc + (i << 1)));
+            a = _mm_add_epi32(a, _mm_srai_epi32(_mm_mullo_epi32(lo, g), shift));
+            _mm_storeu_si128((__m128i *)(acc + (i << 1)), a);
+            a = _mm_loadu_si128((const __m128i *)(acc + (i << 1) + 4));
+            a = _mm_add_epi32(a, _mm_srai_epi32(_mm_mullo_epi32(hi, g), shift));
+            _mm_storeu_si128((__m128i *)(acc + (i << 1) + 4), a);
+        }
+        else {
+            a = _mm_loadu_si128((const __m128i *)(acc + i));
+            a = _mm_add_epi32(a, _mm_srai_epi32(_mm_mullo_epi32(x, g), shift));
+            _mm_storeu_si128((__m128i *)(acc + i), a);
+        }
+    }
+
+    return n;
+}
+
+/* packssdw saturates to 16 bits, which is just the clamp that's needed. Does
+   the first n samples, n being a multiple of 8. */
+__attribute__((target("sse4.1")))
+static void clamp_sse41(int16 *out, const int32 *acc, int n) {
+    __m128i a, b;
+    int j;
+
+    for(j = 0; j < n; j += 8) {
+        a = _mm_loadu_si128((const __m128i *)(acc + j));
+        b = _mm_loadu_si128((const __m128i *)(acc + j + 4));
+        _mm_storeu_si128((__m128i *)(out + j), _mm_packs_epi32(a, b));
+    }
+}
+#endif
+
+void mixer_run(mixer_t *mix, int16 *out, int16 *const in[], int samples) {
+    int32 acc[MIXER_CHUNK << 1];
+    int i, j, n, width, done, pos = 0;
+    int ch = mix->channels;
+    const mixer_stream_t *s;
+
+    /* A lone stream at unity gain mixed onto itself is already done. */
+    if(mix->count == 1 && in[0] == out &&
+       mix->stream[0].gain[0] == MIXER_UNITY &&
+       mix->stream[0].gain[1] == MIXER_UNITY &&
+       (mix->stream[0].type == MIXER_MONO) == (ch == 1))
+        return;
+
+    while(pos < samples) {
+        n = samples - pos;
+        if(n > MIXER_CHUNK)
+            n = MIXER_CHUNK;
+
+        memset(acc, 0, sizeof(int32) * n * ch);
+
+        for(i = 0; i < mix->count; ++i) {
+            if(!in[i])
+                continue;
+
+            s = &mix->stream[i];
+            width = (s->type == MIXER_MONO) ? 1 : 2;
+            done = 0;
+
+#ifdef MIXER_SSE41
+            if(use_sse41)
+                done = add_sse41(acc, s, in[i] + pos * width, n & ~3, ch);
+#endif
+
+            if(ch == 2)
+                add_stereo(acc + (done << 1), s, in[i] + (pos + done) * width,
+                           n - done);
+            else
+                add_mono(acc + done, s, in[i] + (pos + done) * width,
+                         n - done);
+        }
+
+        j = 0;
+
+#ifdef MIXER_SSE41
+        if(use_sse41) {
+            j = (n * ch) & ~7;
+            clamp_sse41(out + pos * ch, acc, j);
+        }
+#endif
+
+        for(; j < n * ch; ++j) {
+            if(acc[j] > 32767)
+                out[pos * ch + j] = 32767;
+            else if(acc[j] < -32768)
+                out[pos * ch + j] = -32768;
+            else
+                out[pos * ch + j] = (int16)acc[j];
+        }
+
+        pos += n;
+    }
+}
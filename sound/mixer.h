@@ -0,0 +1,66 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2 
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "CrabEmu.h"
+
+CLINKAGE
+
+#define MIXER_MAX_STREAMS   4
+
+/* Stream layouts. MIXER_SUM is two interleaved channels that get played as
+   one, like the YM2413's melody and rhythm outputs. */
+#define MIXER_MONO          0
+#define MIXER_STEREO        1
+#define MIXER_SUM           2
+
+/* Gains are fixed point, with this being 1.0. */
+#define MIXER_UNITY         4096
+
+typedef struct mixer_stream {
+    int type;
+    int32 gain[2];
+} mixer_stream_t;
+
+typedef struct mixer_struct {
+    int channels;
+    int count;
+    mixer_stream_t stream[MIXER_MAX_STREAMS];
+} mixer_t;
+
+void mixer_init(mixer_t *mix, int channels);
+
+/* Returns the new stream's index (streams are passed to mixer_run() in the
+   order they were added), or -1 if there's no room. */
+int mixer_add_stream(mixer_t *mix, int type);
+
+/* gain is linear, 1.0 leaves the stream as is, and is limited to 4.0. pan runs
+   from -1.0 (left only) to 1.0 (right only). */
+void mixer_set_gain(mixer_t *mix, int stream, float gain, float pan);
+
+/* Mix samples frames from each stream in in[] (NULL for a stream that's
+   silent) into out, saturating instead of wrapping. out may be the same buffer
+   as an input that has as many channels as the output. */
+void mixer_run(mixer_t *mix, int16 *out, int16 *const in[], int samples);
+
+ENDCLINK
+
+#endif /* !MIXER_H */
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "nes_apu.h"
+#include "nes_apu_tab.h"
 
 #include "nes.h"
 
@@ -41,9 +42,11 @@ static int32 decay_lut[16];
 static int vbl_lut[32];
 static int trilength_lut[128];
 
-/* noise lookups for both modes */
+/* step_kernel and noise_long_lut are generated by tools/gentables.c, and
+** come from nes_apu_tab.h. The short noise gets rebuilt as it's used, since
+** it depends on where the shift register was left.
+*/
 #ifndef REALTIME_NOISE
-static int8 noise_long_lut[APU_NOISE_32K];
 static int8 noise_short_lut[APU_NOISE_93];
 #endif /* !REALTIME_NOISE */
 
@@ -177,37 +180,85 @@ INLINE int8 shift_register15(uint8 xor_tap)
    return (bit0 ^ 1);
 }
 #else
+/* Only the short (93 step) series is made here. The 32K one goes all the way
+** around, leaving sreg where it started, so it's a constant table.
+*/
 static void shift_register15(int8 *buf, int count)
 {
    static int sreg = 0x4000;
-   int bit0, bit1, bit6, bit14;
+   int bit0, bit6, bit14;
 
-   if (count == APU_NOISE_93)
+   while (count--)
    {
-      while (count--)
-      {
-         bit0 = sreg & 1;
-         bit6 = (sreg & 0x40) >> 6;
-         bit14 = (bit0 ^ bit6);
-         sreg >>= 1;
-         sreg |= (bit14 << 14);
-         *buf++ = bit0 ^ 1;
-      }
+      bit0 = sreg & 1;
+      bit6 = (sreg & 0x40) >> 6;
+      bit14 = (bit0 ^ bit6);
+      sreg >>= 1;
+      sreg |= (bit14 << 14);
+      *buf++ = bit0 ^ 1;
    }
-   else /* 32K noise */
+}
+#endif
+
+/* Where within the current sample a channel's phase accumulator ran out.
+** phaseacc has just had this sample's cycles taken off, so it's the number
+** of cycles (negative, 16.16) from the end of the sample back to the step.
+*/
+INLINE int32 apu_steptime(int32 phaseacc)
+{
+   int32 t = phaseacc + apu->cycle_rate;
+
+   if (t <= 0)
+      return 0;
+
+   t = (int32) (((uint64_t) t * apu->cycle_rate_inv) >> 16);
+   return (t > 0xFFFF) ? 0xFFFF : t;
+}
+
+/* add a level change at sub-sample time t (16 bit fraction) */
+static void apu_step(int32 t, int32 delta)
+{
+   const int16 *kernel = step_kernel[t >> (16 - 5)];
+   int32 *buf = apu->step_buf;
+   int pos = apu->step_pos;
+   int32 part, sum = 0;
+   int i;
+
+   for (i = 0; i < APU_STEP_TAPS; i++)
    {
-      while (count--)
-      {
-         bit0 = sreg & 1;
-         bit1 = (sreg & 2) >> 1;
-         bit14 = (bit0 ^ bit1);
-         sreg >>= 1;
-         sreg |= (bit14 << 14);
-         *buf++ = bit0 ^ 1;
-      }
+      part = (delta * kernel[i]) >> 15;
+      buf[(pos + i) & APU_STEP_MASK] += part;
+      sum += part;
    }
+
+   /* make sure the whole step lands, so the integrator can't drift */
+   buf[(pos + APU_STEP_TAPS / 2) & APU_STEP_MASK] += delta - sum;
+}
+
+INLINE void apu_setlevel(int32 *cur, int32 level, int32 t)
+{
+   if (level != *cur)
+   {
+      apu_step(t, level - *cur);
+      *cur = level;
+   }
+}
+
+/* integrate the step buffer for one output sample, and take the DC off */
+INLINE int32 apu_readsteps(void)
+{
+   int pos = apu->step_pos & APU_STEP_MASK;
+   int32 out;
+
+   apu->step_sum += apu->step_buf[pos];
+   apu->step_buf[pos] = 0;
+   apu->step_pos++;
+
+   out = apu->step_sum - (apu->step_hp >> 10);
+   apu->step_hp += out;
+
+   return out;
 }
-#endif
 
 /* RECTANGLE WAVE
 ** ==============
@@ -216,20 +267,15 @@ static void shift_register15(int8 *buf, int count)
 ** reg2: 8 bits of freq
 ** reg3: 0-2=high freq, 7-4=vbl length counter
 */
-#define  APU_RECTANGLE_OUTPUT chan->output_vol
 static int32 apu_rectangle(rectangle_t *chan)
 {
    int32 output;
 
-#ifdef APU_OVERSAMPLE
-   int num_times;
-   int32 total;
-#endif
-
-   APU_VOLUME_DECAY(chan->output_vol);
-
    if (FALSE == chan->enabled || 0 == chan->vbl_length)
-      return APU_RECTANGLE_OUTPUT;
+   {
+      apu_setlevel(&chan->level, 0, 0);
+      return 0;
+   }
 
    /* vbl length counter */
    if (FALSE == chan->holdnote)
@@ -249,7 +295,10 @@ static int32 apu_rectangle(rectangle_t *chan)
 
    if ((FALSE == chan->sweep_inc && chan->freq > chan->freq_limit)
        || chan->freq < APU_TO_FIXED(4))
-      return APU_RECTANGLE_OUTPUT;
+   {
+      apu_setlevel(&chan->level, 0, 0);
+      return 0;
+   }
 
    /* frequency sweeping at a rate of (sweep_delay + 1) / 120 secs */
    if (chan->sweep_on && chan->sweep_shifts)
@@ -267,47 +316,26 @@ static int32 apu_rectangle(rectangle_t *chan)
 
    chan->phaseacc -= apu->cycle_rate; /* # of cycles per sample */
    if (chan->phaseacc >= 0)
-      return APU_RECTANGLE_OUTPUT;
-
-#ifdef APU_OVERSAMPLE
-   num_times = total = 0;
+      return 0;
 
    if (chan->fixed_envelope)
       output = chan->volume << 8; /* fixed volume */
    else
       output = (chan->env_vol ^ 0x0F) << 8;
-#endif
 
+   /* put each edge of the wave into the step buffer where it happened */
    while (chan->phaseacc < 0)
    {
+      int32 t = apu_steptime(chan->phaseacc);
+
       chan->phaseacc += chan->freq;
       chan->adder = (chan->adder + 1) & 0x0F;
 
-#ifdef APU_OVERSAMPLE
-      if (chan->adder < chan->duty_flip)
-         total += output;
-      else
-         total -= output;
-
-      num_times++;
-#endif
+      apu_setlevel(&chan->level,
+                   (chan->adder < chan->duty_flip) ? output : -output, t);
    }
 
-#ifdef APU_OVERSAMPLE
-   chan->output_vol = total / num_times;
-#else
-   if (chan->fixed_envelope)
-      output = chan->volume << 8; /* fixed volume */
-   else
-      output = (chan->env_vol ^ 0x0F) << 8;
-
-   if (0 == chan->adder)
-      chan->output_vol = output;
-   else if (chan->adder == chan->duty_flip)
-      chan->output_vol = -output;
-#endif
-
-   return APU_RECTANGLE_OUTPUT;
+   return 0;
 }
 
 /* TRIANGLE WAVE
@@ -316,13 +344,11 @@ static int32 apu_rectangle(rectangle_t *chan)
 ** reg2: low 8 bits of frequency
 ** reg3: 7-3=length counter, 2-0=high 3 bits of frequency
 */
-#define  APU_TRIANGLE_OUTPUT  (chan->output_vol + (chan->output_vol >> 2))
 static int32 apu_triangle(triangle_t *chan)
 {
-   APU_VOLUME_DECAY(chan->output_vol);
-
+   /* a silenced triangle holds its level, rather than dropping to 0 */
    if (FALSE == chan->enabled || 0 == chan->vbl_length)
-      return APU_TRIANGLE_OUTPUT;
+      return 0;
 
    if (chan->counter_started)
    {
@@ -346,21 +372,23 @@ static int32 apu_triangle(triangle_t *chan)
    }
 */
    if (0 == chan->linear_length || chan->freq < APU_TO_FIXED(4)) /* inaudible */
-      return APU_TRIANGLE_OUTPUT;
+      return 0;
 
    chan->phaseacc -= apu->cycle_rate; /* # of cycles per sample */
    while (chan->phaseacc < 0)
    {
+      int32 t = apu_steptime(chan->phaseacc);
+      int v;
+
       chan->phaseacc += chan->freq;
       chan->adder = (chan->adder + 1) & 0x1F;
 
-      if (chan->adder & 0x10)
-         chan->output_vol -= (2 << 8);
-      else
-         chan->output_vol += (2 << 8);
+      /* 15..0..15 staircase, centred on 0, at 1.25 times rectangle scale */
+      v = (chan->adder & 0x10) ? (chan->adder ^ 0x1F) : chan->adder;
+      apu_setlevel(&chan->level, ((v << 1) - 15) * (5 << 6), t);
    }
 
-   return APU_TRIANGLE_OUTPUT;
+   return 0;
 }
 
 
@@ -930,12 +958,69 @@ void apu_getpcmdata(void **data, int *num_samples, int *sample_bits)
 }
 
 
+/* generate one output sample */
+static int32 apu_mixsample(void)
+{
+   static int32 prev_sample = 0;
+   int32 next_sample, accum;
+
+   if (APU_MIX_ENABLE(0)) apu_rectangle(&apu->rectangle[0]);
+   if (APU_MIX_ENABLE(1)) apu_rectangle(&apu->rectangle[1]);
+   if (APU_MIX_ENABLE(2)) apu_triangle(&apu->triangle);
+
+   accum = apu_readsteps();
+   if (APU_MIX_ENABLE(3)) accum += apu_noise(&apu->noise);
+   if (APU_MIX_ENABLE(4)) accum += apu_dmc(&apu->dmc);
+
+   if (apu->ext && APU_MIX_ENABLE(5)) accum += apu->ext->process();
+
+   /* do any filtering */
+   if (APU_FILTER_NONE != apu->filter_type)
+   {
+      next_sample = accum;
+
+      if (APU_FILTER_LOWPASS == apu->filter_type)
+      {
+         accum += prev_sample;
+         accum >>= 1;
+      }
+      else
+         accum = (accum + accum + accum + prev_sample) >> 2;
+
+      prev_sample = next_sample;
+   }
+
+   /* little extra kick for the kids */
+   accum <<= 1;
+
+   /* prevent clipping */
+   if (accum > 0x7FFF)
+      accum = 0x7FFF;
+   else if (accum < -0x8000)
+      accum = -0x8000;
+
+   return accum;
+}
+
+INLINE uint8 *apu_putsample(uint8 *u8buf, int32 accum)
+{
+   /* signed 16-bit output, unsigned 8-bit */
+   if (16 == apu->sample_bits) {
+      *(int16 *)(u8buf) = (int16) accum;
+      u8buf += sizeof(int16);
+   }
+   else {
+      *u8buf = (accum >> 8) ^ 0x80;
+      u8buf += sizeof(uint8);
+   }
+
+   return u8buf;
+}
+
 void apu_process(void *buffer, int num_samples)
 {
    apudata_t *d;
    uint32 elapsed_cycles;
-   static int32 prev_sample = 0;
-   int32 next_sample, accum;
    uint8 *u8buf = (uint8 *)buffer;
 
    ASSERT(apu);
@@ -955,54 +1040,55 @@ void apu_process(void *buffer, int num_samples)
       }
 
       elapsed_cycles += APU_FROM_FIXED(apu->cycle_rate);
+      u8buf = apu_putsample(u8buf, apu_mixsample());
+   }
 
-      accum = 0;
-      if (APU_MIX_ENABLE(0)) accum += apu_rectangle(&apu->rectangle[0]);
-      if (APU_MIX_ENABLE(1)) accum += apu_rectangle(&apu->rectangle[1]);
-      if (APU_MIX_ENABLE(2)) accum += apu_triangle(&apu->triangle);
-      if (APU_MIX_ENABLE(3)) accum += apu_noise(&apu->noise);
-      if (APU_MIX_ENABLE(4)) accum += apu_dmc(&apu->dmc);
+   /* resync cycle counter */
+   apu->elapsed_cycles = nes6502_getcycles(FALSE);
+}
 
-      if (apu->ext && APU_MIX_ENABLE(5)) accum += apu->ext->process();
+/* Generate num_samples samples for a frame of `cycles' CPU cycles, applying
+** each queued register write at the sample it was made in. The frame's cycles
+** are spread evenly over its samples, so the sample count follows the frame
+** rate the host plays at, while the channels still run off the real CPU
+** clock. Queued writes are timestamped relative to the start of the frame, so
+** whatever is left in the queue is moved back by a frame afterwards. Returns
+** the number of samples written.
+*/
+int apu_run(void *buffer, int num_samples, uint32 cycles)
+{
+   apudata_t *d;
+   uint32 clock = 0, step;
+   uint8 *u8buf = (uint8 *)buffer;
+   int i, n;
 
-      /* do any filtering */
-      if (APU_FILTER_NONE != apu->filter_type)
-      {
-         next_sample = accum;
+   ASSERT(apu);
 
-         if (APU_FILTER_LOWPASS == apu->filter_type)
-         {
-            accum += prev_sample;
-            accum >>= 1;
-         }
-         else
-            accum = (accum + accum + accum + prev_sample) >> 2;
+   apu->buffer = buffer;
+   step = (uint32) (((uint64_t) cycles << 16) / num_samples);
 
-         prev_sample = next_sample;
+   for (n = 0; n < num_samples; n++)
+   {
+      while ((FALSE == APU_QEMPTY()) &&
+             APU_TO_FIXED(apu->queue[apu->q_tail].timestamp) <= clock)
+      {
+         d = apu_dequeue();
+         apu_regwrite(d->address, d->value);
       }
 
-      /* little extra kick for the kids */
-      accum <<= 1;
-
-      /* prevent clipping */
-      if (accum > 0x7FFF)
-         accum = 0x7FFF;
-      else if (accum < -0x8000)
-         accum = -0x8000;
+      u8buf = apu_putsample(u8buf, apu_mixsample());
+      clock += step;
+   }
 
-      /* signed 16-bit output, unsigned 8-bit */
-      if (16 == apu->sample_bits) {
-         *(int16 *)(u8buf) = (int16) accum;
-         u8buf += sizeof(int16);
-      }
-      else {
-         *u8buf = (accum >> 8) ^ 0x80;
-         u8buf += sizeof(uint8);
-      }
+   for (i = apu->q_tail; i != apu->q_head; i = (i + 1) & APUQUEUE_MASK)
+   {
+      if (apu->queue[i].timestamp > cycles)
+         apu->queue[i].timestamp -= cycles;
+      else
+         apu->queue[i].timestamp = 0;
    }
 
-   /* resync cycle counter */
-   apu->elapsed_cycles = nes6502_getcycles(FALSE);
+   return n;
 }
 
 /* set the filter type */
@@ -1031,6 +1117,14 @@ void apu_reset(void)
    apu->q_head = 0;
    apu->q_tail = 0;
 
+   memset(apu->step_buf, 0, sizeof(apu->step_buf));
+   apu->step_pos = 0;
+   apu->step_sum = 0;
+   apu->step_hp = 0;
+   apu->rectangle[0].level = 0;
+   apu->rectangle[1].level = 0;
+   apu->triangle.level = 0;
+
    /* use to avoid bugs =) */
    for (address = 0x4000; address <= 0x4013; address++)
       apu_regwrite(address, 0);
@@ -1064,7 +1158,6 @@ void apu_build_luts(int num_samples)
 
 #ifndef REALTIME_NOISE
    /* generate noise samples */
-   shift_register15(noise_long_lut, APU_NOISE_32K);
    shift_register15(noise_short_lut, APU_NOISE_93);
 #endif /* !REALTIME_NOISE */
 }
@@ -1096,6 +1189,7 @@ apu_t *apu_create(int sample_rate, int refresh_rate, int sample_bits, boolean st
    temp_apu->num_samples = sample_rate / refresh_rate;
    /* turn into fixed point! */
    temp_apu->cycle_rate = (int32) (APU_BASEFREQ * 65536.0 / (float) sample_rate);
+   temp_apu->cycle_rate_inv = (uint32) (4294967296.0 / temp_apu->cycle_rate);
 
    /* build various lookup tables for apu */
    apu_build_luts(temp_apu->num_samples);
@@ -139,6 +139,9 @@ typedef struct rectangle_s
    int vbl_length;
    uint8 adder;
    int duty_flip;
+
+   /* level last put into the step buffer */
+   int32 level;
 } rectangle_t;
 
 /*
@@ -171,6 +174,8 @@ typedef struct triangle_s
    int vbl_length;
    int linear_length;
 
+   /* level last put into the step buffer */
+   int32 level;
 } triangle_t;
 
 
@@ -256,6 +261,15 @@ typedef struct apuext_s
 } apuext_t;
 
 
+/* band-limited step buffer: each level change is added as a windowed-sinc
+** impulse spread over APU_STEP_TAPS samples, at one of APU_STEP_PHASES
+** sub-sample positions, and the buffer is integrated on output
+*/
+#define  APU_STEP_TAPS     16
+#define  APU_STEP_PHASES   32
+#define  APU_STEP_RING     32
+#define  APU_STEP_MASK     (APU_STEP_RING - 1)
+
 /* APU queue structure */
 #define  APUQUEUE_SIZE  4096
 #define  APUQUEUE_MASK  (APUQUEUE_SIZE - 1)
@@ -287,6 +301,13 @@ typedef struct apu_s
    int filter_type;
 
    int32 cycle_rate;
+   uint32 cycle_rate_inv; /* 2^32 / cycle_rate */
+
+   /* band-limited step buffer for the rectangles and triangle */
+   int32 step_buf[APU_STEP_RING];
+   int step_pos;
+   int32 step_sum;
+   int32 step_hp;
 
    int sample_rate;
    int sample_bits;
@@ -312,6 +333,7 @@ extern void apu_destroy(apu_t *apu);
 extern int apu_setext(apu_t *apu, apuext_t *ext);
 extern int apu_setfilter(int filter_type);
 extern void apu_process(void *buffer, int num_samples);
+extern int apu_run(void *buffer, int num_samples, uint32 cycles);
 extern void apu_reset(void);
 extern int apu_setchan(int chan, boolean enabled);
 extern int32 apu_getcyclerate(void);
@@ -20,9 +20,15 @@
 #include "nesapu.h"
 #include "nes_apu.h"
 #include "sound.h"
+#include "mixer.h"
 
 static apu_t *apu;
 
+/* Samples in a frame. The frontends play the NES at 60 frames a second, and
+   take this many samples from each one, however long nes.c makes the frame in
+   CPU cycles. */
+#define NES_APU_FRAME_SAMPLES   (SOUND_CORE_RATE / 60)
+
 void nes_apu_write(uint16 addr, uint8 data) {
     apu_write(addr, data);
 }
@@ -32,30 +38,48 @@ uint8 nes_apu_read(uint16 addr) {
 }
 
 #ifndef _arch_dreamcast
-void nes_apu_execute(int cycles __UNUSED__) {
-    static int16 sbuf[735];
+/* The APU mixes its own channels and any expansion sound in together, so it's
+   one stream here, only there for the gain. */
+static mixer_t apu_mixer;
+
+void nes_apu_set_gain(float gain) {
+    mixer_set_gain(&apu_mixer, 0, gain, 0.0f);
+}
+
+/* Generate a frame's worth of samples for the given number of CPU cycles, with
+   each register write applied at the point in the frame where it happened. */
+void nes_apu_execute(int cycles) {
+    int16 *sbuf = sound_reserve(NES_APU_FRAME_SAMPLES << 1);
 
-    apu_process(sbuf, 735);
-    sound_update_buffer(sbuf, 735 << 1);
+    apu_run(sbuf, NES_APU_FRAME_SAMPLES, (uint32)cycles);
+    mixer_run(&apu_mixer, sbuf, &sbuf, NES_APU_FRAME_SAMPLES);
+    sound_commit(NES_APU_FRAME_SAMPLES << 1);
 }
 #else
 void nes_apu_execute(int cycles __UNUSED__) {
-    static int16 sbuf[735 << 1];
+    static int16 sbuf[NES_APU_FRAME_SAMPLES << 1];
     static int frame = 0, samples = 0;
 
-    apu_process(sbuf + samples, 735);
+    apu_process(sbuf + samples, NES_APU_FRAME_SAMPLES);
     frame ^= 1;
-    samples += 735;
+    samples += NES_APU_FRAME_SAMPLES;
 
     if(!frame) {
-        sound_update_buffer_noint(sbuf, NULL, NULL, 735 << 2);
+        sound_update_buffer_noint(sbuf, NULL, NULL,
+                                  NES_APU_FRAME_SAMPLES << 2);
         samples = 0;
     }
 }
 #endif
 
 int nes_apu_init(void) {
-    apu = apu_create(44100, 60, 16, FALSE);
+    apu = apu_create(SOUND_CORE_RATE, 60, 16, FALSE);
+
+#ifndef _arch_dreamcast
+    mixer_init(&apu_mixer, 1);
+    mixer_add_stream(&apu_mixer, MIXER_MONO);
+#endif
+
     if(apu)
         return 0;
 
@@ -120,12 +144,10 @@ int nes_apu_write_context(FILE *fp) {
     return 0;
 }
 
-int nes_apu_read_context(const uint8 *buf) {
-    uint32 len;
+int nes_apu_read_context(const uint8 *buf, uint32 len, int load) {
     uint16 ver;
 
     /* Check the size */
-    BUF_TO_UINT32(buf + 4, len);
     if(len != 40)
         return -1;
 
@@ -138,6 +160,9 @@ int nes_apu_read_context(const uint8 *buf) {
     if(buf[12] != 0 || buf[13] != 0 || buf[14] != 0 || buf[15] != 0)
         return -1;
 
+    if(!load)
+        return 0;
+
     /* Read in the registers */
     apu_regwrite(APU_WRA0, buf[16]);
     apu_regwrite(APU_WRA1, buf[17]);
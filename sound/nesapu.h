@@ -27,13 +27,19 @@ CLINKAGE
 
 extern void nes_apu_write(uint16 addr, uint8 data);
 extern uint8 nes_apu_read(uint16 addr);
+/* Run the APU for a frame of the given number of CPU cycles. */
 extern void nes_apu_execute(int cycles);
 extern int nes_apu_init(void);
 extern void nes_apu_shutdown(void);
 extern void nes_apu_reset(void);
 
+#ifndef _arch_dreamcast
+/* Overall APU gain, 1.0 being normal. */
+extern void nes_apu_set_gain(float gain);
+#endif
+
 extern int nes_apu_write_context(FILE *fp);
-extern int nes_apu_read_context(const uint8 *buf);
+extern int nes_apu_read_context(const uint8 *buf, uint32 len, int load);
 
 ENDCLINK
 
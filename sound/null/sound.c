@@ -0,0 +1,192 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2 
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Sound output that goes nowhere, for headless use. A thread drains the ring
+   at the rate a real device would, so sound_wait() still paces emulation to
+   real time. It runs at the rate most devices do, so the samples take the
+   same path through the resampler as they would to real hardware. */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "CrabEmu.h"
+#include "sound.h"
+#include "audioring.h"
+
+#define FRAMES_TO_BUFFER    4
+#define FRAME_LOW_HALF      (FRAMES_TO_BUFFER / 2)
+#define SAMPLE_RATE         48000
+
+/* How often the drain thread wakes up, in nanoseconds. */
+#define PERIOD_NS           10000000
+
+static audioring_t ring;
+static pthread_t thd;
+static sem_t sem;
+static uint32 samples_per_period, samples_per_frame;
+static int paused = 0, quit = 0;
+static int initted = 0;
+
+static int16 *reserved;
+static int16 overflow[SOUND_RESERVE_MAX >> 1];
+
+static int flush_req = 0;
+static uint32 flush_to;
+
+static void *drain_thread(void *data __UNUSED__) {
+    struct timespec next;
+    uint32 consumed = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while(!__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+        next.tv_nsec += PERIOD_NS;
+        if(next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            ++next.tv_sec;
+        }
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        if(__atomic_load_n(&flush_req, __ATOMIC_ACQUIRE)) {
+            audioring_skip(&ring, flush_to - ring.tail);
+            __atomic_store_n(&flush_req, 0, __ATOMIC_RELEASE);
+        }
+
+        if(__atomic_load_n(&paused, __ATOMIC_RELAXED))
+            continue;
+
+        audioring_skip(&ring, samples_per_period);
+        consumed += samples_per_period;
+
+        while(consumed > samples_per_frame) {
+            sem_post(&sem);
+            consumed -= samples_per_frame;
+        }
+    }
+
+    return NULL;
+}
+
+int16 *sound_dev_reserve(int length) {
+    reserved = initted ? audioring_reserve(&ring, length >> 1) : NULL;
+
+    if(!reserved)
+        return overflow;
+
+    return reserved;
+}
+
+void sound_dev_commit(int length) {
+    if(reserved)
+        audioring_commit(&ring, length >> 1);
+
+    reserved = NULL;
+}
+
+int sound_init(int channels, int region) {
+    uint32 size;
+
+    if(initted)
+        return 0;
+
+    if(region == VIDEO_NTSC)
+        samples_per_frame = (SAMPLE_RATE / 60) * channels;
+    else
+        samples_per_frame = (SAMPLE_RATE / 50) * channels;
+
+    samples_per_period = (uint32)((uint64_t)SAMPLE_RATE * PERIOD_NS /
+                                  1000000000) * channels;
+
+    size = SOUND_RESERVE_MAX >> 1;
+    while(size < samples_per_frame * FRAMES_TO_BUFFER)
+        size <<= 1;
+
+    if(sound_output_init(channels, SAMPLE_RATE))
+        return -1;
+
+    if(audioring_init(&ring, size, SOUND_RESERVE_MAX >> 1)) {
+        sound_output_shutdown();
+        return -1;
+    }
+
+    if(sem_init(&sem, 0, FRAME_LOW_HALF)) {
+        audioring_destroy(&ring);
+        sound_output_shutdown();
+        return -2;
+    }
+
+    paused = 1;
+    quit = flush_req = 0;
+
+    if(pthread_create(&thd, NULL, &drain_thread, NULL)) {
+        sem_destroy(&sem);
+        audioring_destroy(&ring);
+        sound_output_shutdown();
+        return -3;
+    }
+
+    initted = 1;
+
+    return 0;
+}
+
+void sound_shutdown(void) {
+    if(!initted)
+        return;
+
+    __atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+    pthread_join(thd, NULL);
+
+    sem_destroy(&sem);
+    audioring_destroy(&ring);
+    sound_output_shutdown();
+
+    initted = 0;
+}
+
+void sound_reset_buffer(void) {
+    if(!initted)
+        return;
+
+    sound_output_reset();
+
+    /* The drain thread owns the read side, so ask it to drop what's there. */
+    flush_to = ring.head;
+    __atomic_store_n(&flush_req, 1, __ATOMIC_RELEASE);
+}
+
+void sound_pause(void) {
+    __atomic_store_n(&paused, 1, __ATOMIC_RELAXED);
+}
+
+void sound_unpause(void) {
+    __atomic_store_n(&paused, 0, __ATOMIC_RELAXED);
+}
+
+void sound_wait(void) {
+    if(!initted)
+        return;
+
+    /* Go back to waiting if a signal interrupts us. */
+    while(sem_wait(&sem)) {
+    }
+}
@@ -0,0 +1,114 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2 
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* The front half of every sound output. The cores always hand over samples at
+   SOUND_CORE_RATE; if the output runs at that rate too, they go straight
+   through to it, otherwise they go through a resampler on the way. */
+
+#include <string.h>
+
+#include "sound.h"
+#include "resampler.h"
+
+static resampler_t rs;
+static int converting = 0;
+
+/* What sound_reserve() hands out when converting, and the most input frames
+   that are converted at a time, so that what comes out always fits in one
+   sound_dev_reserve(). */
+static int16 scratch[SOUND_RESERVE_MAX >> 1];
+static int chunk;
+
+int sound_output_init(int channels, int rate) {
+    int limit = (SOUND_RESERVE_MAX >> 1) / channels;
+
+    sound_output_shutdown();
+
+    if(rate == SOUND_CORE_RATE)
+        return 0;
+
+    if(resampler_init(&rs, channels, SOUND_CORE_RATE, rate))
+        return -1;
+
+    /* What's left over in the resampler's history between calls is always
+       under RESAMPLER_TAPS frames, which gives this much room for new ones. */
+    chunk = (int)((uint64_t)(limit - 1) * SOUND_CORE_RATE / rate) -
+        RESAMPLER_TAPS + 1;
+    converting = 1;
+
+    return 0;
+}
+
+void sound_output_shutdown(void) {
+    if(converting)
+        resampler_shutdown(&rs);
+
+    converting = 0;
+}
+
+void sound_output_reset(void) {
+    if(converting)
+        resampler_reset(&rs);
+}
+
+static void convert(const int16 *buf, int length) {
+    int frames = length / (rs.channels * (int)sizeof(int16));
+    int n, out;
+    int16 *ptr;
+
+    while(frames > 0) {
+        n = frames < chunk ? frames : chunk;
+
+        ptr = sound_dev_reserve(resampler_max_output(&rs, n) * rs.channels *
+                                sizeof(int16));
+        out = resampler_process(&rs, buf, n, ptr);
+        sound_dev_commit(out > 0 ? out * rs.channels * sizeof(int16) : 0);
+
+        buf += n * rs.channels;
+        frames -= n;
+    }
+}
+
+int16 *sound_reserve(int length) {
+    /* Samples that don't need converting go right into the output. */
+    if(!converting)
+        return sound_dev_reserve(length);
+
+    return scratch;
+}
+
+void sound_commit(int length) {
+    if(!converting)
+        sound_dev_commit(length);
+    else
+        convert(scratch, length);
+}
+
+void sound_update_buffer(int16 *buf, int length) {
+    int16 *ptr;
+
+    if(converting) {
+        convert(buf, length);
+        return;
+    }
+
+    ptr = sound_dev_reserve(length);
+    memcpy(ptr, buf, length);
+    sound_dev_commit(length);
+}
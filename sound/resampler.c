@@ -0,0 +1,344 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2 
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Polyphase windowed-sinc sample rate converter, used by output.c to take
+   the cores' fixed-rate output to whatever rate the host wants. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "resampler.h"
+
+/* Each output sample is a 32 tap dot product, which can be done 8 taps at a
+   time with AVX and FMA where the CPU has them. */
+#if !defined(_arch_dreamcast) && defined(__x86_64__) && defined(__GNUC__) && \
+    !defined(CRABEMU_NO_AVX)
+#define RESAMPLER_AVX
+#include <immintrin.h>
+
+static int use_avx;
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Kaiser window shape. 8.0 puts the stopband around -80dB. */
+#define KAISER_BETA         8.0
+
+/* Fraction of the lower of the two Nyquist frequencies that is passed. */
+#define CUTOFF              0.91
+
+/* Bits of the output position below the filter phase. */
+#define FRAC_MASK           ((1U << (32 - RESAMPLER_PHASE_BITS)) - 1)
+
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    int k;
+
+    for(k = 1; k < 32; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+static void build_filter(resampler_t *rs) {
+    double fc, x, w, t, sum;
+    float *row;
+    int p, k;
+
+    /* Cutoff relative to the input rate. When going down in rate, this has to
+       sit below the output's Nyquist frequency instead. */
+    if(rs->out_rate < rs->in_rate)
+        fc = CUTOFF * (double)rs->out_rate / (double)rs->in_rate;
+    else
+        fc = CUTOFF;
+
+    for(p = 0; p <= RESAMPLER_PHASES; ++p) {
+        row = rs->filter + p * RESAMPLER_TAPS;
+        sum = 0.0;
+
+        /* Tap k covers the input sample this far from the output point. */
+        for(k = 0; k < RESAMPLER_TAPS; ++k) {
+            x = (k - (RESAMPLER_TAPS / 2 - 1)) -
+                (double)p / RESAMPLER_PHASES;
+            t = x / (RESAMPLER_TAPS / 2);
+
+            if(t <= -1.0 || t >= 1.0)
+                w = 0.0;
+            else
+                w = bessel_i0(KAISER_BETA * sqrt(1.0 - t * t)) /
+                    bessel_i0(KAISER_BETA);
+
+            if(x == 0.0)
+                row[k] = (float)w;
+            else
+                row[k] = (float)(w * sin(M_PI * fc * x) / (M_PI * fc * x));
+
+            sum += row[k];
+        }
+
+        /* Normalize each phase for unity gain at DC. */
+        for(k = 0; k < RESAMPLER_TAPS; ++k)
+            row[k] = (float)(row[k] / sum);
+    }
+}
+
+int resampler_init(resampler_t *rs, int channels, int in_rate, int out_rate) {
+    memset(rs, 0, sizeof(resampler_t));
+
+    if(channels < 1 || channels > 2 || in_rate <= 0 || out_rate <= 0) {
+#ifdef DEBUG
+        fprintf(stderr, "resampler_init: bad parameters\n");
+#endif
+        return -1;
+    }
+
+    rs->channels = channels;
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->step = ((uint64_t)in_rate << 32) / (uint64_t)out_rate;
+
+    if(in_rate == out_rate)
+        return 0;
+
+    rs->filter = (float *)malloc(sizeof(float) * RESAMPLER_TAPS *
+                                 (RESAMPLER_PHASES + 1));
+    if(!rs->filter) {
+#ifdef DEBUG
+        fprintf(stderr, "resampler_init: out of memory\n");
+#endif
+        return -1;
+    }
+
+    build_filter(rs);
+    resampler_reset(rs);
+
+#ifdef RESAMPLER_AVX
+    __builtin_cpu_init();
+    use_avx = __builtin_cpu_supports("avx") && __builtin_cpu_supports("fma");
+#endif
+
+    return 0;
+}
+
+void resampler_shutdown(resampler_t *rs) {
+    free(rs->filter);
+    free(rs->hist);
+    rs->filter = NULL;
+    rs->hist = NULL;
+    rs->hist_len = rs->hist_size = 0;
+}
+
+void resampler_reset(resampler_t *rs) {
+    /* Start with half a filter of silence so that the first output sample
+       lines up with the first input sample. */
+    rs->pos = 0;
+    rs->hist_len = RESAMPLER_TAPS / 2 - 1;
+
+    if(rs->hist)
+        memset(rs->hist, 0, sizeof(float) * rs->hist_len * rs->channels);
+}
+
+int resampler_max_output(resampler_t *rs, int frames) {
+    uint64_t end;
+
+    if(rs->in_rate == rs->out_rate)
+        return frames;
+
+    /* Every output position below the end of the history, plus one for the
+       fractional start. */
+    end = (uint64_t)(rs->hist_len + frames) << 32;
+    return (int)(end / rs->step) + 1;
+}
+
+static int grow_history(resampler_t *rs, int frames) {
+    int need = rs->hist_len + frames;
+    float *tmp;
+
+    if(need <= rs->hist_size && rs->hist)
+        return 0;
+
+    /* Round up so that a few differently sized frames don't each realloc. */
+    need = (need + 1023) & ~1023;
+    tmp = (float *)realloc(rs->hist, sizeof(float) * need * rs->channels);
+    if(!tmp)
+        return -1;
+
+    /* The silence written by resampler_reset() has to be there the first
+       time through. */
+    if(!rs->hist)
+        memset(tmp, 0, sizeof(float) * rs->hist_len * rs->channels);
+
+    rs->hist = tmp;
+    rs->hist_size = need;
+    return 0;
+}
+
+static inline int16 clamp16(float s) {
+    if(s >= 32767.0f)
+        return 32767;
+    else if(s <= -32768.0f)
+        return -32768;
+
+    return (int16)lrintf(s);
+}
+
+/* Work out one output frame at the given fraction of the way past the start of
+   x, blending the two filter phases on either side of it as it goes. */
+static void filter_c(const resampler_t *rs, uint32 frac, const float *x,
+                     float s[2]) {
+    uint32 p = frac >> (32 - RESAMPLER_PHASE_BITS);
+    float mu = (float)(frac & FRAC_MASK) * (1.0f / (FRAC_MASK + 1.0f));
+    const float *a = rs->filter + p * RESAMPLER_TAPS;
+    const float *b = a + RESAMPLER_TAPS;
+    float c, l = 0.0f, r = 0.0f;
+    int k;
+
+    if(rs->channels == 2) {
+        for(k = 0; k < RESAMPLER_TAPS; ++k) {
+            c = a[k] + (b[k] - a[k]) * mu;
+            l += c * x[k << 1];
+            r += c * x[(k << 1) + 1];
+        }
+    }
+    else {
+        for(k = 0; k < RESAMPLER_TAPS; ++k)
+            l += (a[k] + (b[k] - a[k]) * mu) * x[k];
+    }
+
+    s[0] = l;
+    s[1] = r;
+}
+
+#ifdef RESAMPLER_AVX
+/* The same, 8 taps at a time. For stereo, each coefficient gets doubled up to
+   line up with the interleaved left and right samples. */
+__attribute__((target("avx,fma")))
+static void filter_avx(const resampler_t *rs, uint32 frac, const float *x,
+                       float s[2]) {
+    uint32 p = frac >> (32 - RESAMPLER_PHASE_BITS);
+    const float *a = rs->filter + p * RESAMPLER_TAPS;
+    const float *b = a + RESAMPLER_TAPS;
+    __m256 mu = _mm256_set1_ps((float)(frac & FRAC_MASK) *
+                               (1.0f / (FRAC_MASK + 1.0f)));
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 c, ca, cb, lo, hi;
+    __m128 t;
+    int k;
+
+    for(k = 0; k < RESAMPLER_TAPS; k += 8) {
+        ca = _mm256_loadu_ps(a + k);
+        cb = _mm256_loadu_ps(b + k);
+        c = _mm256_fmadd_ps(_mm256_sub_ps(cb, ca), mu, ca);
+
+        if(rs->channels == 2) {
+            lo = _mm256_unpacklo_ps(c, c);
+            hi = _mm256_unpackhi_ps(c, c);
+            acc0 = _mm256_fmadd_ps(_mm256_permute2f128_ps(lo, hi, 0x20),
+                                   _mm256_loadu_ps(x + (k << 1)), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_permute2f128_ps(lo, hi, 0x31),
+                                   _mm256_loadu_ps(x + (k << 1) + 8), acc1);
+        }
+        else {
+            acc0 = _mm256_fmadd_ps(c, _mm256_loadu_ps(x + k), acc0);
+        }
+    }
+
+    acc0 = _mm256_add_ps(acc0, acc1);
+    t = _mm_add_ps(_mm256_castps256_ps128(acc0),
+                   _mm256_extractf128_ps(acc0, 1));
+    t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+
+    /* Stereo ends up as left and right in the bottom two, mono still has two
+       halves to add. */
+    if(rs->channels == 2) {
+        s[0] = _mm_cvtss_f32(t);
+        s[1] = _mm_cvtss_f32(_mm_shuffle_ps(t, t, 1));
+    }
+    else {
+        s[0] = _mm_cvtss_f32(_mm_add_ss(t, _mm_shuffle_ps(t, t, 1)));
+        s[1] = 0.0f;
+    }
+}
+#endif
+
+int resampler_process(resampler_t *rs, const int16 *in, int frames,
+                      int16 *out) {
+    void (*filter)(const resampler_t *, uint32, const float *, float *);
+    float s[2];
+    float *h;
+    int i, n = 0, idx, drop;
+
+    if(frames <= 0)
+        return 0;
+
+    if(rs->in_rate == rs->out_rate) {
+        memcpy(out, in, sizeof(int16) * frames * rs->channels);
+        return frames;
+    }
+
+    if(grow_history(rs, frames))
+        return -1;
+
+    /* Append the new input to the history. */
+    h = rs->hist + rs->hist_len * rs->channels;
+    for(i = 0; i < frames * rs->channels; ++i)
+        h[i] = (float)in[i];
+
+    rs->hist_len += frames;
+
+    filter = &filter_c;
+#ifdef RESAMPLER_AVX
+    if(use_avx)
+        filter = &filter_avx;
+#endif
+
+    /* Produce every output sample whose whole filter lies inside the data we
+       have. */
+    while((idx = (int)(rs->pos >> 32)) + RESAMPLER_TAPS <= rs->hist_len) {
+        filter(rs, (uint32)rs->pos, rs->hist + idx * rs->channels, s);
+
+        if(rs->channels == 2) {
+            out[n << 1] = clamp16(s[0]);
+            out[(n << 1) + 1] = clamp16(s[1]);
+        }
+        else {
+            out[n] = clamp16(s[0]);
+        }
+
+        ++n;
+        rs->pos += rs->step;
+    }
+
+    /* Throw away the input that no future output sample can reach. */
+    drop = (int)(rs->pos >> 32);
+    if(drop > 0) {
+        memmove(rs->hist, rs->hist + drop * rs->channels,
+                sizeof(float) * (rs->hist_len - drop) * rs->channels);
+        rs->hist_len -= drop;
+        rs->pos -= (uint64_t)drop << 32;
+    }
+
+    return n;
+}
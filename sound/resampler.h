@@ -0,0 +1,72 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2 
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include "CrabEmu.h"
+
+CLINKAGE
+
+/* Input and output are both interleaved signed 16-bit, as the cores hand it to
+   sound_update_buffer() and the sound devices take it. */
+
+/* Length of the windowed-sinc filter in input samples, and the number of
+   filter phases stored between two input samples. Coefficients for positions
+   that fall between two phases are linearly interpolated. */
+#define RESAMPLER_TAPS          32
+#define RESAMPLER_PHASE_BITS    8
+#define RESAMPLER_PHASES        (1 << RESAMPLER_PHASE_BITS)
+
+typedef struct resampler_struct {
+    int channels;
+    int in_rate;
+    int out_rate;
+
+    /* Filter table, (RESAMPLER_PHASES + 1) rows of RESAMPLER_TAPS each. */
+    float *filter;
+
+    /* Input not yet fully consumed, converted to float and interleaved. */
+    float *hist;
+    int hist_len;
+    int hist_size;
+
+    /* Position of the next output sample in the history, and the distance
+       between output samples, both in 32.32 fixed point input samples. */
+    uint64_t pos;
+    uint64_t step;
+} resampler_t;
+
+int resampler_init(resampler_t *rs, int channels, int in_rate, int out_rate);
+void resampler_shutdown(resampler_t *rs);
+void resampler_reset(resampler_t *rs);
+
+/* Largest number of output frames that resampler_process() can produce from
+   the given number of input frames. */
+int resampler_max_output(resampler_t *rs, int frames);
+
+/* Convert frames of interleaved 16-bit input into out, which must have room
+   for resampler_max_output(rs, frames) frames. Returns the number of output
+   frames written, or -1 on error. */
+int resampler_process(resampler_t *rs, const int16 *in, int frames,
+                      int16 *out);
+
+ENDCLINK
+
+#endif /* !RESAMPLER_H */
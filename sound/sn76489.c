@@ -28,9 +28,93 @@ static const int volume_values[16] = {
      478,  384,  300,  226,  160,  100,   48,    0
 };
 
+#ifndef _arch_dreamcast
+#define BL_TAPS     16
+#define BL_PHASES   32
+#define BL_MASK     (SN76489_BL_RING - 1)
+
+/* Band-limited step kernel: a Blackman-windowed sinc cut off at 0.9 of
+   nyquist, BL_TAPS long, for a step BL_PHASES ahead of each phase of a
+   sample, with the impulse centred BL_TAPS / 2 samples later. Each row sums
+   to 32768. This is generated offline (the same way as the NES APU's kernel)
+   rather than at startup so the output doesn't depend on the host's libm. */
+static const int16 bl_kernel[BL_PHASES][BL_TAPS] = {
+    {      0,    18,  -109,   353,  -820,  1492, -2199,  2566,
+      29481,  3495, -2543,  1628,  -866,   364,  -110,    18 },
+    {      0,    17,  -107,   340,  -769,  1349, -1852,  1679,
+      29400,  4463, -2883,  1757,  -906,   373,  -111,    18 },
+    {      0,    17,  -104,   324,  -715,  1202, -1507,   837,
+      29243,  5467, -3216,  1876,  -941,   378,  -110,    17 },
+    {      0,    16,  -100,   306,  -657,  1052, -1165,    43,
+      29003,  6502, -3537,  1986,  -970,   381,  -108,    16 },
+    {      0,    15,   -95,   287,  -597,   900,  -830,  -702,
+      28688,  7565, -3845,  2083,  -991,   380,  -105,    15 },
+    {      0,    14,   -90,   267,  -535,   748,  -503, -1395,
+      28292,  8653, -4135,  2167, -1005,   376,  -100,    14 },
+    {     -1,    13,   -85,   245,  -471,   597,  -187, -2034,
+      27826,  9759, -4405,  2237, -1011,   367,   -94,    12 },
+    {     -1,    12,   -79,   223,  -407,   447,   116, -2620,
+      27288, 10880, -4652,  2291, -1008,   355,   -87,    10 },
+    {     -1,    11,   -73,   200,  -343,   301,   405, -3150,
+      26681, 12010, -4872,  2328,  -997,   339,   -78,     7 },
+    {     -2,    10,   -66,   177,  -279,   159,   677, -3624,
+      26008, 13145, -5062,  2346,  -976,   319,   -68,     4 },
+    {     -2,     9,   -60,   153,  -217,    22,   932, -4043,
+      25271, 14281, -5219,  2346,  -945,   295,   -56,     1 },
+    {     -2,     8,   -53,   130,  -156,  -108,  1167, -4405,
+      24475, 15410, -5340,  2326,  -905,   267,   -43,    -3 },
+    {     -3,     7,   -47,   107,   -96,  -232,  1383, -4713,
+      23627, 16529, -5423,  2284,  -854,   235,   -28,    -8 },
+    {     -3,     6,   -40,    85,   -39,  -348,  1577, -4966,
+      22725, 17633, -5464,  2222,  -794,   198,   -12,   -12 },
+    {     -3,     5,   -34,    64,    15,  -456,  1750, -5166,
+      21780, 18715, -5461,  2137,  -724,   158,     5,   -17 },
+    {     -4,     4,   -28,    43,    66,  -554,  1902, -5314,
+      20793, 19771, -5412,  2031,  -644,   114,    23,   -23 },
+    {     -4,     3,   -23,    23,   114,  -644,  2031, -5412,
+      19771, 20795, -5315,  1902,  -554,    66,    43,   -28 },
+    {     -4,     2,   -17,     5,   158,  -724,  2137, -5461,
+      18715, 21784, -5167,  1751,  -456,    15,    64,   -34 },
+    {     -4,     2,   -12,   -12,   198,  -794,  2222, -5465,
+      17633, 22731, -4967,  1578,  -348,   -39,    85,   -40 },
+    {     -5,     1,    -8,   -28,   235,  -855,  2285, -5424,
+      16534, 23632, -4714,  1383,  -232,   -96,   107,   -47 },
+    {     -5,     1,    -3,   -43,   267,  -905,  2326, -5341,
+      15415, 24483, -4407,  1167,  -108,  -156,   130,   -53 },
+    {     -4,     1,     1,   -56,   295,  -945,  2347, -5220,
+      14284, 25279, -4044,   932,    22,  -217,   153,   -60 },
+    {     -4,     0,     4,   -68,   319,  -976,  2347, -5063,
+      13151, 26016, -3625,   677,   159,  -280,   177,   -66 },
+    {     -4,     0,     7,   -78,   340,  -997,  2329, -4874,
+      12015, 26691, -3151,   405,   301,  -343,   200,   -73 },
+    {     -3,     0,    10,   -87,   356, -1009,  2292, -4654,
+      10884, 27300, -2621,   116,   447,  -407,   223,   -79 },
+    {     -3,     0,    12,   -94,   368, -1012,  2238, -4407,
+       9764, 27839, -2035,  -187,   597,  -472,   245,   -85 },
+    {     -2,     0,    14,  -100,   376, -1006,  2168, -4137,
+       8655, 28307, -1395,  -503,   749,  -535,   267,   -90 },
+    {     -1,     0,    15,  -105,   380,  -992,  2084, -3846,
+       7569, 28700,  -702,  -830,   901,  -597,   287,   -95 },
+    {      0,     0,    16,  -108,   381,  -970,  1987, -3539,
+       6505, 29017,    43, -1166,  1053,  -657,   306,  -100 },
+    {      1,     0,    17,  -110,   379,  -942,  1877, -3217,
+       5470, 29256,   837, -1508,  1203,  -715,   324,  -104 },
+    {      3,     0,    18,  -111,   373,  -907,  1757, -2885,
+       4465, 29415,  1679, -1853,  1350,  -769,   340,  -107 },
+    {      4,     0,    18,  -110,   364,  -866,  1628, -2544,
+       3497, 29494,  2567, -2200,  1492,  -820,   353,  -109 }
+};
+#endif
+
 int sn76489_init(sn76489_t *psg, float clock, float sample_rate,
                  uint16 noise_bits, uint16 tapped) {
     psg->enabled_channels = 0x0F;
+
+#ifndef _arch_dreamcast
+    psg->cycles = NULL;
+    psg->band_limited = 0;
+#endif
+
     return sn76489_reset(psg, clock, sample_rate, noise_bits, tapped);
 }
 
@@ -69,10 +153,43 @@ int sn76489_reset(sn76489_t *psg, float clock, float sample_rate,
     psg->noise_tapped = tapped;
     psg->noise_bits = noise_bits;
 
+#ifndef _arch_dreamcast
+    psg->log_count = 0;
+
+    psg->bl_cps = (uint32)((double)clock / 16.0 / sample_rate * 65536.0 + 0.5);
+    psg->bl_cps_inv = (uint32)((65536.0 * 65536.0) / psg->bl_cps);
+    psg->bl_resync = 1;
+    psg->bl_stereo = 0;
+    psg->bl_pos = 0;
+    memset(psg->bl_out, 0, sizeof(psg->bl_out));
+    memset(psg->bl_buf, 0, sizeof(psg->bl_buf));
+    memset(psg->bl_sum, 0, sizeof(psg->bl_sum));
+#endif
+
     return 0;
 }
 
-void sn76489_write(sn76489_t *psg, uint8 byte) {
+#ifndef _arch_dreamcast
+static int log_write(sn76489_t *psg, uint8 stereo, uint8 data) {
+    sn76489_logent_t *ent;
+
+    if(psg->log_count == SN76489_LOG_SIZE) {
+#ifdef DEBUG
+        fprintf(stderr, "sn76489: write log full, applying write now\n");
+#endif
+        return 0;
+    }
+
+    ent = &psg->log[psg->log_count++];
+    ent->cycle = psg->cycles();
+    ent->stereo = stereo;
+    ent->data = data;
+
+    return 1;
+}
+#endif
+
+static void write_reg(sn76489_t *psg, uint8 byte) {
     if(byte & 0x80) {
         /* This is a LATCH/DATA byte */
         psg->latched_reg = (byte & 0x70);
@@ -137,6 +254,15 @@ void sn76489_write(sn76489_t *psg, uint8 byte) {
     }
 }
 
+void sn76489_write(sn76489_t *psg, uint8 byte) {
+#ifndef _arch_dreamcast
+    if(psg->cycles && log_write(psg, 0, byte))
+        return;
+#endif
+
+    write_reg(psg, byte);
+}
+
 /* This is pretty much taken directly from Maxim's SN76489 document. */
 static __INLINE__ int parity(uint16 input) {
     input ^= input >> 8;
@@ -148,11 +274,239 @@ static __INLINE__ int parity(uint16 input) {
 
 #ifndef _arch_dreamcast
 
+/* Add a level change of delta at the given sample (relative to the ring) and
+   phase within that sample. */
+static void bl_step(int32 *buf, uint32 pos, uint32 phase, int32 delta) {
+    const int16 *kernel = bl_kernel[phase];
+    int32 part, sum = 0;
+    int i;
+
+    pos &= BL_MASK;
+
+    if(pos + BL_TAPS <= SN76489_BL_RING) {
+        int32 *out = buf + pos;
+
+        for(i = 0; i < BL_TAPS; ++i) {
+            part = (delta * kernel[i]) >> 15;
+            out[i] += part;
+            sum += part;
+        }
+    }
+    else {
+        for(i = 0; i < BL_TAPS; ++i) {
+            part = (delta * kernel[i]) >> 15;
+            buf[(pos + i) & BL_MASK] += part;
+            sum += part;
+        }
+    }
+
+    /* Make sure the whole step lands, so the integrator can't drift. */
+    buf[(pos + BL_TAPS / 2) & BL_MASK] += delta - sum;
+}
+
+/* Set a channel's output level as of time t (16.16 PSG clocks from the start
+   of the chunk). Unless a stereo setting has been used, only the left side is
+   tracked and it gets copied to the right. */
+static void bl_level(sn76489_t *psg, int ch, int32 amp, int32 t) {
+    uint32 pos, phase;
+    int32 v;
+
+    if(t < 0)
+        t = 0;
+
+    /* 16.16 sample number within the chunk. */
+    pos = (uint32)(((uint64_t)t * psg->bl_cps_inv) >> 16);
+    phase = (pos >> (16 - 5)) & (BL_PHASES - 1);
+    pos = psg->bl_pos + (pos >> 16);
+
+    v = amp & psg->channel_masks[0][ch];
+    if(v != psg->bl_out[0][ch]) {
+        bl_step(psg->bl_buf[0], pos, phase, v - psg->bl_out[0][ch]);
+        psg->bl_out[0][ch] = v;
+    }
+
+    if(!psg->bl_stereo)
+        return;
+
+    v = amp & psg->channel_masks[1][ch];
+    if(v != psg->bl_out[1][ch]) {
+        bl_step(psg->bl_buf[1], pos, phase, v - psg->bl_out[1][ch]);
+        psg->bl_out[1][ch] = v;
+    }
+}
+
+static __INLINE__ int32 bl_tone_amp(sn76489_t *psg, int ch) {
+    return ((psg->enabled_channels >> ch) & 0x01) * psg->tone_state[ch] *
+        volume_values[psg->volume[ch]];
+}
+
+static __INLINE__ int32 bl_noise_amp(sn76489_t *psg) {
+    return ((psg->enabled_channels >> 3) & 0x01) * (psg->noise_shift & 0x01) *
+        volume_values[psg->volume[3]];
+}
+
+static void bl_clock_noise(sn76489_t *psg, int32 t) {
+    psg->tone_state[3] = -psg->tone_state[3];
+
+    if(psg->tone_state[3] == 1) {
+        if(psg->noise & 0x04) {
+            psg->noise_shift = (psg->noise_shift >> 1) |
+                (parity(psg->noise_shift & psg->noise_tapped) <<
+                (psg->noise_bits - 1));
+        }
+        else {
+            psg->noise_shift = (psg->noise_shift >> 1) |
+                ((psg->noise_shift & 0x01) << (psg->noise_bits - 1));
+        }
+
+        bl_level(psg, 3, bl_noise_amp(psg), t);
+    }
+}
+
+static void bl_chunk(sn76489_t *psg, int16 *buf, uint32 samples) {
+    int32 span = (int32)(samples * psg->bl_cps), t, period;
+    int32 *bufl = psg->bl_buf[0], *bufr = psg->bl_buf[1];
+    uint32 i, j, pos;
+    int noise_on_tone2 = ((psg->noise & 0x03) == 0x03), n;
+
+    /* Pick up anything the registers did since the last call. */
+    for(j = 0; j < 3; ++j) {
+        bl_level(psg, j, bl_tone_amp(psg, j), 0);
+    }
+
+    bl_level(psg, 3, bl_noise_amp(psg), 0);
+
+    for(j = 0; j < 3; ++j) {
+        t = psg->bl_count[j];
+        period = psg->tone[j] ? psg->tone[j] << 16 : 0x10000;
+
+        if(psg->tone[j] < 7) {
+            /* The PSG doesn't change states if the tone isn't at least 7,
+               this fixes the "Sega" at the beginning of Sonic The Hedgehog 2
+               for the Game Gear. */
+            if(t < span && psg->tone_state[j] != 1) {
+                psg->tone_state[j] = 1;
+                bl_level(psg, j, bl_tone_amp(psg, j), t);
+            }
+        }
+        else if(((psg->enabled_channels >> j) & 0x01) &&
+                psg->volume[j] != 0x0F) {
+            for(; t < span; t += period) {
+                psg->tone_state[j] = -psg->tone_state[j];
+                bl_level(psg, j, bl_tone_amp(psg, j), t);
+
+                if(j == 2 && noise_on_tone2)
+                    bl_clock_noise(psg, t);
+            }
+        }
+
+        if(j == 2 && noise_on_tone2) {
+            for(; t < span; t += period) {
+                if(psg->tone[2] >= 7)
+                    psg->tone_state[2] = -psg->tone_state[2];
+
+                bl_clock_noise(psg, t);
+            }
+        }
+        else if(t < span) {
+            /* Nothing to hear, so just keep the phase right. */
+            n = (span - t + period - 1) / period;
+            t += n * period;
+
+            if((n & 1) && psg->tone[j] >= 7)
+                psg->tone_state[j] = -psg->tone_state[j];
+        }
+
+        psg->bl_count[j] = t - span;
+    }
+
+    if(noise_on_tone2) {
+        psg->bl_count[3] = psg->bl_count[2];
+    }
+    else {
+        period = 0x100000 << (psg->noise & 0x03);
+
+        for(t = psg->bl_count[3]; t < span; t += period) {
+            bl_clock_noise(psg, t);
+        }
+
+        psg->bl_count[3] = t - span;
+    }
+
+    /* Integrate the chunk's steps. */
+    pos = psg->bl_pos;
+
+    if(psg->bl_stereo) {
+        for(i = 0; i < samples; ++i, ++pos) {
+            psg->bl_sum[0] += bufl[pos & BL_MASK];
+            psg->bl_sum[1] += bufr[pos & BL_MASK];
+            bufl[pos & BL_MASK] = bufr[pos & BL_MASK] = 0;
+            buf[i << 1] = (int16)psg->bl_sum[0];
+            buf[(i << 1) + 1] = (int16)psg->bl_sum[1];
+        }
+    }
+    else {
+        for(i = 0; i < samples; ++i, ++pos) {
+            psg->bl_sum[0] += bufl[pos & BL_MASK];
+            bufl[pos & BL_MASK] = 0;
+            buf[i << 1] = buf[(i << 1) + 1] = (int16)psg->bl_sum[0];
+        }
+    }
+
+    psg->bl_pos = pos;
+}
+
+/* Transition-driven version of sn76489_execute_samples(). The channels are
+   clocked in whole PSG clocks (clock / 16), kept as 16.16 counts of clocks
+   until each channel's next edge, and only the edges of audible channels do
+   any work: each level change goes into a band-limited step buffer, which is
+   integrated once per output sample. Everything is integer math, so the
+   output is the same on every host. */
+static void execute_band_limited(sn76489_t *psg, int16 *buf,
+                                 uint32 samples) {
+    uint32 j, n;
+
+    if(psg->bl_resync) {
+        for(j = 0; j < 4; ++j) {
+            psg->bl_count[j] = (int32)(psg->counter[j] * 65536.0f);
+        }
+
+        psg->bl_resync = 0;
+    }
+
+    /* Once a stereo setting shows up, start tracking the right side on its
+       own, starting from where the left side was. */
+    if(!psg->bl_stereo && psg->output_channels != 0xFF) {
+        memcpy(psg->bl_buf[1], psg->bl_buf[0], sizeof(psg->bl_buf[0]));
+        memcpy(psg->bl_out[1], psg->bl_out[0], sizeof(psg->bl_out[0]));
+        psg->bl_sum[1] = psg->bl_sum[0];
+        psg->bl_stereo = 1;
+    }
+
+    while(samples) {
+        n = samples > SN76489_BL_CHUNK ? SN76489_BL_CHUNK : samples;
+        bl_chunk(psg, buf, n);
+        buf += n << 1;
+        samples -= n;
+    }
+
+    /* Keep the float counters current for save states and in case the normal
+       synthesis gets switched back on. */
+    for(j = 0; j < 4; ++j) {
+        psg->counter[j] = psg->bl_count[j] / 65536.0f;
+    }
+}
+
 void sn76489_execute_samples(sn76489_t *psg, int16 *buf,
                              uint32 samples) {
     int32 channels[4];
     uint32 i, j;
 
+    if(psg->band_limited) {
+        execute_band_limited(psg, buf, samples);
+        return;
+    }
+
     for(i = 0; i < samples; ++i) {
         for(j = 0; j < 3; ++j) {
             psg->counter[j] -= psg->clocks_per_sample;
@@ -279,7 +633,7 @@ void sn76489_execute_samples_dc(sn76489_t *psg, int16 *bufl,
 }
 #endif
 
-void sn76489_set_output_channels(sn76489_t *psg, uint8 data) {
+static void set_output(sn76489_t *psg, uint8 data) {
     psg->output_channels = data;
 
     memset(psg->channel_masks[0], 0, 4 * sizeof(uint32));
@@ -309,3 +663,103 @@ void sn76489_set_output_channels(sn76489_t *psg, uint8 data) {
     if(psg->output_channels & NOISE_RIGHT)
         psg->channel_masks[1][3] = 0xFFFFFFFF;
 }
+
+void sn76489_set_output_channels(sn76489_t *psg, uint8 data) {
+#ifndef _arch_dreamcast
+    if(psg->cycles && log_write(psg, 1, data))
+        return;
+#endif
+
+    set_output(psg, data);
+}
+
+#ifndef _arch_dreamcast
+
+static void apply_logent(sn76489_t *psg, const sn76489_logent_t *ent) {
+    if(ent->stereo)
+        set_output(psg, ent->data);
+    else
+        write_reg(psg, ent->data);
+}
+
+static void drop_log(sn76489_t *psg, uint32 count) {
+    psg->log_count -= count;
+
+    if(psg->log_count)
+        memmove(psg->log, psg->log + count,
+                psg->log_count * sizeof(sn76489_logent_t));
+}
+
+void sn76489_set_band_limited(sn76489_t *psg, int enable) {
+    if(enable && !psg->band_limited)
+        psg->bl_resync = 1;
+
+    psg->band_limited = enable ? 1 : 0;
+}
+
+void sn76489_set_logging(sn76489_t *psg, int (*cycles)(void)) {
+    /* Don't lose anything that was queued up with the old setting. */
+    if(psg->cycles)
+        sn76489_flush_log(psg, 0x7FFFFFFF);
+
+    psg->cycles = cycles;
+    psg->log_count = 0;
+}
+
+/* Synthesize samples worth of output covering the cycles from start to end,
+   applying each logged write that happened before end at the sample that
+   corresponds to its cycle stamp. Writes stamped at or after end (the Z80 can
+   overshoot the end of a frame by an instruction) are left in the log. */
+void sn76489_execute_logged(sn76489_t *psg, int16 *buf, uint32 samples,
+                            int32 start, int32 end) {
+    uint32 i, pos = 0, next;
+    int32 span = end - start;
+    sn76489_logent_t *ent;
+
+    for(i = 0; i < psg->log_count; ++i) {
+        ent = &psg->log[i];
+
+        if(ent->cycle >= end)
+            break;
+
+        if(ent->cycle <= start || span <= 0)
+            next = 0;
+        else
+            next = (uint32)(ent->cycle - start) * samples / (uint32)span;
+
+        if(next > pos) {
+            sn76489_execute_samples(psg, buf + (pos << 1), next - pos);
+            pos = next;
+        }
+
+        apply_logent(psg, ent);
+    }
+
+    drop_log(psg, i);
+
+    if(pos < samples)
+        sn76489_execute_samples(psg, buf + (pos << 1), samples - pos);
+}
+
+/* Apply every logged write that happened before end without generating any
+   output, for when the PSG output is disabled. */
+void sn76489_flush_log(sn76489_t *psg, int32 end) {
+    uint32 i;
+
+    for(i = 0; i < psg->log_count && psg->log[i].cycle < end; ++i) {
+        apply_logent(psg, &psg->log[i]);
+    }
+
+    drop_log(psg, i);
+}
+
+/* Rebase whatever is left in the log onto the next frame's cycle count. */
+void sn76489_end_frame(sn76489_t *psg, int32 cycles) {
+    uint32 i;
+
+    for(i = 0; i < psg->log_count; ++i) {
+        psg->log[i].cycle -= cycles;
+    }
+}
+
+#endif
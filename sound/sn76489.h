@@ -24,6 +24,25 @@
 
 CLINKAGE
 
+#ifndef _arch_dreamcast
+/* Number of register writes that can be logged before they get applied
+   immediately instead. A frame's worth of PSG writes is normally well under a
+   few hundred, even for sample-playback tricks. */
+#define SN76489_LOG_SIZE    2048
+
+/* Band-limited synthesis works on up to SN76489_BL_CHUNK samples at a time,
+   adding steps into a ring per side that has to hold a chunk plus the length
+   of the step kernel. The ring size must be a power of two. */
+#define SN76489_BL_CHUNK    512
+#define SN76489_BL_RING     1024
+
+typedef struct sn76489_logent {
+    int32 cycle;
+    uint8 stereo;
+    uint8 data;
+} sn76489_logent_t;
+#endif
+
 typedef struct sn76489_struct {
     uint8 volume[4];
     uint16 tone[3];
@@ -45,6 +64,27 @@ typedef struct sn76489_struct {
     uint32 channel_masks[2][4];
 
     float clocks_per_sample;
+
+#ifndef _arch_dreamcast
+    /* Cycle-stamped register log. When cycles is non-NULL, writes are queued
+       with the value it returns and applied at the matching sample position
+       by sn76489_execute_logged(). */
+    int (*cycles)(void);
+    uint32 log_count;
+    sn76489_logent_t log[SN76489_LOG_SIZE];
+
+    /* Band-limited synthesis, see sn76489_set_band_limited(). */
+    uint8 band_limited;
+    uint8 bl_resync;
+    uint8 bl_stereo;
+    uint32 bl_cps;
+    uint32 bl_cps_inv;
+    int32 bl_count[4];
+    int32 bl_out[2][4];
+    int32 bl_buf[2][SN76489_BL_RING];
+    int32 bl_sum[2];
+    uint32 bl_pos;
+#endif
 } sn76489_t;
 
 #define LATCH_TONE0 0x00
@@ -91,6 +131,14 @@ void sn76489_write(sn76489_t *psg, uint8 byte);
 #ifndef _arch_dreamcast
 void sn76489_execute_samples(sn76489_t *psg, int16 *buf,
                              uint32 samples);
+
+void sn76489_set_band_limited(sn76489_t *psg, int enable);
+
+void sn76489_set_logging(sn76489_t *psg, int (*cycles)(void));
+void sn76489_execute_logged(sn76489_t *psg, int16 *buf, uint32 samples,
+                            int32 start, int32 end);
+void sn76489_flush_log(sn76489_t *psg, int32 end);
+void sn76489_end_frame(sn76489_t *psg, int32 cycles);
 #else
 void sn76489_execute_samples_dc(sn76489_t *psg, int16 *bufl,
                                 int16 *bufr, uint32 samples);
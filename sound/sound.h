@@ -24,10 +24,41 @@
 
 CLINKAGE
 
+/* Rate that every core synthesizes at. Output running at some other rate gets
+   converted on its way out (see sound_output_init() below). */
+#define SOUND_CORE_RATE     44100
+
+/* Most samples (per channel) a core makes in one frame, at 50fps. */
+#define SOUND_FRAME_MAX     (SOUND_CORE_RATE / 50)
+
 int sound_init(int channels, int region);
 void sound_shutdown(void);
 #ifndef _arch_dreamcast
 void sound_update_buffer(int16 *buf, int length);
+
+/* Zero-copy alternative to sound_update_buffer(). sound_reserve() returns room
+   for length bytes of samples (never NULL; if the output can't take them, they
+   go to a scratch buffer and get dropped), and sound_commit() sends out the
+   first length bytes of it. Nothing else may be sent out in between, and no
+   reservation may be over SOUND_RESERVE_MAX bytes. */
+#define SOUND_RESERVE_MAX   (2048 << 1)
+
+int16 *sound_reserve(int length);
+void sound_commit(int length);
+
+/* sound_update_buffer(), sound_reserve() and sound_commit() are shared by
+   every output (see output.c), and convert the cores' samples to the rate the
+   output runs at when that isn't SOUND_CORE_RATE. An output calls
+   sound_output_init() from its sound_init() with the rate it runs at, and
+   sound_output_reset() from its sound_reset_buffer(). It takes the converted
+   samples with sound_dev_reserve() and sound_dev_commit(), which work just
+   like sound_reserve() and sound_commit(). */
+int sound_output_init(int channels, int rate);
+void sound_output_shutdown(void);
+void sound_output_reset(void);
+
+int16 *sound_dev_reserve(int length);
+void sound_dev_commit(int length);
 #else
 void sound_update_buffer_noint(int16 *bufl, int16 *bufr, int16 *fmbuf,
                                int length);
@@ -52,6 +52,7 @@ to do:
 */
 
 #include "ym2413.h"
+#include "ym2413-tab.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -447,6 +448,36 @@ static void advance_lfo(YM2413 *fm)
 	fm->LFO_PM = (fm->lfo_pm_cnt>>LFO_SH) & 7;
 }
 
+/* Phase Generator */
+INLINE void advance_phase(YM2413 *fm, struct OPLL_CH *CH, struct OPLL_SLOT *op)
+{
+	if(op->vib)
+	{
+		UINT8 block;
+
+		unsigned int fnum_lfo   = 8*((CH->block_fnum&0x01c0) >> 6);
+		unsigned int block_fnum = CH->block_fnum * 2;
+		signed int lfo_fn_table_index_offset = lfo_pm_table[fm->LFO_PM + fnum_lfo ];
+
+		if (lfo_fn_table_index_offset)  /* LFO phase modulation active */
+		{
+			block_fnum += lfo_fn_table_index_offset;
+			block = (block_fnum&0x1c00) >> 10;
+			op->phase += (fm->fn_tab[block_fnum&0x03ff] >> (7-block)) * op->mul;
+		}
+		else    /* LFO phase modulation  = zero */
+		{
+			op->phase += op->freq;
+		}
+	}
+	else    /* LFO phase modulation disabled for this operator */
+	{
+		op->phase += op->freq;
+	}
+}
+
+static void advance_noise(YM2413 *fm);
+
 /* advance to next sample */
 static void advance(YM2413 *fm)
 {
@@ -465,6 +496,9 @@ static void advance(YM2413 *fm)
 
 		for (i=0; i<9*2; i++)
 		{
+			if (fm->idle_slots & (1 << i))
+				continue;
+
 			CH  = &fm->P_CH[i/2];
 
 			op  = &CH->SLOT[i&1];
@@ -613,31 +647,16 @@ static void advance(YM2413 *fm)
 		CH  = &fm->P_CH[i/2];
 		op  = &CH->SLOT[i&1];
 
-		/* Phase Generator */
-		if(op->vib)
-		{
-			UINT8 block;
+		advance_phase(fm, CH, op);
+	}
 
-			unsigned int fnum_lfo   = 8*((CH->block_fnum&0x01c0) >> 6);
-			unsigned int block_fnum = CH->block_fnum * 2;
-			signed int lfo_fn_table_index_offset = lfo_pm_table[fm->LFO_PM + fnum_lfo ];
+	advance_noise(fm);
+}
 
-			if (lfo_fn_table_index_offset)  /* LFO phase modulation active */
-			{
-				block_fnum += lfo_fn_table_index_offset;
-				block = (block_fnum&0x1c00) >> 10;
-				op->phase += (fm->fn_tab[block_fnum&0x03ff] >> (7-block)) * op->mul;
-			}
-			else    /* LFO phase modulation  = zero */
-			{
-				op->phase += op->freq;
-			}
-		}
-		else    /* LFO phase modulation disabled for this operator */
-		{
-			op->phase += op->freq;
-		}
-	}
+/* advance the noise generator by one sample */
+static void advance_noise(YM2413 *fm)
+{
+	unsigned int i;
 
 	/*  The Noise Generator of the YM3812 is 23-bit shift register.
 	*   Period is equal to 2^23-2 samples.
@@ -677,18 +696,18 @@ static void advance(YM2413 *fm)
 }
 
 
-static int op_calc(YM2413 *fm, UINT32 phase, unsigned int env, signed int pm, unsigned int wave_tab)
+static int op_calc(UINT32 phase, unsigned int env, signed int pm, unsigned int wave_tab)
 {
 	UINT32 p;
 
-	p = (env<<5) + fm->sin_tab[wave_tab + ((((signed int)((phase & ~FREQ_MASK) + (pm<<17))) >> FREQ_SH ) & SIN_MASK) ];
+	p = (env<<5) + sin_tab[wave_tab + ((((signed int)((phase & ~FREQ_MASK) + (pm<<17))) >> FREQ_SH ) & SIN_MASK) ];
 
 	if (p >= TL_TAB_LEN)
 		return 0;
-	return fm->tl_tab[p];
+	return tl_tab[p];
 }
 
-static int op_calc1(YM2413 *fm, UINT32 phase, unsigned int env, signed int pm, unsigned int wave_tab)
+static int op_calc1(UINT32 phase, unsigned int env, signed int pm, unsigned int wave_tab)
 {
 	UINT32 p;
 	INT32  i;
@@ -697,13 +716,13 @@ static int op_calc1(YM2413 *fm, UINT32 phase, unsigned int env, signed int pm, u
 
 /*logerror("i=%08x (i>>16)&511=%8i phase=%i [pm=%08x] ",i, (i>>16)&511, phase>>FREQ_SH, pm);*/
 
-	p = (env<<5) + fm->sin_tab[ wave_tab + ((i>>FREQ_SH) & SIN_MASK)];
+	p = (env<<5) + sin_tab[ wave_tab + ((i>>FREQ_SH) & SIN_MASK)];
 
 /*logerror("(p&255=%i p>>8=%i) out= %i\n", p&255,p>>8, tl_tab[p&255]>>(p>>8) );*/
 
 	if (p >= TL_TAB_LEN)
 		return 0;
-	return fm->tl_tab[p];
+	return tl_tab[p];
 }
 
 
@@ -732,7 +751,7 @@ static void chan_calc(YM2413 *fm, struct OPLL_CH *CH)
 	{
 		if (!SLOT->fb_shift)
 			out = 0;
-		SLOT->op1_out[1] = op_calc1(fm, SLOT->phase, env, (out<<SLOT->fb_shift), SLOT->wavetable );
+		SLOT->op1_out[1] = op_calc1(SLOT->phase, env, (out<<SLOT->fb_shift), SLOT->wavetable );
 	}
 
 	/* SLOT 2 */
@@ -740,7 +759,7 @@ static void chan_calc(YM2413 *fm, struct OPLL_CH *CH)
 	env = volume_calc(fm, SLOT);
 	if( env < ENV_QUIET )
 	{
-		fm->output[0] += op_calc(fm, SLOT->phase, env, phase_modulation, SLOT->wavetable);
+		fm->output[0] += op_calc(SLOT->phase, env, phase_modulation, SLOT->wavetable);
 	}
 }
 
@@ -811,14 +830,14 @@ static void rhythm_calc(YM2413 *fm, struct OPLL_CH *CH, unsigned int noise)
 	{
 		if (!SLOT->fb_shift)
 			out = 0;
-		SLOT->op1_out[1] = op_calc1(fm, SLOT->phase, env, (out<<SLOT->fb_shift), SLOT->wavetable );
+		SLOT->op1_out[1] = op_calc1(SLOT->phase, env, (out<<SLOT->fb_shift), SLOT->wavetable );
 	}
 
 	/* SLOT 2 */
 	SLOT++;
 	env = volume_calc(fm, SLOT);
 	if( env < ENV_QUIET )
-		fm->output[1] += op_calc(fm, SLOT->phase, env, phase_modulation, SLOT->wavetable) * 2;
+		fm->output[1] += op_calc(SLOT->phase, env, phase_modulation, SLOT->wavetable) * 2;
 
 
 	/* Phase generation is based on: */
@@ -885,7 +904,7 @@ static void rhythm_calc(YM2413 *fm, struct OPLL_CH *CH, unsigned int noise)
 				phase = 0xd0>>2;
 		}
 
-		fm->output[1] += op_calc(fm, phase<<FREQ_SH, env, 0, SLOT7_1->wavetable) * 2;
+		fm->output[1] += op_calc(phase<<FREQ_SH, env, 0, SLOT7_1->wavetable) * 2;
 	}
 
 	/* Snare Drum (verified on real YM3812) */
@@ -906,13 +925,13 @@ static void rhythm_calc(YM2413 *fm, struct OPLL_CH *CH, unsigned int noise)
 		if (noise)
 			phase ^= 0x100;
 
-		fm->output[1] += op_calc(fm, phase<<FREQ_SH, env, 0, SLOT7_2->wavetable) * 2;
+		fm->output[1] += op_calc(phase<<FREQ_SH, env, 0, SLOT7_2->wavetable) * 2;
 	}
 
 	/* Tom Tom (verified on real YM3812) */
 	env = volume_calc(fm, SLOT8_1);
 	if( env < ENV_QUIET )
-		fm->output[1] += op_calc(fm, SLOT8_1->phase, env, 0, SLOT8_1->wavetable) * 2;
+		fm->output[1] += op_calc(SLOT8_1->phase, env, 0, SLOT8_1->wavetable) * 2;
 
 	/* Top Cymbal (verified on real YM2413) */
 	env = volume_calc(fm, SLOT8_2);
@@ -939,7 +958,7 @@ static void rhythm_calc(YM2413 *fm, struct OPLL_CH *CH, unsigned int noise)
 		if (res2)
 			phase = 0x300;
 
-		fm->output[1] += op_calc(fm, phase<<FREQ_SH, env, 0, SLOT8_2->wavetable) * 2;
+		fm->output[1] += op_calc(phase<<FREQ_SH, env, 0, SLOT8_2->wavetable) * 2;
 	}
 
 }
@@ -1209,6 +1228,8 @@ static void write_reg(YM2413 *fm, int r, int v)
 	r &= 0xff;
 	v &= 0xff;
 
+	fm->idle_dirty = 1;
+
 	switch(r&0xf0)
 	{
 	case 0x00:  /* 00-0f:control */
@@ -1455,32 +1476,168 @@ static void write_reg(YM2413 *fm, int r, int v)
 	}
 }
 
-//-------------------------------------------------
-//  sound_stream_update - handle a stream update
-//-------------------------------------------------
+/*  An operator is idle when its envelope generator has nothing left to do
+    (off, a melody modulator parked in release, or a sustain that can't move)
+    and it's too quiet to be heard even with full AM. Registers only change
+    between updates, so anything idle at the start of an update stays idle
+    for all of it, and leaving it out changes nothing but its phase.
+*/
+static int slot_idle(YM2413 *fm, struct OPLL_SLOT *op, int i)
+{
+	switch(op->state)
+	{
+	case EG_OFF:
+		break;
 
-static void sound_stream_update(YM2413 *fm, INT16 *buf, int samples)
+	case EG_SUS:
+		if (!op->eg_type && op->volume < MAX_ATT_INDEX)
+			return 0;
+		break;
+
+	case EG_REL:
+		if ( (i&1) || ((fm->rhythm&0x20) && (i>=12)) )
+			return 0;
+		break;
+
+	default:
+		return 0;
+	}
+
+	return (UINT32)(op->TLL + op->volume) >= ENV_QUIET;
+}
+
+/*  Work out which operators and channels can be left out of this update. A
+    channel can be skipped when both of its operators are idle and the
+    feedback history has run out, since chan_calc() wouldn't do anything
+    then. Bit 9 covers rhythm_calc(), which only keeps the bass drum's
+    feedback.
+*/
+static void find_idle(YM2413 *fm)
 {
-	for(int i=0; i < samples ; i++ )
+	struct OPLL_CH *CH;
+	int i;
+
+	/*  Only a register write can wake something that's idle, so the old
+	    answer is safe until then. Things go idle on their own as notes
+	    release though, so take another look every so often. */
+	if (!fm->idle_dirty && fm->idle_check--)
+		return;
+
+	fm->idle_dirty = 0;
+	fm->idle_check = 15;
+	fm->idle_slots = 0;
+	fm->idle_chans = 0;
+
+	for (i=0; i<9*2; i++)
 	{
-		fm->output[0] = 0;
-		fm->output[1] = 0;
+		if (slot_idle(fm, &fm->P_CH[i/2].SLOT[i&1], i))
+			fm->idle_slots |= 1 << i;
+	}
+
+	for (i=0; i<9; i++)
+	{
+		CH = &fm->P_CH[i];
+
+		if ( ((fm->idle_slots >> (i*2)) & 3) == 3 &&
+			!CH->SLOT[SLOT1].op1_out[0] && !CH->SLOT[SLOT1].op1_out[1] )
+			fm->idle_chans |= 1 << i;
+	}
+
+	if ( (fm->idle_slots & 0x3f000) == 0x3f000 && (fm->idle_chans & 0x40) )
+		fm->idle_chans |= 0x200;
+}
+
+/*  Nothing can be heard and nothing but the counters can change, so only step
+    what has to be stepped. Vibrato needs the LFO each sample; everything
+    else just gets its whole phase increment at once.
+*/
+static void skip_samples(YM2413 *fm, int samples)
+{
+	struct OPLL_CH *CH;
+	struct OPLL_SLOT *op;
+	UINT32 vib = 0;
+	int i, j;
 
+	for (i=0; i<9*2; i++)
+	{
+		CH = &fm->P_CH[i/2];
+		op = &CH->SLOT[i&1];
+
+		if (op->vib)
+			vib |= 1 << i;
+		else
+			op->phase += op->freq * samples;
+	}
+
+	for (j=0; j<samples; j++)
+	{
 		advance_lfo(fm);
 
-		/* FM part */
-		for(int j=0; j<6; j++)
-			chan_calc(fm, &fm->P_CH[j]);
+		fm->eg_timer += fm->eg_timer_add;
 
-		if(!(fm->rhythm & 0x20))
+		while (fm->eg_timer >= fm->eg_timer_overflow)
 		{
-			for(int j=6; j<9; j++)
-				chan_calc(fm, &fm->P_CH[j]);
+			fm->eg_timer -= fm->eg_timer_overflow;
+			fm->eg_cnt++;
 		}
-		else        /* Rhythm part */
+
+		for (i=0; vib >> i; i++)
+		{
+			if (vib & (1 << i))
+				advance_phase(fm, &fm->P_CH[i/2], &fm->P_CH[i/2].SLOT[i&1]);
+		}
+
+		advance_noise(fm);
+	}
+}
+
+/* all channels (or the rhythm section) have to be computed unless idle */
+INLINE void calc_sample(YM2413 *fm)
+{
+	fm->output[0] = 0;
+	fm->output[1] = 0;
+
+	advance_lfo(fm);
+
+	/* FM part */
+	for(int j=0; j<6; j++)
+	{
+		if (!(fm->idle_chans & (1 << j)))
+			chan_calc(fm, &fm->P_CH[j]);
+	}
+
+	if(!(fm->rhythm & 0x20))
+	{
+		for(int j=6; j<9; j++)
 		{
-			rhythm_calc(fm, &fm->P_CH[0], fm->noise_rng & 1 );
+			if (!(fm->idle_chans & (1 << j)))
+				chan_calc(fm, &fm->P_CH[j]);
 		}
+	}
+	else if (!(fm->idle_chans & 0x200))   /* Rhythm part */
+	{
+		rhythm_calc(fm, &fm->P_CH[0], fm->noise_rng & 1 );
+	}
+}
+
+//-------------------------------------------------
+//  sound_stream_update - handle a stream update
+//-------------------------------------------------
+
+static void sound_stream_update(YM2413 *fm, INT16 *buf, int samples)
+{
+	find_idle(fm);
+
+	if ( fm->idle_slots == 0x3ffff && (fm->idle_chans & 0x3ff) == 0x3ff )
+	{
+		skip_samples(fm, samples);
+		memset(buf, 0, samples * 2 * sizeof(INT16));
+		return;
+	}
+
+	for(int i=0; i < samples ; i++ )
+	{
+		calc_sample(fm);
 
 		buf[i << 1] = limit( fm->output[0] , 32767, -32768 );
 		buf[(i << 1) + 1] = limit( fm->output[1] , 32767, -32768 );
@@ -1492,26 +1649,18 @@ static void sound_stream_update(YM2413 *fm, INT16 *buf, int samples)
 /* Added for CrabEmu's Dreamcast port. */
 static void sound_stream_update_mono(YM2413 *fm, INT16 *buf, int samples)
 {
-    for(int i=0; i < samples ; i++ )
-    {
-        fm->output[0] = 0;
-        fm->output[1] = 0;
-
-        advance_lfo(fm);
+    find_idle(fm);
 
-        /* FM part */
-        for(int j=0; j<6; j++)
-            chan_calc(fm, &fm->P_CH[j]);
+    if(fm->idle_slots == 0x3ffff && (fm->idle_chans & 0x3ff) == 0x3ff)
+    {
+        skip_samples(fm, samples);
+        memset(buf, 0, samples * sizeof(INT16));
+        return;
+    }
 
-        if(!(fm->rhythm & 0x20))
-        {
-            for(int j=6; j<9; j++)
-                chan_calc(fm, &fm->P_CH[j]);
-        }
-        else        /* Rhythm part */
-        {
-            rhythm_calc(fm, &fm->P_CH[0], fm->noise_rng & 1 );
-        }
+    for(int i=0; i < samples ; i++ )
+    {
+        calc_sample(fm);
 
         buf[i] = limit(fm->output[0] + fm->output[1], 32767, -32767);
         advance(fm);
@@ -1528,59 +1677,8 @@ static void device_start(YM2413 *fm, int clock, int rate)
 
 	//m_stream = machine().sound().stream_alloc(*this,0,2,rate);
 
-	for (int x=0; x<TL_RES_LEN; x++)
-	{
-		double m = (1<<16) / pow(2, (x+1) * (ENV_STEP/4.0) / 8.0);
-		m = floor(m);
-
-		/* we never reach (1<<16) here due to the (x+1) */
-		/* result fits within 16 bits at maximum */
-
-		int n = (int)m; /* 16 bits here */
-		n >>= 4;        /* 12 bits here */
-		if (n&1)        /* round to nearest */
-			n = (n>>1)+1;
-		else
-			n = n>>1;
-						/* 11 bits here (rounded) */
-		fm->tl_tab[ x*2 + 0 ] = n;
-		fm->tl_tab[ x*2 + 1 ] = -fm->tl_tab[ x*2 + 0 ];
-
-		for (int i=1; i<11; i++)
-		{
-			fm->tl_tab[ x*2+0 + i*2*TL_RES_LEN ] =  fm->tl_tab[ x*2+0 ]>>i;
-			fm->tl_tab[ x*2+1 + i*2*TL_RES_LEN ] = -fm->tl_tab[ x*2+0 + i*2*TL_RES_LEN ];
-		}
-	}
-
-	for (int i=0; i<SIN_LEN; i++)
-	{
-		/* non-standard sinus */
-		double m = sin( ((i*2)+1) * M_PI / SIN_LEN ); /* checked against the real chip */
-
-		/* we never reach zero here due to ((i*2)+1) */
-
-		double o = 8*log(1.0/fabs(m))/log(2.0);  /* convert to 'decibels' */
-
-		o = o / (ENV_STEP/4);
-
-		int n = (int)(2.0*o);
-		if (n&1)                        /* round to nearest */
-			n = (n>>1)+1;
-		else
-			n = n>>1;
-
-		/* waveform 0: standard sinus  */
-		fm->sin_tab[ i ] = n*2 + (m>=0.0? 0: 1 );
-
-		/* waveform 1:  __      __     */
-		/*             /  \____/  \____*/
-		/* output only first half of the sinus waveform (positive one) */
-		if (i & (1<<(SIN_BITS-1)) )
-			fm->sin_tab[1*SIN_LEN+i] = TL_TAB_LEN;
-		else
-			fm->sin_tab[1*SIN_LEN+i] = fm->sin_tab[i];
-	}
+	/* tl_tab and sin_tab don't depend on the clock, so they're generated ahead
+	   of time by tools/gentables.c, and live in ym2413-tab.h. */
 
 	/* make fnumber -> increment counter table */
 	for( int i = 0 ; i < 1024; i++ )
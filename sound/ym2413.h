@@ -114,12 +114,6 @@ enum {
 };
 
 typedef struct ym2413_s {
-	int tl_tab[TL_TAB_LEN];
-
-	/* sin waveform table in 'decibel' scale */
-	/* two waveforms on OPLL type chips */
-	unsigned int sin_tab[SIN_LEN * 2];
-
 	struct OPLL_CH P_CH[9];         /* OPLL chips have 9 channels*/
 	UINT8   instvol_r[9];           /* instrument/volume (or volume/volume in percussive mode)*/
 
@@ -156,6 +150,11 @@ typedef struct ym2413_s {
 
 	UINT8 address;                  /* address register             */
 
+	UINT32  idle_slots;             /* operators that can't change or be heard right now */
+	UINT32  idle_chans;             /* channels (bit 9 = rhythm) that can be skipped */
+	UINT8   idle_dirty;             /* registers written since idle_slots was found */
+	UINT8   idle_check;             /* updates left until idle_slots is looked at again */
+
 	signed int output[2];
 } YM2413;
 
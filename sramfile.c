@@ -0,0 +1,298 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef _arch_dreamcast
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#include "sramfile.h"
+
+#ifndef _arch_dreamcast
+
+/* Cart RAM and an EEPROM is as many as any one console has. */
+#define MAX_REGIONS 4
+
+typedef struct sramfile_region {
+    void *addr;
+    size_t len;
+    dev_t dev;
+    ino_t ino;
+} sramfile_region_t;
+
+static sramfile_region_t regions[MAX_REGIONS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_t thd;
+static int running = 0, quit = 0, interval = 0;
+
+static size_t page_round(size_t len) {
+    size_t pg = (size_t)sysconf(_SC_PAGESIZE);
+
+    return (len + pg - 1) & ~(pg - 1);
+}
+
+void *sramfile_alloc(size_t len) {
+    void *ptr;
+
+    /* Anonymous mappings are zeroed and page aligned, and nothing else will
+       end up sharing their pages. */
+    ptr = mmap(NULL, page_round(len), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+void sramfile_free(void *ptr, size_t len) {
+    if(!ptr)
+        return;
+
+    sramfile_unmap(ptr);
+    munmap(ptr, page_round(len));
+}
+
+static void *flush_thread(void *data __UNUSED__) {
+    struct timeval now;
+    struct timespec until;
+    int i;
+
+    pthread_mutex_lock(&lock);
+
+    while(!quit) {
+        gettimeofday(&now, NULL);
+        until.tv_sec = now.tv_sec + interval / 1000;
+        until.tv_nsec = now.tv_usec * 1000L + (interval % 1000) * 1000000L;
+
+        if(until.tv_nsec >= 1000000000L) {
+            until.tv_nsec -= 1000000000L;
+            ++until.tv_sec;
+        }
+
+        if(pthread_cond_timedwait(&wake, &lock, &until) != ETIMEDOUT)
+            continue;
+
+        /* Only dirty pages actually get written, so this is cheap if the game
+           hasn't saved anything. */
+        for(i = 0; i < MAX_REGIONS; ++i) {
+            if(regions[i].addr)
+                msync(regions[i].addr, regions[i].len, MS_SYNC);
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int sramfile_set_interval(int ms) {
+    if(ms < 0)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+    interval = ms;
+
+    if(ms && !running) {
+        quit = 0;
+
+        if(pthread_create(&thd, NULL, &flush_thread, NULL)) {
+#ifdef DEBUG
+            fprintf(stderr, "sramfile_set_interval: Cannot create thread!\n");
+#endif
+            interval = 0;
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+
+        running = 1;
+    }
+    else if(!ms && running) {
+        quit = 1;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+        pthread_join(thd, NULL);
+        running = 0;
+        return 0;
+    }
+    else {
+        /* Start waiting again with the new interval. */
+        pthread_cond_signal(&wake);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+static sramfile_region_t *find_region(const void *addr) {
+    int i;
+
+    for(i = 0; i < MAX_REGIONS; ++i) {
+        if(regions[i].addr == addr)
+            return &regions[i];
+    }
+
+    return NULL;
+}
+
+int sramfile_map(void *addr, size_t len, const char *fn) {
+    sramfile_region_t *r;
+    struct stat st;
+    ssize_t got = 0;
+    void *ptr;
+    int fd;
+
+    if(!interval || !addr || !len || !fn)
+        return -1;
+
+    if((uintptr_t)addr % (size_t)sysconf(_SC_PAGESIZE))
+        return -1;
+
+    sramfile_unmap(addr);
+
+    if((fd = open(fn, O_RDWR | O_CREAT, 0644)) < 0)
+        return -1;
+
+    if(fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+
+    /* Make the file the full size, so the whole mapping has something behind
+       it. This is the only time it gets copied. */
+    if((size_t)st.st_size < len) {
+        if(st.st_size)
+            got = pread(fd, addr, (size_t)st.st_size, 0);
+
+        if(got < 0 || pwrite(fd, addr, len, 0) != (ssize_t)len) {
+#ifdef DEBUG
+            fprintf(stderr, "sramfile_map: Couldn't fill out %s\n", fn);
+#endif
+            close(fd);
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&lock);
+
+    if(!(r = find_region(NULL))) {
+        pthread_mutex_unlock(&lock);
+        close(fd);
+        return -1;
+    }
+
+    ptr = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+               0);
+
+    if(ptr != addr) {
+        /* A failed MAP_FIXED can leave the old pages gone, so put some back,
+           with what the file has in them. */
+        mmap(addr, page_round(len), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        got = pread(fd, addr, len, 0);
+        pthread_mutex_unlock(&lock);
+        close(fd);
+#ifdef DEBUG
+        fprintf(stderr, "sramfile_map: Couldn't map %s\n", fn);
+#endif
+        return -1;
+    }
+
+    close(fd);
+
+    r->addr = addr;
+    r->len = len;
+    r->dev = st.st_dev;
+    r->ino = st.st_ino;
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+void sramfile_unmap(void *addr) {
+    sramfile_region_t *r;
+    uint8 *tmp;
+
+    pthread_mutex_lock(&lock);
+
+    if(!addr || !(r = find_region(addr))) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    msync(addr, r->len, MS_SYNC);
+
+    /* Swap the file out for ordinary memory with the same contents. */
+    tmp = (uint8 *)malloc(r->len);
+
+    if(tmp)
+        memcpy(tmp, addr, r->len);
+
+    mmap(addr, page_round(r->len), PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+    if(tmp) {
+        memcpy(addr, tmp, r->len);
+        free(tmp);
+    }
+
+    r->addr = NULL;
+    pthread_mutex_unlock(&lock);
+}
+
+int sramfile_sync(const void *addr, const char *fn) {
+    sramfile_region_t *r;
+    struct stat st;
+    int rv = -1;
+
+    if(!fn || stat(fn, &st))
+        return -1;
+
+    pthread_mutex_lock(&lock);
+
+    if(addr && (r = find_region(addr)) && r->dev == st.st_dev &&
+       r->ino == st.st_ino)
+        rv = msync(r->addr, r->len, MS_SYNC) ? -1 : 0;
+
+    pthread_mutex_unlock(&lock);
+    return rv;
+}
+
+#else
+
+void *sramfile_alloc(size_t len) {
+    return calloc(1, len);
+}
+
+void sramfile_free(void *ptr, size_t len __UNUSED__) {
+    free(ptr);
+}
+
+#endif /* !_arch_dreamcast */
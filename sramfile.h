@@ -0,0 +1,85 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef SRAMFILE_H
+#define SRAMFILE_H
+
+#include <stddef.h>
+#include "CrabEmu.h"
+
+CLINKAGE
+
+/* Battery backed memory that lives in its save file. Once turned on (by
+   giving sramfile_set_interval() something other than 0), a console's cart
+   RAM or EEPROM can be mapped over its save file, in place, so everything
+   the game writes goes straight to the file. A thread msync()s every mapped
+   file at the given interval, so a crash loses at most that much, and the
+   emulation thread never has to write anything out.
+
+   The memory is mapped at the address it's already at, so nothing pointing
+   into it has to change. That means it has to own whole pages, so it has to
+   be SRAMFILE_ALIGNED with a size that's a multiple of SRAMFILE_PAGE_SIZE, or
+   come from sramfile_alloc(). Anything else just fails to map, and the
+   console can fall back to reading and writing the file as usual. */
+
+#if defined(__GNUC__) && !defined(_arch_dreamcast)
+/* Big enough for 4KiB and 16KiB pages. */
+#define SRAMFILE_PAGE_SIZE  16384
+#define SRAMFILE_ALIGNED    __attribute__((aligned(SRAMFILE_PAGE_SIZE)))
+#else
+#define SRAMFILE_PAGE_SIZE  32
+#define SRAMFILE_ALIGNED
+#endif
+
+/* Round a size up so it can be used with SRAMFILE_ALIGNED. */
+#define SRAMFILE_ROUND(len) \
+    (((len) + SRAMFILE_PAGE_SIZE - 1) & ~(SRAMFILE_PAGE_SIZE - 1))
+
+/* Zeroed memory that can be mapped, and freeing it (which unmaps it first if
+   it's mapped). These work everywhere, the rest only outside of the DC. */
+extern void *sramfile_alloc(size_t len);
+extern void sramfile_free(void *ptr, size_t len);
+
+#ifndef _arch_dreamcast
+
+/* Flush mapped files every ms milliseconds. 0 (the default) turns the whole
+   thing off: nothing new gets mapped, though anything already mapped stays
+   that way until it's unmapped. */
+extern int sramfile_set_interval(int ms);
+
+/* Map the file fn over the len bytes at addr. If the file is shorter than
+   that, what's there is read in and the rest of the file is filled out from
+   what's in memory now, so a new file starts out as whatever the console
+   initialized the memory to. Anything already mapped at addr gets unmapped
+   first. Returns 0 if the memory now lives in the file, -1 if not. */
+extern int sramfile_map(void *addr, size_t len, const char *fn);
+
+/* Flush the file and put ordinary memory back, with the same contents. Does
+   nothing if addr isn't mapped. */
+extern void sramfile_unmap(void *addr);
+
+/* If addr is mapped to fn, flush it and return 0. Otherwise (including if fn
+   is some other file) return -1, and the caller should write fn itself. */
+extern int sramfile_sync(const void *addr, const char *fn);
+
+#endif /* !_arch_dreamcast */
+
+ENDCLINK
+
+#endif /* !SRAMFILE_H */
@@ -0,0 +1,462 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _arch_dreamcast
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef __APPLE__
+#include "fmemopen/open_memstream.h"
+#endif
+#endif
+
+#include "statesave.h"
+
+#ifndef _arch_dreamcast
+
+typedef struct statesave_job {
+    struct statesave_job *next;
+    uint8 *buf;
+    size_t len;
+    statesave_done_t done;
+    void *data;
+    char fn[];
+} statesave_job_t;
+
+static statesave_job_t *head = NULL, *tail = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static pthread_t thd;
+static int running = 0, quit = 0, busy = 0;
+
+static int write_file(const statesave_job_t *j) {
+    char *tmp;
+    FILE *fp;
+    const uint8 *out = j->buf;
+    size_t len = j->len;
+    int rv = 0;
+#ifndef NO_ZLIB
+    uint8 *comp;
+    z_stream zs;
+
+    /* The fastest level zlib has; states are mostly RAM and VRAM, which
+       shrink plenty even at this level. */
+    memset(&zs, 0, sizeof(zs));
+
+    if(deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, MAX_WBITS + 16, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+
+    len = deflateBound(&zs, (uLong)j->len);
+
+    if(!(comp = (uint8 *)malloc(len))) {
+        deflateEnd(&zs);
+        return -1;
+    }
+
+    zs.next_in = j->buf;
+    zs.avail_in = (uInt)j->len;
+    zs.next_out = comp;
+    zs.avail_out = (uInt)len;
+
+    if(deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&zs);
+        free(comp);
+        return -1;
+    }
+
+    len = zs.total_out;
+    out = comp;
+    deflateEnd(&zs);
+#endif
+
+    if(!(tmp = (char *)malloc(strlen(j->fn) + 5))) {
+        rv = -1;
+        goto free_comp;
+    }
+
+    sprintf(tmp, "%s.tmp", j->fn);
+
+    if(!(fp = fopen(tmp, "wb"))) {
+        rv = -1;
+        goto free_tmp;
+    }
+
+    if(fwrite(out, 1, len, fp) != len || fflush(fp) || fsync(fileno(fp)))
+        rv = -1;
+
+    if(fclose(fp))
+        rv = -1;
+
+    /* Only replace the old state once the new one is all there. */
+    if(rv || rename(tmp, j->fn)) {
+#ifdef DEBUG
+        fprintf(stderr, "statesave: Couldn't write %s\n", j->fn);
+#endif
+        remove(tmp);
+        rv = -1;
+    }
+
+free_tmp:
+    free(tmp);
+free_comp:
+#ifndef NO_ZLIB
+    free(comp);
+#endif
+    return rv;
+}
+
+static void finish_job(statesave_job_t *j) {
+    int rv = write_file(j);
+
+    if(j->done)
+        j->done(rv, j->data);
+
+    free(j->buf);
+    free(j);
+}
+
+static void *statesave_thread(void *data __UNUSED__) {
+    statesave_job_t *j;
+
+    pthread_mutex_lock(&lock);
+
+    for(;;) {
+        while(!head && !quit)
+            pthread_cond_wait(&work, &lock);
+
+        /* Anything queued still gets written before quitting. */
+        if(!head)
+            break;
+
+        j = head;
+        if(!(head = j->next))
+            tail = NULL;
+
+        busy = 1;
+        pthread_mutex_unlock(&lock);
+
+        finish_job(j);
+
+        pthread_mutex_lock(&lock);
+        busy = 0;
+
+        if(!head)
+            pthread_cond_broadcast(&idle);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int statesave_async(const char *fn, int (*write_state)(FILE *fp),
+                    statesave_done_t done, void *data) {
+    statesave_job_t *j;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp;
+    int rv;
+
+    if(!fn || !write_state)
+        return -1;
+
+    if(!(j = (statesave_job_t *)malloc(sizeof(statesave_job_t) +
+                                        strlen(fn) + 1)))
+        return -1;
+
+    if(!(fp = open_memstream(&buf, &len))) {
+        free(j);
+        return -1;
+    }
+
+    rv = write_state(fp);
+
+    if(fclose(fp) && !rv)
+        rv = -1;
+
+    if(rv) {
+        free(buf);
+        free(j);
+        return rv;
+    }
+
+    j->next = NULL;
+    j->buf = (uint8 *)buf;
+    j->len = len;
+    j->done = done;
+    j->data = data;
+    strcpy(j->fn, fn);
+
+    pthread_mutex_lock(&lock);
+
+    if(!running) {
+        quit = 0;
+
+        if(pthread_create(&thd, NULL, &statesave_thread, NULL)) {
+            pthread_mutex_unlock(&lock);
+#ifdef DEBUG
+            fprintf(stderr, "statesave_async: Cannot create thread!\n");
+#endif
+            /* Better a hitch than no save at all. */
+            finish_job(j);
+            return 0;
+        }
+
+        running = 1;
+    }
+
+    if(tail)
+        tail->next = j;
+    else
+        head = j;
+
+    tail = j;
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+void statesave_flush(void) {
+    pthread_mutex_lock(&lock);
+
+    while(head || busy)
+        pthread_cond_wait(&idle, &lock);
+
+    pthread_mutex_unlock(&lock);
+}
+
+void statesave_shutdown(void) {
+    pthread_mutex_lock(&lock);
+
+    if(!running) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    quit = 1;
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(thd, NULL);
+    running = 0;
+}
+
+#ifndef NO_ZLIB
+static int inflate_state(const uint8 *data, size_t len, statesave_buf_t *buf) {
+    z_stream zs;
+    uint32 size;
+
+    /* The gzip trailer says how big it is, so it all goes in one buffer. That
+       comes straight from the file, so don't believe anything too big. */
+    BUF_TO_UINT32(data + len - 4, size);
+
+    if(!size || size > STATESAVE_MAX_LEN ||
+       !(buf->data = (uint8 *)malloc(size)))
+        return -1;
+
+    memset(&zs, 0, sizeof(zs));
+
+    if(inflateInit2(&zs, MAX_WBITS + 16) != Z_OK) {
+        statesave_release(buf);
+        return -1;
+    }
+
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = (uInt)len;
+    zs.next_out = buf->data;
+    zs.avail_out = size;
+
+    if(inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out != size) {
+        inflateEnd(&zs);
+        statesave_release(buf);
+        return -1;
+    }
+
+    inflateEnd(&zs);
+    buf->len = size;
+    return 0;
+}
+#endif
+
+int statesave_read(const char *fn, statesave_buf_t *buf) {
+    struct stat st;
+    uint8 *data;
+    size_t len, got;
+    ssize_t rv;
+    int fd;
+
+    buf->data = NULL;
+    buf->len = 0;
+
+    statesave_flush();
+
+    if((fd = open(fn, O_RDONLY)) < 0)
+        return -1;
+
+    if(fstat(fd, &st) || !st.st_size || st.st_size > STATESAVE_MAX_LEN ||
+       !(data = (uint8 *)malloc((size_t)st.st_size))) {
+        close(fd);
+        return -1;
+    }
+
+    /* One read for the whole thing. Reading beats mapping it here, since
+       states are small enough that setting up and tearing down the mapping
+       costs more than the copy. */
+    len = (size_t)st.st_size;
+
+    for(got = 0; got < len; got += rv) {
+        if((rv = read(fd, data + got, len - got)) <= 0)
+            break;
+    }
+
+    close(fd);
+
+    if(got != len) {
+        free(data);
+        return -1;
+    }
+
+#ifndef NO_ZLIB
+    if(len > 18 && data[0] == 0x1F && data[1] == 0x8B) {
+        rv = inflate_state(data, len, buf);
+        free(data);
+        return (int)rv;
+    }
+#endif
+
+    buf->data = data;
+    buf->len = len;
+    return 0;
+}
+
+void statesave_release(statesave_buf_t *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+}
+
+#endif /* !_arch_dreamcast */
+
+int statesave_version(const uint8 *buf, size_t len) {
+    if(len < STATESAVE_HEADER_LEN || memcmp(buf, "CrabEmu Save State", 18) ||
+       buf[18] != 0)
+        return -2;
+
+    return buf[19];
+}
+
+static const statesave_reader_t *find_reader(const statesave_reader_t *r,
+                                             uint32 fourcc) {
+    for(; r->read; ++r) {
+        if(r->fourcc == fourcc)
+            return r;
+    }
+
+    return NULL;
+}
+
+int statesave_check(const uint8 *buf, size_t len,
+                    const statesave_reader_t *readers) {
+    const statesave_reader_t *r;
+    const uint8 *ptr, *end = buf + len;
+    uint32 fourcc, blen;
+    uint16 flags;
+    int rv;
+
+    for(ptr = buf; ptr < end; ptr += blen) {
+        if(end - ptr < 16)
+            return -1;
+
+        BUF_TO_UINT32(ptr, fourcc);
+        BUF_TO_UINT32(ptr + 4, blen);
+
+        if(blen < 16 || blen > (size_t)(end - ptr))
+            return -1;
+
+        if((r = find_reader(readers, fourcc))) {
+            if((rv = r->read(ptr, blen, 0))) {
+#ifdef DEBUG
+                printf("Error parsing block %c%c%c%c\n", ptr[0], ptr[1],
+                       ptr[2], ptr[3]);
+#endif
+                return rv;
+            }
+
+            continue;
+        }
+
+        /* See if its marked as essential... */
+        BUF_TO_UINT16(ptr + 10, flags);
+        if(flags & 1) {
+#ifdef DEBUG
+            printf("Unknown block %c%c%c%c, bailing out!\n", ptr[0], ptr[1],
+                   ptr[2], ptr[3]);
+#endif
+            return -1;
+        }
+
+#ifdef DEBUG
+        printf("Ignoring unknown block %c%c%c%c\n", ptr[0], ptr[1], ptr[2],
+               ptr[3]);
+#endif
+    }
+
+    return 0;
+}
+
+int statesave_load(const uint8 *buf, size_t len,
+                   const statesave_reader_t *readers) {
+    const statesave_reader_t *r;
+    const uint8 *ptr, *end = buf + len;
+    uint32 fourcc, blen;
+    int rv;
+
+    for(ptr = buf; ptr < end; ptr += blen) {
+        BUF_TO_UINT32(ptr, fourcc);
+        BUF_TO_UINT32(ptr + 4, blen);
+
+        if((r = find_reader(readers, fourcc)) && (rv = r->read(ptr, blen, 1)))
+            return rv;
+    }
+
+    return 0;
+}
+
+int statesave_walk(const uint8 *buf, size_t len,
+                   const statesave_reader_t *readers) {
+    int rv;
+
+    /* Make sure all of it will load before loading any of it. */
+    if((rv = statesave_check(buf, len, readers)))
+        return rv;
+
+    return statesave_load(buf, len, readers);
+}
@@ -0,0 +1,114 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef STATESAVE_H
+#define STATESAVE_H
+
+#include <stdio.h>
+#include "CrabEmu.h"
+
+CLINKAGE
+
+/* Save states written off of the emulation thread. statesave_async() has the
+   console write its state into memory, which only takes as long as copying
+   it, then hands that to a worker thread. The worker compresses it (with
+   zlib, as a gzip file, unless built with NO_ZLIB), writes it to a temporary
+   file and renames that over the real one, so a state file is never left
+   half written.
+
+   Loading works on one buffer holding the whole state: statesave_read()
+   reads the file in one go (inflating it, if it was compressed) and the
+   console walks the blocks in place with statesave_walk(), handing each
+   one's reader a pointer straight into the buffer. */
+
+/* "CrabEmu Save State", a 0 and the version. */
+#define STATESAVE_HEADER_LEN    20
+
+/* The biggest state statesave_read() will take, before or after inflating
+   it. The largest real ones are under 64KB. */
+#define STATESAVE_MAX_LEN       (1024 * 1024)
+
+typedef struct statesave_buf {
+    uint8 *data;
+    size_t len;
+} statesave_buf_t;
+
+/* One kind of block a console can load, and the function that loads it. The
+   reader gets a pointer to the start of the block and its length. With load
+   set to 0, it only checks that it could load the block (the length first,
+   before touching anything past the header) and changes nothing. Tables of
+   these end with an entry that has a NULL read. */
+typedef struct statesave_reader {
+    uint32 fourcc;
+    int (*read)(const uint8 *buf, uint32 len, int load);
+} statesave_reader_t;
+
+/* Check the header on a state, returning the format version, or -2 if it
+   isn't a save state at all. */
+extern int statesave_version(const uint8 *buf, size_t len);
+
+/* Make sure the blocks in buf (the part of a version 2 state after the
+   header, or a block's children) are all there, that there's a reader for
+   every one marked as essential, and that each reader would take its block,
+   without loading anything. Returns 0 if so, -1 if the blocks don't add up,
+   or the first error from a reader. */
+extern int statesave_check(const uint8 *buf, size_t len,
+                           const statesave_reader_t *readers);
+
+/* Load each block in buf with its reader, skipping those nobody reads. Only
+   for blocks that statesave_check() already passed. */
+extern int statesave_load(const uint8 *buf, size_t len,
+                          const statesave_reader_t *readers);
+
+/* Both of the above, so a state that fails the check leaves everything as it
+   was. */
+extern int statesave_walk(const uint8 *buf, size_t len,
+                          const statesave_reader_t *readers);
+
+#ifndef _arch_dreamcast
+
+/* Called from the worker thread once the file is written (rv is 0) or
+   writing it failed (rv is -1). */
+typedef void (*statesave_done_t)(int rv, void *data);
+
+/* Get the whole state in fn into buf, waiting for anything still queued to
+   be written first, so this always sees the latest state. Compressed states
+   come back inflated. Returns 0 on success, -1 on failure.
+   statesave_release() frees the buffer again. */
+extern int statesave_read(const char *fn, statesave_buf_t *buf);
+extern void statesave_release(statesave_buf_t *buf);
+
+/* Capture a state with write_state() right now and queue it to be written
+   to fn. If this returns 0, done (if not NULL) gets called once it's on disk
+   or has failed. Otherwise, nothing was queued and done won't be called; the
+   return value is whatever write_state() returned, or -1. */
+extern int statesave_async(const char *fn, int (*write_state)(FILE *fp),
+                           statesave_done_t done, void *data);
+
+/* Wait for everything queued so far to be written. */
+extern void statesave_flush(void);
+
+/* Write anything left and stop the worker thread. */
+extern void statesave_shutdown(void);
+
+#endif /* !_arch_dreamcast */
+
+ENDCLINK
+
+#endif /* !STATESAVE_H */
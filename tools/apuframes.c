@@ -0,0 +1,142 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Checks that the NES APU gives the same number of samples every frame, no
+   matter how long the frame is in CPU cycles. The frontends take
+   SOUND_CORE_RATE / 60 samples per frame from the NES, so any fewer and their
+   buffers run dry. Also checks that a register write lands at the sample
+   matching the cycle it was made on.
+
+   Build with something like:
+   cc -O2 -DIN_CRABEMU -I. -Isound -Isound/nes_apu -Iconsoles/nes \
+       tools/apuframes.c sound/nes_apu/nes_apu.c */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "CrabEmu.h"
+#include "nes_apu.h"
+#include "sound.h"
+
+#define FRAME_SAMPLES   (SOUND_CORE_RATE / 60)
+#define FRAMES          600
+
+/* nes.c runs 113 cycles a line: 262 lines a frame normally, one more when
+   stepping a line at a time. A real NTSC frame is 29780.5 cycles. */
+static const uint32 frame_cycles[] = { 113 * 262, 113 * 263, 29781 };
+
+static int cycle;
+
+/* What nes_apu.c needs from the rest of the NES. */
+int nes_cycles_elapsed(void) {
+    return cycle;
+}
+
+uint8 nes_mem_read(void *cpu __UNUSED__, uint16 addr __UNUSED__) {
+    return 0;
+}
+
+void nes_burn_cycles(int cycles __UNUSED__) {
+}
+
+void nes_assert_irq(void) {
+}
+
+static int16 buf[FRAME_SAMPLES * 2];
+
+/* Write to the APU as if at the given cycle of the frame. */
+static void write_at(int c, uint16 addr, uint8 data) {
+    cycle = c;
+    apu_write(addr, data);
+}
+
+/* Turn on the first pulse channel, halfway through a frame of the given
+   length, and find the first sample that isn't silent. */
+static int first_sound(uint32 cycles) {
+    int i;
+
+    apu_reset();
+
+    write_at(0, 0x4015, 0x00);
+    apu_run(buf, FRAME_SAMPLES, cycles);
+
+    write_at(0, 0x4000, 0xBF);
+    write_at(0, 0x4002, 0xFD);
+    write_at(cycles / 2, 0x4015, 0x01);
+    write_at(cycles / 2, 0x4003, 0x08);
+    apu_run(buf, FRAME_SAMPLES, cycles);
+
+    for(i = 0; i < FRAME_SAMPLES; ++i) {
+        if(buf[i])
+            return i;
+    }
+
+    return -1;
+}
+
+int main(void) {
+    apu_t *apu;
+    int i, f, n, fail = 0;
+    long total;
+
+    if(!(apu = apu_create(SOUND_CORE_RATE, 60, 16, FALSE))) {
+        fprintf(stderr, "apu_create failed\n");
+        return 1;
+    }
+
+    for(i = 0; i < 3; ++i) {
+        apu_reset();
+        total = 0;
+
+        for(f = 0; f < FRAMES; ++f) {
+            write_at((f * 997) % frame_cycles[i], 0x4015, f & 1);
+
+            if((n = apu_run(buf, FRAME_SAMPLES, frame_cycles[i])) !=
+               FRAME_SAMPLES) {
+                printf("%u cycle frames: frame %d gave %d samples\n",
+                       (unsigned)frame_cycles[i], f, n);
+                fail = 1;
+                break;
+            }
+
+            total += n;
+        }
+
+        printf("%u cycle frames: %ld samples in %d frames (%d expected)\n",
+               (unsigned)frame_cycles[i], total, FRAMES,
+               FRAME_SAMPLES * FRAMES);
+
+        if(total != (long)FRAME_SAMPLES * FRAMES)
+            fail = 1;
+
+        /* A write halfway through the frame lands halfway through its
+           samples, give or take the few samples the pulse takes to get
+           going. */
+        n = first_sound(frame_cycles[i]);
+        printf("  write at half frame first heard at sample %d of %d\n", n,
+               FRAME_SAMPLES);
+
+        if(n < FRAME_SAMPLES / 2 || n > FRAME_SAMPLES / 2 + 8)
+            fail = 1;
+    }
+
+    apu_destroy(apu);
+    printf("%s\n", fail ? "FAIL" : "OK");
+    return fail;
+}
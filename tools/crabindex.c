@@ -0,0 +1,172 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Command line front end to the ROM library indexer. Scans each directory
+   given, updates the index file, and prints what's in it.
+
+   Build with something like:
+   cc -DIN_CRABEMU -I. -Iconsoles/sms -Iconsoles/nes -Iconsoles/colecovision \
+      -Icpu/CrabZ80 -Iutils/minizip \
+      tools/crabindex.c romindex.c rom.c gamedb.c consoles/sms/mappers.c \
+      utils/minizip/unzip.c utils/minizip/ioapi.c -lz -lbz2 -lpthread */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "CrabEmu.h"
+#include "console.h"
+#include "romindex.h"
+#include "gamedb.h"
+
+static const char *console_name(int console) {
+    switch(console) {
+        case CONSOLE_SMS:
+            return "SMS";
+
+        case CONSOLE_GG:
+            return "GG";
+
+        case CONSOLE_SG1000:
+            return "SG-1000";
+
+        case CONSOLE_SC3000:
+            return "SC-3000";
+
+        case CONSOLE_COLECOVISION:
+            return "Coleco";
+
+        case CONSOLE_NES:
+            return "NES";
+
+        case CONSOLE_CHIP8:
+            return "Chip-8";
+
+        default:
+            return "-";
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-j threads] [-i index] [-d gamedb] [-q] "
+            "dir...\n"
+            "  -j  Number of threads to use (default: one per CPU)\n"
+            "  -i  Index file to read and update (default: romindex.dat)\n"
+            "  -d  Game database to look mappers up in (from gamedbc)\n"
+            "  -q  Don't list the index when done\n", argv0);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    const char *fn = "romindex.dat";
+    romindex_t idx;
+    romindex_entry_t *ent;
+    int threads = 0, quiet = 0, ch, i, rv = 0;
+    uint32 j, roms = 0;
+    double start;
+
+    while((ch = getopt(argc, argv, "j:i:d:qh")) != -1) {
+        switch(ch) {
+            case 'j':
+                threads = atoi(optarg);
+                break;
+
+            case 'i':
+                fn = optarg;
+                break;
+
+            case 'd':
+                if(gamedb_open(optarg)) {
+                    fprintf(stderr, "%s: couldn't read %s\n", argv[0],
+                            optarg);
+                    return 1;
+                }
+                break;
+
+            case 'q':
+                quiet = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* A missing or unreadable index just means starting from scratch. */
+    romindex_load(&idx, fn);
+
+    for(i = optind; i < argc; ++i) {
+        start = now();
+
+        if(romindex_scan(&idx, argv[i], threads)) {
+            fprintf(stderr, "%s: couldn't scan %s\n", argv[0], argv[i]);
+            rv = 1;
+            continue;
+        }
+
+        fprintf(stderr, "%s: %" PRIu32 " read, %" PRIu32 " unchanged, "
+                "%.1f ms\n", argv[i], (uint32_t)idx.scanned,
+                (uint32_t)idx.reused, (now() - start) * 1000.0);
+    }
+
+    if(romindex_save(&idx, fn)) {
+        fprintf(stderr, "%s: couldn't write %s\n", argv[0], fn);
+        rv = 1;
+    }
+
+    for(j = 0; j < idx.count; ++j) {
+        ent = &idx.entries[j];
+
+        if(ent->console <= 0)
+            continue;
+
+        ++roms;
+
+        if(quiet)
+            continue;
+
+        printf("%08" PRIX32 " %08" PRIX32 " %-7s %3d %X %s\n",
+               (uint32_t)ent->crc32, (uint32_t)ent->adler32,
+               console_name(ent->console),
+               ent->mapper == (uint32)-1 ? -1 : (int)ent->mapper,
+               ent->region, ent->path);
+    }
+
+    fprintf(stderr, "%" PRIu32 " ROMs in %" PRIu32 " files\n",
+            (uint32_t)roms, (uint32_t)idx.count);
+
+    romindex_free(&idx);
+    gamedb_close();
+    return rv;
+}
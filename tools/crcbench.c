@@ -0,0 +1,107 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Times the ROM checksum code over the range of sizes ROMs actually come in,
+   against the bit at a time CRC32 that rom.c used to have.
+
+   Build with something like:
+   cc -O2 -DIN_CRABEMU -I. -Iconsoles/sms -Iconsoles/nes \
+      -Iconsoles/colecovision -Icpu/CrabZ80 -Iutils/minizip \
+      tools/crcbench.c rom.c utils/minizip/unzip.c utils/minizip/ioapi.c \
+      -lz -lbz2 -lpthread */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "CrabEmu.h"
+#include "rom.h"
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32 bitwise_crc32(const uint8 *data, uint32 size) {
+    uint32 i, j, rv = 0xFFFFFFFF;
+
+    for(i = 0; i < size; ++i) {
+        rv ^= data[i];
+
+        for(j = 0; j < 8; ++j) {
+            rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
+        }
+    }
+
+    return ~rv;
+}
+
+/* MB/s for the given function, run for long enough to mean something. */
+#define TIME_IT(expr, size, out) { \
+    uint32 n_ = 0; \
+    double s_ = now(), e_; \
+    do { \
+        sink ^= (expr); \
+        ++n_; \
+        e_ = now(); \
+    } while(e_ - s_ < 0.2); \
+    out = (double)(size) * n_ / (e_ - s_) / 1048576.0; \
+}
+
+int main(void) {
+    uint8 *buf;
+    uint32 size, i, crc, adler;
+    volatile uint32 sink = 0;
+    double old, c, a, both;
+
+    if(!(buf = (uint8 *)malloc(4 << 20)))
+        return 1;
+
+    srand(1);
+
+    for(i = 0; i < (4 << 20); ++i) {
+        buf[i] = (uint8)rand();
+    }
+
+    printf("%8s %10s %10s %10s %10s %8s\n", "size", "bitwise", "crc32",
+           "adler32", "both", "speedup");
+
+    for(size = 8 << 10; size <= (4 << 20); size <<= 1) {
+        if(bitwise_crc32(buf, size) != rom_crc32(buf, size)) {
+            printf("CRC mismatch at %u bytes!\n", (unsigned)size);
+            return 1;
+        }
+
+        TIME_IT(bitwise_crc32(buf, size), size, old);
+        TIME_IT(rom_crc32(buf, (int)size), size, c);
+        TIME_IT(rom_adler32(buf, size), size, a);
+        TIME_IT((rom_checksums(buf, size, &crc, &adler), crc ^ adler), size,
+                both);
+
+        printf("%7uK %8.0f/s %8.0f/s %8.0f/s %8.0f/s %7.1fx\n",
+               (unsigned)(size >> 10), old, c, a, both, both / old);
+    }
+
+    printf("(MB/s; speedup is both checksums against the old CRC alone)\n");
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,634 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Compiles the text game database (gamedb.txt) into the hashed binary form
+   that gamedb.c reads. See gamedb.txt for the source format and gamedb.h for
+   the binary one. After writing the output, it's read back in and every game
+   is looked up to make sure it can be found.
+
+   Build with something like:
+   cc -DIN_CRABEMU -I. -Iconsoles/sms -Iconsoles/nes -Iconsoles/colecovision \
+      -Icpu/CrabZ80 -Iutils/minizip \
+      tools/gamedbc.c gamedb.c rom.c utils/minizip/unzip.c \
+      utils/minizip/ioapi.c -lz -lbz2 -lpthread */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "CrabEmu.h"
+#include "console.h"
+#include "gamedb.h"
+#include "smsmem.h"
+
+#define MAX_DISP    0xFFFF
+
+typedef struct game {
+    gamedb_entry_t ent;
+    char *name;
+    uint32 name_off;
+    int line;
+} game_t;
+
+typedef struct name_map {
+    const char *name;
+    int value;
+} name_map_t;
+
+static const name_map_t consoles[] = {
+    { "any", CONSOLE_NULL },
+    { "sms", CONSOLE_SMS },
+    { "gg", CONSOLE_GG },
+    { "sg1000", CONSOLE_SG1000 },
+    { "sc3000", CONSOLE_SC3000 },
+    { "coleco", CONSOLE_COLECOVISION },
+    { "nes", CONSOLE_NES },
+    { "chip8", CONSOLE_CHIP8 },
+    { NULL, 0 }
+};
+
+static const name_map_t sms_mappers[] = {
+    { "none", SMS_MAPPER_NONE },
+    { "sega", SMS_MAPPER_SEGA },
+    { "codemasters", SMS_MAPPER_CODEMASTERS },
+    { "korean", SMS_MAPPER_KOREAN },
+    { "93c46", SMS_MAPPER_93C46 },
+    { "castle", SMS_MAPPER_CASTLE },
+    { "terebi", SMS_MAPPER_TEREBI_OEKAKI },
+    { "korean_msx", SMS_MAPPER_KOREAN_MSX },
+    { "4pak", SMS_MAPPER_4PAK_ALL_ACTION },
+    { "janggun", SMS_MAPPER_JANGGUN },
+    { "msx_a", SMS_MAPPER_TW_MSX_TYPE_A },
+    { "msx_b", SMS_MAPPER_TW_MSX_TYPE_B },
+    { NULL, 0 }
+};
+
+static const name_map_t regions[] = {
+    { "japan", REGION_JAPAN },
+    { "us", REGION_US },
+    { "europe", REGION_EUROPE },
+    { NULL, 0 }
+};
+
+static const name_map_t videos[] = {
+    { "ntsc", VIDEO_NTSC },
+    { "pal", VIDEO_PAL },
+    { NULL, 0 }
+};
+
+static const name_map_t srams[] = {
+    { "none", GAMEDB_SRAM_NONE },
+    { "battery", GAMEDB_SRAM_BATTERY },
+    { "93c46", GAMEDB_SRAM_93C46 },
+    { NULL, 0 }
+};
+
+static const name_map_t mirrors[] = {
+    { "h", GAMEDB_MIRROR_H },
+    { "v", GAMEDB_MIRROR_V },
+    { "4", GAMEDB_MIRROR_4 },
+    { NULL, 0 }
+};
+
+static const char *src_fn;
+static int errors = 0;
+
+static void error(int line, const char *msg, const char *what) {
+    fprintf(stderr, "%s:%d: %s%s%s\n", src_fn, line, msg, what ? ": " : "",
+            what ? what : "");
+    ++errors;
+}
+
+static int lookup(const name_map_t *map, const char *name, int *out) {
+    for(; map->name; ++map) {
+        if(!strcasecmp(map->name, name)) {
+            *out = map->value;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int parse_hex(const char *str, uint32 max, uint32 *out) {
+    char *end;
+    unsigned long v;
+
+    if(*str == '$')
+        ++str;
+
+    if(!isxdigit((unsigned char)*str))
+        return -1;
+
+    v = strtoul(str, &end, 16);
+
+    if(*end || v > max)
+        return -1;
+
+    *out = (uint32)v;
+    return 0;
+}
+
+/* Pull the next whitespace separated token out of the line, or the contents of
+   a quoted string if that's what's next. */
+static char *next_token(char **pos, int *quoted) {
+    char *p = *pos, *start;
+
+    while(isspace((unsigned char)*p))
+        ++p;
+
+    if(!*p || *p == '#')
+        return NULL;
+
+    if((*quoted = (*p == '"'))) {
+        start = ++p;
+
+        while(*p && *p != '"')
+            ++p;
+
+        if(!*p)
+            return NULL;
+    }
+    else {
+        start = p;
+
+        while(*p && !isspace((unsigned char)*p))
+            ++p;
+    }
+
+    if(*p)
+        *p++ = 0;
+
+    *pos = p;
+    return start;
+}
+
+static void parse_setting(game_t *g, char *tok) {
+    char *val = strchr(tok, '=');
+    int v, i;
+    uint32 hex;
+
+    if(!val) {
+        if(!strcasecmp(tok, "fm"))
+            g->ent.flags |= GAMEDB_FM;
+        else
+            error(g->line, "unknown setting", tok);
+
+        return;
+    }
+
+    *val++ = 0;
+
+    if(!strcasecmp(tok, "mapper")) {
+        /* NES mappers are just numbered, Sega ones have names too. */
+        if(!lookup(sms_mappers, val, &v) && g->ent.console != CONSOLE_NES)
+            g->ent.mapper = (uint16)v;
+        else if(*val && strspn(val, "0123456789") == strlen(val) &&
+                strtoul(val, NULL, 10) < GAMEDB_NO_MAPPER)
+            g->ent.mapper = (uint16)strtoul(val, NULL, 10);
+        else
+            error(g->line, "bad mapper", val);
+    }
+    else if(!strcasecmp(tok, "region")) {
+        if(lookup(regions, val, &v))
+            error(g->line, "bad region", val);
+        else
+            g->ent.region = (uint8)v;
+    }
+    else if(!strcasecmp(tok, "video")) {
+        if(lookup(videos, val, &v))
+            error(g->line, "bad video system", val);
+        else
+            g->ent.video = (uint8)v;
+    }
+    else if(!strcasecmp(tok, "sram")) {
+        if(lookup(srams, val, &v))
+            error(g->line, "bad sram type", val);
+        else
+            g->ent.sram = (uint8)v;
+    }
+    else if(!strcasecmp(tok, "mirror")) {
+        if(lookup(mirrors, val, &v))
+            error(g->line, "bad mirroring", val);
+        else
+            g->ent.flags = (g->ent.flags & ~(GAMEDB_MIRROR_H | GAMEDB_MIRROR_V |
+                                             GAMEDB_MIRROR_4)) | v;
+    }
+    else if(!strcasecmp(tok, "idle")) {
+        for(i = 0; i < GAMEDB_IDLE_PCS && g->ent.idle_pc[i]; ++i) {
+        }
+
+        if(i == GAMEDB_IDLE_PCS)
+            error(g->line, "too many idle loops", val);
+        else if(parse_hex(val, 0xFFFF, &hex) || !hex)
+            error(g->line, "bad idle loop PC", val);
+        else
+            g->ent.idle_pc[i] = (uint16)hex;
+    }
+    else {
+        error(g->line, "unknown setting", tok);
+    }
+}
+
+static int parse_line(char *buf, int line, game_t *g) {
+    char *pos = buf, *tok;
+    int quoted, v;
+    uint32 hex;
+
+    memset(g, 0, sizeof(game_t));
+    g->line = line;
+    g->ent.mapper = GAMEDB_NO_MAPPER;
+
+    if(!(tok = next_token(&pos, &quoted)))
+        return 0;
+
+    if(parse_hex(tok, 0xFFFFFFFF, &hex)) {
+        error(line, "bad CRC32", tok);
+        return 0;
+    }
+
+    g->ent.crc32 = hex;
+
+    if(!(tok = next_token(&pos, &quoted))) {
+        error(line, "missing Adler-32", NULL);
+        return 0;
+    }
+
+    if(strcmp(tok, "-") && parse_hex(tok, 0xFFFFFFFF, &g->ent.adler32)) {
+        error(line, "bad Adler-32", tok);
+        return 0;
+    }
+
+    if(!(tok = next_token(&pos, &quoted)) || lookup(consoles, tok, &v)) {
+        error(line, "bad or missing console", tok);
+        return 0;
+    }
+
+    g->ent.console = (uint8)v;
+
+    while((tok = next_token(&pos, &quoted))) {
+        if(quoted) {
+            g->name = strdup(tok);
+            break;
+        }
+
+        parse_setting(g, tok);
+    }
+
+    if(!g->name) {
+        error(line, "missing title", NULL);
+        return 0;
+    }
+
+    return 1;
+}
+
+static game_t *read_source(const char *fn, uint32 *count) {
+    FILE *fp;
+    char buf[1024];
+    game_t *games = NULL, *tmp;
+    uint32 n = 0, alloc = 0, i;
+    int line = 0;
+
+    if(!(fp = fopen(fn, "r"))) {
+        perror(fn);
+        return NULL;
+    }
+
+    while(fgets(buf, sizeof(buf), fp)) {
+        ++line;
+
+        if(n == alloc) {
+            alloc = alloc ? alloc << 1 : 256;
+
+            if(!(tmp = (game_t *)realloc(games, alloc * sizeof(game_t)))) {
+                perror("realloc");
+                exit(1);
+            }
+
+            games = tmp;
+        }
+
+        if(parse_line(buf, line, &games[n]))
+            ++n;
+    }
+
+    fclose(fp);
+
+    /* The hash only goes by CRC, so those have to be unique. */
+    for(i = 1; i < n; ++i) {
+        uint32 j;
+
+        for(j = 0; j < i; ++j) {
+            if(games[i].ent.crc32 == games[j].ent.crc32) {
+                error(games[i].line, "duplicate CRC32", games[j].name);
+                break;
+            }
+        }
+    }
+
+    *count = n;
+    return games;
+}
+
+static uint32 *sort_buckets;
+static uint32 *bucket_size;
+
+static int bucket_cmp(const void *a, const void *b) {
+    uint32 sa = bucket_size[*(const uint32 *)a];
+    uint32 sb = bucket_size[*(const uint32 *)b];
+
+    return sa < sb ? 1 : (sa > sb ? -1 : 0);
+}
+
+/* Hash and displace: put each CRC in a bucket, then for each bucket (biggest
+   first) find a displacement that puts all of its CRCs in free slots. With
+   four keys to a bucket on average that finds one quickly nearly always, and
+   if it doesn't, more buckets makes it easier. Returns the slot for each game
+   in slots, and the displacements in disp. */
+static int build_hash(const game_t *games, uint32 n, uint32 nb, uint16 *disp,
+                      uint32 *slots) {
+    uint32 *bucket = (uint32 *)malloc(n * sizeof(uint32));
+    uint8 *used = (uint8 *)calloc(n, 1);
+    uint32 *members = (uint32 *)malloc(n * sizeof(uint32));
+    uint32 i, j, k, b, d, m, s;
+    int rv = 0;
+
+    sort_buckets = (uint32 *)malloc(nb * sizeof(uint32));
+    bucket_size = (uint32 *)calloc(nb, sizeof(uint32));
+
+    if(!bucket || !used || !members || !sort_buckets || !bucket_size) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for(i = 0; i < n; ++i) {
+        bucket[i] = gamedb_hash(games[i].ent.crc32, 0) % nb;
+        ++bucket_size[bucket[i]];
+    }
+
+    for(b = 0; b < nb; ++b) {
+        sort_buckets[b] = b;
+        disp[b] = 0;
+    }
+
+    qsort(sort_buckets, nb, sizeof(uint32), &bucket_cmp);
+
+    for(j = 0; j < nb && !rv; ++j) {
+        b = sort_buckets[j];
+
+        if(!bucket_size[b])
+            break;
+
+        for(i = 0, m = 0; i < n; ++i) {
+            if(bucket[i] == b)
+                members[m++] = i;
+        }
+
+        for(d = 0; d <= MAX_DISP; ++d) {
+            for(k = 0; k < m; ++k) {
+                s = gamedb_hash(games[members[k]].ent.crc32, d + 1) % n;
+
+                if(used[s])
+                    break;
+
+                /* Claim it for now, so the rest of the bucket can't. */
+                used[s] = 1;
+                slots[members[k]] = s;
+            }
+
+            if(k == m)
+                break;
+
+            while(k--) {
+                used[slots[members[k]]] = 0;
+            }
+        }
+
+        if(d > MAX_DISP)
+            rv = -1;
+        else
+            disp[b] = (uint16)d;
+    }
+
+    free(sort_buckets);
+    free(bucket_size);
+    free(members);
+    free(used);
+    free(bucket);
+
+    return rv;
+}
+
+static int write_db(const char *fn, game_t *games, uint32 n, uint32 nb,
+                    const uint16 *disp, const uint32 *slots) {
+    uint8 hdr[GAMEDB_HDR_LEN];
+    uint8 *recs, *rec;
+    uint32 i, j, disp_off, recs_off, strs_off, strs_len = 1;
+    char tmpfn[1024];
+    FILE *fp;
+
+    /* Offset 0 of the string table is an empty string. */
+    for(i = 0; i < n; ++i) {
+        games[i].name_off = strs_len;
+        strs_len += (uint32)strlen(games[i].name) + 1;
+    }
+
+    disp_off = GAMEDB_HDR_LEN;
+    recs_off = (disp_off + nb * 2 + 3) & ~3;
+    strs_off = recs_off + n * GAMEDB_REC_LEN;
+
+    if(!(recs = (uint8 *)calloc(n ? n : 1, GAMEDB_REC_LEN))) {
+        perror("calloc");
+        return -1;
+    }
+
+    for(i = 0; i < n; ++i) {
+        const gamedb_entry_t *e = &games[i].ent;
+
+        rec = recs + slots[i] * GAMEDB_REC_LEN;
+        UINT32_TO_BUF(e->crc32, rec);
+        UINT32_TO_BUF(e->adler32, rec + 4);
+        rec[8] = e->console;
+        rec[9] = e->region;
+        rec[10] = e->video;
+        rec[11] = e->sram;
+        UINT16_TO_BUF(e->mapper, rec + 12);
+        UINT16_TO_BUF(e->flags, rec + 14);
+
+        for(j = 0; j < GAMEDB_IDLE_PCS; ++j) {
+            UINT16_TO_BUF(e->idle_pc[j], rec + 16 + j * 2);
+        }
+
+        UINT32_TO_BUF(games[i].name_off, rec + 20);
+    }
+
+    memcpy(hdr, "CRDB", 4);
+    UINT16_TO_BUF(GAMEDB_VERSION, hdr + 4);
+    UINT16_TO_BUF(GAMEDB_REC_LEN, hdr + 6);
+    UINT32_TO_BUF(n, hdr + 8);
+    UINT32_TO_BUF(nb, hdr + 12);
+    UINT32_TO_BUF(disp_off, hdr + 16);
+    UINT32_TO_BUF(recs_off, hdr + 20);
+    UINT32_TO_BUF(strs_off, hdr + 24);
+    UINT32_TO_BUF(strs_len, hdr + 28);
+
+    snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", fn);
+
+    if(!(fp = fopen(tmpfn, "wb"))) {
+        perror(tmpfn);
+        free(recs);
+        return -1;
+    }
+
+    fwrite(hdr, 1, GAMEDB_HDR_LEN, fp);
+
+    for(i = 0; i < nb; ++i) {
+        uint8 buf[2];
+
+        UINT16_TO_BUF(disp[i], buf);
+        fwrite(buf, 1, 2, fp);
+    }
+
+    for(i = disp_off + nb * 2; i < recs_off; ++i) {
+        fputc(0, fp);
+    }
+
+    fwrite(recs, GAMEDB_REC_LEN, n, fp);
+    fputc(0, fp);
+
+    for(i = 0; i < n; ++i) {
+        fwrite(games[i].name, 1, strlen(games[i].name) + 1, fp);
+    }
+
+    free(recs);
+
+    if(fclose(fp) || rename(tmpfn, fn)) {
+        perror(fn);
+        unlink(tmpfn);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Make sure everything can be found again, with everything intact. */
+static int verify_db(const char *fn, const game_t *games, uint32 n) {
+    gamedb_entry_t ent;
+    uint32 i;
+    int bad = 0;
+
+    if(gamedb_open(fn)) {
+        fprintf(stderr, "%s: couldn't read back the database\n", fn);
+        return -1;
+    }
+
+    for(i = 0; i < n; ++i) {
+        const gamedb_entry_t *e = &games[i].ent;
+
+        if(gamedb_find(e->crc32, e->adler32, &ent) ||
+           ent.console != e->console || ent.region != e->region ||
+           ent.video != e->video || ent.sram != e->sram ||
+           ent.mapper != e->mapper || ent.flags != e->flags ||
+           memcmp(ent.idle_pc, e->idle_pc, sizeof(ent.idle_pc)) ||
+           strcmp(ent.name, games[i].name)) {
+            fprintf(stderr, "%s: lookup of %08X (%s) failed\n", fn,
+                    (unsigned)e->crc32, games[i].name);
+            bad = 1;
+        }
+    }
+
+    gamedb_close();
+    return bad ? -1 : 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-q] source output\n"
+            "  -q  Don't print a summary when done\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    game_t *games;
+    uint32 n, nb, i, *slots;
+    uint16 *disp;
+    int ch, quiet = 0;
+
+    while((ch = getopt(argc, argv, "qh")) != -1) {
+        switch(ch) {
+            case 'q':
+                quiet = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    src_fn = argv[optind];
+
+    if(!(games = read_source(src_fn, &n)))
+        return 1;
+
+    if(errors) {
+        fprintf(stderr, "%s: %d error(s), no output written\n", src_fn,
+                errors);
+        return 1;
+    }
+
+    slots = (uint32 *)malloc((n ? n : 1) * sizeof(uint32));
+
+    for(nb = (n + 3) / 4 ? (n + 3) / 4 : 1;; nb <<= 1) {
+        if(!(disp = (uint16 *)malloc(nb * sizeof(uint16))) || !slots) {
+            perror("malloc");
+            return 1;
+        }
+
+        if(!n || !build_hash(games, n, nb, disp, slots))
+            break;
+
+        free(disp);
+    }
+
+    if(write_db(argv[optind + 1], games, n, nb, disp, slots) ||
+       verify_db(argv[optind + 1], games, n))
+        return 1;
+
+    if(!quiet)
+        fprintf(stderr, "%s: %u games, %u buckets\n", argv[optind + 1],
+                (unsigned)n, (unsigned)nb);
+
+    for(i = 0; i < n; ++i) {
+        free(games[i].name);
+    }
+
+    free(games);
+    free(slots);
+    free(disp);
+
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Writes out the constant lookup tables that the sound and video cores used
+   to build every time they started up, as static const arrays. That way they
+   end up in read-only data that every running copy shares, rather than in
+   each one's own dirty pages. The math here is the same as what the cores
+   did, so the tables come out exactly the same.
+
+   Usage: gentables table output
+   where table is one of ym2413, nes_apu, smsvdp or nesppu, and output is
+   sound/ym2413-tab.h, sound/nes_apu/nes_apu_tab.h, consoles/sms/smsvdp-tab.h
+   or consoles/nes/nesppu-tab.h respectively.
+
+   The Xcode target builds this and runs it on every table, failing the build
+   if any of the checked in headers doesn't match what it writes.
+
+   Build with something like:
+   cc -DIN_CRABEMU -I. -Isound -Isound/nes_apu -Iconsoles/nes \
+      -Iconsoles/sms -Icpu/CrabZ80 -Icpu/Crab6502 tools/gentables.c -lm */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ym2413.h"
+#include "nes_apu.h"
+
+/* From ym2413.c */
+#define ENV_BITS        10
+#define ENV_LEN         (1 << ENV_BITS)
+#define ENV_STEP        (128.0 / ENV_LEN)
+
+static void header(FILE *fp, const char *table) {
+    fprintf(fp, "/* Generated by tools/gentables.c (gentables %s). Don't edit "
+            "this, change\n   the generator and run it again. */\n\n", table);
+}
+
+/* Print count values, per_line to a line, indented by indent spaces. If
+   digits isn't 0, they're printed in hex with that many digits, which is
+   easier to read for the bit spreading tables. */
+static void values(FILE *fp, const long *v, int count, int per_line,
+                   int indent, int digits) {
+    int i;
+
+    for(i = 0; i < count; ++i) {
+        if(!(i % per_line))
+            fprintf(fp, "%*s", indent - 1, "");
+
+        if(digits)
+            fprintf(fp, " 0x%0*lX,", digits, v[i]);
+        else
+            fprintf(fp, " %ld,", v[i]);
+
+        if(i % per_line == per_line - 1 || i == count - 1)
+            fprintf(fp, "\n");
+    }
+}
+
+/* ym2413.c's device_start(), less the parts that depend on the clock. */
+static void gen_ym2413(FILE *fp) {
+    long tl_tab[TL_TAB_LEN], sin_tab[SIN_LEN * 2];
+    double m, o;
+    int x, i, n;
+
+    for(x = 0; x < TL_RES_LEN; ++x) {
+        m = (1 << 16) / pow(2, (x + 1) * (ENV_STEP / 4.0) / 8.0);
+        m = floor(m);
+
+        n = (int)m;
+        n >>= 4;
+        if(n & 1)
+            n = (n >> 1) + 1;
+        else
+            n = n >> 1;
+
+        tl_tab[x * 2 + 0] = n;
+        tl_tab[x * 2 + 1] = -tl_tab[x * 2 + 0];
+
+        for(i = 1; i < 11; ++i) {
+            tl_tab[x * 2 + 0 + i * 2 * TL_RES_LEN] = tl_tab[x * 2 + 0] >> i;
+            tl_tab[x * 2 + 1 + i * 2 * TL_RES_LEN] =
+                -tl_tab[x * 2 + 0 + i * 2 * TL_RES_LEN];
+        }
+    }
+
+    for(i = 0; i < SIN_LEN; ++i) {
+        m = sin(((i * 2) + 1) * M_PI / SIN_LEN);
+        o = 8 * log(1.0 / fabs(m)) / log(2.0);
+        o = o / (ENV_STEP / 4);
+
+        n = (int)(2.0 * o);
+        if(n & 1)
+            n = (n >> 1) + 1;
+        else
+            n = n >> 1;
+
+        sin_tab[i] = n * 2 + (m >= 0.0 ? 0 : 1);
+
+        if(i & (1 << (SIN_BITS - 1)))
+            sin_tab[SIN_LEN + i] = TL_TAB_LEN;
+        else
+            sin_tab[SIN_LEN + i] = sin_tab[i];
+    }
+
+    header(fp, "ym2413");
+    fprintf(fp, "static const int tl_tab[TL_TAB_LEN] = {\n");
+    values(fp, tl_tab, TL_TAB_LEN, 10, 4, 0);
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "/* sin waveform table in 'decibel' scale */\n"
+            "/* two waveforms on OPLL type chips */\n");
+    fprintf(fp, "static const unsigned int sin_tab[SIN_LEN * 2] = {\n");
+    values(fp, sin_tab, SIN_LEN * 2, 10, 4, 0);
+    fprintf(fp, "};\n");
+}
+
+/* apu_build_kernel() and the long noise part of apu_build_luts() from
+   nes_apu.c. The noise shift register runs all the way around, so it's back
+   where it started afterwards, just as it was when the core did this. */
+static void gen_nes_apu(FILE *fp) {
+    long kernel[APU_STEP_TAPS], noise[APU_NOISE_32K];
+    double x, w, h[APU_STEP_TAPS], total;
+    int p, i, sum, sreg = 0x4000, bit0, bit1;
+
+    header(fp, "nes_apu");
+    fprintf(fp, "/* band-limited impulses, one per sub-sample phase, summing "
+            "to 1 << 15 */\n");
+    fprintf(fp, "static const int16 step_kernel[APU_STEP_PHASES]"
+            "[APU_STEP_TAPS] = {\n");
+
+    for(p = 0; p < APU_STEP_PHASES; ++p) {
+        total = 0.0;
+
+        for(i = 0; i < APU_STEP_TAPS; ++i) {
+            x = i - APU_STEP_TAPS / 2 - (p + 0.5) / APU_STEP_PHASES;
+            w = 0.42 + 0.5 * cos(M_PI * x / (APU_STEP_TAPS / 2)) +
+                0.08 * cos(2.0 * M_PI * x / (APU_STEP_TAPS / 2));
+            h[i] = (x == 0.0) ? 0.9 : sin(M_PI * 0.9 * x) / (M_PI * x);
+            h[i] *= w;
+            total += h[i];
+        }
+
+        sum = 0;
+        for(i = 0; i < APU_STEP_TAPS; ++i) {
+            kernel[i] = (int16) floor(h[i] * 32768.0 / total + 0.5);
+            sum += kernel[i];
+        }
+
+        kernel[APU_STEP_TAPS / 2] += 32768 - sum;
+
+        fprintf(fp, "    {\n");
+        values(fp, kernel, APU_STEP_TAPS, 8, 8, 0);
+        fprintf(fp, "    },\n");
+    }
+
+    fprintf(fp, "};\n\n");
+
+    for(i = 0; i < APU_NOISE_32K; ++i) {
+        bit0 = sreg & 1;
+        bit1 = (sreg & 2) >> 1;
+        sreg >>= 1;
+        sreg |= (bit0 ^ bit1) << 14;
+        noise[i] = bit0 ^ 1;
+    }
+
+    if(sreg != 0x4000) {
+        fprintf(stderr, "gentables: noise shift register didn't wrap\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(fp, "#ifndef REALTIME_NOISE\n");
+    fprintf(fp, "static const int8 noise_long_lut[APU_NOISE_32K] = {\n");
+    values(fp, noise, APU_NOISE_32K, 24, 4, 0);
+    fprintf(fp, "};\n#endif /* !REALTIME_NOISE */\n");
+}
+
+/* Spread the 8 bits of each byte out to every shift bits, so four bitplanes
+   can be OR'd together into one value per pixel. */
+static void gen_spread(FILE *fp, const char *table, const char *type,
+                       const char *name, int shift) {
+    int digits = shift * 2;
+    long lut[256];
+    int i, b;
+
+    for(i = 0; i < 256; ++i) {
+        lut[i] = 0;
+
+        for(b = 0; b < 8; ++b) {
+            if(i & (1 << b))
+                lut[i] |= 1L << (b * shift);
+        }
+    }
+
+    header(fp, table);
+    fprintf(fp, "static const %s %s[256] = {\n", type, name);
+    values(fp, lut, 256, 48 / (digits + 4), 4, digits);
+    fprintf(fp, "};\n");
+}
+
+int main(int argc, char *argv[]) {
+    char tmp[4096];
+    FILE *fp;
+
+    if(argc != 3) {
+        fprintf(stderr, "Usage: %s ym2413|nes_apu|smsvdp|nesppu output\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", argv[2]);
+
+    if(!(fp = fopen(tmp, "w"))) {
+        perror(tmp);
+        return EXIT_FAILURE;
+    }
+
+    if(!strcmp(argv[1], "ym2413")) {
+        gen_ym2413(fp);
+    }
+    else if(!strcmp(argv[1], "nes_apu")) {
+        gen_nes_apu(fp);
+    }
+    else if(!strcmp(argv[1], "smsvdp")) {
+        /* Four planes, so each pixel is a nibble. */
+        gen_spread(fp, "smsvdp", "uint32", "lut", 4);
+    }
+    else if(!strcmp(argv[1], "nesppu")) {
+        /* Two planes, so each pixel gets two bits. */
+        gen_spread(fp, "nesppu", "uint16", "ppu_lut", 2);
+    }
+    else {
+        fprintf(stderr, "gentables: unknown table %s\n", argv[1]);
+        fclose(fp);
+        remove(tmp);
+        return EXIT_FAILURE;
+    }
+
+    if(ferror(fp) | fclose(fp) || rename(tmp, argv[2])) {
+        perror(argv[2]);
+        remove(tmp);
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
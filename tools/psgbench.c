@@ -0,0 +1,130 @@
+/*
+    This file is part of CrabEmu.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    CrabEmu is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    CrabEmu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CrabEmu; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Times sn76489_execute_samples() with the band-limited edge engine against
+   the original float one, for a silent PSG, one low tone, one high tone and
+   everything playing at once.
+
+   Build with something like:
+   cc -O2 -DIN_CRABEMU -I. -Isound tools/psgbench.c sound/sn76489.c */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "CrabEmu.h"
+#include "sn76489.h"
+#include "sound.h"
+
+#define CLOCK       3579545.0f
+#define RATE        ((float)SOUND_CORE_RATE)
+#define FRAME       735
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void set_tone(sn76489_t *psg, int ch, float freq, int vol) {
+    int n = (int)(CLOCK / 32.0f / freq);
+
+    sn76489_write(psg, 0x80 | (ch << 5) | (n & 0x0F));
+    sn76489_write(psg, (n >> 4) & 0x3F);
+    sn76489_write(psg, 0x90 | (ch << 5) | vol);
+}
+
+/* Set up the PSG for one of the cases below. */
+static void setup(sn76489_t *psg, int which, int band_limited) {
+    int i;
+
+    sn76489_init(psg, CLOCK, RATE, SN76489_NOISE_BITS_SMS,
+                 SN76489_NOISE_TAPPED_SMS);
+    sn76489_set_band_limited(psg, band_limited);
+
+    /* Everything off, then turn on what the case wants. */
+    for(i = 0; i < 4; ++i) {
+        sn76489_write(psg, 0x90 | (i << 5) | 0x0F);
+    }
+
+    switch(which) {
+        case 1:
+            set_tone(psg, 0, 110.0f, 2);
+            break;
+
+        case 2:
+            set_tone(psg, 0, 8000.0f, 2);
+            break;
+
+        case 3:
+            set_tone(psg, 0, 110.0f, 2);
+            set_tone(psg, 1, 440.0f, 2);
+            set_tone(psg, 2, 8000.0f, 2);
+            sn76489_write(psg, 0xE4);
+            sn76489_write(psg, 0xF2);
+            break;
+    }
+}
+
+/* Nanoseconds per sample, over whole frames for long enough to mean
+   something. */
+static double time_it(int which, int band_limited) {
+    static sn76489_t psg;
+    int16 buf[FRAME << 1];
+    uint32 n = 0;
+    double s, e;
+
+    setup(&psg, which, band_limited);
+
+    /* Let the first frame settle anything that only happens once. */
+    sn76489_execute_samples(&psg, buf, FRAME);
+
+    s = now();
+
+    do {
+        sn76489_execute_samples(&psg, buf, FRAME);
+        ++n;
+        e = now();
+    } while(e - s < 0.5);
+
+    return (e - s) * 1e9 / ((double)n * FRAME);
+}
+
+int main(void) {
+    static const char *names[4] = {
+        "silent", "110Hz tone", "8kHz tone", "3 tones + noise"
+    };
+    double f, bl;
+    int i;
+
+    printf("%-16s %10s %10s %8s\n", "case", "float", "band-lim",
+           "speedup");
+
+    for(i = 0; i < 4; ++i) {
+        f = time_it(i, 0);
+        bl = time_it(i, 1);
+
+        printf("%-16s %8.1fns %8.1fns %7.1fx\n", names[i], f, bl, f / bl);
+    }
+
+    printf("(per stereo sample at %dHz, %d sample frames)\n", SOUND_CORE_RATE,
+           FRAME);
+
+    return 0;
+}